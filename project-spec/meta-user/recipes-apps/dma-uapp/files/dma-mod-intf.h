@@ -12,7 +12,9 @@
 #ifndef DMA_MOD_INTF__H
 #define DMA_MOD_INTF__H
 
-// DMA channels
+// DMA channels of the default DMA-PROXY instance
+// (the driver takes the channels from "dma-names" DT property of each
+// DMA-PROXY node, the character device of the channel is /dev/<dma-name>)
 typedef enum _DM_CH_e {
 	_DM_CH_AXI_DMA_0,
 	_DM_CH_AXI_DMA_SC
@@ -23,32 +25,424 @@ typedef enum _DM_CH_e {
 #define _DM_CHN_AXI_DMA_0	"axi_dma_0"		// For _DM_CH_AXI_DMA_0 channel
 #define	_DM_CHN_AXI_DMA_SC	"axi_dma_sc36"	// For _DM_CH_AXI_DMA_SC channel
 
-// Size of one DMA transaction (for each DMA channel) (b)
+// Size of one stream frame (for each DMA channel) (b)
+// By default one DMA transaction receives one frame (see _DM_IOCTL_GEOM)
 #define _DM_AXI_DMA_0_TRSZ	(48*48*128)
 #define _DM_AXI_DMA_SC_TRSZ	(48*48*4)
 
+// Maximum number of frames per DMA transaction
+#define _DM_FRAMES_MAX		64
+
+// Default number of buffers in the buffer queue of DMA channel
+// (can be set for each channel by "por,buf-counts" DT property)
+#define _DM_BUF_NUM			4
+
+// Maximum number of buffers in the buffer queue of DMA channel
+#define _DM_BUF_MAX			16
+
+// Maximum number of frame slots in the capture ring of DMA channel
+// (the ring channel has "por,ring-sizes" DT property: its buffer queue is
+// the ring sliced into buffers - slots, _DM_CH_INFO_t buf_num slots)
+#define _DM_RING_SLOTS_MAX	1024
+
+// Maximum number of DMA transactions per interrupt (interrupt coalescing)
+#define _DM_COAL_MAX		32
+
+// Maximum number of buffers queued/dequeued by one batch request
+#define _DM_BATCH_MAX		64
+
+// Memory page size for buffer alignment in the mapped area (b)
+#define _DM_PAGE_SZ			4096
+
+// Distance between two neighbour buffers in the mapped area (b)
+// (DMA transaction size rounded up to the memory page size)
+#define _DM_BUF_STRIDE(trsz)	(((trsz) + _DM_PAGE_SZ - 1) & ~(_DM_PAGE_SZ - 1))
+
+// Offset of the buffer in the mapped area (b) (mmap() offset argument)
+#define _DM_BUF_OFFS(trsz,buf_idx)	((buf_idx) * _DM_BUF_STRIDE(trsz))
+
+// Metadata area: memory pages next to the buffers in the mapped area
+// (mmap() offset - _DM_CH_INFO_t meta_offs, length - _DM_CH_INFO_t meta_sz,
+// read only). It holds _DM_META_t structure of each buffer (indexed by
+// buffer index). The area of the channel without the ring is one page.
+
+// DMA channel transfer directions
+// The transmit channel streams the written data (write() or queued buffers)
+// into the PL. The written data is collected into buffers, the full buffer
+// is queued, fsync() queues the partial buffer and waits until all data is
+// transmitted. The transmit channel can not be read.
+typedef enum _DM_DIR_e {
+	_DM_DIR_RX,					// Receive: stream to memory (S2MM)
+	_DM_DIR_TX					// Transmit: memory to stream (MM2S)
+} _DM_DIR_t;
+
+// DMA channel buffer memory modes
+typedef enum _DM_MEM_MODE_e {
+	_DM_MEM_COHERENT,			// Coherent (uncached) memory, no sync is needed
+	_DM_MEM_CACHED				// Cacheable memory: user access to the dequeued buffer
+								// must be bracketed by "begin/end CPU access" requests
+} _DM_MEM_MODE_t;
+
 // DMA transaction result codes
 typedef enum _DM_TRAN_RES_CODE_e {
 	_DM_TRAN_RES_SUCCESS,		// Transaction was executed successfully
-	_DM_TRAN_RES_TIMEOUT,		// Error: timeout
-	_DM_TRAN_RES_ERROR			// Other error
+	_DM_TRAN_RES_TIMEOUT,		// Error: timeout (no data within the channel timeout)
+	_DM_TRAN_RES_ERROR,			// Other error
+	_DM_TRAN_RES_ABORTED		// The transaction was aborted by user request
 } _DM_TRAN_RES_CODE_t;
 
+// The number of bytes received by the transaction is (trsz - residue).
+// After timeout or abort the residue allows to keep the partial data
+// (the granularity of the residue depends on DMA engine driver: it can be
+// one frame or the whole transaction)
+
 // DMA transaction result structure (for user space application)
 typedef struct _DM_TRAN_RESULT_s {
 	uint32_t res_code;				// DMA transaction result code
+	uint32_t residue;				// Number of bytes not transferred (b)
 } _DM_TRAN_RESULT_t;
 
+// DMA channel queue buffer structure (for user space application)
+typedef struct _DM_BUF_s {
+	uint32_t buf_idx;				// Buffer index (0..buf_num-1)
+	uint32_t res_code;				// DMA transaction result code (dequeue only)
+	uint32_t residue;				// Number of bytes not transferred (dequeue only)
+	uint32_t len;					// Queue: number of bytes to transmit (transmit
+									// channel only, 0 - whole buffer);
+									// dequeue: number of bytes transferred
+} _DM_BUF_t;
+
+// Buffer metadata structure (in the metadata area, for user space application)
+// Set when DMA transaction into the buffer is finished, valid after dequeue
+typedef struct _DM_META_s {
+	uint64_t ts_ns;					// Completion time (CLOCK_MONOTONIC, ns)
+	uint32_t seq;					// Completion sequence number of the channel
+									// (gap - the transactions were not delivered)
+	uint32_t res_code;				// DMA transaction result code
+	uint32_t residue;				// Number of bytes not transferred (b)
+	uint32_t batch;					// Number of the completion event (interrupt or
+									// poll) which finished the transaction (the
+									// same number - finished in one batch)
+	uint32_t flags;					// Overrun flags (_DM_META_FLAG_t)
+	uint32_t lost;					// Number of transactions dropped by the driver
+									// right before this one (_DM_META_OVERRUN)
+} _DM_META_t;
+
+// Buffer metadata overrun flags
+// The frames lost before the buffer are marked in its metadata: the buffers
+// dropped by the overrun policy (their number is known) or a stall of the
+// stream (DMA had no buffers, the PL lost an unknown number of frames)
+typedef enum _DM_META_FLAG_e {
+	_DM_META_OVERRUN = 0x01,	// The driver dropped "lost" finished buffers
+								// before this one (drop policies)
+	_DM_META_STALL = 0x02		// DMA had no buffers before this transaction
+								// (the PL stream overran)
+} _DM_META_FLAG_t;
+
+// DMA channel information structure (for user space application)
+typedef struct _DM_CH_INFO_s {
+	uint32_t trsz;					// Size of one DMA transaction (b)
+	uint32_t frame_sz;				// Size of one stream frame (b)
+	uint32_t frames;				// Number of frames per DMA transaction
+	uint32_t buf_num;				// Number of buffers in the buffer queue
+	uint32_t dir;					// Transfer direction (_DM_DIR_t)
+	uint32_t buf_stride;			// Distance between buffers in the mapped area (b)
+	uint32_t area_sz;				// Size of the area with all buffers (b)
+									// (mmap() length argument)
+	uint32_t mem_mode;				// Buffer memory mode (_DM_MEM_MODE_t)
+	uint32_t timeout_ms;			// DMA transaction timeout (ms) (0 - no timeout)
+	uint32_t meta_offs;				// Offset of the metadata area (b) (= area_sz)
+	uint32_t meta_sz;				// Size of the metadata area (b)
+	uint32_t ring_sz;				// Size of the capture ring (b) (0 - no ring)
+	uint32_t inflight;				// Maximum number of submitted DMA transactions
+	uint32_t coal_cnt;				// Number of DMA transactions per interrupt
+	uint32_t coal_us;				// Poll period of coalesced transactions (us)
+	uint32_t ovr_policy;			// Overrun policy (_DM_OVR_POLICY_t)
+	int32_t rt_cpu;					// CPU of the real-time completion worker
+									// (-1 - the system workqueue is used)
+	uint32_t rt_prio;				// SCHED_FIFO priority of the worker (0 - off)
+} _DM_CH_INFO_t;
+
+// User buffer DMA transaction structure (for user space application)
+// The data is received directly into the user memory (zero-copy). The buffer
+// address and size must be multiples of the cache line size (page aligned
+// buffers are recommended): the request fails with EINVAL otherwise.
+typedef struct _DM_USR_TRAN_s {
+	uint64_t uaddr;					// User buffer virtual address
+	uint32_t len;					// User buffer size (b) (= DMA transaction size)
+	uint32_t res_code;				// DMA transaction result code (output)
+	uint32_t residue;				// Number of bytes not transferred (output)
+	uint32_t seq;					// Completion sequence number (output)
+	uint64_t ts_ns;					// Completion time (CLOCK_MONOTONIC, ns) (output)
+} _DM_USR_TRAN_t;
+
+// Exported buffer structure (for user space application)
+// The buffer is exported as dma-buf file descriptor: other processes (the
+// descriptor is passed through UNIX socket) and drivers import the buffer
+// without copying. The memory can not be reallocated while it is exported.
+typedef struct _DM_EXPBUF_s {
+	uint32_t buf_idx;				// Buffer index (0..buf_num-1)
+	uint32_t flags;					// Descriptor flags: O_RDONLY/O_RDWR, O_CLOEXEC
+	int32_t fd;						// dma-buf file descriptor (output)
+} _DM_EXPBUF_t;
+
+// Reader information structure (for user space application)
+// Any number of files can be opened for the channel. Each file reads the data
+// stream (read, splice in cached memory mode) from its own position. The slow
+// reader does not stop DMA: the frames it has not read yet are reused for new
+// transfers and are counted as lost. The buffer queue ioctl requests are
+// available for one file only, while no file reads the data stream.
+typedef struct _DM_RD_INFO_s {
+	uint64_t frames;				// Number of frames read by the file
+	uint64_t lost;					// Number of frames lost by the file
+	uint32_t lag;					// Number of received frames not read yet
+	uint32_t readers;				// Number of files reading the channel
+} _DM_RD_INFO_t;
+
+// Interrupt coalescing parameters structure (for user space application)
+// The queued buffers are submitted in batches: only the last DMA transaction
+// of the batch interrupts, the batch is finished by one callback. The
+// finished transactions are also polled (the stream can stop in the middle of
+// the batch). Each transaction keeps its own result code and residue.
+typedef struct _DM_COAL_s {
+	uint32_t count;					// Number of DMA transactions per interrupt
+									// (1 - no coalescing; limited to the half of
+									// inflight transactions and _DM_COAL_MAX)
+	uint32_t timeout_us;			// Poll period of coalesced transactions (us)
+									// (0 - no poll)
+} _DM_COAL_t;
+
+// In-kernel recorder commands
+typedef enum _DM_REC_CMD_e {
+	_DM_REC_START,				// Start recording into the file descriptor
+	_DM_REC_STOP,				// Stop recording (the counters are returned)
+	_DM_REC_STAT				// Get the counters, recording goes on
+} _DM_REC_CMD_t;
+
+// In-kernel recorder structure (for user space application)
+// The kernel thread of the channel writes each received buffer into the file
+// (regular file, block device, pipe) and queues the buffer again: no data
+// passes through user space. The file is written from its current offset,
+// the offset is advanced past the recorded data when recording stops,
+// O_DIRECT files are not supported. While recording is on, the buffer queue
+// requests are not available. A write error stops the recorder thread.
+typedef struct _DM_REC_s {
+	uint32_t cmd;					// Recorder command (_DM_REC_CMD_t)
+	int32_t fd;						// File descriptor to write to (start only)
+	uint64_t bytes;					// Number of bytes written (output)
+	uint64_t frames;				// Number of buffers written (output)
+	uint64_t errors;				// Number of failed DMA transactions (output)
+	int32_t wr_err;					// Write error code (0 - no errors) (output)
+	uint32_t running;				// Flag: the recorder thread writes (1) (output)
+	uint64_t lost;					// Number of buffers dropped by the overrun
+									// policy before written ones (output)
+	uint64_t stalls;				// Number of stream stalls before written
+									// buffers (output)
+} _DM_REC_t;
+
+// Overrun policies of the receive channel
+// When user space does not queue the buffers fast enough, DMA runs out of
+// buffers and the PL loses the stream frames. The policy selects which data
+// is lost: the PL stream (block) or the finished buffers not dequeued yet
+// (drop). The drop policies reuse the finished buffers for DMA while there
+// are less than two DMA transactions submitted, one finished buffer is
+// always kept for user. The lost data is marked in the metadata of the next
+// dequeued buffer (_DM_META_FLAG_t). Not used by readers (read/splice) - the
+// fan-out ring has its own reuse rule.
+typedef enum _DM_OVR_POLICY_e {
+	_DM_OVR_BLOCK,				// Wait for user buffers, the stream stalls (default)
+	_DM_OVR_DROP_OLDEST,		// Reuse the oldest finished buffer (keep newest data)
+	_DM_OVR_DROP_NEWEST			// Reuse the newest finished buffer (keep oldest data)
+} _DM_OVR_POLICY_t;
+
+// Overrun policy structure (for user space application)
+typedef struct _DM_OVR_s {
+	uint32_t policy;				// Overrun policy (_DM_OVR_POLICY_t) (set: input)
+	uint32_t set;					// Flag: set the policy (1), get only (0)
+	uint64_t drops;					// Number of buffers dropped (output)
+	uint64_t stalls;				// Number of stream stalls (output)
+} _DM_OVR_t;
+
+// Batch request entry: one buffer (for user space application)
+typedef struct _DM_BATCH_ENT_s {
+	uint32_t buf_idx;				// Buffer index (queue: input, dequeue: output)
+	uint32_t res_code;				// DMA transaction result code (dequeue only)
+	uint32_t len;					// Queue: number of bytes to transmit (transmit
+									// channel only, 0 - whole buffer);
+									// dequeue: number of bytes transferred
+	uint32_t seq;					// Completion sequence number (dequeue only)
+	uint64_t ts_ns;					// Completion time (CLOCK_MONOTONIC, ns)
+									// (dequeue only)
+} _DM_BATCH_ENT_t;
+
+// Batch request structure (for user space application)
+// One request queues the buffers ent[0..qcount-1] (the buffers processed by
+// the previous request), then dequeues up to "count" finished buffers into
+// ent[0..done-1] (the oldest first). It waits for "wait" buffers as dequeue
+// request does (0 - does not wait), the buffers finished by then are taken
+// without waiting. The dequeued buffers are synchronized for CPU access
+// (no _DM_IOCTL_CPU_BEG is needed). The results are copied to user at once:
+// the header and "done" entries.
+typedef struct _DM_BATCH_s {
+	uint32_t qcount;				// Number of buffers to queue (0.._DM_BATCH_MAX)
+	uint32_t queued;				// Number of buffers queued (output)
+	uint32_t count;					// Maximum number of buffers to dequeue
+									// (0.._DM_BATCH_MAX)
+	uint32_t wait;					// Number of buffers to wait for (0..count)
+	uint32_t done;					// Number of buffers dequeued (output)
+	uint32_t reserved;				// Reserved (alignment)
+	_DM_BATCH_ENT_t ent[_DM_BATCH_MAX];	// Buffers to queue/dequeued buffers
+} _DM_BATCH_t;
+
+// DMA channel transfer geometry structure (for user space application)
+typedef struct _DM_CH_GEOM_s {
+	uint32_t frames;				// Number of frames per DMA transaction (1.._DM_FRAMES_MAX)
+	uint32_t frame_sz;				// Size of one stream frame (b) (output)
+	uint32_t trsz;					// Size of one DMA transaction (b) (output)
+} _DM_CH_GEOM_t;
+
 // Ioctl call type (8-bit)
 #define _DM_IOC_MAGIC    	'i'
 
 // Ioctl function code (nr - sequence number) (8-bit)
 #define _DM_IOC_NR_TRAN_RC	1	// Execute DMA data receive transation
+#define _DM_IOC_NR_QBUF		2	// Queue the buffer for DMA data receiving
+#define _DM_IOC_NR_DQBUF	3	// Dequeue the buffer with received data
+#define _DM_IOC_NR_STRM_ON	4	// Start streaming on the buffer queue
+#define _DM_IOC_NR_STRM_OFF	5	// Stop streaming, return all buffers to user
+#define _DM_IOC_NR_TRAN_ST	6	// Start DMA data receive transaction
+#define _DM_IOC_NR_TRAN_RES	7	// Collect the result of started transaction
+#define _DM_IOC_NR_INFO		8	// Get DMA channel information
+#define _DM_IOC_NR_MEM_MODE	9	// Set buffer memory mode
+#define _DM_IOC_NR_CPU_BEG	10	// Begin CPU access to the buffer
+#define _DM_IOC_NR_CPU_END	11	// End CPU access to the buffer
+#define _DM_IOC_NR_TRAN_USR	12	// Execute DMA data receive into user buffer
+#define _DM_IOC_NR_GEOM		13	// Set DMA channel transfer geometry
+#define _DM_IOC_NR_TIMEOUT	14	// Set DMA transaction timeout
+#define _DM_IOC_NR_ABORT	15	// Abort all DMA transactions on the channel
+#define _DM_IOC_NR_EXPBUF	16	// Export the buffer as dma-buf
+#define _DM_IOC_NR_RD_INFO	17	// Get reader information
+#define _DM_IOC_NR_COAL		18	// Set interrupt coalescing parameters
+#define _DM_IOC_NR_REC		19	// In-kernel recorder control
+#define _DM_IOC_NR_BATCH	20	// Queue and dequeue the buffers in one call
+#define _DM_IOC_NR_OVR		21	// Set/get overrun policy and counters
 
 // Ioctl "execute DMA data receive transaction" code (32-bit)
 #define _DM_IOCTL_TRAN_RC	_IOR(_DM_IOC_MAGIC, \
 									_DM_IOC_NR_TRAN_RC, \
 									_DM_TRAN_RESULT_t)
 
+// Ioctl "queue the buffer" code (32-bit)
+#define _DM_IOCTL_QBUF		_IOW(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_QBUF, \
+									_DM_BUF_t)
+
+// Ioctl "dequeue the buffer" code (32-bit) (the call can block)
+#define _DM_IOCTL_DQBUF		_IOR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_DQBUF, \
+									_DM_BUF_t)
+
+// Ioctl "start streaming" code (32-bit)
+#define _DM_IOCTL_STRM_ON	_IO(_DM_IOC_MAGIC, _DM_IOC_NR_STRM_ON)
+
+// Ioctl "stop streaming" code (32-bit)
+#define _DM_IOCTL_STRM_OFF	_IO(_DM_IOC_MAGIC, _DM_IOC_NR_STRM_OFF)
+
+// Ioctl "start DMA data receive transaction" code (32-bit) (does not block)
+#define _DM_IOCTL_TRAN_ST	_IO(_DM_IOC_MAGIC, _DM_IOC_NR_TRAN_ST)
+
+// Ioctl "collect the result of started transaction" code (32-bit)
+// (blocks until the transaction is finished, unless O_NONBLOCK is set)
+#define _DM_IOCTL_TRAN_RES	_IOR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_TRAN_RES, \
+									_DM_TRAN_RESULT_t)
+
+// Ioctl "get DMA channel information" code (32-bit)
+#define _DM_IOCTL_INFO		_IOR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_INFO, \
+									_DM_CH_INFO_t)
+
+// Ioctl "set buffer memory mode" code (32-bit)
+// (streaming must be off, the buffers must not be mapped;
+// the ring channel supports coherent memory mode only)
+#define _DM_IOCTL_MEM_MODE	_IOW(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_MEM_MODE, \
+									uint32_t)
+
+// Ioctl "begin CPU access to the dequeued buffer" code (32-bit)
+#define _DM_IOCTL_CPU_BEG	_IOW(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_CPU_BEG, \
+									_DM_BUF_t)
+
+// Ioctl "end CPU access to the buffer" code (32-bit)
+#define _DM_IOCTL_CPU_END	_IOW(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_CPU_END, \
+									_DM_BUF_t)
+
+// Ioctl "execute DMA data receive transaction into user buffer" code (32-bit)
+// (the call blocks, streaming must be off)
+#define _DM_IOCTL_TRAN_USR	_IOWR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_TRAN_USR, \
+									_DM_USR_TRAN_t)
+
+// Ioctl "set transfer geometry" code (32-bit)
+// (the buffers are resized: streaming must be off, the buffers must not be mapped;
+// the ring of the ring channel is sliced again: buf_num is changed)
+#define _DM_IOCTL_GEOM		_IOWR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_GEOM, \
+									_DM_CH_GEOM_t)
+
+// Ioctl "set DMA transaction timeout" code (32-bit)
+// (ms, 0 - no timeout. A blocking request which waits longer than the
+// timeout stops the transfers, they are finished with timeout result code)
+#define _DM_IOCTL_TIMEOUT	_IOW(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_TIMEOUT, \
+									uint32_t)
+
+// Ioctl "abort all DMA transactions" code (32-bit)
+// (can be called from any thread: the active transfers are finished with
+// "aborted" result code, blocked requests of the channel return)
+#define _DM_IOCTL_ABORT		_IO(_DM_IOC_MAGIC, _DM_IOC_NR_ABORT)
+
+// Ioctl "export the buffer as dma-buf" code (32-bit)
+// (only the buffer owned by user is exported, EBUSY otherwise; the data of
+// the buffer is valid while it is owned by user: the importer must finish
+// the access before the buffer is queued again, DMA overwrites the data)
+#define _DM_IOCTL_EXPBUF	_IOWR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_EXPBUF, \
+									_DM_EXPBUF_t)
+
+// Ioctl "get reader information" code (32-bit)
+#define _DM_IOCTL_RD_INFO	_IOR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_RD_INFO, \
+									_DM_RD_INFO_t)
+
+// Ioctl "set interrupt coalescing parameters" code (32-bit)
+// (the limited number of transactions per interrupt is copied to user;
+// the parameters are used by the next submitted batch)
+#define _DM_IOCTL_COAL		_IOWR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_COAL, \
+									_DM_COAL_t)
+
+// Ioctl "in-kernel recorder control" code (32-bit)
+#define _DM_IOCTL_REC		_IOWR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_REC, \
+									_DM_REC_t)
+
+// Ioctl "queue and dequeue the buffers" code (32-bit)
+// (streaming must be on to dequeue; the request can block like dequeue
+// request. If it fails after some buffers were dequeued, success is
+// returned with the dequeued buffers)
+#define _DM_IOCTL_BATCH		_IOWR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_BATCH, \
+									_DM_BATCH_t)
+
+// Ioctl "set/get overrun policy" code (32-bit)
+// (the policy can be changed while streaming, the counters are copied
+// to user; the counters are reset by debugfs "reset" file)
+#define _DM_IOCTL_OVR		_IOWR(_DM_IOC_MAGIC, \
+									_DM_IOC_NR_OVR, \
+									_DM_OVR_t)
+
 #endif /* DMA_MOD_INTF__H */
 
@@ -0,0 +1,123 @@
+/*================================ ZYNQBOARD ==================================
+*	PROJECT:	ZYNQ3 v1:	 "ZynqBoard software (Xilinx Zynq-7000, Linux) "
+*	FILE:		dma-rec-fmt.h
+*	CONTENTS:	Header file. Container format of the recorded DMA channel
+*				data (dma-uapp -f): file header, frame headers, index
+*	VERSION:	01.01  16.10.2026
+*	AUTHOR:		Andrey Poroshin
+*	UPDATES :
+*	1) 01.01   16 October 2026 - Initial version
+ ============================================================================== */
+
+#ifndef DMA_REC_FMT__H
+#define DMA_REC_FMT__H
+
+// Container file layout (one file per channel or per segment, little-endian,
+// all offsets from the file start):
+//
+//	_DR_FILE_HDR_t					File header: geometry, configuration
+//	_DR_FRAME_HDR_t + data			Record 0 (one DMA transaction)
+//	_DR_FRAME_HDR_t + data			Record 1
+//	...
+//	_DR_FRAME_HDR_t (_DR_INDEX_MAGIC)	Index header: data_len = 8 * records
+//	uint64_t offs[records]			Offset of each record (its frame header)
+//	_DR_TRAILER_t					Trailer: the last bytes of the file
+//
+// Seek to record N: read the trailer at (file size - sizeof(_DR_TRAILER_t)),
+// read offs[N] at (index_offs + sizeof(_DR_FRAME_HDR_t) + 8 * N).
+// Partial file (the recording was not closed: no trailer): the records are
+// scanned from hdr_sz, each frame header is followed by data_len bytes. The
+// scan stops at the first header with wrong magic (the preallocated space is
+// zeroed), with data_len > trsz or not complete in the file.
+
+// Magic numbers ("DREC", "DFRM", "DIDX", "DTRL" in the file)
+#define _DR_FILE_MAGIC		0x43455244
+#define _DR_FRAME_MAGIC		0x4D524644
+#define _DR_INDEX_MAGIC		0x58444944
+#define _DR_TRAIL_MAGIC		0x4C525444
+
+// Format version (the sizes in the headers allow to add fields at the end)
+#define _DR_VERSION			1
+
+// Frame geometry: pixels of the focal surface (x, y)
+#define _DR_PIX_X			48
+#define _DR_PIX_Y			48
+
+// Number of GTUs integrated into one frame of the integrated channel
+#define _DR_GTU_INTEG_NUM	128
+
+// GTU modes of the channel data
+typedef enum _DR_GTU_MODE_e {
+	_DR_GTU_RAW,				// 8-bit counts, one 48x48 layer per GTU
+								// (gtus layers per frame)
+	_DR_GTU_INTEG				// 32-bit counts integrated over gtu_integ GTUs
+								// (one 48x48 layer per frame)
+} _DR_GTU_MODE_t;
+
+// File header (at the file start)
+typedef struct _DR_FILE_HDR_s {
+	uint32_t magic;					// _DR_FILE_MAGIC
+	uint32_t version;				// _DR_VERSION
+	uint32_t hdr_sz;				// Size of the file header (b) (first record)
+	uint32_t frame_hdr_sz;			// Size of the frame header (b)
+	char ch_name[32];				// DMA channel name
+	uint32_t ch_idx;				// DMA channel index
+	uint32_t dir;					// Transfer direction (_DM_DIR_t)
+	// Geometry
+	uint32_t pix_x;					// Pixels in x (_DR_PIX_X)
+	uint32_t pix_y;					// Pixels in y (_DR_PIX_Y)
+	uint32_t gtus;					// Number of 48x48 layers per stream frame
+	uint32_t pix_bytes;				// Size of one pixel count (b)
+	uint32_t gtu_mode;				// GTU mode (_DR_GTU_MODE_t)
+	uint32_t gtu_integ;				// Number of GTUs integrated into one layer
+	uint32_t frame_sz;				// Size of one stream frame (b)
+	uint32_t frames;				// Number of stream frames per record
+	uint32_t trsz;					// Size of the full record data (b)
+	// Configuration snapshot (driver: _DM_CH_INFO_t, dma-uapp: options)
+	uint32_t buf_num;				// Number of buffers in the buffer queue
+	uint32_t mem_mode;				// Buffer memory mode (_DM_MEM_MODE_t)
+	uint32_t timeout_ms;			// DMA transaction timeout (ms) (0 - no timeout)
+	uint32_t ring_sz;				// Size of the capture ring (b) (0 - no ring)
+	uint32_t inflight;				// Maximum number of submitted DMA transactions
+	uint32_t coal_cnt;				// Number of DMA transactions per interrupt
+	uint32_t coal_us;				// Poll period of coalesced transactions (us)
+	uint32_t ovr_policy;			// Overrun policy (_DM_OVR_POLICY_t)
+	int32_t rt_cpu;					// CPU of the real-time completion worker (-1 - off)
+	uint32_t rt_prio;				// SCHED_FIFO priority of the worker (0 - off)
+	uint32_t wr_slots;				// Number of slots in the writer ring
+	uint32_t direct;				// Flag: written with direct I/O (1)
+	uint32_t seg_idx;				// Segment index (0 - not segmented or the first)
+	uint32_t seg_secs;				// Segment duration (s) (0 - not limited)
+	uint32_t reserved;				// Reserved (0)
+	uint64_t seg_sz;				// Segment size limit (b) (0 - not limited)
+	uint64_t first_frame;			// Number of the first record of the file
+									// (in the recording of the channel)
+	uint64_t t_real_ns;				// File start time (CLOCK_REALTIME, ns)
+	uint64_t t_mono_ns;				// The same time (CLOCK_MONOTONIC, ns): the time
+									// base of the record timestamps
+} _DR_FILE_HDR_t;
+
+// Frame header (before the data of each record; the index header)
+typedef struct _DR_FRAME_HDR_s {
+	uint32_t magic;					// _DR_FRAME_MAGIC (_DR_INDEX_MAGIC - index)
+	uint32_t data_len;				// Number of data bytes after the header (b)
+									// (less than trsz - partial transaction)
+	uint64_t frame_no;				// Record number in the recording of the channel
+									// (index: number of records in the file)
+	uint64_t ts_ns;					// Completion time (CLOCK_MONOTONIC, ns)
+	uint32_t seq;					// Completion sequence number of the channel
+	uint32_t res_code;				// DMA transaction result code
+	uint32_t flags;					// Overrun flags (_DM_META_FLAG_t)
+	uint32_t lost;					// Number of transactions dropped by the driver
+									// right before this one
+} _DR_FRAME_HDR_t;
+
+// Trailer (the last bytes of the closed file)
+typedef struct _DR_TRAILER_s {
+	uint32_t magic;					// _DR_TRAIL_MAGIC
+	uint32_t trl_sz;				// Size of the trailer (b)
+	uint64_t index_offs;			// Offset of the index header (b)
+	uint64_t records;				// Number of records in the file
+} _DR_TRAILER_t;
+
+#endif /* DMA_REC_FMT__H */
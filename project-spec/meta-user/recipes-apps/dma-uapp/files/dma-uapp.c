@@ -14,69 +14,312 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <fcntl.h>
-#include <pthread.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "dma-mod-intf.h"
+#include "dma-rec-fmt.h"
 
 /******************************************************************************
 *	Internal definitions
 *******************************************************************************/
 
+// Default number of frames to receive from each DMA channel
+#define CHRC_FRAMES_NUM		1
+
+// Maximum number of frames per channel in test mode: the frames are printed,
+// the buffers are cleared before receiving (not done by the acquisition)
+#define CHRC_PRINT_MAX		16
+
+// Poll cycle tick (ms): the stop request, the duration and the reports
+// are checked at least once per tick
+#define CHRC_TICK_MS		100
+
+// Default throughput report period (s)
+#define CHRC_REPORT_S		1
+
+// Default number of frame slots in the writer ring of each channel
+#define CHWR_SLOTS			32
+
+// Cache line size: the ring indexes are kept in separate lines
+// (Cortex-A9 has 32-byte lines, 64 covers the hosts too)
+#define CHWR_LINE_SZ		64
+
+// Direct I/O alignment of the buffers, the file offsets and the lengths (b)
+// (the page covers 512-byte and 4 KiB logical blocks)
+#define CHST_BLK_SZ			4096
+
+// Direct I/O batch: the frames are collected and written in batches (b)
+#define CHST_BATCH_SZ		(1024 * 1024)
+
+// Number of direct I/O batches (AIO requests) in flight
+#define CHST_AIO_REQS		4
+
+// The file is preallocated ahead of the direct writes in steps of (b)
+#define CHST_PREALLOC_SZ	(64 * 1024 * 1024)
+
+// Maximum length of the segment file name
+#define CHST_NAME_LEN		256
+
+// Initial number of entries of the container file index (grows by doubling)
+#define CHST_INDEX_NUM		4096
+
+// Frame size in storage benchmark (b) (48x48 pixels, 128 GTUs)
+#define CHSB_FRAME_SZ		(48 * 48 * 128)
+
+// Default duration of each method in storage benchmark (s)
+#define CHSB_SECS			5
+
+// Number of passes over all channel buffers in CPU read bandwidth benchmark
+#define CHBM_PASS_NUM		64
+
+// DMA transaction timeout in recording benchmark (ms) (idle channel is skipped)
+#define CHRB_TIMEOUT_MS		1000
+
+// Number of bins of the wakeup latency histogram (log2 of ns)
+#define CHRB_HIST_BINS		32
+
 /******************************************************************************
 *	Internal structures
 *******************************************************************************/
 
-// DMA channel data receive/store thread parameters
-typedef struct THR_PARAMS_s {
-	pthread_t	id;				// Thread ID
-	uint32_t	created;		// Flag: the thread was created and started (1)
-} THR_PARAMS_t;
+// Direct I/O storage: the file is written with O_DIRECT by page aligned
+// batches, several batches are in flight (Linux AIO), the file is
+// preallocated ahead of the writes (no page cache, no writeback stalls)
+typedef struct CHST_DIO_s {
+	int			fd;				// File descriptor (-1 - not opened)
+	uint32_t	direct;			// Flag: O_DIRECT is used (0 - page cache, tmpfs)
+	aio_context_t ctx;			// AIO context (0 - not created)
+	uint8_t		*mem;			// Batch buffers (CHST_AIO_REQS * CHST_BATCH_SZ)
+	struct iocb	iocb[CHST_AIO_REQS];	// AIO request of each batch buffer
+	uint32_t	busy[CHST_AIO_REQS];	// Flag: the batch is in flight (1)
+	uint32_t	inflight;		// Number of batches in flight
+	uint32_t	cur;			// Index of the batch buffer being filled
+	uint32_t	fill;			// Number of bytes in the batch buffer being filled
+	uint64_t	off;			// File offset of the next batch (b)
+	uint64_t	size;			// Number of data bytes written into the file
+	uint64_t	alloc_end;		// End of the preallocated file space (b)
+	uint32_t	prealloc;		// Flag: the file system supports fallocate (1)
+} CHST_DIO_t;
+
+// Segmented file: the data is stored in numbered segment files
+// (<name>.000000, <name>.000001, ...), the segment is switched by size or
+// duration at a frame boundary. The segment thread preallocates the next
+// segment ahead and puts the finished one on the storage (fsync, close),
+// so the rotation does not wait for the file system.
+typedef struct CHST_SEG_s {
+	const char	*name;			// Base file name (channel name)
+	uint64_t	max_sz;			// Segment size limit (b) (0 - not limited)
+	uint32_t	max_secs;		// Segment duration (s) (0 - not limited)
+	uint32_t	idx;			// Index of the current segment
+	uint64_t	bytes;			// Number of bytes in the current segment (file)
+	uint64_t	frames;			// Number of frames in the current segment
+	double		t_beg;			// Start time of the current segment (s)
+	uint32_t	direct;			// Flag: the segments are opened with O_DIRECT (1)
+	uint32_t	late;			// Number of switches that waited for the next segment
+	pthread_t	thread;			// Segment thread
+	uint32_t	thread_run;		// Flag: the segment thread was created (1)
+	pthread_mutex_t lock;		// Lock of the fields below (writer/segment thread)
+	pthread_cond_t cond;		// Signal: a request was set or was done
+	uint32_t	quit;			// Flag: the segment thread must exit (1)
+	uint32_t	next_req;		// Flag: the next segment is requested (1)
+	uint32_t	next_idx;		// Index of the requested segment
+	uint64_t	next_sz;		// Size to preallocate for the requested segment (b)
+	int			next_fd;		// Prepared next segment (-1 - not ready)
+	uint32_t	next_err;		// Flag: can not open the next segment (1)
+	uint32_t	old_req;		// Flag: the finished segment must be closed (1)
+	FILE		*old_file;		// Finished segment (stdio) (NULL - direct I/O)
+	int			old_fd;			// Finished segment (direct I/O)
+	uint64_t	old_sz;			// Data size of the finished segment (b)
+	uint32_t	old_err;		// Flag: can not put a finished segment on
+								// the storage (1)
+} CHST_SEG_t;
+
+// Container format writer (dma-rec-fmt.h): the file header is written at
+// the start of each file (segment), the record offsets are collected for
+// the index written before the file is closed
+typedef struct CHST_REC_s {
+	uint32_t	on;				// Flag: the container format is written (1)
+	uint32_t	hdr_wr;			// Flag: the file header was written (1)
+	_DR_FILE_HDR_t hdr;			// File header (the channel fields are set before open)
+	uint64_t	*index;			// Offsets of the records of the file
+	uint64_t	num;			// Number of records in the file
+	uint64_t	max;			// Number of entries of the index array
+	uint64_t	frame_no;		// Number of the next record in the recording
+} CHST_REC_t;
+
+// Writer ring: single producer (capture) / single consumer (writer) ring of
+// frame slots. The indexes are free-running counters, each one is written
+// by one thread only and is kept in its own cache line with the other
+// fields of that thread: no locks are used while the ring is not empty.
+// The writer sleeps on the condition while the ring is empty, the capture
+// signals it only if the writer is idle.
+typedef struct CHWR_RING_s {
+	uint32_t	head __attribute__((aligned(CHWR_LINE_SZ)));	// Next slot to fill
+											// (written by capture)
+	uint32_t	hwm;			// High-water mark: maximum number of filled slots
+	uint64_t	overflows;		// Number of frames dropped: the ring was full
+	uint32_t	tail __attribute__((aligned(CHWR_LINE_SZ)));	// Next slot to write
+											// (written by writer)
+	uint32_t	idle;			// Flag: the writer waits for the frames (1)
+	uint32_t	stop __attribute__((aligned(CHWR_LINE_SZ)));	// Flag: no more frames,
+											// drain and exit (1) (capture)
+	uint32_t	wr_err;			// Flag: write error, the writer exited (1) (writer)
+	uint8_t		*mem;			// Slot memory (slots * slot_sz)
+	uint32_t	*len;			// Data length in each slot (b)
+	_DM_META_t	*meta;			// Completion metadata of each slot
+	uint32_t	slots;			// Number of slots
+	uint32_t	slot_sz;		// Size of one slot (b)
+	pthread_mutex_t lock;		// Lock of the idle writer wait
+	pthread_cond_t cond;		// Signal: a frame was put or the stop was set
+	pthread_t	thread;			// Writer thread
+	uint32_t	thread_run;		// Flag: the writer thread was created (1)
+} CHWR_RING_t;
 
 // DMA channel data receive/store operation parameters
 typedef struct CHRC_PARAMS_s {
 	uint32_t	ch_idx;			// DMA channel index
 	FILE 		*file_store;	// File to store the data
+	CHST_DIO_t	dio;			// Direct I/O storage (instead of file_store)
+	CHST_SEG_t	seg;			// Segmented file (the limits are set before open)
+	CHST_REC_t	rec;			// Container format writer
+	_DM_CH_INFO_t info;			// DMA channel information (chRcGeom)
 	int 		proxy_fd;		// DMA proxy character device file descriptor
-	uint8_t		*kernel_buf;	// Pointer to the DMA channel data buffer
+	uint8_t		*kernel_area;	// Pointer to the mapped area with all channel buffers
+	uint32_t	kernel_area_sz;	// Mapped area size (b)
+	uint8_t		*kernel_buf;	// Pointer to the dequeued DMA channel data buffer
 	uint32_t	kernel_buf_sz;	// Kernel buffer size (b)
+	uint32_t	kernel_buf_num;	// Number of kernel buffers in the queue
+	uint8_t		*user_buf;		// Pointer to the user buffer (zero-copy receive)
+	uint32_t	buf_idx;		// Index of the dequeued buffer
+	uint32_t	data_len;		// Length of received data in the buffer (b)
+	uint32_t	frames_left;	// Number of frames left to receive
+	uint32_t	active;			// Flag: the channel is served by the poll cycle (1)
+	uint32_t	abort_sent;		// Flag: abort was requested by the poll cycle (1)
+	uint32_t	stopped;		// Flag: the transfers were stopped by timeout/abort (1)
+	const _DM_META_t *meta;		// Pointer to the mapped completion metadata area
+	uint32_t	meta_offs;		// Offset of the metadata area in the device mapping
+	uint32_t	meta_sz;		// Size of the metadata area (b)
+	uint32_t	seq;			// Sequence number of the last received buffer
+	uint32_t	seq_valid;		// Flag: at least one buffer was received (1)
+	uint32_t	seq_lost;		// Number of completions missed (sequence gaps)
+	uint64_t	ts_ns;			// Completion time of the last received buffer (ns)
+	uint64_t	frames;			// Number of received frames (stored)
+	uint64_t	bytes;			// Number of received bytes (stored)
+	uint64_t	rep_frames;		// Number of received frames at the last report
+	uint64_t	rep_bytes;		// Number of received bytes at the last report
+	uint64_t	stall_ns;		// Maximum completion interval since the report (ns)
+	uint64_t	stall_max_ns;	// Maximum completion interval of the run (ns)
+	CHWR_RING_t	ring;			// Writer ring (the poll cycle)
 } CHRC_PARAMS_t;
 
 /******************************************************************************
 *	Internal functions
 *******************************************************************************/
-static int thrStart(uint32_t thr_idx);
-static void thrWaitFin(uint32_t thr_idx);
-static void *thrMain(void *arg);
-static void chRcMain(uint32_t ch_idx);
+static int chRcPollInit(void);
+static void chRcPollClose(void);
+static void chRcPollCycle(void);
+static void chRcPollAbort(void);
+static void chRcPollStopAll(void);
+static void chRcReport(double t_period);
+static void chRcSummary(double t_run);
+static void chRcSigInt(int sig);
+static int chRcStart(uint32_t ch_idx);
+static void chRcStop(CHRC_PARAMS_t *params);
 static int chRcInit(CHRC_PARAMS_t *params);
+static int chRcGeom(CHRC_PARAMS_t *params);
 static void chRcInitParams(uint32_t ch_idx);
 static int chRcFlDtOpen(CHRC_PARAMS_t *params);
+static void chRcFlDtHdr(CHRC_PARAMS_t *params);
 static int chRcFlDtWrite(CHRC_PARAMS_t *params);
 static void chRcFlDtClose(CHRC_PARAMS_t *params);
 static int chRcFlProxyOpen(CHRC_PARAMS_t *params);
 static void chRcFlProxyClose(CHRC_PARAMS_t *params);
 static int chRcMemMap(CHRC_PARAMS_t *params);
 static void chRcMemUnmap(CHRC_PARAMS_t *params);
-static int chRcDataCycle(CHRC_PARAMS_t *params);
+static int chRcDataService(CHRC_PARAMS_t *params);
+static int chRcDataStart(CHRC_PARAMS_t *params);
 static void chRcDataClrBuf(CHRC_PARAMS_t *params);
-static int chRcDataTran(CHRC_PARAMS_t *params);
+static int chRcDataQbuf(CHRC_PARAMS_t *params, uint32_t buf_idx);
+static int chRcDataDqbuf(CHRC_PARAMS_t *params);
+static void chRcDataStopped(CHRC_PARAMS_t *params, uint32_t res_code,
+	uint32_t residue);
+static void chRcDataSeq(CHRC_PARAMS_t *params, uint32_t seq, uint64_t ts_ns);
 static void chRcDataPrint(CHRC_PARAMS_t *params);
+static void chRcDataMeta(CHRC_PARAMS_t *params, _DM_META_t *meta);
+static int chRcUsrRun(uint32_t ch_idx);
+static int chRcUsrTran(CHRC_PARAMS_t *params);
+static int chRcDataCpuAcc(CHRC_PARAMS_t *params, uint32_t buf_idx,
+	unsigned long req);
 static void chRcFinalize(CHRC_PARAMS_t *params);
+static int chWrStart(CHRC_PARAMS_t *params);
+static void chWrStop(CHRC_PARAMS_t *params);
+static int chWrPush(CHRC_PARAMS_t *params);
+static void *chWrThread(void *arg);
+static int chStOpen(CHRC_PARAMS_t *params, const char *fname,
+	uint32_t direct);
+static int chStPut(CHRC_PARAMS_t *params, const uint8_t *data, uint32_t len);
+static int chStFrame(CHRC_PARAMS_t *params, const _DM_META_t *meta,
+	const uint8_t *data, uint32_t len);
+static int chStFlush(CHRC_PARAMS_t *params);
+static int chStClose(CHRC_PARAMS_t *params);
+static int chStRecHdr(CHRC_PARAMS_t *params);
+static int chStRecIndex(CHRC_PARAMS_t *params);
+static void chStSegName(CHST_SEG_t *seg, uint32_t idx, char *name);
+static int chStSegStart(CHRC_PARAMS_t *params);
+static void chStSegStop(CHRC_PARAMS_t *params);
+static int chStSegSwitch(CHRC_PARAMS_t *params);
+static void *chStSegThread(void *arg);
+static int chDioOpen(CHST_DIO_t *dio, const char *fname);
+static int chDioWrite(CHST_DIO_t *dio, const uint8_t *data, uint32_t len);
+static int chDioSubmit(CHST_DIO_t *dio, uint32_t len);
+static int chDioWait(CHST_DIO_t *dio, long min_nr);
+static int chDioClose(CHST_DIO_t *dio);
+static int chDioSwitch(CHST_DIO_t *dio, int fd, uint64_t alloc_sz,
+	int *old_fd, uint64_t *old_sz);
+static void chBmRun(void);
+static int chBmChannel(uint32_t ch_idx);
+static int chBmMode(int proxy_fd, uint32_t mode, uint8_t *copy_buf);
+static double chBmTimeGet(void);
+static void chRbRun(uint32_t secs);
+static int chRbChannel(uint32_t ch_idx, uint32_t secs);
+static double chRbUser(int proxy_fd, uint32_t ch_idx, _DM_CH_INFO_t *info,
+	uint32_t secs);
+static double chRbBatch(int proxy_fd, uint32_t ch_idx, _DM_CH_INFO_t *info,
+	uint32_t secs);
+static double chRbKernel(int proxy_fd, uint32_t ch_idx, uint32_t secs);
+static void chRbLatCount(uint32_t *hist, uint64_t *max_ns, uint64_t ts_ns);
+static void chRbLatPrint(const uint32_t *hist, uint64_t max_ns);
+static void chPbRun(const char *fname);
+static int chPbChannel(uint32_t ch_idx, const char *fname);
+static void chSbRun(const char *fname);
+static int chSbMethod(const char *fname, const uint8_t *frame,
+	uint32_t direct, uint32_t secs);
 
 /******************************************************************************
 *	Internal data
 *******************************************************************************/
 
-// DMA channel data receive/store thread parameters - for each thread
-static THR_PARAMS_t thr_params[_DM_CH_NUM];
-
-// DMA channel data receive/store operation parameters - for each thread
+// DMA channel data receive/store operation parameters - for each channel
 static CHRC_PARAMS_t chrc_params[_DM_CH_NUM];
 
+// Epoll file descriptor: one poll cycle serves all DMA channels
+static int chrc_epoll_fd = -1;
+
+// Number of DMA channels served by the poll cycle
+static uint32_t chrc_active_num;
+
 // DMA channel names
 static const char	*dm_ch_name[_DM_CH_NUM] = {
 	_DM_CHN_AXI_DMA_0,			// Index - _DM_CH_AXI_DMA_0
@@ -89,136 +332,549 @@ static const char 	*chrc_proxy_name[_DM_CH_NUM] = {
 	"/dev/"_DM_CHN_AXI_DMA_SC	// Index - _DM_CH_AXI_DMA_SC
 };
 
-// DMA channel kernel buffer sizes (b)
-static const uint32_t chrc_kbuf_sz[_DM_CH_NUM] = {
-	_DM_AXI_DMA_0_TRSZ,			// Index - _DM_CH_AXI_DMA_0
-	_DM_AXI_DMA_SC_TRSZ			// Index - _DM_CH_AXI_DMA_SC
+// GTU mode of the channel data (container file header)
+static const uint32_t chrc_gtu_mode[_DM_CH_NUM] = {
+	_DR_GTU_RAW,				// Index - _DM_CH_AXI_DMA_0
+	_DR_GTU_INTEG				// Index - _DM_CH_AXI_DMA_SC
 };
 
+// Number of frames per DMA transaction to set (0 - keep driver geometry)
+static uint32_t chrc_frames;
+
+// DMA transaction timeout (ms) (0 - no timeout)
+static uint32_t chrc_timeout;
+
+// Number of frames to receive from each channel (0 - until stopped)
+static uint32_t chrc_count = CHRC_FRAMES_NUM;
+
+// Acquisition duration (s) (0 - not limited)
+static uint32_t chrc_secs;
+
+// Channel set: bit N - DMA channel index N
+static uint32_t chrc_ch_mask = (1 << _DM_CH_NUM) - 1;
+
+// Throughput report period (s) (0 - no periodic reports)
+static uint32_t chrc_report = CHRC_REPORT_S;
+
+// Flag: test mode - the frames are printed, the buffers are cleared (1)
+static uint32_t chrc_verbose;
+
+// Flag: stop was requested by SIGINT (1)
+static volatile sig_atomic_t chrc_stop;
+
+// Number of frame slots in the writer ring of each channel
+static uint32_t chwr_slots = CHWR_SLOTS;
+
+// Flag: the files are written with O_DIRECT and Linux AIO (1)
+static uint32_t chst_direct;
+
+// Segment size limit (b) (0 - not limited)
+static uint64_t chst_seg_sz;
+
+// Segment duration (s) (0 - not limited)
+static uint32_t chst_seg_secs;
+
+// Flag: the files are written in the container format (1)
+static uint32_t chst_rec;
+
+// Overrun policy to set (_DM_OVR_POLICY_t) (-1 - keep driver policy)
+static int32_t chrc_ovr = -1;
+
 /******************************* main(argc,argv) ******************************
 * Main function of the application
+* One poll cycle receives and stores data from all DMA channels: while the
+*	data of one channel is stored, DMA engine fills the next queued buffers.
+* The acquisition runs for the number of frames, for the duration or until
+*	SIGINT, the throughput of each channel is reported periodically.
+* Options:
+*	-b  Run CPU read bandwidth benchmark of DMA buffers
+*		(coherent vs cached memory mode) instead of data receiving
+*	-r <s>  Run recording benchmark: each channel is recorded for <s>
+*		seconds by the user space loop and by the in-kernel recorder
+*	-p <file>  Play the recorded file back into each transmit channel
+*		(the data is streamed into the PL)
+*	-u  Receive data directly into user memory (zero-copy, one channel
+*		after another) instead of the poll cycle over the buffer queues
+*	-k <frames>  Receive <frames> stream frames per DMA transaction
+*		(the channel buffers are resized by the driver)
+*	-t <ms>  Stop the channel if no data is received within <ms>
+*		(the partially received data is stored)
+*	-o <policy>  Set the overrun policy of the channels: 0 - block,
+*		1 - drop the oldest, 2 - drop the newest finished buffer
+*	-c <mask>  Channel set: bit N - DMA channel index N (all by default)
+*	-n <frames>  Receive <frames> frames from each channel (0 - until
+*		stopped by the duration or SIGINT; CHRC_FRAMES_NUM by default, 0
+*		if the duration is set). Up to CHRC_PRINT_MAX frames are printed.
+*	-d <s>  Stop the acquisition after <s> seconds
+*	-i <s>  Throughput report period (0 - final summary only)
+*	-w <slots>  Number of frame slots in the writer ring of each channel
+*		(the frames are stored by the writer thread of the channel)
+*	-a  Write the files with O_DIRECT and Linux AIO (page aligned batches,
+*		preallocated file) instead of stdio
+*	-s <MB>  Store the data in segment files of <MB> megabytes at most
+*		(<channel>.000000, <channel>.000001, ...; whole frames)
+*	-e <s>  Switch to the next segment file every <s> seconds
+*	-f  Write the files in the container format (dma-rec-fmt.h): file
+*		header with the geometry and the configuration, frame headers
+*		(sequence, timestamp, status), index of the frames
+*	-S <file>  Run storage benchmark: synthetic frames are written to
+*		<file> by stdio and by direct I/O for the duration (-d) each
 * Parameters:
-*	(i)argc - Number of arguments (not used)
-*	(i)argv - Argument list (not used)
+*	(i)argc - Number of arguments
+*	(i)argv - Argument list
 * Return value:
 *	Always zero
 *******************************************************************************/
 int main(int argc, char *argv[])
 {
-	uint32_t thr_idx;
+	struct sigaction sa;
+	uint32_t ch_idx;
+	uint32_t rb_secs;
+	const char *pb_name;
+	int count_set;
+	int run_mode;
+	int opt;
+	int rc;
+
+	// Parse command line options
+	run_mode = 0;
+	rb_secs = 0;
+	pb_name = NULL;
+	count_set = 0;
+	while((opt = getopt(argc, argv, "bur:p:k:t:o:c:n:d:i:w:aS:s:e:f")) != -1) {
+		switch(opt) {
+		case 'b':
+		case 'u':
+			// Benchmark or zero-copy receive mode
+			run_mode = opt;
+			break;
+
+		case 'r':
+			// Recording benchmark mode
+			run_mode = opt;
+			rb_secs = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'p':
+		case 'S':
+			// Playback or storage benchmark mode
+			run_mode = opt;
+			pb_name = optarg;
+			break;
+
+		case 'k':
+			// Number of frames per DMA transaction
+			chrc_frames = strtoul(optarg, NULL, 0);
+			break;
+
+		case 't':
+			// DMA transaction timeout
+			chrc_timeout = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'o':
+			// Overrun policy
+			chrc_ovr = strtol(optarg, NULL, 0);
+			break;
+
+		case 'c':
+			// Channel set
+			chrc_ch_mask = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			// Number of frames per channel
+			chrc_count = strtoul(optarg, NULL, 0);
+			count_set = 1;
+			break;
+
+		case 'd':
+			// Acquisition duration
+			chrc_secs = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'i':
+			// Throughput report period
+			chrc_report = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'w':
+			// Number of writer ring slots (2 at least)
+			chwr_slots = strtoul(optarg, NULL, 0);
+			if(chwr_slots < 2) chwr_slots = 2;
+			break;
+
+		case 'a':
+			// Direct I/O storage
+			chst_direct = 1;
+			break;
+
+		case 's':
+			// Segment size limit
+			chst_seg_sz = strtoull(optarg, NULL, 0) * 1000000;
+			break;
+
+		case 'e':
+			// Segment duration
+			chst_seg_secs = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'f':
+			// Container format
+			chst_rec = 1;
+			break;
+
+		default:
+			printf("Usage: %s [-b | -u | -r s | -p file | -S file] [-k frames] "
+				"[-t ms] [-o policy] [-c mask] [-n frames] [-d s] [-i s] "
+				"[-w slots] [-a] [-s MB] [-e s] [-f] \n", argv[0]);
+			return 0;
+		}
+	}
 
-	printf("dma-uapp: Starting Threads \n");
+	// Run the benchmark only
+	if(run_mode == 'b') {
+		chBmRun();
+		return 0;
+	}
+
+	// Run the recording benchmark only
+	if(run_mode == 'r') {
+		chRbRun(rb_secs);
+		return 0;
+	}
+
+	// Play the recorded file back only
+	if(run_mode == 'p') {
+		chPbRun(pb_name);
+		return 0;
+	}
+
+	// Run the storage benchmark only
+	if(run_mode == 'S') {
+		chSbRun(pb_name);
+		return 0;
+	}
 
-	// Start threads cycle: one thread for one DMA channel
-	for(thr_idx = 1; thr_idx < _DM_CH_NUM; thr_idx++)
-		thrStart(thr_idx);					// Start data receive/store thread
+	// The duration limits the acquisition, not the number of frames
+	if(chrc_secs != 0 && !count_set) chrc_count = 0;
 
-	printf("dma-uapp: Threads were started \n");
+	// Test mode: a few frames are printed
+	chrc_verbose = (chrc_count != 0 && chrc_count <= CHRC_PRINT_MAX);
 
-	// Wait until all threads are finished
-	for(thr_idx = 1; thr_idx < _DM_CH_NUM; thr_idx++)
-		thrWaitFin(thr_idx);				// Block, wait until the thread is finished
+	// SIGINT stops the acquisition (the blocked calls are interrupted)
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = chRcSigInt;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
 
-	
-	printf("dma-uapp: All threads were finished \n");
+	// Receive data into user memory on DMA channels of the set
+	if(run_mode == 'u') {
+		for(ch_idx = 0; ch_idx < _DM_CH_NUM && !chrc_stop; ch_idx++)
+			if(chrc_ch_mask & (1 << ch_idx)) chRcUsrRun(ch_idx);
+		return 0;
+	}
+
+	printf("dma-uapp: Starting data receiving \n");
+
+	// Create epoll instance for the poll cycle
+	rc = chRcPollInit();
+	if(rc < 0) return 0;
+
+	// Start data receiving on DMA channels of the set
+	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++)
+		if(chrc_ch_mask & (1 << ch_idx)) chRcStart(ch_idx);
+
+	printf("dma-uapp: Data receiving was started \n");
+
+	// Receive and store data until all channels are finished
+	chRcPollCycle();
+
+	// Close epoll instance
+	chRcPollClose();
+
+	printf("dma-uapp: All channels were finished \n");
 
 	// Application is finished successfully
 	return 0;
 }
 
-/***************************** thrStart(thr_idx) ******************************
-* Start data receive/store thread for one DMA channel
+/******************************* chRcPollInit() *******************************
+* Create epoll instance for the poll cycle
 * Used variable:
-*	(o)thr_params - thread parameters
-* Parameter:
-*	(i)thr_idx - index of the thread to start (not checked here)
+*	(o)chrc_epoll_fd - epoll file descriptor
 * Return value:
-*	 0 Thread was started successfully
-*	-1 Error, the thread was not started
+*	 0 Success. Epoll instance was created
+*	-1 Error. Can not create epoll instance
 *******************************************************************************/
-static int thrStart(uint32_t thr_idx)
+static int chRcPollInit(void)
 {
-	THR_PARAMS_t *thr_param;
-	pthread_t id;
-	int rc;
+	int epoll_fd;
 
-	// Set the pointer to the thread parameters structure
-	thr_param = &thr_params[thr_idx];
+	// Create epoll instance
+	epoll_fd = epoll_create1(0);
+	if(epoll_fd < 0) {
+		printf("dma-uapp: Can not create epoll instance \n");
 
-	// Create a thread
-	rc = pthread_create(&id, NULL, thrMain, (void *)thr_idx);
-	if(rc != 0) return -1;					// Can not create thread
-
-	// Store created thread ID in the thread parameters structure
-	thr_param -> id = id;
+		// Epoll instance was not created
+		return -1;
+	}
 
-	// Set the flag: the thread was created and started
-	thr_param -> created = 1;
+	// Store epoll file descriptor
+	chrc_epoll_fd = epoll_fd;
 
-	// Thread was started successfully
+	// Epoll instance was created successfully
 	return 0;
 }
 
-/**************************** thrWaitFin(thr_idx) *****************************
-* Wait until thread is finished
-* The operation is performed only if the thread was started
+/****************************** chRcPollClose() *******************************
+* Close epoll instance
+* The instance is closed only if it was created before
 * Used variable:
-*	(i)thr_params - thread parameters
-* Parameter:
-*	(i)thr_idx - index of the thread
+*	(io)chrc_epoll_fd - epoll file descriptor
+*******************************************************************************/
+static void chRcPollClose(void)
+{
+	// Close epoll instance only if it was created
+	if(chrc_epoll_fd >= 0) close(chrc_epoll_fd);
+
+	// Clear epoll file descriptor
+	chrc_epoll_fd = -1;
+}
+
+/****************************** chRcPollCycle() *******************************
+* Poll cycle: receive and store data from all active DMA channels
+* Waits until one or more channels have finished DMA transactions,
+*	serves the ready channels. The channel is stopped when all its frames
+*	are received or in case of errors.
+* If the timeout is set and no channel is ready within it, the transfers
+*	of all active channels are aborted (see chRcPollAbort)
+* All channels are stopped after the duration or by SIGINT. The throughput
+*	is reported periodically, the summary is printed at the end.
+* The function returns when all channels are stopped
+* Used variables:
+*	(i)chrc_epoll_fd - epoll file descriptor
+*	(i)chrc_active_num - number of active channels
+*	(i)chrc_timeout - DMA transaction timeout (ms)
+*	(i)chrc_secs - acquisition duration (s)
+*	(i)chrc_report - throughput report period (s)
+*	(i)chrc_stop - flag: stop was requested
+*******************************************************************************/
+static void chRcPollCycle(void)
+{
+	struct epoll_event events[_DM_CH_NUM];
+	CHRC_PARAMS_t *params;
+	double t_beg, t_now, t_data, t_rep;
+	int ev_num, ev_idx;
+	int rc;
+
+	// Start time of the acquisition, the data and the report periods
+	t_beg = chBmTimeGet();
+	t_data = t_beg;
+	t_rep = t_beg;
+
+	// Poll cycle is executed while there are active channels
+	while(chrc_active_num > 0) {
+		// Stop all channels after the duration or by SIGINT
+		t_now = chBmTimeGet();
+		if(chrc_stop || (chrc_secs != 0 && t_now - t_beg >= chrc_secs)) {
+			chRcPollStopAll();
+			break;
+		}
+
+		// Report the throughput of the period
+		if(chrc_report != 0 && t_now - t_rep >= chrc_report) {
+			chRcReport(t_now - t_rep);
+			t_rep = t_now;
+		}
+
+		// Wait until one or more channels are ready (one tick at most)
+		ev_num = epoll_wait(chrc_epoll_fd, events, _DM_CH_NUM, CHRC_TICK_MS);
+		if(ev_num < 0) {
+			if(errno == EINTR) continue;	// The wait was interrupted by a signal
+			break;							// Poll error
+		}
+
+		// Timeout: no data from the channels, abort their transfers
+		if(ev_num != 0) t_data = chBmTimeGet();
+		else if(chrc_timeout != 0 &&
+				(chBmTimeGet() - t_data) * 1000 >= chrc_timeout) {
+			chRcPollAbort();
+			t_data = chBmTimeGet();
+		}
+
+		// Serve ready channels cycle
+		for(ev_idx = 0; ev_idx < ev_num; ev_idx++) {
+			// Set the pointer to the ready channel parameters
+			params = events[ev_idx].data.ptr;
+
+			// Receive and store channel data
+			rc = chRcDataService(params);
+
+			// Stop the channel if all frames were received or in case of errors
+			if(rc <= 0) chRcStop(params);
+		}
+	}
+
+	// Print the summary of all channels
+	chRcSummary(chBmTimeGet() - t_beg);
+}
+
+/****************************** chRcPollAbort() *******************************
+* Abort the transfers of all active channels (poll timeout)
+* The stopped buffers become ready and are served by the poll cycle: the
+*	partially received data is stored, the channel is finished.
+*	The channel which is not ready after the previous abort is stopped.
+* Used variables:
+*	(io)chrc_params - channel data operation parameters
 *******************************************************************************/
-static void thrWaitFin(uint32_t thr_idx)
+static void chRcPollAbort(void)
 {
-	THR_PARAMS_t *thr_param;
-	pthread_t id;
-	uint32_t created;
+	CHRC_PARAMS_t *params;
+	uint32_t ch_idx;
 
-	// Set the pointer to the thread parameters structure
-	thr_param = &thr_params[thr_idx];
+	// Abort cycle over the active channels
+	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++) {
+		// Set the pointer to the channel parameters
+		params = &chrc_params[ch_idx];
+		if(!(params -> active)) continue;
 
-	// Read thread parameters: thread ID and "created" flag
-	id = thr_param -> id;
-	created = thr_param -> created;
+		// No buffers after the previous abort: stop the channel
+		if(params -> abort_sent) {
+			chRcStop(params);
+			continue;
+		}
 
-	// Wait until the thread is finished only if the thread was created and started
-	if(created) pthread_join(id, NULL);
+		printf("dma-uapp: No data within %d ms, aborting ch_idx=%d \n",
+			chrc_timeout, ch_idx);
 
-	// The thread is finished
+		// Abort the transfers of the channel
+		ioctl(params -> proxy_fd, _DM_IOCTL_ABORT);
+		params -> abort_sent = 1;
+	}
 }
 
-/******************************** thrMain(arg) ********************************
-* Main function of DMA channel data receive thread
+/***************************** chRcPollStopAll() ******************************
+* Stop all active channels (duration is over or SIGINT)
+* The received buffers not served yet are dropped
+* Used variable:
+*	(io)chrc_params - channel data operation parameters
+*******************************************************************************/
+static void chRcPollStopAll(void)
+{
+	uint32_t ch_idx;
+
+	// Stop cycle over the active channels
+	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++)
+		if(chrc_params[ch_idx].active) chRcStop(&chrc_params[ch_idx]);
+}
+
+/**************************** chRcReport(t_period) ****************************
+* Print the throughput of each active channel for the report period:
+*	frames/s, MB/s, the maximum interval between completions (stall), the
+*	number of completions lost and the high-water mark of the writer ring
+* Used variable:
+*	(io)chrc_params - channel data operation parameters
 * Parameter:
-*	(i)arg - index of the thread (i.e. DMA channel ID)
-* Return value:
-*	NULL Data receiving is finished, the thread is finished
+*	(i)t_period - report period (s)
 *******************************************************************************/
-static void *thrMain(void *arg)
+static void chRcReport(double t_period)
 {
-	uint32_t thr_idx;
+	CHRC_PARAMS_t *params;
+	uint32_t ch_idx;
 
-	// The argument of the function contains thread index aka DMA channel ID
-	thr_idx = (uint32_t)arg;
+	// Report cycle over the active channels
+	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++) {
+		// Set the pointer to the channel parameters
+		params = &chrc_params[ch_idx];
+		if(!(params -> active)) continue;
+
+		// Print the rates of the period
+		printf("dma-uapp: ch_idx=%d %8.1f frames/s %8.1f MB/s  stall %7.2f ms"
+			"  lost %u  ring %u/%u (overflows %llu) \n", ch_idx,
+			(params -> frames - params -> rep_frames) / t_period,
+			(params -> bytes - params -> rep_bytes) / 1e6 / t_period,
+			params -> stall_ns / 1e6, params -> seq_lost,
+			params -> ring.hwm, params -> ring.slots,
+			(unsigned long long)params -> ring.overflows);
+
+		// Start the next period
+		params -> rep_frames = params -> frames;
+		params -> rep_bytes = params -> bytes;
+		params -> stall_ns = 0;
+	}
 
-	// Execute channel data receive operation
-	chRcMain(thr_idx);
+	// Flush output buffer
+	fflush(stdout);
+}
 
-	// Data receiving is finished, the thread is finished
-	return NULL;
+/***************************** chRcSummary(t_run) *****************************
+* Print the summary of each channel of the set: frames, bytes, average
+*	rates, the maximum interval between completions, completions lost,
+*	the high-water mark of the writer ring (to size it against the worst
+*	storage stall) and the frames dropped by the full ring
+* Used variables:
+*	(i)chrc_params - channel data operation parameters
+*	(i)chrc_ch_mask - channel set
+* Parameter:
+*	(i)t_run - acquisition time (s)
+*******************************************************************************/
+static void chRcSummary(double t_run)
+{
+	CHRC_PARAMS_t *params;
+	uint32_t ch_idx;
+
+	// Nothing to average
+	if(t_run <= 0) return;
+
+	// Summary cycle over the channels of the set
+	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++) {
+		if(!(chrc_ch_mask & (1 << ch_idx))) continue;
+		params = &chrc_params[ch_idx];
+
+		// Print the totals and the average rates
+		printf("dma-uapp: ch_idx=%d total %llu frames %.1f MB in %.1f s: "
+			"%.1f frames/s %.1f MB/s  max stall %.2f ms  lost %u \n", ch_idx,
+			(unsigned long long)params -> frames, params -> bytes / 1e6, t_run,
+			params -> frames / t_run, params -> bytes / 1e6 / t_run,
+			params -> stall_max_ns / 1e6, params -> seq_lost);
+		printf("dma-uapp: ch_idx=%d writer ring high-water mark %u of %u slots, "
+			"%llu frames dropped \n", ch_idx, params -> ring.hwm,
+			params -> ring.slots, (unsigned long long)params -> ring.overflows);
+	}
 }
 
-/****************************** chRcMain(ch_idx) ******************************
-* Channel data receive operation: main function
-* Inits DMA channel data receiving
-* Receives DMA channel data, stores the data in a file
+/******************************* chRcSigInt(sig) ******************************
+* SIGINT handler: request the stop of the acquisition
 * Used variable:
+*	(o)chrc_stop - flag: stop was requested
+* Parameter:
+*	(i)sig - signal number (not used)
+*******************************************************************************/
+static void chRcSigInt(int sig)
+{
+	// The poll cycle stops all channels
+	chrc_stop = 1;
+}
+
+/****************************** chRcStart(ch_idx) *****************************
+* Start DMA channel data receiving
+* Inits DMA channel data receiving, starts streaming,
+*	adds the channel to the poll cycle
+* Used variables:
 *	(o)chrc_params - channel data operation parameters
+*	(i)chrc_epoll_fd - epoll file descriptor
+*	(io)chrc_active_num - number of active channels
 * Parameter:
 *	(i)ch_idx - DMA channel index
+* Return value:
+*	 0 Success. Data receiving was started
+*	-1 Error. Data receiving was not started
 *******************************************************************************/
-static void chRcMain(uint32_t ch_idx)
+static int chRcStart(uint32_t ch_idx)
 {
 	CHRC_PARAMS_t *params;
+	struct epoll_event event;
 	int rc;
 
 	// Init DMA channel operation parameters
@@ -229,13 +885,58 @@ static void chRcMain(uint32_t ch_idx)
 
 	// Init DMA channel data receiving
 	rc = chRcInit(params);
-	if(rc < 0) goto CHRC_FIN;
+	if(rc < 0) goto CHRC_ERR;
+
+	// Queue all channel buffers, start streaming
+	rc = chRcDataStart(params);
+	if(rc < 0) goto CHRC_ERR;
+
+	// Add the channel to the poll cycle: wait for finished DMA transactions
+	event.events = EPOLLIN;
+	event.data.ptr = params;
+	rc = epoll_ctl(chrc_epoll_fd, EPOLL_CTL_ADD, params -> proxy_fd, &event);
+	if(rc < 0) goto CHRC_ERR;
+
+	// The channel is served by the poll cycle
+	params -> active = 1;
+	chrc_active_num++;
 
-	// Perform dma receive operation in a cycle
-	chRcDataCycle(params);
+	// Data receiving was started successfully
+	return 0;
+
+CHRC_ERR:
+	printf("dma-uapp: Data receiving was not started ch_idx=%d \n", ch_idx);
+
+	// Free all resources allocated for the channel
+	chRcFinalize(params);
+
+	// Data receiving was not started
+	return -1;
+}
 
-CHRC_FIN:
-	printf("dma-uapp: Data receiving finished ch_idx=%d \n", ch_idx);
+/****************************** chRcStop(params) ******************************
+* Stop DMA channel data receiving
+* Removes the channel from the poll cycle, stops streaming,
+*	frees all resources allocated for the channel
+* Used variables:
+*	(i)chrc_epoll_fd - epoll file descriptor
+*	(io)chrc_active_num - number of active channels
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+*******************************************************************************/
+static void chRcStop(CHRC_PARAMS_t *params)
+{
+	// Remove the channel from the poll cycle
+	epoll_ctl(chrc_epoll_fd, EPOLL_CTL_DEL, params -> proxy_fd, NULL);
+
+	// The channel is not served by the poll cycle any more
+	params -> active = 0;
+	chrc_active_num--;
+
+	// Stop streaming
+	ioctl(params -> proxy_fd, _DM_IOCTL_STRM_OFF);
+
+	printf("dma-uapp: Data receiving finished ch_idx=%d \n", params -> ch_idx);
 
 	// Free all resources allocated for the channel
 	chRcFinalize(params);
@@ -243,9 +944,10 @@ CHRC_FIN:
 
 /****************************** chRcInit(params) ******************************
 * Initialize DMA channel data receiving
+*	Opens DMA proxy character device, sets the geometry
 *	Opens file for writing received data
-*	Opens DMA proxy character device
 *	Maps the kernel buffer memory into user space
+*	Starts the writer thread of the channel
 * Parameter: 
 *	(o)params - DMA channel data operation parameters
 * Return value:
@@ -256,16 +958,94 @@ static int chRcInit(CHRC_PARAMS_t *params)
 {
 	int rc;
 
-	// Open file for writing received data
-	rc = chRcFlDtOpen(params);
-	if(rc < 0) return rc;				// Can not open the file
-
 	// Open DMA proxy character device
 	rc = chRcFlProxyOpen(params);
 	if(rc < 0) return rc;				// Can not open the file
 
+	// Set transfer geometry, get buffer sizes
+	rc = chRcGeom(params);
+	if(rc < 0) return rc;				// Can not set the geometry
+
+	// Open file for writing received data (the geometry is in the header)
+	rc = chRcFlDtOpen(params);
+	if(rc < 0) return rc;				// Can not open the file
+
 	// Map the kernel buffer memory into user space
-	return chRcMemMap(params);
+	rc = chRcMemMap(params);
+	if(rc < 0) return rc;				// Can not map the memory
+
+	// Start the writer thread with its frame ring
+	return chWrStart(params);
+}
+
+/****************************** chRcGeom(params) ******************************
+* Set DMA channel transfer geometry, timeout and overrun policy (if
+*	requested), get buffer sizes
+* Used variables:
+*	(i)chrc_frames - number of frames per DMA transaction to set
+*	(i)chrc_timeout - DMA transaction timeout (ms)
+*	(i)chrc_ovr - overrun policy to set
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success. Buffer sizes were read from the driver
+*	-1 Error. Can not set the geometry or get channel information
+*******************************************************************************/
+static int chRcGeom(CHRC_PARAMS_t *params)
+{
+	_DM_CH_GEOM_t geom;
+	_DM_CH_INFO_t info;
+	_DM_OVR_t ovr;
+	int rc;
+
+	// Set the number of frames per DMA transaction
+	if(chrc_frames != 0) {
+		geom.frames = chrc_frames;
+		rc = ioctl(params -> proxy_fd, _DM_IOCTL_GEOM, &geom);
+		if(rc != 0) {
+			printf("dma-uapp: Can not set %d frames per transfer, ch_idx=%d \n",
+				chrc_frames, params -> ch_idx);
+
+			// Can not set the geometry
+			return -1;
+		}
+	}
+
+	// Set DMA transaction timeout (limits the blocking requests)
+	if(chrc_timeout != 0) {
+		rc = ioctl(params -> proxy_fd, _DM_IOCTL_TIMEOUT, &chrc_timeout);
+		if(rc != 0) return -1;			// Can not set the timeout
+	}
+
+	// Set the overrun policy (what is lost when the buffers are not queued)
+	if(chrc_ovr >= 0) {
+		ovr.policy = chrc_ovr;
+		ovr.set = 1;
+		rc = ioctl(params -> proxy_fd, _DM_IOCTL_OVR, &ovr);
+		if(rc != 0) return -1;			// Can not set the policy
+	}
+
+	// Get DMA channel information (kept for the container file header)
+	rc = ioctl(params -> proxy_fd, _DM_IOCTL_INFO, &info);
+	if(rc != 0) return -1;				// Can not get the information
+	params -> info = info;
+
+	// Set kernel buffer size and the size of the area with all buffers
+	params -> kernel_buf_sz = info.trsz;
+	params -> kernel_area_sz = info.area_sz;
+
+	// Set the number of buffers in the channel queue
+	params -> kernel_buf_num = info.buf_num;
+	if(info.ring_sz != 0)
+		printf("dma-uapp: Capture ring %u bytes, %u slots, ch_idx=%d \n",
+			info.ring_sz, info.buf_num, params -> ch_idx);
+
+	// Set the offset and the size of the completion metadata area
+	params -> meta_offs = info.meta_offs;
+	params -> meta_sz = info.meta_sz;
+
+	// Buffer sizes were read successfully
+	return 0;
 }
 
 /*************************** chRcInitParams(ch_idx) ***************************
@@ -289,14 +1069,51 @@ static void chRcInitParams(uint32_t ch_idx)
 	// DMA proxy character device file descriptor is not initialized
 	params -> proxy_fd = -1;
 
-	// Init kernel buffer size for the channel
-	params -> kernel_buf_sz = chrc_kbuf_sz[ch_idx];
+	// User buffer is not allocated
+	params -> user_buf = NULL;
+
+	// The files are not opened
+	params -> file_store = NULL;
+	memset(&(params -> dio), 0, sizeof(CHST_DIO_t));
+	params -> dio.fd = -1;
+	memset(&(params -> seg), 0, sizeof(CHST_SEG_t));
+	memset(&(params -> rec), 0, sizeof(CHST_REC_t));
+
+	// Kernel buffer and area sizes, number of buffers are read from the driver (chRcGeom)
+	params -> kernel_buf_sz = 0;
+	params -> kernel_area_sz = 0;
+	params -> kernel_buf_num = 0;
+
+	// Init the number of frames to receive, the channel is not active yet
+	params -> frames_left = chrc_count;
+	params -> active = 0;
+
+	// The writer ring is not allocated, the writer thread is not started
+	memset(&(params -> ring), 0, sizeof(CHWR_RING_t));
+
+	// Clear the throughput counters
+	params -> frames = 0;
+	params -> bytes = 0;
+	params -> rep_frames = 0;
+	params -> rep_bytes = 0;
+	params -> stall_ns = 0;
+	params -> stall_max_ns = 0;
+
+	// Metadata page is not mapped, no buffers were received yet
+	params -> meta = NULL;
+	params -> seq_valid = 0;
+	params -> seq_lost = 0;
+	params -> abort_sent = 0;
+	params -> stopped = 0;
 }
 
 /**************************** chRcFlDtOpen(params) ****************************
 * Open file for writing received data
-* Used variable:
+* Used variables:
 *	(i)dm_ch_name - DMA channel names
+*	(i)chst_direct - flag: direct I/O storage
+*	(i)chst_seg_sz, chst_seg_secs - segment size and duration limits
+*	(i)chst_rec - flag: container format
 * Parameter:
 *	(io)params - DMA channel data operation parameters
 * Return value:
@@ -307,7 +1124,6 @@ static int chRcFlDtOpen(CHRC_PARAMS_t *params)
 {
 	uint32_t ch_idx;
 	const char	*fname;
-	FILE *file;
 
 	// Get DMA channel index
 	ch_idx = params -> ch_idx;
@@ -315,48 +1131,109 @@ static int chRcFlDtOpen(CHRC_PARAMS_t *params)
 	// Set the pointer to the file name
 	fname = dm_ch_name[ch_idx];
 
+	// Set the segment limits (the file is segmented if one is set)
+	params -> seg.max_sz = chst_seg_sz;
+	params -> seg.max_secs = chst_seg_secs;
+
+	// Set the container file header
+	params -> rec.on = chst_rec;
+	if(chst_rec) chRcFlDtHdr(params);
+
 	// Open the file for writing
-	file = fopen(fname,"wb");
-	if(file == NULL) return -1;			// Can not open the file
+	return chStOpen(params, fname, chst_direct);
+}
+
+/**************************** chRcFlDtHdr(params) *****************************
+* Set the channel fields of the container file header: the geometry and
+*	the configuration snapshot (the segment fields and the start time are
+*	set when the header is written)
+* Used variables:
+*	(i)dm_ch_name - DMA channel names
+*	(i)chrc_gtu_mode - GTU mode of the channel data
+*	(i)chwr_slots, chst_direct, chst_seg_sz, chst_seg_secs - options
+* Parameter:
+*	(io)params - DMA channel data operation parameters (info is read)
+*******************************************************************************/
+static void chRcFlDtHdr(CHRC_PARAMS_t *params)
+{
+	_DR_FILE_HDR_t *hdr;
+	_DM_CH_INFO_t *info;
+	uint32_t ch_idx;
 
-	// Set file structure pointer in DMA channel parameters
-	params -> file_store = file;
+	// Set the pointers to the header and to the channel information
+	hdr = &(params -> rec.hdr);
+	info = &(params -> info);
+	ch_idx = params -> ch_idx;
 
-	// The file was opened successfully
-	return 0;
+	// Format and channel
+	memset(hdr, 0, sizeof(_DR_FILE_HDR_t));
+	hdr -> magic = _DR_FILE_MAGIC;
+	hdr -> version = _DR_VERSION;
+	hdr -> hdr_sz = sizeof(_DR_FILE_HDR_t);
+	hdr -> frame_hdr_sz = sizeof(_DR_FRAME_HDR_t);
+	snprintf(hdr -> ch_name, sizeof(hdr -> ch_name), "%s", dm_ch_name[ch_idx]);
+	hdr -> ch_idx = ch_idx;
+	hdr -> dir = info -> dir;
+
+	// Geometry: 48x48 layers of 8-bit counts (one per GTU) or of 32-bit
+	// counts integrated over the GTUs
+	hdr -> pix_x = _DR_PIX_X;
+	hdr -> pix_y = _DR_PIX_Y;
+	hdr -> gtu_mode = chrc_gtu_mode[ch_idx];
+	if(hdr -> gtu_mode == _DR_GTU_RAW) {
+		hdr -> pix_bytes = sizeof(uint8_t);
+		hdr -> gtu_integ = 1;
+	}
+	else {
+		hdr -> pix_bytes = sizeof(uint32_t);
+		hdr -> gtu_integ = _DR_GTU_INTEG_NUM;
+	}
+	hdr -> gtus = info -> frame_sz / (_DR_PIX_X * _DR_PIX_Y * hdr -> pix_bytes);
+	hdr -> frame_sz = info -> frame_sz;
+	hdr -> frames = info -> frames;
+	hdr -> trsz = info -> trsz;
+
+	// Driver configuration
+	hdr -> buf_num = info -> buf_num;
+	hdr -> mem_mode = info -> mem_mode;
+	hdr -> timeout_ms = info -> timeout_ms;
+	hdr -> ring_sz = info -> ring_sz;
+	hdr -> inflight = info -> inflight;
+	hdr -> coal_cnt = info -> coal_cnt;
+	hdr -> coal_us = info -> coal_us;
+	hdr -> ovr_policy = info -> ovr_policy;
+	hdr -> rt_cpu = info -> rt_cpu;
+	hdr -> rt_prio = info -> rt_prio;
+
+	// Storage configuration
+	hdr -> wr_slots = chwr_slots;
+	hdr -> direct = chst_direct;
+	hdr -> seg_secs = chst_seg_secs;
+	hdr -> seg_sz = chst_seg_sz;
 }
 
 /*************************** chRcFlDtWrite(params) ****************************
 * Write received data into the file
 * Parameter:
-*	(i)params - DMA channel data operation parameters
+*	(io)params - DMA channel data operation parameters
 * Return value:
 *	 0 Success. Data was written to the file
 *	-1 Error. Data was not written to the file
 *******************************************************************************/
 static int chRcFlDtWrite(CHRC_PARAMS_t *params)
 {
-	uint8_t *kernel_buf;
-	uint32_t kbuf_size;
-	FILE *file;
-	int sz;
-
-	// Get the pointer to the mapped kernel buffer, read buffer size
-	kernel_buf = params -> kernel_buf;
-	kbuf_size = params -> kernel_buf_sz;
+	_DM_META_t meta;
+	int rc;
 
-	// Get the pointer to the file structure
-	file = params -> file_store;
+	// Get the completion metadata of the received data
+	chRcDataMeta(params, &meta);
 
-	// Write the data from buffer to the file
-	sz = fwrite(kernel_buf, 1, kbuf_size, file);
-	if(sz != kbuf_size) return -1;			// Data was not written to the file
+	// Write the data from the buffer to the file
+	rc = chStFrame(params, &meta, params -> kernel_buf, params -> data_len);
+	if(rc < 0) return -1;				// Data was not written to the file
 
 	// Force writing from the buffer to the file
-	fflush(file);
-
-	// Data was successfully written to the file
-	return 0;
+	return chStFlush(params);
 }
 
 /*************************** chRcFlDtClose(params) ****************************
@@ -367,16 +1244,12 @@ static int chRcFlDtWrite(CHRC_PARAMS_t *params)
 *******************************************************************************/
 static void chRcFlDtClose(CHRC_PARAMS_t *params)
 {
-	FILE *file;
-
-	// Read opened file structure pointer
-	file = params -> file_store;
-
-	// Close the file only if it was opened
-	if(file != NULL) fclose(file);
+	int rc;
 
-	// Clear file structure pointer in DMA channel parameters
-	params -> file_store = NULL;
+	// Close the file (the data in flight is written first)
+	rc = chStClose(params);
+	if(rc < 0) printf("dma-uapp: Can not write the file, ch_idx=%d \n",
+		params -> ch_idx);
 }
 
 /************************** chRcFlProxyOpen(params) ***************************
@@ -402,7 +1275,8 @@ static int chRcFlProxyOpen(CHRC_PARAMS_t *params)
 	fname = chrc_proxy_name[ch_idx];
 
 	// Open DMA proxy character device
-	proxy_fd = open(fname, O_RDWR);
+	// (non-blocking: the channel is served by the poll cycle)
+	proxy_fd = open(fname, O_RDWR | O_NONBLOCK);
 	if(proxy_fd < 0) {
 		printf("dma-uapp: can not open DMA proxy character device: %s \n", fname);
 
@@ -438,7 +1312,8 @@ static void chRcFlProxyClose(CHRC_PARAMS_t *params)
 }
 
 /***************************** chRcMemMap(params) *****************************
-* Map the kernel buffer memory into user space
+* Map the kernel buffer memory (all buffers of the channel buffer queue)
+*	and the read-only completion metadata area into user space
 * Parameter:
 *	(io)params - DMA channel data operation parameters
 * Return value:
@@ -449,21 +1324,21 @@ static int chRcMemMap(CHRC_PARAMS_t *params)
 {
 	uint32_t ch_idx;
 	int proxy_fd;
-	uint32_t kbuf_size;
-	uint8_t	*buf;
+	uint32_t karea_size;
+	uint8_t	*area;
 
 	// Read DMA channel parameters
 	ch_idx = params -> ch_idx;
 	proxy_fd = params -> proxy_fd;
-	kbuf_size = params -> kernel_buf_sz;
+	karea_size = params -> kernel_area_sz;
 
 	// Map the kernel buffer memory into user space
-	buf = (uint8_t	*)mmap(NULL, kbuf_size, 
+	area = (uint8_t	*)mmap(NULL, karea_size, 
 				PROT_READ | PROT_WRITE,
 				MAP_SHARED, proxy_fd, 0);
 
 	// Check memory mapping result
-	if(buf == MAP_FAILED) {
+	if(area == MAP_FAILED) {
 		printf("dma-uapp: Failed to map kernel memory, ch_idx=%d \n",ch_idx);
 
 		// Memory mapping failed
@@ -471,7 +1346,20 @@ static int chRcMemMap(CHRC_PARAMS_t *params)
 	}
 
 	// Store mapped memory pointer in DMA channel parameters
-	params -> kernel_buf = buf;
+	params -> kernel_area = area;
+
+	// Map the completion metadata area (follows the buffer area)
+	area = (uint8_t	*)mmap(NULL, params -> meta_sz, PROT_READ,
+				MAP_SHARED, proxy_fd, params -> meta_offs);
+	if(area == MAP_FAILED) {
+		printf("dma-uapp: Failed to map metadata area, ch_idx=%d \n",ch_idx);
+
+		// Memory mapping failed
+		return -1;
+	}
+
+	// Store the pointer to the metadata entries (indexed by buffer index)
+	params -> meta = (const _DM_META_t *)area;
 
 	// The memory was mapped successfully
 	return 0;		
@@ -485,58 +1373,132 @@ static int chRcMemMap(CHRC_PARAMS_t *params)
 *******************************************************************************/
 static void chRcMemUnmap(CHRC_PARAMS_t *params)
 {
-	uint8_t *kernel_buf;
-	uint32_t kbuf_size;
+	uint8_t *kernel_area;
+	uint32_t karea_size;
 	
 	// Read DMA channel parameters
-	kernel_buf = params -> kernel_buf;
-	kbuf_size = params -> kernel_buf_sz;
+	kernel_area = params -> kernel_area;
+	karea_size = params -> kernel_area_sz;
 
 	// Unmap kernel buffer memory if it was mapped
-	if(kernel_buf != NULL)
-		munmap(kernel_buf, kbuf_size);
+	if(kernel_area != NULL)
+		munmap(kernel_area, karea_size);
+
+	// Unmap the metadata area if it was mapped
+	if(params -> meta != NULL)
+		munmap((void *)params -> meta, params -> meta_sz);
+	params -> meta = NULL;
 
-	// Clear the pointer to the kernel buffer
+	// Clear the pointers to the kernel memory
+	params -> kernel_area = NULL;
 	params -> kernel_buf = NULL;
 }
 
-/*************************** chRcDataCycle(params) ****************************
-* Dma receive cycle
-* In the cycle:
-*	- clears kernel buffer before data receiving
-*	- performs single dma receive operation
-*	- prints received data
-*	- stores received data in the file
-* The function returns only in case of errors
+/************************** chRcDataService(params) ***************************
+* Dma receive service: called by the poll cycle when the channel is ready
+* Stores all received frames, which can be dequeued without blocking.
+* For each frame:
+*	- dequeues the buffer with received data
+*	- prints received data (test mode)
+*	- copies received data into the writer ring (the writer thread stores
+*	  it in the file: the storage latency does not delay the next queue),
+*	  the frame dropped by the full ring is not counted as received
+*	- clears the buffer (test mode) and queues it again for data receiving
+* Used variables:
+*	(i)chrc_count - number of frames to receive (0 - until stopped)
+*	(i)chrc_verbose - flag: test mode
 * Parameter:
-*	(i)params - DMA channel data operation parameters
+*	(io)params - DMA channel data operation parameters
 * Return value:
+*	 1 Success. More frames are expected from the channel
+*	 0 Success. All frames were received
 *	-1 DMA receive operation failed
 *******************************************************************************/
-static int chRcDataCycle(CHRC_PARAMS_t *params)
+static int chRcDataService(CHRC_PARAMS_t *params)
+{
+	int rc;
+
+	// DMA receive cycle: serve all finished buffers
+	while(chrc_count == 0 || params -> frames_left > 0) {
+		// Dequeue the buffer with received data (does not block)
+		rc = chRcDataDqbuf(params);
+		if(rc < 0) return -1;	// DMA receive transaction failed
+		if(rc == 0) return 1;	// No more finished buffers, wait for the next
+
+		// Print received data
+		if(chrc_verbose) chRcDataPrint(params);
+
+		// Hand received data over to the writer thread
+		rc = chWrPush(params);
+		if(rc < 0) return -1;	// The writer can not write to the file
+
+		// One more frame was received, count the frame handed over to
+		// the writer (the dropped frames are counted by the ring)
+		if(chrc_count != 0) params -> frames_left--;
+		if(rc == 0) {
+			params -> frames++;
+			params -> bytes += params -> data_len;
+		}
+
+		// The transfers were stopped by timeout/abort: the channel is finished
+		if(params -> stopped) return 0;
+
+		// Clear kernel buffer before data receiving
+		if(chrc_verbose) chRcDataClrBuf(params);
+
+		// Queue the buffer again
+		rc = chRcDataQbuf(params, params -> buf_idx);
+		if(rc < 0) return -1;	// Can not queue the buffer
+	}
+
+	// All frames were received
+	return 0;
+}
+
+/*************************** chRcDataStart(params) ****************************
+* Start streaming on DMA channel buffer queue
+* Clears and queues all channel buffers, starts streaming
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success. Streaming was started
+*	-1 Error. Can not start streaming
+*******************************************************************************/
+static int chRcDataStart(CHRC_PARAMS_t *params)
 {
-	int rc, i;
+	uint32_t buf_idx;
+	int rc;
+
+	// Queue all channel buffers
+	for(buf_idx = 0; buf_idx < params -> kernel_buf_num; buf_idx++) {
+		// Set the pointer to the buffer in the mapped area
+		params -> kernel_buf = params -> kernel_area +
+			_DM_BUF_OFFS(params -> kernel_buf_sz, buf_idx);
+
+		// Begin CPU access to the buffer
+		rc = chRcDataCpuAcc(params, buf_idx, _DM_IOCTL_CPU_BEG);
+		if(rc < 0) return -1;			// Can not access the buffer
 
-	// DMA receive infinite cycle
-	//while(1)
-	for(i=0;i<1;i++) {
 		// Clear kernel buffer before data receiving
 		chRcDataClrBuf(params);
 
-		// Perform single DMA receive transaction
-		rc = chRcDataTran(params);
-		if(rc < 0) break;		// DMA receive transaction failed
+		// Queue the buffer
+		rc = chRcDataQbuf(params, buf_idx);
+		if(rc < 0) return -1;			// Can not queue the buffer
+	}
 
-		// Print received data
-		chRcDataPrint(params);
+	// Start streaming
+	rc = ioctl(params -> proxy_fd, _DM_IOCTL_STRM_ON);
+	if(rc != 0) {
+		printf("dma-uapp: Can not start streaming, ch_idx=%d \n",
+			params -> ch_idx);
 
-		// Write received data into the file
-		rc = chRcFlDtWrite(params);
-		if(rc < 0) break;		// Can not write to the file
+		// Can not start streaming
+		return -1;
 	}
 
-	// DMA receive operation failed
-	return -1;
+	// Streaming was started successfully
+	return 0;
 }
 
 /*************************** chRcDataClrBuf(params) ***************************
@@ -548,31 +1510,67 @@ static void chRcDataClrBuf(CHRC_PARAMS_t *params)
 {
 	uint8_t *kernel_buf;
 	uint32_t kbuf_size;
-	uint32_t i;
 
 	// Get the pointer to the mapped kernel buffer, read buffer size
 	kernel_buf = params -> kernel_buf;
 	kbuf_size = params -> kernel_buf_sz;
 
-	// Clear the buffer in a cycle
-	for(i = 0; i < kbuf_size; i++)
-		kernel_buf[i] = 0;
+	// Clear the buffer
+	memset(kernel_buf, 0, kbuf_size);
+}
+
+/************************ chRcDataQbuf(params,buf_idx) ************************
+* Queue the buffer for DMA data receiving
+* CPU access to the buffer is finished before queueing
+* Parameters:
+*	(i)params - DMA channel data operation parameters
+*	(i)buf_idx - index of the buffer to queue
+* Return value:
+*	 0 Success. The buffer was queued
+*	-1 Error. Can not queue the buffer
+*******************************************************************************/
+static int chRcDataQbuf(CHRC_PARAMS_t *params, uint32_t buf_idx)
+{
+	_DM_BUF_t buf;
+	int rc;
+
+	// End CPU access to the buffer (hand it over to DMA device)
+	rc = chRcDataCpuAcc(params, buf_idx, _DM_IOCTL_CPU_END);
+	if(rc < 0) return -1;				// Can not release the buffer
+
+	// Set the index of the buffer to queue
+	buf.buf_idx = buf_idx;
+
+	// Queue the buffer
+	rc = ioctl(params -> proxy_fd, _DM_IOCTL_QBUF, &buf);
+	if(rc != 0) {
+		printf("dma-uapp: Can not queue the buffer, ch_idx=%d buf_idx=%d \n",
+			params -> ch_idx, buf_idx);
+
+		// Can not queue the buffer
+		return -1;
+	}
+
+	// The buffer was queued successfully
+	return 0;
 }
 
-/**************************** chRcDataTran(params) ****************************
-* Perform single DMA receive transaction
-* This function can block.
+/*************************** chRcDataDqbuf(params) ****************************
+* Dequeue the buffer with received data (finished DMA receive transaction)
+* The dequeued buffer becomes the current kernel buffer
+* The function does not block (DMA proxy device is opened with O_NONBLOCK)
 * Parameter:
 *	(io)params - DMA channel data operation parameters
 * Return value:
-*	 0 Success. DMA receive transaction was executed
+*	 1 Success. DMA receive transaction was executed
+*	 0 No finished DMA receive transactions yet
 *	-1 DMA receive transaction failed
 *******************************************************************************/
-static int chRcDataTran(CHRC_PARAMS_t *params)
+static int chRcDataDqbuf(CHRC_PARAMS_t *params)
 {
 	uint32_t ch_idx;
 	int proxy_fd;
-	_DM_TRAN_RESULT_t res;
+	_DM_BUF_t buf;
 	uint32_t res_code;
 	int rc;
 
@@ -580,13 +1578,43 @@ static int chRcDataTran(CHRC_PARAMS_t *params)
 	ch_idx = params -> ch_idx;
 	proxy_fd = params -> proxy_fd;
 
-	// Execute DMA receive transaction
-	// (the function can block here)
-	rc = ioctl(proxy_fd, _DM_IOCTL_TRAN_RC, &res);
-	if(rc != 0) return -1;				// Can not execute DMA transaction
+	// Dequeue the buffer with received data
+	rc = ioctl(proxy_fd, _DM_IOCTL_DQBUF, &buf);
+	if(rc != 0) {
+		if(errno == EAGAIN) return 0;	// No finished buffers yet
+		return -1;						// Can not dequeue the buffer
+	}
+
+	// Set the pointer to the dequeued buffer in the mapped area
+	params -> buf_idx = buf.buf_idx;
+	params -> kernel_buf = params -> kernel_area +
+		_DM_BUF_OFFS(params -> kernel_buf_sz, buf.buf_idx);
+
+	// Begin CPU access to the buffer (invalidates cache in cached memory mode)
+	rc = chRcDataCpuAcc(params, buf.buf_idx, _DM_IOCTL_CPU_BEG);
+	if(rc < 0) return -1;				// Can not access the buffer
+
+	// Check completion sequence number and time in the metadata area
+	// (the driver marks the stall of the stream before the buffer)
+	if(params -> meta != NULL) {
+		chRcDataSeq(params, params -> meta[buf.buf_idx].seq,
+			params -> meta[buf.buf_idx].ts_ns);
+		if(params -> meta[buf.buf_idx].flags & _DM_META_STALL)
+			printf("dma-uapp: Stream stalled (no buffers), ch_idx=%d seq=%u \n",
+				ch_idx, params -> meta[buf.buf_idx].seq);
+	}
 
 	// Read DMA transaction result code
-	res_code = res.res_code;
+	res_code = buf.res_code;
+
+	// The transfer was stopped by timeout/abort: keep the partial data
+	if(res_code == _DM_TRAN_RES_TIMEOUT || res_code == _DM_TRAN_RES_ABORTED) {
+		chRcDataStopped(params, res_code, buf.residue);
+		return 1;
+	}
+
+	// All the buffer is received
+	params -> data_len = params -> kernel_buf_sz;
 
 	// Check the result code
 	if(res_code != _DM_TRAN_RES_SUCCESS){
@@ -598,7 +1626,65 @@ static int chRcDataTran(CHRC_PARAMS_t *params)
 	}
 
 	// DMA receive transaction was executed successfully
-	return 0;
+	return 1;
+}
+
+/****************** chRcDataStopped(params,res_code,residue) ******************
+* Process the transfer stopped by timeout or abort: set the length of the
+*	partially received data, mark the channel stopped
+* Parameters:
+*	(io)params - DMA channel data operation parameters
+*	(i)res_code - DMA transaction result code
+*	(i)residue - number of bytes not transferred
+*******************************************************************************/
+static void chRcDataStopped(CHRC_PARAMS_t *params, uint32_t res_code,
+	uint32_t residue)
+{
+	// Set received data length (the residue can not exceed the buffer size)
+	if(residue > params -> kernel_buf_sz) residue = params -> kernel_buf_sz;
+	params -> data_len = params -> kernel_buf_sz - residue;
+
+	// The channel transfers were stopped
+	params -> stopped = 1;
+
+	printf("dma-uapp: Transfer %s, %d bytes of partial data, ch_idx=%d \n",
+		(res_code == _DM_TRAN_RES_TIMEOUT) ? "timed out" : "aborted",
+		params -> data_len, params -> ch_idx);
+}
+
+/*********************** chRcDataSeq(params,seq,ts_ns) ************************
+* Check the completion sequence number of the received buffer: the numbers
+*	of consecutive completions differ by one, a gap means that completions
+*	were missed (were not dequeued before the buffers were reused)
+* Parameters:
+*	(io)params - DMA channel data operation parameters
+*	(i)seq - completion sequence number of the received buffer
+*	(i)ts_ns - completion time of the received buffer (ns, monotonic)
+*******************************************************************************/
+static void chRcDataSeq(CHRC_PARAMS_t *params, uint32_t seq, uint64_t ts_ns)
+{
+	uint32_t lost;
+
+	// Keep the maximum interval between completions (stall)
+	if(params -> seq_valid && ts_ns > params -> ts_ns) {
+		if(ts_ns - params -> ts_ns > params -> stall_ns)
+			params -> stall_ns = ts_ns - params -> ts_ns;
+		if(params -> stall_ns > params -> stall_max_ns)
+			params -> stall_max_ns = params -> stall_ns;
+	}
+
+	// Count the completions missed since the previous buffer
+	if(params -> seq_valid && seq != params -> seq + 1) {
+		lost = seq - params -> seq - 1;
+		params -> seq_lost += lost;
+		printf("dma-uapp: Sequence gap, %u completions lost, ch_idx=%d "
+			"seq=%u \n", lost, params -> ch_idx, seq);
+	}
+
+	// Store sequence number and completion time of the received buffer
+	params -> seq = seq;
+	params -> seq_valid = 1;
+	params -> ts_ns = ts_ns;
 }
 
 /*************************** chRcDataPrint(params) ****************************
@@ -615,12 +1701,15 @@ static void chRcDataPrint(CHRC_PARAMS_t *params)
 	// Get DMA channel index
 	ch_idx = params -> ch_idx;
 
-	// Get the pointer to the mapped kernel buffer, read buffer size
+	// Get the pointer to the mapped kernel buffer, read received data length
 	kernel_buf = params -> kernel_buf;
-	kbuf_size = params -> kernel_buf_sz;
+	kbuf_size = params -> data_len;
 
 	// Print received data
-	printf("Received length=%.8x ch_idx=%d \n", kbuf_size, ch_idx);
+	printf("Received length=%.8x ch_idx=%d seq=%u ts=%llu.%.9llu \n",
+		kbuf_size, ch_idx, params -> seq,
+		(unsigned long long)(params -> ts_ns / 1000000000ULL),
+		(unsigned long long)(params -> ts_ns % 1000000000ULL));
 	/*for(i = 0; i < kbuf_size; i++){
 		if(i % 0x10 == 0) printf("\n");
 		printf("%.2x ", kernel_buf[i]);
@@ -631,6 +1720,212 @@ static void chRcDataPrint(CHRC_PARAMS_t *params)
 	fflush(stdout);
 }
 
+/************************** chRcDataMeta(params,meta) *************************
+* Get the completion metadata of the dequeued buffer
+* Without the metadata area (zero-copy receive) the sequence number is
+*	the frame number, the time is the receive time
+* Parameters:
+*	(i)params - DMA channel data operation parameters
+*	(o)meta - completion metadata
+*******************************************************************************/
+static void chRcDataMeta(CHRC_PARAMS_t *params, _DM_META_t *meta)
+{
+	struct timespec ts;
+
+	// Copy the metadata of the buffer
+	if(params -> meta != NULL) {
+		*meta = params -> meta[params -> buf_idx];
+		return;
+	}
+
+	// Set the metadata of the received data
+	memset(meta, 0, sizeof(_DM_META_t));
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	meta -> ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	meta -> seq = params -> frames;
+	meta -> res_code = params -> stopped ? _DM_TRAN_RES_TIMEOUT :
+		_DM_TRAN_RES_SUCCESS;
+}
+
+/***************************** chRcUsrRun(ch_idx) *****************************
+* Receive and store data from DMA channel in zero-copy mode
+* DMA engine writes the data directly into the user buffer (normal cached
+*	memory), the data is written to the file from there: no channel buffer
+*	and no pass over uncached memory is needed
+* Receiving stops after the frames, the duration or by SIGINT
+* Used variables:
+*	(o)chrc_params - channel data operation parameters
+*	(i)chrc_count - number of frames to receive (0 - until stopped)
+*	(i)chrc_secs - acquisition duration (s)
+*	(i)chrc_stop - flag: stop was requested
+* Parameter:
+*	(i)ch_idx - DMA channel index
+* Return value:
+*	 0 Success. All frames were received
+*	-1 Error. Data receiving failed
+*******************************************************************************/
+static int chRcUsrRun(uint32_t ch_idx)
+{
+	CHRC_PARAMS_t *params;
+	void *user_buf;
+	double t_beg;
+	int rc;
+
+	// Init DMA channel operation parameters
+	chRcInitParams(ch_idx);
+
+	// Set the pointer to the DMA channel operation parameters
+	params = &chrc_params[ch_idx];
+
+	// Open DMA proxy character device
+	rc = chRcFlProxyOpen(params);
+	if(rc < 0) goto CHRC_ERR;
+
+	// Set transfer geometry, get buffer sizes
+	rc = chRcGeom(params);
+	if(rc < 0) goto CHRC_ERR;
+
+	// Open file for writing received data
+	rc = chRcFlDtOpen(params);
+	if(rc < 0) goto CHRC_ERR;
+
+	// Allocate page aligned user buffer
+	rc = posix_memalign(&user_buf, _DM_PAGE_SZ, params -> kernel_buf_sz);
+	if(rc != 0) goto CHRC_ERR;
+	params -> user_buf = user_buf;
+
+	// Received data is taken from the user buffer
+	params -> kernel_buf = params -> user_buf;
+
+	// DMA receive cycle (until the frames are received, the duration is
+	// over or the stop is requested)
+	t_beg = chBmTimeGet();
+	while((chrc_count == 0 || params -> frames_left > 0) && !chrc_stop &&
+			(chrc_secs == 0 || chBmTimeGet() - t_beg < chrc_secs)) {
+		// Receive data into the user buffer (SIGINT interrupts the request)
+		rc = chRcUsrTran(params);
+		if(rc < 0 && chrc_stop) break;
+		if(rc < 0) goto CHRC_ERR;
+
+		// Print received data
+		if(chrc_verbose) chRcDataPrint(params);
+
+		// Write received data into the file
+		rc = chRcFlDtWrite(params);
+		if(rc < 0) goto CHRC_ERR;
+
+		// One more frame was received
+		if(chrc_count != 0) params -> frames_left--;
+		params -> frames++;
+		params -> bytes += params -> data_len;
+
+		// The transfer was stopped by timeout: the channel is finished
+		if(params -> stopped) break;
+	}
+
+	printf("dma-uapp: Data receiving finished ch_idx=%d: %llu frames, "
+		"%.1f MB/s \n", ch_idx, (unsigned long long)params -> frames,
+		params -> bytes / 1e6 / (chBmTimeGet() - t_beg));
+
+	// Free all resources allocated for the channel
+	chRcFinalize(params);
+
+	// All frames were received successfully
+	return 0;
+
+CHRC_ERR:
+	printf("dma-uapp: Data receiving failed ch_idx=%d \n", ch_idx);
+
+	// Free all resources allocated for the channel
+	chRcFinalize(params);
+
+	// Data receiving failed
+	return -1;
+}
+
+/**************************** chRcUsrTran(params) *****************************
+* Execute DMA receive transaction into the user buffer
+* The function blocks until the transaction is finished
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success. DMA receive transaction was executed
+*	-1 DMA receive transaction failed
+*******************************************************************************/
+static int chRcUsrTran(CHRC_PARAMS_t *params)
+{
+	_DM_USR_TRAN_t utran;
+	int rc;
+
+	// Set user buffer address and size
+	utran.uaddr = (uintptr_t)params -> user_buf;
+	utran.len = params -> kernel_buf_sz;
+	utran.res_code = _DM_TRAN_RES_ERROR;
+
+	// Receive data into the user buffer
+	rc = ioctl(params -> proxy_fd, _DM_IOCTL_TRAN_USR, &utran);
+
+	// Check completion sequence number and time
+	if(rc == 0) chRcDataSeq(params, utran.seq, utran.ts_ns);
+
+	// The transfer was stopped by timeout/abort: keep the partial data
+	if(rc == 0 && (utran.res_code == _DM_TRAN_RES_TIMEOUT ||
+			utran.res_code == _DM_TRAN_RES_ABORTED)) {
+		chRcDataStopped(params, utran.res_code, utran.residue);
+		return 0;
+	}
+
+	// All the buffer is received
+	params -> data_len = params -> kernel_buf_sz;
+
+	// Check the result
+	if(rc != 0 || utran.res_code != _DM_TRAN_RES_SUCCESS) {
+		printf("dma-uapp: DMA transaction failed, ch_idx=%d res_code=%d \n",
+			params -> ch_idx, utran.res_code);
+
+		// DMA receive transaction failed
+		return -1;
+	}
+
+	// DMA receive transaction was executed successfully
+	return 0;
+}
+
+/********************* chRcDataCpuAcc(params,buf_idx,req) *********************
+* Begin/end CPU access to the buffer owned by user
+* In cached memory mode the driver synchronizes CPU cache with the memory,
+*	in coherent memory mode the requests are cheap no-ops
+* Parameters:
+*	(i)params - DMA channel data operation parameters
+*	(i)buf_idx - index of the buffer
+*	(i)req - ioctl request: _DM_IOCTL_CPU_BEG or _DM_IOCTL_CPU_END
+* Return value:
+*	 0 Success. The buffer was synchronized
+*	-1 Error. Can not synchronize the buffer
+*******************************************************************************/
+static int chRcDataCpuAcc(CHRC_PARAMS_t *params, uint32_t buf_idx,
+	unsigned long req)
+{
+	_DM_BUF_t buf;
+	int rc;
+
+	// Set the index of the buffer
+	buf.buf_idx = buf_idx;
+
+	// Synchronize the buffer
+	rc = ioctl(params -> proxy_fd, req, &buf);
+	if(rc != 0) {
+		printf("dma-uapp: Can not sync the buffer, ch_idx=%d buf_idx=%d \n",
+			params -> ch_idx, buf_idx);
+
+		// Can not synchronize the buffer
+		return -1;
+	}
+
+	// The buffer was synchronized successfully
+	return 0;
+}
+
 /**************************** chRcFinalize(params) ****************************
 * Free all resources allocated for the channel
 * Opened file descriptors are closed here
@@ -639,6 +1934,9 @@ static void chRcDataPrint(CHRC_PARAMS_t *params)
 *******************************************************************************/
 static void chRcFinalize(CHRC_PARAMS_t *params)
 {
+	// Stop the writer thread (the frames in the ring are stored first)
+	chWrStop(params);
+
 	// Unmap kernel buffer memory from user space
 	chRcMemUnmap(params);
 
@@ -647,6 +1945,2016 @@ static void chRcFinalize(CHRC_PARAMS_t *params)
 
 	// Close local file with received data
 	chRcFlDtClose(params);
+
+	// Free user buffer (zero-copy receive)
+	free(params -> user_buf);
+	params -> user_buf = NULL;
+	params -> kernel_buf = NULL;
+}
+
+/****************************** chWrStart(params) *****************************
+* Allocate the writer ring of the channel, start the writer thread
+* Used variable:
+*	(i)chwr_slots - number of frame slots in the ring
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success. The writer thread was started
+*	-1 Error. Can not allocate the ring or start the thread
+*******************************************************************************/
+static int chWrStart(CHRC_PARAMS_t *params)
+{
+	CHWR_RING_t *ring;
+	void *mem;
+	int rc;
+
+	// Set the pointer to the writer ring
+	ring = &(params -> ring);
+
+	// Allocate page aligned slot memory and slot lengths
+	ring -> slots = chwr_slots;
+	ring -> slot_sz = _DM_BUF_STRIDE(params -> kernel_buf_sz);
+	rc = posix_memalign(&mem, _DM_PAGE_SZ, (size_t)ring -> slots *
+		ring -> slot_sz);
+	if(rc != 0) return -1;				// Can not allocate the ring
+	ring -> mem = mem;
+	ring -> len = calloc(ring -> slots, sizeof(uint32_t));
+	if(ring -> len == NULL) return -1;	// Can not allocate the ring
+	ring -> meta = calloc(ring -> slots, sizeof(_DM_META_t));
+	if(ring -> meta == NULL) return -1;	// Can not allocate the ring
+
+	// The ring is empty
+	ring -> head = 0;
+	ring -> tail = 0;
+	ring -> idle = 0;
+	ring -> stop = 0;
+	ring -> wr_err = 0;
+	ring -> hwm = 0;
+	ring -> overflows = 0;
+
+	// Start the writer thread
+	pthread_mutex_init(&(ring -> lock), NULL);
+	pthread_cond_init(&(ring -> cond), NULL);
+	rc = pthread_create(&(ring -> thread), NULL, chWrThread, params);
+	if(rc != 0) {
+		printf("dma-uapp: Can not start the writer, ch_idx=%d \n",
+			params -> ch_idx);
+
+		// Can not start the thread
+		pthread_cond_destroy(&(ring -> cond));
+		pthread_mutex_destroy(&(ring -> lock));
+		return -1;
+	}
+	ring -> thread_run = 1;
+
+	// The writer thread was started successfully
+	return 0;
+}
+
+/****************************** chWrStop(params) ******************************
+* Stop the writer thread: the frames in the ring are stored, the thread
+*	exits. The ring memory is freed.
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+*******************************************************************************/
+static void chWrStop(CHRC_PARAMS_t *params)
+{
+	CHWR_RING_t *ring;
+
+	// Set the pointer to the writer ring
+	ring = &(params -> ring);
+
+	// No more frames: the writer drains the ring and exits
+	if(ring -> thread_run) {
+		pthread_mutex_lock(&(ring -> lock));
+		__atomic_store_n(&(ring -> stop), 1, __ATOMIC_RELEASE);
+		pthread_cond_signal(&(ring -> cond));
+		pthread_mutex_unlock(&(ring -> lock));
+		pthread_join(ring -> thread, NULL);
+		ring -> thread_run = 0;
+
+		// Free the thread resources
+		pthread_cond_destroy(&(ring -> cond));
+		pthread_mutex_destroy(&(ring -> lock));
+	}
+
+	// Free the ring memory
+	free(ring -> mem);
+	free(ring -> len);
+	free(ring -> meta);
+	ring -> mem = NULL;
+	ring -> len = NULL;
+	ring -> meta = NULL;
+}
+
+/****************************** chWrPush(params) ******************************
+* Copy the received data and the completion metadata of the dequeued buffer
+*	into the next slot of the writer ring (producer side). The full ring
+*	does not block the capture: the frame is dropped and counted.
+* The idle writer (the ring was empty) is woken up
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success. The frame was put into the ring
+*	 1 Success. The ring is full, the frame was dropped
+*	-1 Error. The writer thread stopped (write error)
+*******************************************************************************/
+static int chWrPush(CHRC_PARAMS_t *params)
+{
+	CHWR_RING_t *ring;
+	uint32_t head, tail, slot;
+
+	// Set the pointer to the writer ring
+	ring = &(params -> ring);
+
+	// The writer stopped by write error
+	if(__atomic_load_n(&(ring -> wr_err), __ATOMIC_ACQUIRE)) {
+		printf("dma-uapp: Can not write the file, ch_idx=%d \n",
+			params -> ch_idx);
+		return -1;
+	}
+
+	// Read the indexes (the tail is written by the writer)
+	head = ring -> head;
+	tail = __atomic_load_n(&(ring -> tail), __ATOMIC_ACQUIRE);
+
+	// The ring is full: drop the frame
+	if(head - tail >= ring -> slots) {
+		ring -> overflows++;
+		return 1;
+	}
+
+	// Copy the data into the slot
+	slot = head % ring -> slots;
+	memcpy(ring -> mem + (size_t)slot * ring -> slot_sz, params -> kernel_buf,
+		params -> data_len);
+	ring -> len[slot] = params -> data_len;
+	chRcDataMeta(params, &(ring -> meta[slot]));
+
+	// Publish the slot (the data is visible before the head). The head is
+	// stored before the idle flag is read, the writer sets the flag before
+	// it reads the head: either the writer sees the frame or it is woken up.
+	__atomic_store_n(&(ring -> head), head + 1, __ATOMIC_SEQ_CST);
+
+	// Wake up the idle writer
+	if(__atomic_load_n(&(ring -> idle), __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&(ring -> lock));
+		pthread_cond_signal(&(ring -> cond));
+		pthread_mutex_unlock(&(ring -> lock));
+	}
+
+	// Update the high-water mark
+	if(head + 1 - tail > ring -> hwm) ring -> hwm = head + 1 - tail;
+
+	// The frame was put into the ring
+	return 0;
+}
+
+/******************************* chWrThread(arg) ******************************
+* Writer thread: store the frames of the ring in the file (consumer side)
+* The file is flushed when the ring becomes empty, the thread waits on the
+*	ring condition while the ring is empty (the capture signals the put
+*	frame and the stop). After the stop request the ring is drained. The
+*	write error stops the thread (the capture stops the channel).
+* The signals are blocked: SIGINT is served by the capture thread
+* Parameter:
+*	(io)arg - DMA channel data operation parameters (CHRC_PARAMS_t)
+* Return value:
+*	NULL always
+*******************************************************************************/
+static void *chWrThread(void *arg)
+{
+	CHRC_PARAMS_t *params;
+	CHWR_RING_t *ring;
+	uint32_t head, tail, slot;
+	uint32_t stop, dirty;
+	sigset_t sigs;
+	int rc;
+
+	// Set the pointers to the channel parameters and the writer ring
+	params = arg;
+	ring = &(params -> ring);
+
+	// Block the signals in the writer thread
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	// Write cycle
+	dirty = 0;
+	tail = ring -> tail;
+	while(1) {
+		// Read the stop flag before the head: the frames published before
+		// the stop are drained
+		stop = __atomic_load_n(&(ring -> stop), __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&(ring -> head), __ATOMIC_ACQUIRE);
+
+		// The ring is empty: flush the file, exit or wait for the frames
+		if(tail == head) {
+			if(dirty) chStFlush(params);
+			dirty = 0;
+			if(stop) break;
+
+			// Set the idle flag before the head is read again (the capture
+			// stores the head before it reads the flag), wait for the frame
+			// or the stop
+			pthread_mutex_lock(&(ring -> lock));
+			__atomic_store_n(&(ring -> idle), 1, __ATOMIC_SEQ_CST);
+			while(__atomic_load_n(&(ring -> head), __ATOMIC_SEQ_CST) == tail &&
+				!__atomic_load_n(&(ring -> stop), __ATOMIC_ACQUIRE))
+				pthread_cond_wait(&(ring -> cond), &(ring -> lock));
+			__atomic_store_n(&(ring -> idle), 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&(ring -> lock));
+			continue;
+		}
+
+		// Write the oldest frame
+		slot = tail % ring -> slots;
+		rc = chStFrame(params, &(ring -> meta[slot]),
+			ring -> mem + (size_t)slot * ring -> slot_sz, ring -> len[slot]);
+		if(rc < 0) {
+			// Write error: stop the thread
+			__atomic_store_n(&(ring -> wr_err), 1, __ATOMIC_RELEASE);
+			break;
+		}
+		dirty = 1;
+
+		// Free the slot
+		tail++;
+		__atomic_store_n(&(ring -> tail), tail, __ATOMIC_RELEASE);
+	}
+
+	// The thread is finished
+	return NULL;
+}
+
+/*********************** chStOpen(params,fname,direct) ************************
+* Open the file for storing data: stdio stream or direct I/O storage
+* If a segment limit is set (params -> seg), the first segment is opened
+*	and the segment thread is started. The container file header is
+*	written if the format is set (params -> rec).
+* Parameters:
+*	(io)params - DMA channel data operation parameters
+*	(i)fname - file name (base name of the segments)
+*	(i)direct - flag: direct I/O storage (1)
+* Return value:
+*	 0 Success. The file was opened
+*	-1 Error. Can not open the file
+*******************************************************************************/
+static int chStOpen(CHRC_PARAMS_t *params, const char *fname,
+	uint32_t direct)
+{
+	char name[CHST_NAME_LEN];
+	CHST_SEG_t *seg;
+	FILE *file;
+	int rc;
+
+	// Set the pointer to the segmented file
+	seg = &(params -> seg);
+
+	// The file is empty
+	seg -> bytes = 0;
+	seg -> frames = 0;
+
+	// The file is segmented: open the first segment
+	seg -> name = fname;
+	if(seg -> max_sz != 0 || seg -> max_secs != 0) {
+		chStSegName(seg, 0, name);
+		fname = name;
+	}
+
+	// Open the file with direct I/O
+	if(direct) {
+		rc = chDioOpen(&(params -> dio), fname);
+		if(rc < 0) return -1;			// Can not open the file
+		seg -> direct = params -> dio.direct;
+	}
+	else {
+		// Open the file for writing
+		file = fopen(fname,"wb");
+		if(file == NULL) return -1;		// Can not open the file
+
+		// Set file structure pointer in DMA channel parameters
+		params -> file_store = file;
+
+		// Preallocate the first segment (cut on close), the preallocation
+		// is skipped if the file system does not support it
+		if(seg -> max_sz != 0 &&
+				fallocate(fileno(file), 0, 0, seg -> max_sz) != 0 &&
+				errno != EOPNOTSUPP)
+			return -1;					// Can not allocate the segment
+	}
+
+	// Write the container file header
+	if(params -> rec.on) {
+		rc = chStRecHdr(params);
+		if(rc < 0) return -1;			// Can not write the header
+	}
+
+	// Start the segment thread: the next segment is prepared
+	if(seg -> max_sz != 0 || seg -> max_secs != 0)
+		return chStSegStart(params);
+
+	// The file was opened successfully
+	return 0;
+}
+
+/************************** chStPut(params,data,len) **************************
+* Write the data into the opened file
+* Parameters:
+*	(io)params - DMA channel data operation parameters
+*	(i)data - pointer to the data
+*	(i)len - data length (b)
+* Return value:
+*	 0 Success. The data was written (or queued for direct I/O)
+*	-1 Error. The data was not written
+*******************************************************************************/
+static int chStPut(CHRC_PARAMS_t *params, const uint8_t *data, uint32_t len)
+{
+	size_t sz;
+
+	// Count the bytes of the file (segment)
+	params -> seg.bytes += len;
+
+	// Collect the data into the direct I/O batch
+	if(params -> dio.fd >= 0) return chDioWrite(&(params -> dio), data, len);
+
+	// Write the data into the stdio stream
+	sz = fwrite(data, 1, len, params -> file_store);
+	if(sz != len) return -1;			// Data was not written to the file
+
+	// Data was written successfully
+	return 0;
+}
+
+/********************** chStFrame(params,meta,data,len) ***********************
+* Write one frame (DMA transaction data) into the opened file
+* The frame is written into the next segment if the current one is full or
+*	its time is over (the frame is not split between the segments).
+*	In the container format the frame header is written before the data,
+*	the frame offset is added to the index.
+* Parameters:
+*	(io)params - DMA channel data operation parameters
+*	(i)meta - completion metadata of the frame
+*	(i)data - pointer to the frame data
+*	(i)len - data length (b)
+* Return value:
+*	 0 Success. The frame was written (or queued for direct I/O)
+*	-1 Error. The frame was not written
+*******************************************************************************/
+static int chStFrame(CHRC_PARAMS_t *params, const _DM_META_t *meta,
+	const uint8_t *data, uint32_t len)
+{
+	_DR_FRAME_HDR_t hdr;
+	CHST_SEG_t *seg;
+	CHST_REC_t *rec;
+	uint64_t *index;
+	uint64_t need;
+	int rc;
+
+	// Set the pointers to the segmented file and to the container writer
+	seg = &(params -> seg);
+	rec = &(params -> rec);
+
+	// Bytes to add to the file: the frame and, in the container format,
+	// its header, the index (with the new entry) and the trailer
+	need = len;
+	if(rec -> on)
+		need += sizeof(_DR_FRAME_HDR_t) + sizeof(_DR_FRAME_HDR_t) +
+			(rec -> num + 1) * sizeof(uint64_t) + sizeof(_DR_TRAILER_t);
+
+	// The segment is full or its time is over: switch to the next segment
+	if(seg -> thread_run && seg -> frames != 0 &&
+			((seg -> max_sz != 0 && seg -> bytes + need > seg -> max_sz) ||
+			(seg -> max_secs != 0 &&
+			chBmTimeGet() - seg -> t_beg >= seg -> max_secs))) {
+		// Close the container file of the segment with its index
+		if(rec -> on) {
+			rc = chStRecIndex(params);
+			if(rc < 0) return -1;		// Can not write the index
+		}
+
+		// Switch the segment
+		rc = chStSegSwitch(params);
+		if(rc < 0) return -1;			// Can not switch the segment
+
+		// Start the container file of the next segment
+		if(rec -> on) {
+			rc = chStRecHdr(params);
+			if(rc < 0) return -1;		// Can not write the header
+		}
+	}
+
+	// Container format: index the frame, write the frame header
+	if(rec -> on) {
+		// Grow the index
+		if(rec -> num == rec -> max) {
+			index = realloc(rec -> index, (rec -> max ? rec -> max * 2 :
+				CHST_INDEX_NUM) * sizeof(uint64_t));
+			if(index == NULL) return -1;	// Can not grow the index
+			rec -> index = index;
+			rec -> max = rec -> max ? rec -> max * 2 : CHST_INDEX_NUM;
+		}
+
+		// The frame starts at the current file offset
+		rec -> index[rec -> num++] = seg -> bytes;
+
+		// Write the frame header
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.magic = _DR_FRAME_MAGIC;
+		hdr.data_len = len;
+		hdr.frame_no = rec -> frame_no++;
+		hdr.ts_ns = meta -> ts_ns;
+		hdr.seq = meta -> seq;
+		hdr.res_code = meta -> res_code;
+		hdr.flags = meta -> flags;
+		hdr.lost = meta -> lost;
+		rc = chStPut(params, (const uint8_t *)&hdr, sizeof(hdr));
+		if(rc < 0) return -1;			// The frame was not written
+	}
+
+	// Write the frame data
+	rc = chStPut(params, data, len);
+	if(rc < 0) return -1;				// The frame was not written
+
+	// One more frame in the segment
+	seg -> frames++;
+
+	// The frame was written successfully
+	return 0;
+}
+
+/***************************** chStFlush(params) ******************************
+* Flush the opened file: the stdio buffer is written, the finished
+*	direct I/O requests are collected (the partial batch is kept)
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success
+*	-1 Error. The data was not written
+*******************************************************************************/
+static int chStFlush(CHRC_PARAMS_t *params)
+{
+	int rc;
+
+	// Collect the finished direct I/O requests (no wait)
+	if(params -> dio.fd >= 0) return chDioWait(&(params -> dio), 0);
+
+	// Write the stdio buffer to the file
+	rc = fflush(params -> file_store);
+	if(rc != 0) return -1;				// Data was not written to the file
+
+	// The file was flushed successfully
+	return 0;
 }
 
+/***************************** chStClose(params) ******************************
+* Close the file for storing data
+* The file is closed only if it was opened before. The index of the
+*	container file is written first. The segment thread is stopped
+*	(the unused preallocated segment is removed).
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success. All data was written, the file was closed
+*	-1 Error. The data was not written
+*******************************************************************************/
+static int chStClose(CHRC_PARAMS_t *params)
+{
+	int rc;
+
+	// Write the index of the container file
+	rc = 0;
+	if(params -> rec.hdr_wr) rc = chStRecIndex(params);
+
+	// Free the index
+	free(params -> rec.index);
+	params -> rec.index = NULL;
+	params -> rec.max = 0;
+	params -> rec.num = 0;
+
+	// Close the direct I/O storage (the batches are written first)
+	if(chDioClose(&(params -> dio)) < 0) rc = -1;
+
+	// Close the stdio stream only if it was opened
+	if(params -> file_store != NULL) {
+		// Cut the preallocated space of the segment
+		if(fflush(params -> file_store) != 0) rc = -1;
+		if(params -> seg.thread_run &&
+				ftruncate(fileno(params -> file_store), params -> seg.bytes) != 0)
+			rc = -1;
+		if(fclose(params -> file_store) != 0) rc = -1;
+	}
 
+	// Clear file structure pointer in DMA channel parameters
+	params -> file_store = NULL;
+
+	// Stop the segment thread (the finished segment is closed first)
+	chStSegStop(params);
+	if(params -> seg.old_err) rc = -1;
+
+	// Return the result of the writes
+	return rc;
+}
+
+/***************************** chStRecHdr(params) *****************************
+* Write the container file header at the start of the file (segment)
+* The segment index, the first record number and the start time are set,
+*	the index of the file is cleared
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success. The header was written
+*	-1 Error. The header was not written
+*******************************************************************************/
+static int chStRecHdr(CHRC_PARAMS_t *params)
+{
+	struct timespec ts;
+	CHST_REC_t *rec;
+	int rc;
+
+	// Set the pointer to the container writer
+	rec = &(params -> rec);
+
+	// Set the segment fields
+	rec -> hdr.seg_idx = params -> seg.idx;
+	rec -> hdr.first_frame = rec -> frame_no;
+
+	// Set the start time: real time and the time base of the frames
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec -> hdr.t_real_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec -> hdr.t_mono_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	// The file has no records yet
+	rec -> num = 0;
+
+	// Write the header
+	rc = chStPut(params, (const uint8_t *)&(rec -> hdr),
+		sizeof(_DR_FILE_HDR_t));
+	if(rc < 0) return -1;				// The header was not written
+	rec -> hdr_wr = 1;
+
+	// The header was written successfully
+	return 0;
+}
+
+/**************************** chStRecIndex(params) ****************************
+* Write the index and the trailer at the end of the container file
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success. The index was written
+*	-1 Error. The index was not written
+*******************************************************************************/
+static int chStRecIndex(CHRC_PARAMS_t *params)
+{
+	_DR_FRAME_HDR_t hdr;
+	_DR_TRAILER_t trl;
+	CHST_REC_t *rec;
+	int rc;
+
+	// Set the pointer to the container writer
+	rec = &(params -> rec);
+
+	// The index starts at the current file offset
+	memset(&trl, 0, sizeof(trl));
+	trl.magic = _DR_TRAIL_MAGIC;
+	trl.trl_sz = sizeof(_DR_TRAILER_t);
+	trl.index_offs = params -> seg.bytes;
+	trl.records = rec -> num;
+
+	// Write the index header
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = _DR_INDEX_MAGIC;
+	hdr.data_len = rec -> num * sizeof(uint64_t);
+	hdr.frame_no = rec -> num;
+	rc = chStPut(params, (const uint8_t *)&hdr, sizeof(hdr));
+	if(rc < 0) return -1;				// The index was not written
+
+	// Write the record offsets
+	if(rec -> num != 0) {
+		rc = chStPut(params, (const uint8_t *)rec -> index, hdr.data_len);
+		if(rc < 0) return -1;			// The index was not written
+	}
+
+	// Write the trailer
+	rc = chStPut(params, (const uint8_t *)&trl, sizeof(trl));
+	if(rc < 0) return -1;				// The index was not written
+	rec -> hdr_wr = 0;
+
+	// The index was written successfully
+	return 0;
+}
+
+/************************** chStSegName(seg,idx,name) *************************
+* Make the segment file name: <base name>.<index>
+* Parameters:
+*	(i)seg - segmented file
+*	(i)idx - segment index
+*	(o)name - segment file name (CHST_NAME_LEN)
+*******************************************************************************/
+static void chStSegName(CHST_SEG_t *seg, uint32_t idx, char *name)
+{
+	// Add the six digit index to the base name
+	snprintf(name, CHST_NAME_LEN, "%s.%06u", seg -> name, idx);
+}
+
+/**************************** chStSegStart(params) ****************************
+* Start the segment thread of the opened first segment, request the
+*	preallocation of the second one
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success. The segment thread was started
+*	-1 Error. Can not start the segment thread
+*******************************************************************************/
+static int chStSegStart(CHRC_PARAMS_t *params)
+{
+	CHST_SEG_t *seg;
+	int rc;
+
+	// Set the pointer to the segmented file
+	seg = &(params -> seg);
+
+	// The first segment is started, the next one is requested
+	seg -> idx = 0;
+	seg -> t_beg = chBmTimeGet();
+	seg -> next_req = 1;
+	seg -> next_idx = 1;
+	seg -> next_sz = seg -> max_sz ? seg -> max_sz : CHST_PREALLOC_SZ;
+	seg -> next_fd = -1;
+	seg -> old_fd = -1;
+
+	// Start the segment thread
+	pthread_mutex_init(&(seg -> lock), NULL);
+	pthread_cond_init(&(seg -> cond), NULL);
+	rc = pthread_create(&(seg -> thread), NULL, chStSegThread, params);
+	if(rc != 0) {
+		printf("dma-uapp: Can not start the segment thread, ch_idx=%d \n",
+			params -> ch_idx);
+
+		// Can not start the thread
+		pthread_cond_destroy(&(seg -> cond));
+		pthread_mutex_destroy(&(seg -> lock));
+		return -1;
+	}
+	seg -> thread_run = 1;
+
+	// The segment thread was started successfully
+	return 0;
+}
+
+/**************************** chStSegStop(params) *****************************
+* Stop the segment thread: the finished segment is closed, the prepared
+*	next segment (not used) is removed
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+*******************************************************************************/
+static void chStSegStop(CHRC_PARAMS_t *params)
+{
+	char name[CHST_NAME_LEN];
+	CHST_SEG_t *seg;
+
+	// Set the pointer to the segmented file
+	seg = &(params -> seg);
+
+	// The segment thread was not started
+	if(!seg -> thread_run) return;
+
+	// Request the exit, wait for the thread
+	pthread_mutex_lock(&(seg -> lock));
+	seg -> quit = 1;
+	pthread_cond_broadcast(&(seg -> cond));
+	pthread_mutex_unlock(&(seg -> lock));
+	pthread_join(seg -> thread, NULL);
+	seg -> thread_run = 0;
+
+	// Remove the prepared next segment
+	if(seg -> next_fd >= 0) {
+		close(seg -> next_fd);
+		chStSegName(seg, seg -> next_idx, name);
+		unlink(name);
+		seg -> next_fd = -1;
+	}
+
+	if(seg -> late != 0)
+		printf("dma-uapp: ch_idx=%d %u segment switches waited for "
+			"the preallocation \n", params -> ch_idx, seg -> late);
+
+	// Free the thread resources
+	pthread_cond_destroy(&(seg -> cond));
+	pthread_mutex_destroy(&(seg -> lock));
+}
+
+/*************************** chStSegSwitch(params) ****************************
+* Switch the storage to the next segment
+* The prepared (preallocated) next segment is taken, the finished one is
+*	given to the segment thread for closing, the segment after the next
+*	one is requested. The switch waits only if the next segment is not
+*	prepared yet (counted) or the previous segment is not closed yet.
+* Parameter:
+*	(io)params - DMA channel data operation parameters
+* Return value:
+*	 0 Success. The data is written into the next segment
+*	-1 Error. Can not switch the segment (or a finished segment was not
+*	   put on the storage)
+*******************************************************************************/
+static int chStSegSwitch(CHRC_PARAMS_t *params)
+{
+	CHST_SEG_t *seg;
+	FILE *old_file;
+	uint64_t old_sz;
+	int old_fd;
+	int fd;
+	int rc;
+
+	// Set the pointer to the segmented file
+	seg = &(params -> seg);
+
+	// Check that the finished segments were put on the storage
+	pthread_mutex_lock(&(seg -> lock));
+	if(seg -> old_err) {
+		pthread_mutex_unlock(&(seg -> lock));
+		printf("dma-uapp: Can not store the finished segment, ch_idx=%d \n",
+			params -> ch_idx);
+		return -1;						// The segment data may be lost
+	}
+
+	// Take the prepared next segment (wait if it is not ready)
+	if(seg -> next_fd < 0) seg -> late++;
+	while(seg -> next_fd < 0 && !seg -> next_err)
+		pthread_cond_wait(&(seg -> cond), &(seg -> lock));
+	fd = seg -> next_fd;
+	seg -> next_fd = -1;
+	pthread_mutex_unlock(&(seg -> lock));
+	if(fd < 0) return -1;				// Can not open the next segment
+
+	// Switch the file: the data of the finished segment is written
+	old_file = NULL;
+	old_fd = -1;
+	old_sz = seg -> bytes;
+	if(params -> dio.fd >= 0) {
+		rc = chDioSwitch(&(params -> dio), fd, seg -> next_sz, &old_fd,
+			&old_sz);
+		if(rc < 0) return -1;			// The data was not written
+	}
+	else {
+		rc = fflush(params -> file_store);
+		if(rc != 0) return -1;			// The data was not written
+		old_file = params -> file_store;
+		params -> file_store = fdopen(fd, "wb");
+		if(params -> file_store == NULL) {
+			params -> file_store = old_file;
+			close(fd);
+			return -1;					// Can not open the stream
+		}
+	}
+
+	// Give the finished segment to the segment thread, request the segment
+	// after the next one (the preallocation size follows the segment size)
+	pthread_mutex_lock(&(seg -> lock));
+	while(seg -> old_req)
+		pthread_cond_wait(&(seg -> cond), &(seg -> lock));
+	seg -> old_req = 1;
+	seg -> old_file = old_file;
+	seg -> old_fd = old_fd;
+	seg -> old_sz = old_sz;
+	seg -> next_req = 1;
+	seg -> next_idx = seg -> idx + 2;
+	if(seg -> max_sz == 0 && seg -> bytes > CHST_PREALLOC_SZ)
+		seg -> next_sz = seg -> bytes;
+	pthread_cond_broadcast(&(seg -> cond));
+	pthread_mutex_unlock(&(seg -> lock));
+
+	// The next segment is started
+	seg -> idx++;
+	seg -> bytes = 0;
+	seg -> frames = 0;
+	seg -> t_beg = chBmTimeGet();
+
+	// The segment was switched successfully
+	return 0;
+}
+
+/***************************** chStSegThread(arg) *****************************
+* Segment thread: close the finished segments, prepare the next ones
+* The finished segment is cut to its data size, put on the storage (fsync)
+*	and closed. The next segment is created and preallocated (fallocate,
+*	if supported by the file system): the segment files are not
+*	fragmented and the switch does not wait for the allocation.
+* The errors are recorded: the failed close stops the storage at the next
+*	switch (or close), the failed preallocation is reported as the next
+*	segment which can not be opened.
+* The signals are blocked: SIGINT is served by the capture thread
+* Parameter:
+*	(io)arg - DMA channel data operation parameters (CHRC_PARAMS_t)
+* Return value:
+*	NULL always
+*******************************************************************************/
+static void *chStSegThread(void *arg)
+{
+	char name[CHST_NAME_LEN];
+	CHRC_PARAMS_t *params;
+	CHST_SEG_t *seg;
+	uint32_t old_req, next_req;
+	FILE *old_file;
+	uint64_t old_sz, next_sz;
+	uint32_t err;
+	int old_fd, fd;
+	sigset_t sigs;
+
+	// Set the pointers to the channel parameters and the segmented file
+	params = arg;
+	seg = &(params -> seg);
+
+	// Block the signals in the segment thread
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	// Request cycle
+	pthread_mutex_lock(&(seg -> lock));
+	while(1) {
+		// Wait for a request (the requests are done before the exit)
+		while(!seg -> quit && !seg -> old_req && !seg -> next_req)
+			pthread_cond_wait(&(seg -> cond), &(seg -> lock));
+		if(!seg -> old_req && !seg -> next_req) break;
+
+		// Take the requests
+		old_req = seg -> old_req;
+		old_file = seg -> old_file;
+		old_fd = seg -> old_fd;
+		old_sz = seg -> old_sz;
+		next_req = seg -> next_req;
+		next_sz = seg -> next_sz;
+		chStSegName(seg, seg -> next_idx, name);
+		pthread_mutex_unlock(&(seg -> lock));
+
+		// Close the finished segment: cut the preallocated space, put
+		// the data on the storage
+		err = 0;
+		if(old_req) {
+			if(old_file != NULL) old_fd = fileno(old_file);
+			if(ftruncate(old_fd, old_sz) != 0) err = 1;
+			if(fsync(old_fd) != 0) err = 1;
+			if(old_file != NULL) {
+				if(fclose(old_file) != 0) err = 1;
+			}
+			else if(close(old_fd) != 0) err = 1;
+		}
+
+		// Create and preallocate the next segment (the preallocation is
+		// skipped if the file system does not support it)
+		fd = -1;
+		if(next_req) {
+			fd = open(name, O_WRONLY | O_CREAT | O_TRUNC |
+				(seg -> direct ? O_DIRECT : 0), 0644);
+			if(fd >= 0 && fallocate(fd, 0, 0, next_sz) != 0 &&
+					errno != EOPNOTSUPP) {
+				// Can not allocate the segment (no space)
+				close(fd);
+				unlink(name);
+				fd = -1;
+			}
+		}
+
+		// The requests are done
+		pthread_mutex_lock(&(seg -> lock));
+		if(old_req) {
+			seg -> old_req = 0;
+			if(err) seg -> old_err = 1;
+		}
+		if(next_req) {
+			seg -> next_req = 0;
+			seg -> next_fd = fd;
+			if(fd < 0) seg -> next_err = 1;
+		}
+		pthread_cond_broadcast(&(seg -> cond));
+	}
+	pthread_mutex_unlock(&(seg -> lock));
+
+	// The thread is finished
+	return NULL;
+}
+
+/**************************** chDioOpen(dio,fname) ****************************
+* Open the file for direct I/O storage
+* The file is opened with O_DIRECT (if the file system does not support it,
+*	e.g. tmpfs, the page cache is used), the batch buffers and
+*	the AIO context are created, one AIO request per batch buffer
+* Parameters:
+*	(o)dio - direct I/O storage
+*	(i)fname - file name
+* Return value:
+*	 0 Success. The file was opened
+*	-1 Error. Can not open the file or allocate the resources
+*	   (dio must be closed by chDioClose)
+*******************************************************************************/
+static int chDioOpen(CHST_DIO_t *dio, const char *fname)
+{
+	uint32_t i;
+	void *mem;
+	int fd;
+	int rc;
+
+	// Nothing is allocated yet
+	memset(dio, 0, sizeof(CHST_DIO_t));
+	dio -> fd = -1;
+
+	// Open the file for direct writing
+	dio -> direct = 1;
+	fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if(fd < 0 && errno == EINVAL) {
+		printf("dma-uapp: O_DIRECT is not supported for %s, "
+			"the page cache is used \n", fname);
+
+		// Open the file for page cache writing
+		dio -> direct = 0;
+		fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if(fd < 0) return -1;				// Can not open the file
+	dio -> fd = fd;
+
+	// Allocate aligned batch buffers
+	rc = posix_memalign(&mem, CHST_BLK_SZ, CHST_AIO_REQS * CHST_BATCH_SZ);
+	if(rc != 0) return -1;				// Can not allocate the buffers
+	dio -> mem = mem;
+
+	// Create AIO context (the raw system call: no libaio is needed)
+	rc = syscall(__NR_io_setup, CHST_AIO_REQS, &(dio -> ctx));
+	if(rc < 0) {
+		dio -> ctx = 0;
+		return -1;						// Can not create AIO context
+	}
+
+	// Prepare the write request of each batch buffer
+	for(i = 0; i < CHST_AIO_REQS; i++) {
+		dio -> iocb[i].aio_data = i;
+		dio -> iocb[i].aio_lio_opcode = IOCB_CMD_PWRITE;
+		dio -> iocb[i].aio_fildes = fd;
+		dio -> iocb[i].aio_buf = (uintptr_t)(dio -> mem + i * CHST_BATCH_SZ);
+	}
+
+	// The file is preallocated ahead of the writes (if supported)
+	dio -> prealloc = 1;
+
+	// The file was opened successfully
+	return 0;
+}
+
+/************************** chDioWrite(dio,data,len) **************************
+* Collect the data into the batch buffers, submit each full batch
+* The writer waits only if all batch buffers are in flight
+* Parameters:
+*	(io)dio - direct I/O storage
+*	(i)data - pointer to the data
+*	(i)len - data length (b)
+* Return value:
+*	 0 Success. The data was collected
+*	-1 Error. The data was not written
+*******************************************************************************/
+static int chDioWrite(CHST_DIO_t *dio, const uint8_t *data, uint32_t len)
+{
+	uint32_t part;
+	int rc;
+
+	// Collect all data
+	while(len > 0) {
+		// The batch buffer is in flight: wait for a finished request
+		if(dio -> busy[dio -> cur]) {
+			rc = chDioWait(dio, 1);
+			if(rc < 0) return -1;		// The data was not written
+			continue;
+		}
+
+		// Copy the data into the batch buffer
+		part = CHST_BATCH_SZ - dio -> fill;
+		if(part > len) part = len;
+		memcpy(dio -> mem + dio -> cur * CHST_BATCH_SZ + dio -> fill, data,
+			part);
+		dio -> fill += part;
+		dio -> size += part;
+		data += part;
+		len -= part;
+
+		// The batch is full: submit the write request
+		if(dio -> fill == CHST_BATCH_SZ) {
+			rc = chDioSubmit(dio, CHST_BATCH_SZ);
+			if(rc < 0) return -1;		// The data was not written
+		}
+	}
+
+	// All data was collected
+	return 0;
+}
+
+/************************** chDioSubmit(dio,len) ******************************
+* Submit the write request of the current batch buffer
+* The file is preallocated ahead of the writes: the direct writes do not
+*	extend the file (the extending writes are synchronous)
+* Parameters:
+*	(io)dio - direct I/O storage
+*	(i)len - length to write (b) (multiple of CHST_BLK_SZ)
+* Return value:
+*	 0 Success. The request was submitted
+*	-1 Error. The request was not submitted
+*******************************************************************************/
+static int chDioSubmit(CHST_DIO_t *dio, uint32_t len)
+{
+	struct iocb *iocb;
+	int rc;
+
+	// Preallocate the next file part (not supported by some file systems)
+	if(dio -> prealloc && dio -> off + len > dio -> alloc_end) {
+		rc = fallocate(dio -> fd, 0, dio -> alloc_end, CHST_PREALLOC_SZ);
+		if(rc < 0) dio -> prealloc = 0;
+		else dio -> alloc_end += CHST_PREALLOC_SZ;
+	}
+
+	// Set the request: the batch is written at the next file offset
+	iocb = &(dio -> iocb[dio -> cur]);
+	iocb -> aio_nbytes = len;
+	iocb -> aio_offset = dio -> off;
+
+	// Submit the request
+	rc = syscall(__NR_io_submit, dio -> ctx, 1, &iocb);
+	if(rc != 1) return -1;				// The request was not submitted
+
+	// The batch is in flight, fill the next batch buffer
+	dio -> busy[dio -> cur] = 1;
+	dio -> inflight++;
+	dio -> off += len;
+	dio -> cur = (dio -> cur + 1) % CHST_AIO_REQS;
+	dio -> fill = 0;
+
+	// The request was submitted successfully
+	return 0;
+}
+
+/************************** chDioWait(dio,min_nr) *****************************
+* Collect the finished write requests, their batch buffers are free again
+* Parameters:
+*	(io)dio - direct I/O storage
+*	(i)min_nr - number of requests to wait for (0 - no wait)
+* Return value:
+*	 0 Success. The finished requests were collected
+*	-1 Error. The request failed (short write) or can not be collected
+*******************************************************************************/
+static int chDioWait(CHST_DIO_t *dio, long min_nr)
+{
+	struct io_event events[CHST_AIO_REQS];
+	struct timespec ts;
+	uint32_t i;
+	int num;
+	int rc;
+
+	// No requests in flight
+	if(dio -> inflight == 0) return 0;
+
+	// Get the finished requests (no timeout if the wait is requested),
+	// the wait interrupted by a signal is repeated
+	ts.tv_sec = 0;
+	ts.tv_nsec = 0;
+	do {
+		num = syscall(__NR_io_getevents, dio -> ctx, min_nr, CHST_AIO_REQS,
+			events, min_nr ? NULL : &ts);
+	} while(num < 0 && errno == EINTR);
+	if(num < 0) return -1;				// Can not collect the requests
+
+	// Free the batch buffers, check the written lengths
+	rc = 0;
+	while(num-- > 0) {
+		i = events[num].data;
+		dio -> busy[i] = 0;
+		dio -> inflight--;
+		if(events[num].res != (int64_t)dio -> iocb[i].aio_nbytes) rc = -1;
+	}
+
+	// Return the result of the requests
+	return rc;
+}
+
+/****************************** chDioClose(dio) *******************************
+* Close the direct I/O storage
+* The partial batch is written (padded to the block size), all requests
+*	are waited for, the padding and the preallocated space are cut
+*	from the file, the file is put on the storage (fdatasync: the written
+*	extents and the size), the resources are freed. Only the opened parts
+*	are closed.
+* Parameter:
+*	(io)dio - direct I/O storage
+* Return value:
+*	 0 Success. All data was written
+*	-1 Error. The data was not written
+*******************************************************************************/
+static int chDioClose(CHST_DIO_t *dio)
+{
+	uint32_t len;
+	int rc;
+
+	// The file was not opened
+	if(dio -> fd < 0) return 0;
+
+	// Write the rest of the data
+	rc = 0;
+	if(dio -> mem != NULL && dio -> ctx != 0) {
+		// Write the partial batch padded to the block size
+		if(dio -> fill > 0) {
+			len = (dio -> fill + CHST_BLK_SZ - 1) & ~(CHST_BLK_SZ - 1);
+			memset(dio -> mem + dio -> cur * CHST_BATCH_SZ + dio -> fill, 0,
+				len - dio -> fill);
+			if(chDioSubmit(dio, len) < 0) rc = -1;
+		}
+
+		// Wait for all requests in flight
+		while(dio -> inflight > 0) {
+			if(chDioWait(dio, 1) < 0) {
+				rc = -1;
+				break;
+			}
+		}
+	}
+
+	// Cut the padding and the preallocated space: the file size is
+	// the data size
+	if(ftruncate(dio -> fd, dio -> size) < 0) rc = -1;
+
+	// Put the file on the storage: O_DIRECT bypasses the page cache, but
+	// not the metadata of the file
+	if(fdatasync(dio -> fd) != 0) rc = -1;
+
+	// Free the resources (the requests still in flight are cancelled)
+	if(dio -> ctx != 0) syscall(__NR_io_destroy, dio -> ctx);
+	close(dio -> fd);
+	free(dio -> mem);
+	dio -> ctx = 0;
+	dio -> fd = -1;
+	dio -> mem = NULL;
+
+	// Return the result of the writes
+	return rc;
+}
+
+/***************** chDioSwitch(dio,fd,alloc_sz,old_fd,old_sz) *****************
+* Switch the direct I/O storage to the next file (the next segment)
+* The partial batch is written (padded to the block size), the requests
+*	in flight are waited for, the batch buffers and the AIO context are kept
+* Parameters:
+*	(io)dio - direct I/O storage
+*	(i)fd - descriptor of the next file
+*	(i)alloc_sz - preallocated size of the next file (b)
+*	(o)old_fd - descriptor of the finished file (to be cut and closed)
+*	(o)old_sz - data size of the finished file (b)
+* Return value:
+*	 0 Success. The next file is used
+*	-1 Error. The data of the finished file was not written
+*******************************************************************************/
+static int chDioSwitch(CHST_DIO_t *dio, int fd, uint64_t alloc_sz,
+	int *old_fd, uint64_t *old_sz)
+{
+	uint32_t len;
+	uint32_t i;
+	int rc;
+
+	// Write the partial batch padded to the block size
+	if(dio -> fill > 0) {
+		len = (dio -> fill + CHST_BLK_SZ - 1) & ~(CHST_BLK_SZ - 1);
+		memset(dio -> mem + dio -> cur * CHST_BATCH_SZ + dio -> fill, 0,
+			len - dio -> fill);
+		rc = chDioSubmit(dio, len);
+		if(rc < 0) return -1;			// The data was not written
+	}
+
+	// Wait for all requests in flight (they use the finished file)
+	while(dio -> inflight > 0) {
+		rc = chDioWait(dio, 1);
+		if(rc < 0) return -1;			// The data was not written
+	}
+
+	// Return the finished file
+	*old_fd = dio -> fd;
+	*old_sz = dio -> size;
+
+	// Use the next file from its start
+	dio -> fd = fd;
+	dio -> off = 0;
+	dio -> size = 0;
+	dio -> alloc_end = alloc_sz;
+	for(i = 0; i < CHST_AIO_REQS; i++) dio -> iocb[i].aio_fildes = fd;
+
+	// The file was switched successfully
+	return 0;
+}
+
+
+
+/********************************* chBmRun() **********************************
+* CPU read bandwidth benchmark of DMA buffers
+* For each DMA channel the buffers are read by CPU in coherent and
+*	in cached memory mode, the bandwidth of each mode is printed.
+* The channels must not be used by other applications (streaming is off)
+*******************************************************************************/
+static void chBmRun(void)
+{
+	uint32_t ch_idx;
+
+	printf("dma-uapp: CPU read bandwidth benchmark, passes=%d \n",
+		CHBM_PASS_NUM);
+
+	// Benchmark all DMA channels
+	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++)
+		chBmChannel(ch_idx);
+}
+
+/****************************** chBmChannel(ch_idx) ***************************
+* CPU read bandwidth benchmark of one DMA channel
+* The channel memory is measured in both memory modes, then
+*	the initial memory mode of the channel is restored
+* Used variable:
+*	(i)chrc_proxy_name - DMA proxy character device names
+* Parameter:
+*	(i)ch_idx - DMA channel index
+* Return value:
+*	 0 Success. The benchmark was executed
+*	-1 Error. The benchmark failed
+*******************************************************************************/
+static int chBmChannel(uint32_t ch_idx)
+{
+	_DM_CH_INFO_t info;
+	uint8_t *copy_buf;
+	int proxy_fd;
+	int rc;
+
+	// Open DMA proxy character device
+	proxy_fd = open(chrc_proxy_name[ch_idx], O_RDWR);
+	if(proxy_fd < 0) {
+		printf("dma-uapp: can not open DMA proxy character device: %s \n",
+			chrc_proxy_name[ch_idx]);
+		return -1;
+	}
+
+	// Get DMA channel information
+	rc = ioctl(proxy_fd, _DM_IOCTL_INFO, &info);
+	if(rc != 0) goto CHBM_ERR;
+
+	// Allocate the destination buffer for memory copy test
+	copy_buf = malloc(info.trsz);
+	if(copy_buf == NULL) goto CHBM_ERR;
+
+	printf("dma-uapp: ch_idx=%d trsz=%d buf_num=%d \n",
+		ch_idx, info.trsz, info.buf_num);
+
+	// Measure both memory modes
+	chBmMode(proxy_fd, _DM_MEM_COHERENT, copy_buf);
+	chBmMode(proxy_fd, _DM_MEM_CACHED, copy_buf);
+
+	// Restore initial memory mode of the channel
+	ioctl(proxy_fd, _DM_IOCTL_MEM_MODE, &info.mem_mode);
+
+	// Free resources
+	free(copy_buf);
+	close(proxy_fd);
+
+	// The benchmark was executed successfully
+	return 0;
+
+CHBM_ERR:
+	printf("dma-uapp: benchmark failed, ch_idx=%d \n", ch_idx);
+
+	// Close DMA proxy character device
+	close(proxy_fd);
+
+	// The benchmark failed
+	return -1;
+}
+
+/********************** chBmMode(proxy_fd,mode,copy_buf) **********************
+* CPU read bandwidth benchmark of the channel memory in one memory mode
+* All buffers of the channel are owned by CPU during the test.
+*	Two tests are executed: word sum (plain CPU reads) and memory copy
+*	into a normal heap buffer
+* Parameters:
+*	(i)proxy_fd - DMA proxy character device file descriptor
+*	(i)mode - memory mode (_DM_MEM_MODE_t)
+*	(i)copy_buf - destination buffer for memory copy test (trsz bytes)
+* Return value:
+*	 0 Success. The benchmark was executed
+*	-1 Error. The benchmark failed
+*******************************************************************************/
+static int chBmMode(int proxy_fd, uint32_t mode, uint8_t *copy_buf)
+{
+	static const char *mode_name[] = {"coherent", "cached"};
+	_DM_CH_INFO_t info;
+	_DM_BUF_t buf;
+	uint8_t *area;
+	const uint32_t *word;
+	uint32_t buf_idx, pass, i;
+	uint32_t sum;
+	double t_beg, t_sum, t_cpy, mbytes;
+	int rc;
+
+	// Set memory mode, get new channel memory parameters
+	rc = ioctl(proxy_fd, _DM_IOCTL_MEM_MODE, &mode);
+	if(rc != 0) {
+		printf("dma-uapp: can not set memory mode %s \n", mode_name[mode]);
+		return -1;
+	}
+	rc = ioctl(proxy_fd, _DM_IOCTL_INFO, &info);
+	if(rc != 0) return -1;
+
+	// Map all channel buffers
+	area = (uint8_t	*)mmap(NULL, info.area_sz, PROT_READ | PROT_WRITE,
+				MAP_SHARED, proxy_fd, 0);
+	if(area == MAP_FAILED) return -1;
+
+	// Begin CPU access to all buffers
+	for(buf_idx = 0; buf_idx < info.buf_num; buf_idx++) {
+		buf.buf_idx = buf_idx;
+		ioctl(proxy_fd, _DM_IOCTL_CPU_BEG, &buf);
+	}
+
+	// Word sum test
+	sum = 0;
+	t_beg = chBmTimeGet();
+	for(pass = 0; pass < CHBM_PASS_NUM; pass++)
+		for(buf_idx = 0; buf_idx < info.buf_num; buf_idx++) {
+			word = (const uint32_t *)(area + buf_idx * info.buf_stride);
+			for(i = 0; i < info.trsz / sizeof(uint32_t); i++)
+				sum += word[i];
+		}
+	t_sum = chBmTimeGet() - t_beg;
+
+	// Memory copy test
+	t_beg = chBmTimeGet();
+	for(pass = 0; pass < CHBM_PASS_NUM; pass++)
+		for(buf_idx = 0; buf_idx < info.buf_num; buf_idx++)
+			memcpy(copy_buf, area + buf_idx * info.buf_stride, info.trsz);
+	t_cpy = chBmTimeGet() - t_beg;
+
+	// End CPU access to all buffers
+	for(buf_idx = 0; buf_idx < info.buf_num; buf_idx++) {
+		buf.buf_idx = buf_idx;
+		ioctl(proxy_fd, _DM_IOCTL_CPU_END, &buf);
+	}
+
+	// Unmap channel buffers
+	munmap(area, info.area_sz);
+
+	// Print the results (MB/s)
+	mbytes = (double)CHBM_PASS_NUM * info.buf_num * info.trsz / 1e6;
+	printf("dma-uapp:   %-8s read %8.1f MB/s  memcpy %8.1f MB/s  (sum=%.8x) \n",
+		mode_name[mode], mbytes / t_sum, mbytes / t_cpy, sum);
+
+	// The benchmark was executed successfully
+	return 0;
+}
+
+/******************************** chBmTimeGet() *******************************
+* Get monotonic time
+* Return value:
+*	Current monotonic time (s)
+*******************************************************************************/
+static double chBmTimeGet(void)
+{
+	struct timespec ts;
+
+	// Read monotonic clock
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	// Convert the time to seconds
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/******************************** chRbRun(secs) *******************************
+* Recording benchmark: sustained write rate of the received data into a file
+* Each DMA channel is recorded by the user space loop (dequeue, fwrite,
+*	fflush, queue), by the user space loop with batch requests (one request
+*	per batch of buffers) and then by the in-kernel recorder thread of the
+*	driver, the rate of each method is printed
+* The channels must not be used by other applications (streaming is off)
+* Parameter:
+*	(i)secs - recording time of each method (s)
+*******************************************************************************/
+static void chRbRun(uint32_t secs)
+{
+	uint32_t ch_idx;
+
+	// At least one second of recording
+	if(secs == 0) secs = 1;
+
+	printf("dma-uapp: Recording benchmark, %d s per method \n", secs);
+
+	// Benchmark all DMA channels
+	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++)
+		chRbChannel(ch_idx, secs);
+}
+
+/************************** chRbChannel(ch_idx,secs) **************************
+* Recording benchmark of one DMA channel
+* The overrun counters of all methods are printed at the end
+* Used variables:
+*	(i)chrc_proxy_name - DMA proxy character device names
+*	(i)chrc_ovr - overrun policy to set
+* Parameters:
+*	(i)ch_idx - DMA channel index
+*	(i)secs - recording time of each method (s)
+* Return value:
+*	 0 Success. The benchmark was executed
+*	-1 Error. The benchmark failed
+*******************************************************************************/
+static int chRbChannel(uint32_t ch_idx, uint32_t secs)
+{
+	_DM_CH_INFO_t info;
+	_DM_OVR_t ovr;
+	uint32_t timeout;
+	double rate_usr, rate_bat, rate_krn;
+	int proxy_fd;
+	int rc;
+
+	// Open DMA proxy character device (blocking dequeue)
+	proxy_fd = open(chrc_proxy_name[ch_idx], O_RDWR);
+	if(proxy_fd < 0) {
+		printf("dma-uapp: can not open DMA proxy character device: %s \n",
+			chrc_proxy_name[ch_idx]);
+		return -1;
+	}
+
+	// Limit the blocking dequeue: the idle channel is not recorded
+	timeout = CHRB_TIMEOUT_MS;
+	rc = ioctl(proxy_fd, _DM_IOCTL_TIMEOUT, &timeout);
+	if(rc != 0) goto CHRB_ERR;
+
+	// Set the overrun policy (the driver policy is read otherwise)
+	ovr.policy = (chrc_ovr >= 0) ? chrc_ovr : 0;
+	ovr.set = (chrc_ovr >= 0);
+	rc = ioctl(proxy_fd, _DM_IOCTL_OVR, &ovr);
+	if(rc != 0) goto CHRB_ERR;
+
+	// Get DMA channel information
+	rc = ioctl(proxy_fd, _DM_IOCTL_INFO, &info);
+	if(rc != 0) goto CHRB_ERR;
+
+	printf("dma-uapp: ch_idx=%d trsz=%d buf_num=%d \n",
+		ch_idx, info.trsz, info.buf_num);
+	if(info.rt_cpu >= 0)
+		printf("dma-uapp:   completion worker CPU%d, SCHED_FIFO %u \n",
+			info.rt_cpu, info.rt_prio);
+
+	// Record by the user space loops, then by the in-kernel recorder
+	rate_usr = chRbUser(proxy_fd, ch_idx, &info, secs);
+	rate_bat = chRbBatch(proxy_fd, ch_idx, &info, secs);
+	rate_krn = chRbKernel(proxy_fd, ch_idx, secs);
+
+	// Print the results (MB/s)
+	printf("dma-uapp:   user loop %8.1f MB/s  batch loop %8.1f MB/s  "
+		"kernel recorder %8.1f MB/s \n", rate_usr, rate_bat, rate_krn);
+
+	// Print the overrun counters (all methods)
+	ovr.set = 0;
+	rc = ioctl(proxy_fd, _DM_IOCTL_OVR, &ovr);
+	if(rc == 0)
+		printf("dma-uapp:   overrun policy %u: %llu buffers dropped, "
+			"%llu stalls \n", ovr.policy, (unsigned long long)ovr.drops,
+			(unsigned long long)ovr.stalls);
+
+	// Close DMA proxy character device
+	close(proxy_fd);
+
+	// The benchmark was executed successfully
+	return 0;
+
+CHRB_ERR:
+	printf("dma-uapp: recording benchmark failed, ch_idx=%d \n", ch_idx);
+
+	// Close DMA proxy character device
+	close(proxy_fd);
+
+	// The benchmark failed
+	return -1;
+}
+
+/******************** chRbUser(proxy_fd,ch_idx,info,secs) *********************
+* Record the channel by the user space loop: the dequeued buffer is written
+*	into the file (fwrite, fflush) and queued again
+* The recording stops after the time or in case of errors (timeout)
+* The wakeup latency (completion time in the buffer metadata -> dequeue
+*	returns) distribution is printed
+* Used variable:
+*	(i)dm_ch_name - DMA channel names
+* Parameters:
+*	(i)proxy_fd - DMA proxy character device file descriptor
+*	(i)ch_idx - DMA channel index
+*	(i)info - DMA channel information
+*	(i)secs - recording time (s)
+* Return value:
+*	Write rate (MB/s) (0 - nothing was recorded)
+*******************************************************************************/
+static double chRbUser(int proxy_fd, uint32_t ch_idx, _DM_CH_INFO_t *info,
+	uint32_t secs)
+{
+	_DM_BUF_t buf;
+	const _DM_META_t *meta;
+	uint8_t *area;
+	FILE *file;
+	char fname[64];
+	uint32_t buf_idx;
+	uint32_t len;
+	uint64_t bytes;
+	uint32_t hist[CHRB_HIST_BINS];
+	uint64_t max_ns;
+	double t_beg, t_run;
+	size_t sz;
+	int rc;
+
+	// Open the file for writing
+	snprintf(fname, sizeof(fname), "%s.rb-user", dm_ch_name[ch_idx]);
+	file = fopen(fname, "wb");
+	if(file == NULL) return 0;
+
+	// Map all channel buffers
+	area = (uint8_t	*)mmap(NULL, info -> area_sz, PROT_READ | PROT_WRITE,
+				MAP_SHARED, proxy_fd, 0);
+	if(area == MAP_FAILED) {
+		fclose(file);
+		return 0;
+	}
+
+	// Map the completion metadata (no latency report without it)
+	meta = (const _DM_META_t *)mmap(NULL, info -> meta_sz, PROT_READ,
+				MAP_SHARED, proxy_fd, info -> meta_offs);
+	if(meta == MAP_FAILED) meta = NULL;
+	memset(hist, 0, sizeof(hist));
+	max_ns = 0;
+
+	// Queue all buffers, start streaming
+	for(buf_idx = 0; buf_idx < info -> buf_num; buf_idx++) {
+		buf.buf_idx = buf_idx;
+		ioctl(proxy_fd, _DM_IOCTL_QBUF, &buf);
+	}
+	ioctl(proxy_fd, _DM_IOCTL_STRM_ON);
+
+	// Record cycle
+	bytes = 0;
+	t_beg = chBmTimeGet();
+	do {
+		// Dequeue the buffer with received data
+		rc = ioctl(proxy_fd, _DM_IOCTL_DQBUF, &buf);
+		if(rc != 0) break;				// Timeout or error
+
+		// Count the wakeup latency of the buffer
+		if(meta != NULL)
+			chRbLatCount(hist, &max_ns, meta[buf.buf_idx].ts_ns);
+
+		// Write the received data, queue the buffer again
+		len = info -> trsz - buf.residue;
+		ioctl(proxy_fd, _DM_IOCTL_CPU_BEG, &buf);
+		sz = fwrite(area + buf.buf_idx * info -> buf_stride, 1, len, file);
+		fflush(file);
+		ioctl(proxy_fd, _DM_IOCTL_CPU_END, &buf);
+		ioctl(proxy_fd, _DM_IOCTL_QBUF, &buf);
+		if(sz != len) break;			// Write error
+		bytes += len;
+	} while(buf.res_code == _DM_TRAN_RES_SUCCESS &&
+			chBmTimeGet() - t_beg < secs);
+	t_run = chBmTimeGet() - t_beg;
+
+	// Stop streaming, free resources
+	ioctl(proxy_fd, _DM_IOCTL_STRM_OFF);
+	if(meta != NULL) munmap((void *)meta, info -> meta_sz);
+	munmap(area, info -> area_sz);
+	fclose(file);
+
+	// Print the wakeup latency distribution
+	chRbLatPrint(hist, max_ns);
+
+	// Return the write rate (MB/s)
+	return bytes / 1e6 / t_run;
+}
+
+/******************** chRbBatch(proxy_fd,ch_idx,info,secs) ********************
+* Record the channel by the user space loop with batch requests: one request
+*	queues the buffers written by the previous cycle and dequeues all
+*	finished buffers (waits for one at least), the buffers are written
+*	into the file (fwrite, one fflush per batch)
+* The recording stops after the time or in case of errors (timeout)
+* Used variable:
+*	(i)dm_ch_name - DMA channel names
+* Parameters:
+*	(i)proxy_fd - DMA proxy character device file descriptor
+*	(i)ch_idx - DMA channel index
+*	(i)info - DMA channel information
+*	(i)secs - recording time (s)
+* Return value:
+*	Write rate (MB/s) (0 - nothing was recorded)
+*******************************************************************************/
+static double chRbBatch(int proxy_fd, uint32_t ch_idx, _DM_CH_INFO_t *info,
+	uint32_t secs)
+{
+	_DM_BATCH_t *bat;
+	uint8_t *area;
+	FILE *file;
+	char fname[64];
+	uint32_t i;
+	uint64_t bytes;
+	double t_beg, t_run;
+	size_t sz;
+	int failed;
+	int rc;
+
+	// Open the file for writing
+	snprintf(fname, sizeof(fname), "%s.rb-batch", dm_ch_name[ch_idx]);
+	file = fopen(fname, "wb");
+	if(file == NULL) return 0;
+
+	// Map all channel buffers, allocate the batch request
+	area = (uint8_t	*)mmap(NULL, info -> area_sz, PROT_READ | PROT_WRITE,
+				MAP_SHARED, proxy_fd, 0);
+	bat = calloc(1, sizeof(_DM_BATCH_t));
+	if(area == MAP_FAILED || bat == NULL) {
+		if(area != MAP_FAILED) munmap(area, info -> area_sz);
+		free(bat);
+		fclose(file);
+		return 0;
+	}
+
+	// The first request queues all buffers (_DM_BATCH_MAX at most)
+	bat -> qcount = (info -> buf_num < _DM_BATCH_MAX) ?
+		info -> buf_num : _DM_BATCH_MAX;
+	for(i = 0; i < bat -> qcount; i++)
+		bat -> ent[i].buf_idx = i;
+	ioctl(proxy_fd, _DM_IOCTL_STRM_ON);
+
+	// Record cycle
+	bytes = 0;
+	failed = 0;
+	t_beg = chBmTimeGet();
+	do {
+		// Queue the written buffers, dequeue the finished ones
+		bat -> count = _DM_BATCH_MAX;
+		bat -> wait = 1;
+		rc = ioctl(proxy_fd, _DM_IOCTL_BATCH, bat);
+		if(rc != 0) break;				// Timeout or error
+
+		// Write the received data (the buffers are synchronized for CPU),
+		// count the written bytes
+		for(i = 0; i < bat -> done; i++) {
+			sz = fwrite(area + bat -> ent[i].buf_idx * info -> buf_stride, 1,
+				bat -> ent[i].len, file);
+			if(sz == bat -> ent[i].len) bytes += sz;
+			else failed = 1;			// Write error
+			if(bat -> ent[i].res_code != _DM_TRAN_RES_SUCCESS) failed = 1;
+		}
+		fflush(file);
+
+		// The dequeued buffers are queued by the next request
+		bat -> qcount = bat -> done;
+	} while(!failed && chBmTimeGet() - t_beg < secs);
+	t_run = chBmTimeGet() - t_beg;
+
+	// Stop streaming, free resources
+	ioctl(proxy_fd, _DM_IOCTL_STRM_OFF);
+	munmap(area, info -> area_sz);
+	free(bat);
+	fclose(file);
+
+	// Return the write rate (MB/s)
+	return bytes / 1e6 / t_run;
+}
+
+/*********************** chRbKernel(proxy_fd,ch_idx,secs) *********************
+* Record the channel by the in-kernel recorder thread: the driver writes
+*	the buffers into the file, the application only supervises (reads the
+*	counters once a second)
+* Used variable:
+*	(i)dm_ch_name - DMA channel names
+* Parameters:
+*	(i)proxy_fd - DMA proxy character device file descriptor
+*	(i)ch_idx - DMA channel index
+*	(i)secs - recording time (s)
+* Return value:
+*	Write rate (MB/s) (0 - nothing was recorded)
+*******************************************************************************/
+static double chRbKernel(int proxy_fd, uint32_t ch_idx, uint32_t secs)
+{
+	_DM_REC_t rec;
+	char fname[64];
+	uint32_t sec;
+	double t_beg, t_run;
+	int fd;
+	int rc;
+
+	// Open the file for writing
+	snprintf(fname, sizeof(fname), "%s.rb-kernel", dm_ch_name[ch_idx]);
+	fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) return 0;
+
+	// Start the recorder
+	rec.cmd = _DM_REC_START;
+	rec.fd = fd;
+	rc = ioctl(proxy_fd, _DM_IOCTL_REC, &rec);
+	if(rc != 0) {
+		printf("dma-uapp: can not start the recorder, ch_idx=%d \n", ch_idx);
+		close(fd);
+		return 0;
+	}
+
+	// Supervise the recorder: stop it after the time or the write error
+	t_beg = chBmTimeGet();
+	for(sec = 0; sec < secs; sec++) {
+		sleep(1);
+		rec.cmd = _DM_REC_STAT;
+		rc = ioctl(proxy_fd, _DM_IOCTL_REC, &rec);
+		if(rc != 0 || !rec.running) break;
+	}
+
+	// Stop the recorder, read the counters
+	rec.cmd = _DM_REC_STOP;
+	ioctl(proxy_fd, _DM_IOCTL_REC, &rec);
+	t_run = chBmTimeGet() - t_beg;
+	close(fd);
+
+	// Report the errors and the data lost by overruns
+	if(rec.wr_err != 0 || rec.errors != 0)
+		printf("dma-uapp:   recorder wr_err=%d errors=%llu \n",
+			rec.wr_err, (unsigned long long)rec.errors);
+	if(rec.lost != 0 || rec.stalls != 0)
+		printf("dma-uapp:   recorder lost=%llu stalls=%llu \n",
+			(unsigned long long)rec.lost, (unsigned long long)rec.stalls);
+
+	// Return the write rate (MB/s)
+	return rec.bytes / 1e6 / t_run;
+}
+
+/********************** chRbLatCount(hist,max_ns,ts_ns) ***********************
+* Count the wakeup latency of the dequeued buffer: the time from DMA
+*	transaction completion (buffer metadata) to now
+* Parameters:
+*	(io)hist - latency histogram (CHRB_HIST_BINS bins, log2 of ns)
+*	(io)max_ns - maximum latency (ns)
+*	(i)ts_ns - completion time of the buffer (ns, monotonic)
+*******************************************************************************/
+static void chRbLatCount(uint32_t *hist, uint64_t *max_ns, uint64_t ts_ns)
+{
+	struct timespec ts;
+	uint64_t ns;
+	uint32_t bin;
+
+	// Get the latency (ns)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	ns = (ns > ts_ns) ? ns - ts_ns : 0;
+	if(ns > *max_ns) *max_ns = ns;
+
+	// Bin index: log2 of the latency, limited by the last bin
+	for(bin = 0; bin < CHRB_HIST_BINS - 1 && (ns >> (bin + 1)) != 0; bin++);
+	hist[bin]++;
+}
+
+/*********************** chRbLatPrint(hist,max_ns) ****************************
+* Print the wakeup latency distribution: median, 99% and 99.9% percentiles
+*	(upper bounds of the histogram bins) and the maximum
+* Parameters:
+*	(i)hist - latency histogram (CHRB_HIST_BINS bins, log2 of ns)
+*	(i)max_ns - maximum latency (ns)
+*******************************************************************************/
+static void chRbLatPrint(const uint32_t *hist, uint64_t max_ns)
+{
+	static const uint32_t pml[3] = {500, 990, 999};	// Percentiles (per mille)
+	uint64_t total, sum;
+	uint32_t bin, i;
+
+	// Count all buffers
+	total = 0;
+	for(bin = 0; bin < CHRB_HIST_BINS; bin++) total += hist[bin];
+	if(total == 0) return;
+
+	// Print the bin of each percentile (latency < 2^(bin+1) ns)
+	printf("dma-uapp:   wakeup latency");
+	for(i = 0; i < 3; i++) {
+		sum = 0;
+		for(bin = 0; bin < CHRB_HIST_BINS - 1; bin++) {
+			sum += hist[bin];
+			if(sum * 1000 >= total * pml[i]) break;
+		}
+		printf("  p%.1f < %llu us", pml[i] / 10.0,
+			(unsigned long long)(((2ULL << bin) + 999) / 1000));
+	}
+	printf("  max %llu us (%llu buffers) \n",
+		(unsigned long long)(max_ns / 1000), (unsigned long long)total);
+}
+
+/******************************* chPbRun(fname) *******************************
+* Playback: stream the recorded file into each transmit (MM2S) channel
+* The receive channels are skipped
+* Parameter:
+*	(i)fname - name of the file to play back
+*******************************************************************************/
+static void chPbRun(const char *fname)
+{
+	uint32_t ch_idx;
+
+	printf("dma-uapp: Playback of %s \n", fname);
+
+	// Play the file back into all transmit channels
+	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++)
+		chPbChannel(ch_idx, fname);
+}
+
+/************************** chPbChannel(ch_idx,fname) *************************
+* Play the recorded file back into one transmit channel
+* The file is read in buffer size blocks and written into the DMA proxy
+*	device, fsync() waits until all data is transmitted. The transmit
+*	rate is printed.
+* Used variables:
+*	(i)chrc_proxy_name - DMA proxy character device names
+*	(i)chrc_timeout - DMA transaction timeout (ms)
+* Parameters:
+*	(i)ch_idx - DMA channel index
+*	(i)fname - name of the file to play back
+* Return value:
+*	 0 Success. The file was played back (or the channel receives data)
+*	-1 Error. The playback failed
+*******************************************************************************/
+static int chPbChannel(uint32_t ch_idx, const char *fname)
+{
+	_DM_CH_INFO_t info;
+	uint8_t *buf;
+	uint64_t bytes;
+	double t_beg, t_run;
+	ssize_t len;
+	int proxy_fd;
+	int fd;
+	int rc;
+
+	// Open DMA proxy character device
+	proxy_fd = open(chrc_proxy_name[ch_idx], O_WRONLY);
+	if(proxy_fd < 0) {
+		printf("dma-uapp: can not open DMA proxy character device: %s \n",
+			chrc_proxy_name[ch_idx]);
+		return -1;
+	}
+
+	// Get DMA channel information, skip the receive channel
+	rc = ioctl(proxy_fd, _DM_IOCTL_INFO, &info);
+	if(rc != 0 || info.dir != _DM_DIR_TX) {
+		close(proxy_fd);
+		return (rc != 0) ? -1 : 0;
+	}
+
+	// Limit the wait for the free buffers (stalled PL input)
+	if(chrc_timeout != 0)
+		ioctl(proxy_fd, _DM_IOCTL_TIMEOUT, &chrc_timeout);
+
+	// Open the file to play back, allocate the block buffer
+	fd = open(fname, O_RDONLY);
+	buf = malloc(info.trsz);
+	if(fd < 0 || buf == NULL) goto CHPB_ERR;
+
+	// Playback cycle (until the end of the file)
+	bytes = 0;
+	t_beg = chBmTimeGet();
+	while((len = read(fd, buf, info.trsz)) > 0) {
+		if(write(proxy_fd, buf, len) != len) goto CHPB_ERR;
+		bytes += len;
+	}
+
+	// Transmit the rest of the data
+	if(len < 0 || fsync(proxy_fd) != 0) goto CHPB_ERR;
+	t_run = chBmTimeGet() - t_beg;
+
+	// Print the result (MB/s)
+	printf("dma-uapp: ch_idx=%d played %llu bytes, %8.1f MB/s \n", ch_idx,
+		(unsigned long long)bytes, bytes / 1e6 / t_run);
+
+	// Free resources
+	free(buf);
+	close(fd);
+	close(proxy_fd);
+
+	// The file was played back successfully
+	return 0;
+
+CHPB_ERR:
+	printf("dma-uapp: playback failed, ch_idx=%d \n", ch_idx);
+
+	// Free resources
+	free(buf);
+	if(fd >= 0) close(fd);
+	close(proxy_fd);
+
+	// The playback failed
+	return -1;
+}
+
+/******************************* chSbRun(fname) *******************************
+* Storage benchmark: sustained write rate of the frames into the file
+* Synthetic frames are written by stdio (fwrite and fflush per frame, as
+*	chRcFlDtWrite does) and by direct I/O storage (O_DIRECT, AIO batches,
+*	preallocation), the rate, the CPU usage and the longest frame write of
+*	each method are printed. The file is removed after each method.
+* Run on the target storage (SD, USB) or on tmpfs/loop device to compare.
+* Used variable:
+*	(i)chrc_secs - duration of each method (s) (CHSB_SECS if not set)
+* Parameter:
+*	(i)fname - name of the file to write
+*******************************************************************************/
+static void chSbRun(const char *fname)
+{
+	uint32_t secs;
+	uint32_t i;
+	void *frame;
+	int rc;
+
+	// Duration of each method
+	secs = chrc_secs;
+	if(secs == 0) secs = CHSB_SECS;
+
+	printf("dma-uapp: Storage benchmark, %s, %d B frames, %d s per method \n",
+		fname, CHSB_FRAME_SZ, secs);
+
+	// Allocate page aligned frame, fill it with the ramp
+	rc = posix_memalign(&frame, _DM_PAGE_SZ, CHSB_FRAME_SZ);
+	if(rc != 0) return;
+	for(i = 0; i < CHSB_FRAME_SZ; i++) ((uint8_t *)frame)[i] = i;
+
+	// Benchmark stdio and direct I/O storage
+	chSbMethod(fname, frame, 0, secs);
+	chSbMethod(fname, frame, 1, secs);
+
+	// Free the frame
+	free(frame);
+}
+
+/******************** chSbMethod(fname,frame,direct,secs) *********************
+* Storage benchmark of one method
+* The frame is written repeatedly for the duration, then the data is put
+*	on the storage (fsync for stdio; all requests and fdatasync on close
+*	for direct I/O): the time of it is included in the rate
+* Parameters:
+*	(i)fname - name of the file to write
+*	(i)frame - frame data (CHSB_FRAME_SZ, page aligned)
+*	(i)direct - flag: direct I/O storage (1), stdio (0)
+*	(i)secs - duration (s)
+* Return value:
+*	 0 Success. The rate was printed
+*	-1 Error. Can not write the file
+*******************************************************************************/
+static int chSbMethod(const char *fname, const uint8_t *frame,
+	uint32_t direct, uint32_t secs)
+{
+	static CHRC_PARAMS_t params;
+	double t_beg, t_put, t_max, t_run;
+	clock_t cpu_beg;
+	uint64_t frames;
+	int rc;
+
+	// The files are not opened
+	memset(&params, 0, sizeof(params));
+	params.dio.fd = -1;
+
+	// Open the file
+	rc = chStOpen(&params, fname, direct);
+	if(rc < 0) {
+		printf("dma-uapp: Can not open %s \n", fname);
+		chStClose(&params);
+		return -1;
+	}
+
+	// Write the frames for the duration
+	t_beg = chBmTimeGet();
+	cpu_beg = clock();
+	t_max = 0;
+	frames = 0;
+	while(chBmTimeGet() - t_beg < secs) {
+		// Write one frame, measure the longest write
+		t_put = chBmTimeGet();
+		rc = chStPut(&params, frame, CHSB_FRAME_SZ);
+		if(rc == 0) rc = chStFlush(&params);
+		if(rc < 0) break;
+		t_put = chBmTimeGet() - t_put;
+		if(t_put > t_max) t_max = t_put;
+		frames++;
+	}
+
+	// Put the data on the storage, close the file (the direct I/O file is
+	// put on the storage by the close)
+	if(rc == 0 && params.file_store != NULL)
+		rc = fsync(fileno(params.file_store));
+	if(chStClose(&params) < 0) rc = -1;
+	t_run = chBmTimeGet() - t_beg;
+
+	// Remove the file
+	unlink(fname);
+
+	if(rc < 0) {
+		printf("dma-uapp: Can not write %s \n", fname);
+		return -1;
+	}
+
+	printf("dma-uapp: %-6s %8.1f MB/s  CPU %5.1f %%  max frame write "
+		"%7.2f ms \n", direct ? "direct" : "stdio",
+		frames * CHSB_FRAME_SZ / 1e6 / t_run,
+		100.0 * (clock() - cpu_beg) / CLOCKS_PER_SEC / t_run, t_max * 1e3);
+
+	// The rate was printed successfully
+	return 0;
+}
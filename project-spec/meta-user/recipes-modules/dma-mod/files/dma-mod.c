@@ -16,6 +16,30 @@
 #include <linux/dmaengine.h>
 #include <linux/dma-mapping.h>
 #include <linux/uaccess.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/scatterlist.h>
+#include <linux/of.h>
+#include <linux/of_reserved_mem.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/dma-buf.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
+#include <linux/vmalloc.h>
+#include <linux/list.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/interrupt.h>
+#include <linux/of_irq.h>
+#include <linux/file.h>
 
 #include "dma-mod-intf.h"
 
@@ -33,46 +57,300 @@ MODULE_DESCRIPTION("dma-mod - dma channels user access module");
 // Created class name
 #define CLASS_NAME	"dma-cls"
 
+// Number of log2 latency histogram bins (bin k: 2^k..2^(k+1)-1 ns)
+#define DM_HIST_BINS	32
+
+// Default maximum number of submitted DMA transactions of the ring channel
+// (the other channels submit all queued buffers by default)
+#define DM_RING_INFLIGHT	8
+
+// Default poll period of coalesced DMA transactions (us)
+#define DM_COAL_US			1000
+
+// Time to wait for the users of the channel memory on release (ms)
+#define DM_FREE_WAIT_MS		5000
+
+// Real-time completion worker: "off" CPU value and default SCHED_FIFO priority
+#define DM_RT_OFF			0xFFFFFFFF
+#define DM_RT_PRIO			50
+
 /******************************************************************************
 *	Internal structures
 *******************************************************************************/
 // Module parameters structure
 typedef struct MODULE_PARM_s {
 	uint8_t plat_drv_registered;	// Flag: platform driver was registered (1)
-	uint8_t dev_found;				// Flag: DMA-PROXY device was found (1)
 	struct class *pclass;			// Pointer to the created class
+	struct dentry *dbg_dir;			// Debugfs directory of the module
 } MODULE_PARM_t;
 
+// DMA-PROXY channel queue buffer states
+typedef enum DM_BUF_ST_e {
+	DM_BUF_ST_USER,					// The buffer is owned by user (not queued)
+	DM_BUF_ST_QUEUED,				// The buffer was queued, waits for streaming start
+									// or for a free place (pending FIFO)
+	DM_BUF_ST_ACTIVE,				// DMA transaction into the buffer was submitted
+	DM_BUF_ST_DONE					// DMA transaction is finished, waits for dequeue
+} DM_BUF_ST_t;
+
+// DMA-PROXY channel queue buffer parameters
+typedef struct DM_BUF_s {
+	// Index of the buffer in the channel buffer queue
+	uint32_t buf_idx;
+
+	// Pointer to the parameters of the channel the buffer belongs to
+	struct DM_CHAN_s *pch;
+
+	// Buffer memory
+	uint8_t *dma_buffer;			// Pointer to the buffer memory (kernel space)
+	dma_addr_t dma_buffer_phadd;	// Buffer memory physical address
+	struct scatterlist sgl[_DM_FRAMES_MAX];	// Buffer sg list: one entry per frame
+	struct page *pages;				// Allocated pages (cached memory mode only)
+	uint8_t cpu_owned;				// Flag: the buffer is synchronized for CPU access (1)
+	atomic_t rd_ref;				// Number of read references (the read positions
+									// and the pipe buffers with the buffer pages)
+	uint8_t rd_requeue;				// Flag: queue the buffer after the last read
+									// reference (the buffer of stopped streaming)
+
+	// DMA transaction support
+	struct dma_async_tx_descriptor *tran_desc;	// Async DMA transaction descriptor
+	dma_cookie_t cookie;			// The cookie to track the status of DMA transaction
+	ktime_t t_submit;				// Transfer submit time
+	ktime_t t_done;					// Transfer finished (callback) time
+	uint32_t start_seq;				// Transfer start order number
+	uint32_t len;					// Number of bytes to transfer (trsz; can be
+									// less for the transmit channel)
+	uint32_t state;					// Buffer state (DM_BUF_ST_t)
+	uint32_t res_code;				// DMA transaction result code (for user app)
+	uint32_t residue;				// Number of bytes not transferred (for user app)
+	uint8_t stopped;				// Flag: the transfer was stopped by timeout/abort (1)
+} DM_BUF_t;
+
+// DMA-PROXY channel fan-out ring entry (finished buffer shared by readers)
+typedef struct DM_FAN_s {
+	uint32_t buf_idx;				// Index of the finished buffer
+	uint32_t len;					// Number of received bytes in the buffer
+} DM_FAN_t;
+
+// DMA-PROXY channel user buffer transaction parameters (zero-copy receive)
+typedef struct DM_USR_s {
+	// Pinned user memory
+	struct page **pages;			// Array of pinned user pages
+	uint32_t npages;				// Number of pinned pages
+	struct sg_table sgt;			// Scatter-gather table of the user buffer
+	uint8_t sgt_alloc;				// Flag: scatter-gather table was allocated (1)
+	uint32_t nents;					// Number of mapped sg entries (0 - not mapped)
+
+	// DMA transaction support
+	struct dma_async_tx_descriptor *tran_desc;	// Async DMA transaction descriptor
+	dma_cookie_t cookie;			// The cookie to track the status of DMA transaction
+	ktime_t t_submit;				// Transfer submit time
+	ktime_t t_done;					// Transfer finished (callback) time
+	uint32_t seq;					// Completion sequence number
+	uint8_t active;					// Flag: DMA transaction was submitted (1)
+	uint8_t done;					// Flag: DMA transaction is finished (1)
+	uint8_t stopped;				// Flag: the transfer was stopped by timeout/abort (1)
+	uint32_t res_code;				// Result code of the stopped transfer
+	uint32_t residue;				// Number of bytes not transferred
+} DM_USR_t;
+
+// DMA-PROXY channel in-kernel recorder parameters
+typedef struct DM_REC_s {
+	struct task_struct *task;		// Recorder thread (NULL - recording is off)
+	struct file *file;				// The file the buffers are written to
+	loff_t pos;						// Write position in the file
+	uint8_t running;				// Flag: the thread writes the buffers (1)
+									// (0 - stopped by write error)
+	int wr_err;						// Write error code (0 - no errors)
+
+	// Counters (protected by the buffer queue lock)
+	uint64_t bytes;					// Number of bytes written
+	uint64_t frames;				// Number of buffers written
+	uint64_t errors;				// Number of failed DMA transactions
+	uint64_t lost;					// Number of buffers dropped by overrun policy
+	uint64_t stalls;				// Number of stream stalls before the buffers
+} DM_REC_t;
+
+// DMA-PROXY channel statistics (exported through debugfs)
+typedef struct DM_STAT_s {
+	// Transfer counters
+	uint64_t transfers;				// Number of finished transfers
+	uint64_t bytes;					// Number of transferred bytes
+	uint64_t errors;				// Number of failed transfers
+	uint64_t timeouts;				// Number of transfers stopped by timeout
+	uint64_t aborts;				// Number of transfers stopped by abort request
+	uint64_t drops;					// Number of finished buffers dropped (overrun)
+	uint64_t stalls;				// Number of stream stalls (DMA had no buffers)
+
+	// Latency histograms (log2 of ns), only transfers finished by DMA engine
+	uint32_t hist_irq[DM_HIST_BINS];	// Submit -> "transfer finished" callback
+	uint32_t hist_wake[DM_HIST_BINS];	// Callback -> the result is taken by user
+	uint32_t hist_kick[DM_HIST_BINS];	// Callback -> the pending buffers are started
+} DM_STAT_t;
+
 // DMA-PROXY DMA channel parameters
 typedef struct DM_CHAN_s {
-	// Unique index of DMA channel
+	// Index of DMA channel in DMA-PROXY instance
 	uint32_t ch_idx;
 
+	// DMA-PROXY device structure pointer (the device the channel belongs to)
+	struct device *dev;
+
+	// DMA channel name (from "dma-names" DT property)
+	const char *name;
+
+	// Transfer direction
+	uint32_t dir;					// Direction for user (_DM_DIR_t)
+	enum dma_transfer_direction tr_dir;	// Direction for DMA engine
+	enum dma_data_direction dma_dir;	// Direction for DMA mapping API
+
+	// Transfer geometry
+	uint32_t frame_sz;				// Size of one stream frame (b)
+	uint32_t frames;				// Number of frames per DMA transaction
+	uint32_t trsz;					// Size of one DMA transaction (b)
+
 	// DMA channel support
 	struct dma_chan *dma_chan;		// DMA Engine channel parameters
-	uint8_t *dma_buffer;			// Pointer to the allocated DMA buffer
-	dma_addr_t dma_buffer_phadd;	// DMA buffer physical address
-	struct dma_async_tx_descriptor *tran_desc;	// Async DMA transaction descriptor
-	struct completion cmp;			// DMA transaction complete indicator
-	dma_cookie_t cookie;			// The cookie to track the status of DMA transaction
-	uint32_t res_code;				// DMA transaction result code (for user app)
+	uint8_t *dma_buffer;			// Pointer to the allocated DMA memory (all buffers)
+	dma_addr_t dma_buffer_phadd;	// DMA memory physical address
+	uint32_t dma_mem_sz;			// Size of the allocated DMA memory (b)
+	uint32_t ring_sz;				// Size of the capture ring (b) (0 - no ring)
+	uint32_t buf_stride;			// Distance between neighbour buffers in memory (b)
+	uint32_t mem_mode;				// Buffer memory mode (_DM_MEM_MODE_t)
+	atomic_t map_cnt;				// Number of user space mappings and exported
+									// dma-bufs of the memory
+	struct address_space *map_space;	// Mapping of the device file (revoked
+									// on release) (NULL - not mapped)
+
+	// Buffer queue support
+	uint32_t buf_num;				// Number of buffers in the buffer queue
+	uint32_t slot_max;				// Number of buffer slots (size of buffer arrays)
+	DM_BUF_t *buf;					// Buffers of the buffer queue
+	spinlock_t lock;				// Buffer queue access lock (callback vs ioctl)
+	struct mutex ioctl_mutex;		// Ioctl requests serialization mutex
+	wait_queue_head_t wq;			// Wait queue: "DMA transaction finished" event
+	uint32_t *done_fifo;			// FIFO of finished buffers indexes
+	uint32_t done_rd;				// Done FIFO read position
+	uint32_t done_cnt;				// Number of buffer indexes in the done FIFO
+	uint8_t streaming;				// Flag: streaming on the buffer queue is on (1)
+	uint32_t start_cnt;				// Number of started transfers (start order)
+
+	// Submission window support (queued buffers wait for a free place)
+	uint32_t *pend_fifo;			// FIFO of queued buffers indexes (queue order)
+	uint32_t pend_rd;				// Pending FIFO read position
+	uint32_t pend_cnt;				// Number of buffer indexes in the pending FIFO
+	uint32_t *act_fifo;				// FIFO of active buffers indexes (start order)
+	uint32_t act_rd;				// Active FIFO read position
+	uint32_t act_cnt;				// Number of active buffers
+	uint32_t act_max;				// Maximum number of active buffers
+	struct mutex kick_mutex;		// Transfer start serialization mutex
+	struct work_struct kick_work;	// Starts pending buffers after completions
+	ktime_t t_kick;					// Time the start was scheduled (0 - not
+									// scheduled) (protected by the queue lock)
+
+	// Real-time completion support (the pending buffers are started by the
+	// SCHED_FIFO worker pinned to the CPU instead of the system workqueue)
+	uint32_t rt_cpu;				// CPU of the completion worker (DM_RT_OFF - off)
+	uint32_t rt_prio;				// SCHED_FIFO priority of the completion worker
+	struct kthread_worker *rt_worker;	// Completion worker (NULL - not used)
+	struct kthread_work rt_work;	// Starts pending buffers after completions
+	unsigned int rt_irq;			// DMA channel interrupt bound to the CPU (0 - none)
+
+	// Interrupt coalescing support (pending buffers are started in batches)
+	uint32_t coal_cnt;				// Number of transfers per interrupt (1 - no coalescing)
+	uint32_t coal_us;				// Poll period of coalesced transfers (us) (0 - no poll)
+	struct delayed_work coal_work;	// Polls the finished coalesced transfers
+	int coal_poll;					// Flag: transfers without callback were issued
+									// after a start error, they are polled (1)
+	uint32_t batch_seq;				// Number of completion events (interrupts and polls)
+
+	// Overrun support (protected by the buffer queue lock)
+	uint32_t ovr_policy;			// Overrun policy (_DM_OVR_POLICY_t)
+	uint8_t ovr_stall;				// Flag: DMA ran out of buffers, the next finished
+									// buffer is marked (1)
+	uint8_t pop_valid;				// Flag: pop_seq is set (1) (not at streaming start)
+	uint32_t pop_seq;				// Expected sequence number of the next dequeued
+									// buffer (the gap - the dropped buffers)
+
+	// Read and splice support (fan-out of finished buffers to the readers)
+	struct mutex fan_mutex;			// Fan-out ring and readers list access mutex
+	DM_FAN_t *fan;					// Fan-out ring: finished buffers by sequence number
+	uint32_t fan_head;				// Sequence number of the next finished buffer
+	uint32_t fan_tail;				// Sequence number of the oldest kept buffer
+	uint32_t fan_rd;				// Ring slot of the oldest kept buffer
+									// (wraps at buf_num)
+	uint32_t fan_lowat;				// Minimum number of buffers owned by DMA
+									// (the older buffers are reused if less)
+	struct list_head rdr_list;		// List of the readers
+	uint32_t rdr_cnt;				// Number of the readers
+	uint8_t rd_strm;				// Flag: streaming was started by read (1)
+	struct DM_RDR_s *ctl_rdr;		// The file using buffer queue ioctl requests
+
+	// In-kernel recorder support (the thread writes the buffers to the file)
+	DM_REC_t rec;
+
+	// Write support (transmit channel: the written data fills the buffers)
+	uint8_t wr_strm;				// Flag: streaming was started by write (1)
+	DM_BUF_t *wr_buf;				// Buffer being filled (NULL - no buffer)
+	uint32_t wr_len;				// Number of bytes in the buffer being filled
+	uint32_t wr_next;				// Index of the next buffer never filled yet
+
+	// Transfer timeout and abort support
+	uint32_t timeout_ms;			// DMA transaction timeout (ms) (0 - no timeout)
+	uint32_t abort_cnt;				// Number of executed abort requests
+
+	// User buffer transaction support
+	DM_USR_t usr;					// Current user buffer transaction
+
+	// Completion metadata support (protected by the buffer queue lock)
+	_DM_META_t *meta;				// Metadata pages: metadata of each buffer
+	uint32_t meta_sz;				// Size of the metadata pages (b)
+	uint32_t seq;					// Completion sequence counter
+
+	// Statistics support (protected by the buffer queue lock)
+	DM_STAT_t stat;					// Transfer counters and latency histograms
+	struct dentry *dbg_dir;			// Debugfs directory of the channel
 
 	// Character device support
 	uint8_t cdev_region_alloc;		// Flag: character device major+minor numbers allocated (1)
 	uint8_t cdev_added;				// Flag: character device was added to the kernel (1)
 	uint8_t cdev_created;			// Flag: character device was created (1)
-	uint8_t cdev_opened;			// Flag: character device was opened (1)
 	dev_t cdev_node;				// 32-bit value, contains major and minor numbers
 	struct cdev cdev;				// Kernel character device structure
 } DM_CHAN_t;
 
-// DMA-PROXY parameters structure
+// DMA-PROXY channel reader parameters (one structure for each opened file)
+typedef struct DM_RDR_s {
+	DM_CHAN_t *pch;					// The channel the file was opened for
+	struct list_head list;			// Entry of the channel readers list
+	uint8_t reading;				// Flag: the file is in the readers list (1)
+	struct mutex rd_mutex;			// Read/splice/write requests serialization mutex
+	uint32_t seq;					// Sequence number of the next buffer to read
+	DM_BUF_t *rd_buf;				// Buffer being read (NULL - no buffer)
+	uint32_t rd_offs;				// Read position in the buffer (b)
+	uint32_t rd_len;				// Number of received bytes in the buffer
+	uint64_t frames;				// Number of buffers read
+	uint64_t lost;					// Number of buffers reused by DMA before read
+} DM_RDR_t;
+
+// DMA-PROXY exported buffer attachment parameters (one for each importer)
+typedef struct DM_EXP_ATT_s {
+	struct sg_table sgt;			// Scatter-gather table of the buffer
+	enum dma_data_direction dir;	// Mapping direction (DMA_NONE - not mapped)
+} DM_EXP_ATT_t;
+
+// DMA-PROXY instance parameters structure
+// (one structure for each probed DMA-PROXY device)
 typedef struct DM_PARM_s {
 	// DMA-PROXY device structure pointer
 	struct device *dev;
 
-	// Parameters for each DMA channel
-	DM_CHAN_t	ch[_DM_CH_NUM];
+	// Parameters for each DMA channel (the channels are listed in DT)
+	uint32_t ch_num;				// Number of DMA channels
+	DM_CHAN_t *ch;					// Array of DMA channel parameters
+
+	// Flag: "memory-region" (reserved memory) is assigned to the device (1)
+	uint8_t rmem;
 } DM_PARM_t;
 
 /******************************************************************************
@@ -81,51 +359,199 @@ typedef struct DM_PARM_s {
 static int __init moduleInit(void);
 static void __init moduleInitParm(void);
 static int __init moduleCrCls(void);
+static void __init moduleCrDbg(void);
 static int __init moduleReg(void);
 static void __exit moduleExit(void);
 static void moduleFreeAll(void);
 static void moduleUnreg(void);
 static void moduleDestrCls(void);
+static void moduleDestrDbg(void);
 static int dmProbe(struct platform_device *pdev);
-static int dmProbeDevFound(void);
 static int dmRemove(struct platform_device *pdev);
-static void dmInitParm(struct platform_device *pdev);
-static void dmInitParmCh(uint32_t ch_idx);
-static int dmInitAllCh(void);
+static int dmInitParm(struct platform_device *pdev, DM_PARM_t *pdm);
+static int dmInitParmCh(DM_PARM_t *pdm, uint32_t ch_idx);
+static int dmInitParmChDt(DM_CHAN_t *pch, struct device_node *np);
+static uint32_t dmInitParmChDef(const char *name);
+static int dmInitParmChQueue(DM_CHAN_t *pch);
+static void *dmInitDevKv(struct device *dev, size_t size);
+static int dmInitParmRmem(DM_PARM_t *pdm);
+static int dmInitAllCh(DM_PARM_t *pdm);
 static int dmInitCh(DM_CHAN_t *pch);
 static int dmInitChReq(DM_CHAN_t *pch);
+static void dmInitChRt(DM_CHAN_t *pch);
+static void dmInitChRtIrq(DM_CHAN_t *pch);
 static int dmInitChMem(DM_CHAN_t *pch);
+static int dmInitChMemCoh(DM_CHAN_t *pch);
+static void dmInitChMemBufs(DM_CHAN_t *pch);
+static int dmInitChMemCached(DM_CHAN_t *pch);
+static int dmInitChMemCachedBuf(DM_BUF_t *pbuf, uint32_t order);
+static int dmInitChMeta(DM_CHAN_t *pch);
 static int dmInitChDev(DM_CHAN_t *pch);
 static int dmInitChDevRegion(DM_CHAN_t *pch);
 static int dmInitChDevCdev(DM_CHAN_t *pch);
 static int dmInitChDevCrDev(DM_CHAN_t *pch);
+static void dmInitChDbg(DM_CHAN_t *pch);
 static int dmCdevOpen(struct inode *ino, struct file *file);
 static int dmCdevRelease(struct inode *ino, struct file *file);
 static long dmCdevIoctl(struct file *file, unsigned int cmd, unsigned long arg);
+static int dmCdevIoctlQueue(unsigned int cmd, unsigned long arg);
 static int dmCdevMmap(struct file *file, struct vm_area_struct *vma);
-static void dmChTransfer(DM_CHAN_t *pch);
-static void dmChTrCallBack(void *cmp);
-static int dmChTrStart(DM_CHAN_t *pch);
-static int dmChTrIniSing(DM_CHAN_t *pch);
-static void dmChTrIniCallBack(DM_CHAN_t *pch);
-static void dmChTrIniCmp(DM_CHAN_t *pch);
-static int dmChTrIniSubmit(DM_CHAN_t *pch);
+static int dmCdevMmapCached(DM_CHAN_t *pch, struct vm_area_struct *vma);
+static int dmCdevMmapMeta(DM_CHAN_t *pch, struct vm_area_struct *vma);
+static void dmCdevVmOpen(struct vm_area_struct *vma);
+static void dmCdevVmClose(struct vm_area_struct *vma);
+static void dmChMapPut(DM_CHAN_t *pch);
+static unsigned int dmCdevPoll(struct file *file, poll_table *wait);
+static ssize_t dmCdevRead(struct file *file, char __user *buf, size_t count,
+	loff_t *ppos);
+static ssize_t dmCdevSpliceRead(struct file *file, loff_t *ppos,
+	struct pipe_inode_info *pipe, size_t len, unsigned int flags);
+static ssize_t dmCdevWrite(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos);
+static int dmCdevFsync(struct file *file, loff_t start, loff_t end,
+	int datasync);
+static int dmChWrStart(DM_RDR_t *prdr);
+static int dmChWrBuf(DM_CHAN_t *pch, int nonblock);
+static void dmChWrQueue(DM_CHAN_t *pch);
+static int dmChWrDrain(DM_CHAN_t *pch);
+static int dmRdrStart(DM_RDR_t *prdr);
+static int dmChRdStart(DM_CHAN_t *pch);
+static int dmRdrBuf(DM_RDR_t *prdr, int nonblock);
+static int dmRdrAvail(DM_RDR_t *prdr);
+static void dmRdrNext(DM_RDR_t *prdr);
+static void dmChRdPut(DM_BUF_t *pbuf);
+static void dmChFanPump(DM_CHAN_t *pch);
+static void dmChFanRecycle(DM_CHAN_t *pch);
+static uint32_t dmChFanSlot(DM_CHAN_t *pch, uint32_t seq);
+static uint32_t dmChQueueDmaCnt(DM_CHAN_t *pch);
+static int dmChCtlClaim(DM_RDR_t *prdr);
+static int dmRdrIoctlInfo(DM_RDR_t *prdr, unsigned long arg);
+static struct page *dmChBufPage(DM_BUF_t *pbuf, uint32_t offs);
+static void dmPipeRefGet(DM_BUF_t *pbuf, struct page *page);
+static void dmPipeRefPut(DM_BUF_t *pbuf, struct page *page);
+static void dmPipeBufGet(struct pipe_inode_info *pipe, struct pipe_buffer *buf);
+static void dmPipeBufRelease(struct pipe_inode_info *pipe,
+	struct pipe_buffer *buf);
+static int dmPipeBufSteal(struct pipe_inode_info *pipe,
+	struct pipe_buffer *buf);
+static void dmPipeSpdRelease(struct splice_pipe_desc *spd, unsigned int i);
+static long dmChIoctlCtrl(DM_CHAN_t *pch, unsigned int cmd, unsigned long arg);
+static int dmChIoctlTranRc(DM_CHAN_t *pch, unsigned long arg);
+static int dmChIoctlTranSt(DM_CHAN_t *pch);
+static int dmChIoctlTranRes(DM_CHAN_t *pch, unsigned long arg, int nonblock);
+static int dmChIoctlQbuf(DM_CHAN_t *pch, unsigned long arg);
+static int dmChIoctlDqbuf(DM_CHAN_t *pch, unsigned long arg, int nonblock);
+static int dmChIoctlBatch(DM_CHAN_t *pch, unsigned long arg, int nonblock);
+static int dmChBatchQueue(DM_CHAN_t *pch, _DM_BATCH_t *pbat);
+static int dmChBatchDequeue(DM_CHAN_t *pch, _DM_BATCH_t *pbat, int nonblock);
+static int dmChIoctlInfo(DM_CHAN_t *pch, unsigned long arg);
+static int dmChIoctlMemMode(DM_CHAN_t *pch, unsigned long arg);
+static int dmChIoctlGeom(DM_CHAN_t *pch, unsigned long arg);
+static int dmChIoctlTimeout(DM_CHAN_t *pch, unsigned long arg);
+static int dmChIoctlCoal(DM_CHAN_t *pch, unsigned long arg);
+static uint32_t dmChCoalLimit(DM_CHAN_t *pch, uint32_t coal_cnt);
+static int dmChIoctlOvr(DM_CHAN_t *pch, unsigned long arg);
+static int dmChIoctlRec(DM_CHAN_t *pch, unsigned long arg);
+static int dmChRecStart(DM_CHAN_t *pch, int fd);
+static void dmChRecStop(DM_CHAN_t *pch);
+static int dmChRecThread(void *data);
+static int dmChRecWrite(DM_CHAN_t *pch, DM_BUF_t *pbuf);
+static int dmChMemRealloc(DM_CHAN_t *pch, uint32_t mode, uint32_t frames);
+static int dmChIoctlCpuAcc(DM_CHAN_t *pch, unsigned long arg, int begin);
+static void dmChBufSyncCpu(DM_BUF_t *pbuf);
+static void dmChBufSyncDev(DM_BUF_t *pbuf);
+static int dmChIoctlExpbuf(DM_CHAN_t *pch, unsigned long arg);
+static int dmChIoctlTranUsr(DM_CHAN_t *pch, unsigned long arg);
+static int dmChUsrTransfer(DM_CHAN_t *pch, _DM_USR_TRAN_t *utran);
+static int dmChUsrPin(DM_USR_t *pusr, unsigned long uaddr, uint32_t len,
+	int write);
+static int dmChUsrMap(DM_CHAN_t *pch);
+static int dmChUsrStart(DM_CHAN_t *pch);
+static void dmChUsrCallBack(void *parm);
+static int dmChUsrDone(DM_CHAN_t *pch);
+static void dmChUsrFree(DM_CHAN_t *pch);
+static int dmChQueueIdle(DM_CHAN_t *pch);
+static int dmChStrmOn(DM_CHAN_t *pch);
+static void dmChStrmOff(DM_CHAN_t *pch);
+static void dmChQueueReset(DM_CHAN_t *pch);
+static int dmChBufQueue(DM_CHAN_t *pch, uint32_t buf_idx, uint32_t len);
+static int dmChQueueKick(DM_CHAN_t *pch);
+static DM_BUF_t *dmChQueueNext(DM_CHAN_t *pch);
+static void dmChQueueSched(DM_CHAN_t *pch);
+static void dmChQueueWork(struct work_struct *work);
+static void dmChQueueRtWork(struct kthread_work *work);
+static void dmChQueueRun(DM_CHAN_t *pch);
+static void dmChCoalWork(struct work_struct *work);
+static uint32_t dmChCoalPeriod(DM_CHAN_t *pch);
+static void dmChOvrCheck(DM_CHAN_t *pch);
+static int dmChBufStart(DM_BUF_t *pbuf, int irq);
+static void dmChBufFinish(DM_BUF_t *pbuf);
+static void dmChBufFail(DM_BUF_t *pbuf);
+static int dmChBufDone(DM_CHAN_t *pch);
+static DM_BUF_t *dmChBufPop(DM_CHAN_t *pch);
+static int dmChBufWaitPop(DM_CHAN_t *pch, int nonblock, DM_BUF_t **ppbuf);
+static int dmChTransfer(DM_CHAN_t *pch);
+static void dmChTrCallBack(void *parm);
+static void dmChMetaStamp(DM_BUF_t *pbuf);
+static void dmChMetaRes(DM_BUF_t *pbuf);
+static int dmChTrStart(DM_BUF_t *pbuf, int irq);
+static int dmChTrIniSing(DM_BUF_t *pbuf, unsigned long flags);
+static int dmChTrIniSg(DM_BUF_t *pbuf, unsigned long flags);
+static void dmChTrIniCallBack(DM_BUF_t *pbuf);
+static int dmChTrIniSubmit(DM_BUF_t *pbuf);
 static void dmChTrIniIssuePend(DM_CHAN_t *pch);
-static void dmChTrWait(DM_CHAN_t *pch);
-static void dmChTrWaitCmp(DM_CHAN_t *pch);
-static enum dma_status dmChTrWaitGetStat(DM_CHAN_t *pch);
-static void dmChTrWaitRes(DM_CHAN_t *pch, enum dma_status status);
-static void dmChTrStResCode(DM_CHAN_t *pch, uint32_t res_code);
-static int dmChResToUser(DM_CHAN_t *pch, unsigned long arg);
+static int dmChTrWait(DM_CHAN_t *pch);
+static long dmChTrWaitTmo(DM_CHAN_t *pch);
+static enum dma_status dmChTrWaitGetStat(DM_BUF_t *pbuf);
+static void dmChTrWaitRes(DM_BUF_t *pbuf, enum dma_status status);
+static int dmChResToUser(DM_BUF_t *pbuf, unsigned long arg);
+static int dmChBufToUser(DM_BUF_t *pbuf, unsigned long arg);
 static void dmChTerm(DM_CHAN_t *pch);
-static void dmFreeAll(void);
-static void dmFreeCh(DM_CHAN_t *pch);
+static void dmChAbort(DM_CHAN_t *pch, uint32_t res_code);
+static void dmChAbortBufs(DM_CHAN_t *pch, uint32_t res_code);
+static void dmChAbortUsr(DM_CHAN_t *pch, uint32_t res_code);
+static DM_BUF_t *dmChBufOldest(DM_CHAN_t *pch);
+static uint32_t dmChAbortResidue(DM_CHAN_t *pch, dma_cookie_t cookie);
+static void dmChStatDone(DM_CHAN_t *pch, uint32_t res_code, uint32_t residue,
+	ktime_t t_submit, ktime_t t_done, int lat);
+static void dmChStatHist(uint32_t *hist, ktime_t t_from, ktime_t t_to);
+static int dmDbgStatsOpen(struct inode *ino, struct file *file);
+static int dmDbgStatsShow(struct seq_file *seq, void *v);
+static void dmDbgStatsHist(struct seq_file *seq, const char *title,
+	uint32_t *hist);
+static ssize_t dmDbgResetWrite(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos);
+static int dmExpAttach(struct dma_buf *dmabuf, struct device *dev,
+	struct dma_buf_attachment *attach);
+static void dmExpDetach(struct dma_buf *dmabuf,
+	struct dma_buf_attachment *attach);
+static struct sg_table *dmExpMap(struct dma_buf_attachment *attach,
+	enum dma_data_direction dir);
+static void dmExpUnmap(struct dma_buf_attachment *attach,
+	struct sg_table *sgt, enum dma_data_direction dir);
+static void dmExpRelease(struct dma_buf *dmabuf);
+static int dmExpCpuBeg(struct dma_buf *dmabuf, enum dma_data_direction dir);
+static int dmExpCpuEnd(struct dma_buf *dmabuf, enum dma_data_direction dir);
+static void *dmExpKmap(struct dma_buf *dmabuf, unsigned long page_num);
+static void dmExpKunmap(struct dma_buf *dmabuf, unsigned long page_num,
+	void *vaddr);
+static int dmExpMmap(struct dma_buf *dmabuf, struct vm_area_struct *vma);
+static void *dmExpVmap(struct dma_buf *dmabuf);
+static void dmFreeAll(DM_PARM_t *pdm);
+static int dmFreeCh(DM_CHAN_t *pch);
+static void dmFreeChDbg(DM_CHAN_t *pch);
 static void dmFreeChDev(DM_CHAN_t *pch);
 static void dmFreeChDevDest(DM_CHAN_t *pch);
 static void dmFreeChDevCdev(DM_CHAN_t *pch);
 static void dmFreeChDevRegion(DM_CHAN_t *pch);
 static void dmFreeChMem(DM_CHAN_t *pch);
+static void dmFreeChMemCached(DM_CHAN_t *pch);
+static void dmFreeChMeta(DM_CHAN_t *pch);
+static void dmFreeChRt(DM_CHAN_t *pch);
 static void dmFreeChRelease(DM_CHAN_t *pch);
+static void dmFreeChKeep(DM_CHAN_t *pch);
+static void dmFreeDevRmem(void *data);
+static void dmFreeDevKv(void *data);
 
 /******************************************************************************
 *	Internal data
@@ -133,9 +559,6 @@ static void dmFreeChRelease(DM_CHAN_t *pch);
 // Module parameters
 static MODULE_PARM_t module_parm;
 
-// DMA-PROXY device parameters
-static DM_PARM_t dm_parm;
-
 // List of platform driver compatible devices
 static struct of_device_id plat_of_match[] = {
 	{ .compatible = "por,dma-proxy-pseudo-dev", },
@@ -154,25 +577,84 @@ static struct platform_driver plat_drv = {
 	.remove = dmRemove,
 };
 
-// DMA channel names
+// Known DMA channel names (used if the frame size is not set in DT)
 static const char	*dm_ch_name[_DM_CH_NUM] = {
 	_DM_CHN_AXI_DMA_0,			// Index - _DM_CH_AXI_DMA_0
 	_DM_CHN_AXI_DMA_SC			// Index - _DM_CH_AXI_DMA_SC
 };
 
-// DMA channel transaction sizes
+// Known DMA channel frame sizes (used if the frame size is not set in DT)
 static const uint32_t dm_ch_trsz[_DM_CH_NUM] = {
 	_DM_AXI_DMA_0_TRSZ,			// Index - _DM_CH_AXI_DMA_0
 	_DM_AXI_DMA_SC_TRSZ			// Index - _DM_CH_AXI_DMA_SC
 };
 
+// Initial buffer memory mode for all channels (module parameter)
+static uint mem_mode = _DM_MEM_COHERENT;
+module_param(mem_mode, uint, S_IRUGO);
+MODULE_PARM_DESC(mem_mode, "Buffer memory mode: 0 - coherent (default), 1 - cached");
+
+// User space mappings operations (mappings counter support)
+static const struct vm_operations_struct dm_vm_ops = {
+	.open = dmCdevVmOpen,
+	.close = dmCdevVmClose
+};
+
+// Debugfs "stats" file operations (channel counters and histograms)
+static const struct file_operations dm_dbg_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = dmDbgStatsOpen,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+// Debugfs "reset" file operations (any write clears the channel statistics)
+static const struct file_operations dm_dbg_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = dmDbgResetWrite
+};
+
+// Exported buffer (dma-buf) operations
+static const struct dma_buf_ops dm_exp_ops = {
+	.attach = dmExpAttach,
+	.detach = dmExpDetach,
+	.map_dma_buf = dmExpMap,
+	.unmap_dma_buf = dmExpUnmap,
+	.release = dmExpRelease,
+	.begin_cpu_access = dmExpCpuBeg,
+	.end_cpu_access = dmExpCpuEnd,
+	.map = dmExpKmap,
+	.unmap = dmExpKunmap,
+	.map_atomic = dmExpKmap,
+	.unmap_atomic = dmExpKunmap,
+	.mmap = dmExpMmap,
+	.vmap = dmExpVmap
+};
+
 // Character device file operations
 static struct file_operations dm_cdev_fops = {
 	.owner = THIS_MODULE,
 	.open = dmCdevOpen,
 	.release = dmCdevRelease,
 	.unlocked_ioctl = dmCdevIoctl,
-	.mmap = dmCdevMmap
+	.mmap = dmCdevMmap,
+	.poll = dmCdevPoll,
+	.read = dmCdevRead,
+	.splice_read = dmCdevSpliceRead,
+	.write = dmCdevWrite,
+	.fsync = dmCdevFsync
+};
+
+// Pipe buffer operations for the spliced buffer pages
+// (the buffer is queued again when the last pipe buffer is released)
+static const struct pipe_buf_operations dm_pipe_buf_ops = {
+	.can_merge = 0,
+	.confirm = generic_pipe_buf_confirm,
+	.release = dmPipeBufRelease,
+	.steal = dmPipeBufSteal,
+	.get = dmPipeBufGet
 };
 
 /******************************** moduleInit() ********************************
@@ -195,6 +677,9 @@ static int __init moduleInit(void)
 	rc = moduleCrCls();
 	if(rc != 0) return rc;
 
+	// Create debugfs directory of the module (statistics)
+	moduleCrDbg();
+
 	// Register platform driver for DMA-PROXY pseudo-device
 	rc = moduleReg();
 	if(rc != 0)
@@ -215,8 +700,8 @@ static void __init moduleInitParm(void)
 {
 	// Set initial values for the module parameters
 	module_parm.plat_drv_registered = 0;
-	module_parm.dev_found = 0;
 	module_parm.pclass = NULL;
+	module_parm.dbg_dir = NULL;
 }
 
 /******************************* moduleCrCls() ********************************
@@ -250,6 +735,29 @@ static int __init moduleCrCls(void)
 	return 0;
 }
 
+/******************************* moduleCrDbg() ********************************
+* Create debugfs directory of the module
+* The channel statistics are exported in its subdirectories.
+* Debugfs is optional: if the directory can not be created, the module
+*	works without statistics files
+* Used variable:
+*	(o)module_parm - module parameters
+*******************************************************************************/
+static void __init moduleCrDbg(void)
+{
+	struct dentry *dir;
+
+	// Create the directory
+	dir = debugfs_create_dir(DRIVER_NAME, NULL);
+	if(IS_ERR_OR_NULL(dir)) {
+		printk(KERN_INFO "dma-mod: debugfs is not available \n");
+		return;
+	}
+
+	// Set the pointer to the created directory
+	module_parm.dbg_dir = dir;
+}
+
 /******************************** moduleReg() *********************************
 * Register platform driver for DMA-PROXY pseudo-device
 * Used variables:
@@ -298,6 +806,9 @@ static void moduleFreeAll(void)
 	// Unregister platform driver for DMA-PROXY pseudo-device
 	moduleUnreg();
 
+	// Remove debugfs directory of the module
+	moduleDestrDbg();
+
 	// Destroy registered class
 	moduleDestrCls();
 }
@@ -342,11 +853,28 @@ static void moduleDestrCls(void)
 	module_parm.pclass = NULL;
 }
 
+/****************************** moduleDestrDbg() ******************************
+* Remove debugfs directory of the module (with all channel subdirectories)
+* The directory is removed only if it was created previously
+* Used variable:
+*	(io)module_parm - module parameters
+*******************************************************************************/
+static void moduleDestrDbg(void)
+{
+	// Remove the directory if it was created
+	if(module_parm.dbg_dir != NULL)
+		debugfs_remove_recursive(module_parm.dbg_dir);
+
+	// Clear the pointer in the module parameters structure
+	module_parm.dbg_dir = NULL;
+}
+
 /******************************* dmProbe(pdev) ********************************
 * DMA-PROXY pseudo-device probe function.
 * The function is called when compatible with this driver platform device
 *	(DMA-PROXY) was found
-* Only one DMA-PROXY device is supported
+* Several DMA-PROXY devices (instances) are supported, each instance
+*	serves the DMA channels listed in its "dma-names" DT property
 * Inits dma channels
 * Creates character devices in /dev folder for each dma channel
 *	(for user ioctl requests)
@@ -359,49 +887,31 @@ static void moduleDestrCls(void)
 *******************************************************************************/
 static int dmProbe(struct platform_device *pdev)
 {
+	DM_PARM_t *pdm;
 	int rc;
 
 	printk(KERN_INFO "Poroshin: dmProbe START \n");
 
-	// Check that only one DMA-PROXY pseudo-device was found
-	rc = dmProbeDevFound();
-	if(rc != 0) return -1;			// Error: Only one DMA-PROXY device is supported.
+	// Allocate DMA-PROXY instance parameters (freed with the device)
+	pdm = devm_kzalloc(&pdev->dev, sizeof(DM_PARM_t), GFP_KERNEL);
+	if(pdm == NULL) return -ENOMEM;
+
+	// Init DMA-PROXY device parameters (channels are read from DT)
+	rc = dmInitParm(pdev, pdm);
+	if(rc != 0) return rc;
 
-	// Init DMA-PROXY device parameters
-	dmInitParm(pdev);
+	// Store instance parameters in the device (for remove function)
+	platform_set_drvdata(pdev, pdm);
 
 	// Init all DMA channels
-	rc = dmInitAllCh();
-	if(rc != 0) 
+	rc = dmInitAllCh(pdm);
+	if(rc != 0) {
 		// Free all resources associated with DMA-PROXY
-		dmFreeAll();
-
-	// Return success/error code
-	return rc;
-}
-
-/***************************** dmProbeDevFound() ******************************
-* DMA-PROXY initialization: check that only one DMA-PROXY device was found
-* Used variable:
-*	(io)module_parm - module parameters
-* Return value:
-*	0  Success. First DMA-PROXY device was found
-*	-1 Error. Only one DMA-PROXY device is supported. 
-*******************************************************************************/
-static int dmProbeDevFound(void)
-{
-	uint32_t dev_found;
-
-	// Read the flag: DMA-PROXY device was found (1), not found (0)
-	dev_found = module_parm.dev_found;
-
-	// Check if the device is not the first one
-	if(dev_found) return -1;	// Error. Only one DMA-PROXY device is supported. 
-
-	// Set the flag: DMA-PROXY device was found
-	module_parm.dev_found = 1;
+		dmFreeAll(pdm);
+		return rc;
+	}
 
-	// Success. First DMA-PROXY device was found
+	// Success. All channels of the instance were initialized
 	return 0;
 }
 
@@ -416,86 +926,512 @@ static int dmProbeDevFound(void)
 *******************************************************************************/
 static int dmRemove(struct platform_device *pdev)
 {
+	DM_PARM_t *pdm;
+
 	printk(KERN_INFO "Poroshin: dmRemove EXECUTED \n");
 
+	// Get DMA-PROXY instance parameters
+	pdm = platform_get_drvdata(pdev);
+
 	// Free all resources associated with DMA-PROXY
-	dmFreeAll();
+	dmFreeAll(pdm);
 
 	// The device was removed successfully
 	return 0;
 }
 
-/****************************** dmInitParm(pdev) ******************************
+/**************************** dmInitParm(pdev,pdm) ****************************
 * DMA-PROXY initialization: init DMA-PROXY device parameters
 * (This function must be called before all DMA-PROXY initializations)
-* Used variable:
-*	(o)dm_parm - DMA-PROXY parameters
-* Parameter:
+* The number of DMA channels is the number of "dma-names" DT property entries
+* The reserved memory region of the device (if any) is assigned after the
+*	channel parameters were read
+* Parameters:
 *	(i)pdev - structure of the platform device - DMA-PROXY
+*	(o)pdm - DMA-PROXY instance parameters
+* Return value:
+*	0  Success. The parameters were initialized
+*	<0 Error code. Bad DT node, no memory or bad reserved memory region
 *******************************************************************************/
-static void dmInitParm(struct platform_device *pdev)
+static int dmInitParm(struct platform_device *pdev, DM_PARM_t *pdm)
 {
 	struct device *dev;
+	int ch_num;
 	uint32_t ch_idx;
+	int rc;
 
 	// Read the pointer to the device structure of DMA-PROXY
 	dev = &pdev->dev;
 
 	// Set device structure pointer in DMA-PROXY parameters
-	dm_parm.dev = dev;
+	pdm -> dev = dev;
+
+	// Get the number of DMA channels from DT
+	ch_num = of_property_count_strings(dev -> of_node, "dma-names");
+	if(ch_num <= 0) {
+		dev_err(dev, "no DMA channels in \"dma-names\"\n");
+		return -EINVAL;
+	}
+	pdm -> ch_num = ch_num;
+
+	// Allocate channel parameters (freed with the device unless user space
+	// keeps the memory of a channel)
+	pdm -> ch = dmInitDevKv(dev, ch_num * sizeof(DM_CHAN_t));
+	if(pdm -> ch == NULL) return -ENOMEM;
 
 	// Init DMA channel parameters cycle
-	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++)
+	for(ch_idx = 0; ch_idx < pdm -> ch_num; ch_idx++) {
 		// Init current channel
-		dmInitParmCh(ch_idx);
+		rc = dmInitParmCh(pdm, ch_idx);
+		if(rc != 0) return rc;			// Bad channel DT properties
+	}
+
+	// Assign reserved memory region (before any DMA memory is allocated)
+	rc = dmInitParmRmem(pdm);
+	if(rc != 0) return rc;				// Can not assign the region
+
+	// The parameters were initialized successfully
+	return 0;
 }
 
-/**************************** dmInitParmCh(ch_idx) ****************************
+/************************** dmInitParmCh(pdm,ch_idx) **************************
 * DMA-PROXY initialization: init DMA-PROXY channel parameters
-* Used variable:
-*	(o)dm_parm - DMA-PROXY parameters
-* Parameter:
+* Parameters:
+*	(io)pdm - DMA-PROXY instance parameters
 *	(i)ch_idx - channel index
+* Return value:
+*	0  Success. The channel parameters were initialized
+*	<0 Error code. Bad channel DT properties or no memory
 *******************************************************************************/
-static void dmInitParmCh(uint32_t ch_idx)
+static int dmInitParmCh(DM_PARM_t *pdm, uint32_t ch_idx)
 {
 	DM_CHAN_t *pch;
+	int rc;
 
 	// Set the pointer to the DMA-PROXY DMA channel parameters
-	pch = &dm_parm.ch[ch_idx];
+	pch = &(pdm -> ch[ch_idx]);
 
-	// Set channel index
+	// Set channel index and the device the channel belongs to
 	pch -> ch_idx = ch_idx;
+	pch -> dev = pdm -> dev;
+
+	// Read channel name, direction, buffers from DT
+	rc = dmInitParmChDt(pch, pdm -> dev -> of_node);
+	if(rc != 0) return rc;
+
+	// Initial transfer geometry: one frame per DMA transaction
+	pch -> frames = 1;
+	pch -> trsz = pch -> frame_sz;
 
 	// Clear pointers to the allocated resources
 	pch -> dma_chan = NULL;
 	pch -> dma_buffer = NULL;
+	pch -> dma_mem_sz = 0;
+
+	// Set initial buffer memory mode, the memory is not mapped
+	// (the capture ring is allocated in coherent memory only)
+	pch -> mem_mode = (mem_mode == _DM_MEM_CACHED && pch -> ring_sz == 0) ?
+		_DM_MEM_CACHED : _DM_MEM_COHERENT;
+	atomic_set(&(pch -> map_cnt), 0);
+
+	// Init buffer queue parameters
+	rc = dmInitParmChQueue(pch);
+	if(rc != 0) return rc;				// Can not allocate buffer parameters
+
+	// Metadata page is not allocated, clear completion sequence counter
+	pch -> meta = NULL;
+	pch -> seq = 0;
+
+	// Clear statistics, debugfs directory is not created
+	memset(&(pch -> stat), 0, sizeof(DM_STAT_t));
+	pch -> dbg_dir = NULL;
 
 	// Clear character device support flags
 	pch -> cdev_region_alloc = 0;
 	pch -> cdev_added = 0;
 	pch -> cdev_created = 0;
-	pch -> cdev_opened = 0;
+
+	// The channel parameters were initialized successfully
+	return 0;
 }
 
-/******************************* dmInitAllCh() ********************************
-* DMA-PROXY initialization: init all DMA channels
-* Used variable:
-*	(o)dm_parm - DMA-PROXY parameters
+/************************** dmInitParmChDt(pch,np) ****************************
+* DMA-PROXY initialization: read DMA-PROXY channel parameters from DT
+* The properties of the DMA-PROXY node are indexed by channel index:
+*	dma-names       - DMA channel names (also /dev file names) (required)
+*	por,frame-sizes - stream frame sizes (b) (optional for known channels)
+*	por,buf-counts  - numbers of buffers (optional, _DM_BUF_NUM by default)
+*	por,directions  - "rx" (stream to memory) or "tx" (memory to stream)
+*					  (optional, "rx" by default)
+*	por,timeouts-ms - DMA transaction timeouts (ms) (optional, 0 - no timeout)
+*	por,ring-sizes  - capture ring sizes (b) (optional, 0 - no ring). The ring
+*					  replaces the buffers: it is sliced into buffer slots
+*					  (one DMA transaction each), "por,buf-counts" is ignored.
+*					  The coherent ring is mapped into the vmalloc area:
+*					  large rings need the "vmalloc=" boot argument
+*	por,inflight    - maximum numbers of submitted DMA transactions (optional,
+*					  DM_RING_INFLIGHT for the ring, all buffers otherwise)
+*	por,irq-coalesce - numbers of DMA transactions per interrupt (optional,
+*					  1 - no coalescing; limited to the half of inflight)
+*	por,overrun     - overrun policies: "block", "drop-oldest" or "drop-newest"
+*					  (optional, "block" by default)
+*	por,rt-cpus     - CPUs of the real-time completion workers (optional,
+*					  0xffffffff or no property - the system workqueue is used)
+*	por,rt-priorities - SCHED_FIFO priorities of the completion workers
+*					  (optional, DM_RT_PRIO by default; the priority out of
+*					  1..MAX_RT_PRIO-1 is replaced by DM_RT_PRIO with warning)
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)np - DMA-PROXY device tree node
+* Return value:
+*	0  Success. The parameters were read
+*	-EINVAL Error. Bad or missing DT properties
+*******************************************************************************/
+static int dmInitParmChDt(DM_CHAN_t *pch, struct device_node *np)
+{
+	struct device *dev;
+	uint32_t ch_idx;
+	const char *dir_name;
+	const char *ovr_name;
+	int rc;
+
+	// Set the pointer to the DMA-PROXY device structure, get channel index
+	dev = pch -> dev;
+	ch_idx = pch -> ch_idx;
+
+	// Read channel name
+	rc = of_property_read_string_index(np, "dma-names", ch_idx, &(pch -> name));
+	if(rc != 0) return -EINVAL;
+
+	// Read frame size, use the size of the known channel if it is not set
+	rc = of_property_read_u32_index(np, "por,frame-sizes", ch_idx,
+		&(pch -> frame_sz));
+	if(rc != 0) pch -> frame_sz = dmInitParmChDef(pch -> name);
+	if(pch -> frame_sz == 0) {
+		dev_err(dev, "%s: no frame size in \"por,frame-sizes\"\n", pch -> name);
+		return -EINVAL;
+	}
+
+	// Read the number of buffers
+	rc = of_property_read_u32_index(np, "por,buf-counts", ch_idx,
+		&(pch -> buf_num));
+	if(rc != 0) pch -> buf_num = _DM_BUF_NUM;
+	if(pch -> buf_num == 0 || pch -> buf_num > _DM_BUF_MAX) {
+		dev_err(dev, "%s: bad buffer count %u\n", pch -> name, pch -> buf_num);
+		return -EINVAL;
+	}
+
+	// Read capture ring size (no ring by default)
+	rc = of_property_read_u32_index(np, "por,ring-sizes", ch_idx,
+		&(pch -> ring_sz));
+	if(rc != 0) pch -> ring_sz = 0;
+
+	// The ring is sliced into the slots of one frame (the geometry is set later)
+	if(pch -> ring_sz != 0) {
+		pch -> buf_num = pch -> ring_sz / _DM_BUF_STRIDE(pch -> frame_sz);
+		if(pch -> buf_num > _DM_RING_SLOTS_MAX) pch -> buf_num = _DM_RING_SLOTS_MAX;
+		if(pch -> buf_num == 0) {
+			dev_err(dev, "%s: ring size %u is less than one frame\n",
+				pch -> name, pch -> ring_sz);
+			return -EINVAL;
+		}
+	}
+
+	// Set the number of buffer slots (the number of buffers can not exceed it)
+	pch -> slot_max = pch -> buf_num;
+
+	// Read the maximum number of submitted DMA transactions
+	rc = of_property_read_u32_index(np, "por,inflight", ch_idx,
+		&(pch -> act_max));
+	if(rc != 0)
+		pch -> act_max = (pch -> ring_sz != 0) ? DM_RING_INFLIGHT : pch -> buf_num;
+	if(pch -> act_max == 0 || pch -> act_max > pch -> slot_max)
+		pch -> act_max = pch -> slot_max;
+
+	// Read the number of DMA transactions per interrupt
+	rc = of_property_read_u32_index(np, "por,irq-coalesce", ch_idx,
+		&(pch -> coal_cnt));
+	if(rc != 0) pch -> coal_cnt = 1;
+	pch -> coal_cnt = dmChCoalLimit(pch, pch -> coal_cnt);
+	pch -> coal_us = DM_COAL_US;
+
+	// Read transfer direction
+	rc = of_property_read_string_index(np, "por,directions", ch_idx, &dir_name);
+	if(rc != 0) dir_name = "rx";
+	if(strcmp(dir_name, "tx") == 0) {
+		// Memory to stream
+		pch -> dir = _DM_DIR_TX;
+		pch -> tr_dir = DMA_MEM_TO_DEV;
+		pch -> dma_dir = DMA_TO_DEVICE;
+	}
+	else if(strcmp(dir_name, "rx") == 0) {
+		// Stream to memory
+		pch -> dir = _DM_DIR_RX;
+		pch -> tr_dir = DMA_DEV_TO_MEM;
+		pch -> dma_dir = DMA_FROM_DEVICE;
+	}
+	else {
+		dev_err(dev, "%s: bad direction \"%s\"\n", pch -> name, dir_name);
+		return -EINVAL;
+	}
+
+	// Read DMA transaction timeout (no timeout by default)
+	rc = of_property_read_u32_index(np, "por,timeouts-ms", ch_idx,
+		&(pch -> timeout_ms));
+	if(rc != 0) pch -> timeout_ms = 0;
+
+	// Read overrun policy (block by default)
+	rc = of_property_read_string_index(np, "por,overrun", ch_idx, &ovr_name);
+	if(rc != 0) ovr_name = "block";
+	if(strcmp(ovr_name, "block") == 0)
+		pch -> ovr_policy = _DM_OVR_BLOCK;
+	else if(strcmp(ovr_name, "drop-oldest") == 0)
+		pch -> ovr_policy = _DM_OVR_DROP_OLDEST;
+	else if(strcmp(ovr_name, "drop-newest") == 0)
+		pch -> ovr_policy = _DM_OVR_DROP_NEWEST;
+	else {
+		dev_err(dev, "%s: bad overrun policy \"%s\"\n", pch -> name, ovr_name);
+		return -EINVAL;
+	}
+
+	// Read the CPU and the priority of the real-time completion worker
+	rc = of_property_read_u32_index(np, "por,rt-cpus", ch_idx, &(pch -> rt_cpu));
+	if(rc != 0) pch -> rt_cpu = DM_RT_OFF;
+	if(pch -> rt_cpu != DM_RT_OFF &&
+			(pch -> rt_cpu >= nr_cpu_ids || !cpu_online(pch -> rt_cpu))) {
+		dev_err(dev, "%s: bad completion CPU %u\n", pch -> name, pch -> rt_cpu);
+		return -EINVAL;
+	}
+	rc = of_property_read_u32_index(np, "por,rt-priorities", ch_idx,
+		&(pch -> rt_prio));
+	if(rc != 0) pch -> rt_prio = DM_RT_PRIO;
+	if(pch -> rt_prio < 1 || pch -> rt_prio > MAX_RT_PRIO - 1) {
+		dev_warn(dev, "%s: bad completion worker priority %u, %u is used\n",
+			pch -> name, pch -> rt_prio, DM_RT_PRIO);
+		pch -> rt_prio = DM_RT_PRIO;
+	}
+
+	// The parameters were read successfully
+	return 0;
+}
+
+/*************************** dmInitParmChDef(name) ****************************
+* DMA-PROXY initialization: get the frame size of the known DMA channel
+* Used variables:
+*	(i)dm_ch_name - known DMA channel names
+*	(i)dm_ch_trsz - known DMA channel frame sizes
+* Parameter:
+*	(i)name - DMA channel name
+* Return value:
+*	>0 The frame size of the known channel (b)
+*	0  The channel is not known
+*******************************************************************************/
+static uint32_t dmInitParmChDef(const char *name)
+{
+	uint32_t i;
+
+	// Search the channel in the known channels list
+	for(i = 0; i < _DM_CH_NUM; i++)
+		if(strcmp(name, dm_ch_name[i]) == 0) return dm_ch_trsz[i];
+
+	// The channel is not known
+	return 0;
+}
+
+/*************************** dmInitParmChQueue(pch) ***************************
+* DMA-PROXY initialization: init DMA-PROXY channel buffer queue parameters
+* Allocates buffer parameters and FIFOs for all buffer slots (freed with
+*	the device). All buffers are owned by user, streaming is off
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*			  (slot_max must be set)
+* Return value:
+*	0  Success. The parameters were initialized
+*	<0 Error code. No memory
+*******************************************************************************/
+static int dmInitParmChQueue(DM_CHAN_t *pch)
+{
+	struct device *dev;
+	DM_BUF_t *pbuf;
+	uint32_t buf_idx;
+
+	// Set the pointer to the DMA-PROXY device structure
+	dev = pch -> dev;
+
+	// Allocate buffer parameters (the ring can have many slots: can be vmalloc)
+	pch -> buf = dmInitDevKv(dev, pch -> slot_max * sizeof(DM_BUF_t));
+	if(pch -> buf == NULL) return -ENOMEM;
+
+	// Allocate done, pending and active FIFOs
+	pch -> done_fifo = dmInitDevKv(dev, pch -> slot_max * sizeof(uint32_t));
+	pch -> pend_fifo = dmInitDevKv(dev, pch -> slot_max * sizeof(uint32_t));
+	pch -> act_fifo = dmInitDevKv(dev, pch -> slot_max * sizeof(uint32_t));
+	if(pch -> done_fifo == NULL || pch -> pend_fifo == NULL ||
+			pch -> act_fifo == NULL) return -ENOMEM;
+
+	// Allocate fan-out ring
+	pch -> fan = dmInitDevKv(dev, pch -> slot_max * sizeof(DM_FAN_t));
+	if(pch -> fan == NULL) return -ENOMEM;
+
+	// Init buffer parameters cycle (all buffer slots)
+	for(buf_idx = 0; buf_idx < pch -> slot_max; buf_idx++) {
+		// Set the pointer to the buffer parameters
+		pbuf = &(pch -> buf[buf_idx]);
+
+		// Set buffer index and the pointer to the owner channel
+		pbuf -> buf_idx = buf_idx;
+		pbuf -> pch = pch;
+
+		// Buffer memory is not allocated yet
+		pbuf -> dma_buffer = NULL;
+		pbuf -> pages = NULL;
+		pbuf -> cpu_owned = 0;
+		atomic_set(&(pbuf -> rd_ref), 0);
+		pbuf -> rd_requeue = 0;
+
+		// The buffer is owned by user
+		pbuf -> state = DM_BUF_ST_USER;
+		pbuf -> res_code = _DM_TRAN_RES_SUCCESS;
+		pbuf -> residue = 0;
+		pbuf -> stopped = 0;
+	}
+
+	// Init buffer queue synchronization objects
+	spin_lock_init(&(pch -> lock));
+	mutex_init(&(pch -> ioctl_mutex));
+	init_waitqueue_head(&(pch -> wq));
+	mutex_init(&(pch -> kick_mutex));
+	INIT_WORK(&(pch -> kick_work), dmChQueueWork);
+	kthread_init_work(&(pch -> rt_work), dmChQueueRtWork);
+	pch -> t_kick = 0;
+	pch -> rt_worker = NULL;
+	pch -> rt_irq = 0;
+	INIT_DELAYED_WORK(&(pch -> coal_work), dmChCoalWork);
+	mutex_init(&(pch -> fan_mutex));
+
+	// Fan-out ring is empty, there are no readers
+	pch -> fan_head = 0;
+	pch -> fan_tail = 0;
+	pch -> fan_rd = 0;
+	pch -> fan_lowat = 1;
+	INIT_LIST_HEAD(&(pch -> rdr_list));
+	pch -> rdr_cnt = 0;
+	pch -> rd_strm = 0;
+	pch -> ctl_rdr = NULL;
+
+	// Done FIFO is empty, streaming is off
+	pch -> done_rd = 0;
+	pch -> done_cnt = 0;
+	pch -> streaming = 0;
+	pch -> start_cnt = 0;
+
+	// No pending and active buffers, no completion events
+	pch -> pend_rd = 0;
+	pch -> pend_cnt = 0;
+	pch -> act_rd = 0;
+	pch -> act_cnt = 0;
+	pch -> batch_seq = 0;
+
+	// No abort requests were executed
+	pch -> abort_cnt = 0;
+
+	// No user buffer transaction
+	memset(&(pch -> usr), 0, sizeof(DM_USR_t));
+
+	// The parameters were initialized successfully
+	return 0;
+}
+
+
+/************************** dmInitDevKv(dev,size) *****************************
+* DMA-PROXY initialization: allocate cleared memory (kvzalloc) freed when
+*	the device is released (device managed action). The free is cancelled
+*	for the channel memory kept by user space (see dmFreeChKeep).
+* Parameters:
+*	(i)dev - DMA-PROXY device structure
+*	(i)size - size of the memory (b)
+* Return value:
+*	Pointer to the allocated memory
+*	NULL - can not allocate the memory
+*******************************************************************************/
+static void *dmInitDevKv(struct device *dev, size_t size)
+{
+	void *data;
+
+	// Allocate the memory (large arrays can be vmalloc)
+	data = kvzalloc(size, GFP_KERNEL);
+	if(data == NULL) return NULL;
+
+	// Free the memory with the device (it is freed here in case of error)
+	if(devm_add_action_or_reset(dev, dmFreeDevKv, data) != 0) return NULL;
+
+	// The memory was allocated successfully
+	return data;
+}
+
+/**************************** dmInitParmRmem(pdm) *****************************
+* DMA-PROXY initialization: assign reserved memory region to the device
+* If DMA-PROXY node has "memory-region" property (reserved-memory node with
+*	"shared-dma-pool" compatible: CMA or no-map pool), the coherent memory
+*	of all channels of the instance is allocated from the region. It is
+*	needed for big capture rings, which do not fit the default CMA area.
+* The region is released with the device, after the memory allocated from it
+* Parameter:
+*	(io)pdm - DMA-PROXY instance parameters
+* Return value:
+*	0  Success. The region was assigned or the device has no region
+*	<0 Error code. Can not assign the region
+*******************************************************************************/
+static int dmInitParmRmem(DM_PARM_t *pdm)
+{
+	struct device *dev;
+	uint32_t ch_idx;
+	int rc;
+
+	// Set the pointer to the DMA-PROXY device structure
+	dev = pdm -> dev;
+
+	// Assign the region of "memory-region" property
+	rc = of_reserved_mem_device_init(dev);
+	if(rc == 0) {
+		// Release the region with the device (after the memory is freed)
+		rc = devm_add_action_or_reset(dev, dmFreeDevRmem, dev);
+		if(rc != 0) return rc;
+		pdm -> rmem = 1;
+	}
+	else if(rc != -ENODEV) {
+		dev_err(dev, "can not assign reserved memory region (%d)\n", rc);
+		return rc;
+	}
+
+	// The rings without the region are allocated from the default CMA area
+	for(ch_idx = 0; ch_idx < pdm -> ch_num; ch_idx++)
+		if(pdm -> ch[ch_idx].ring_sz != 0 && !(pdm -> rmem))
+			dev_info(dev, "%s: no \"memory-region\", default CMA area is used\n",
+				pdm -> ch[ch_idx].name);
+
+	// The region was assigned or the device has no region
+	return 0;
+}
+
+/****************************** dmInitAllCh(pdm) ******************************
+* DMA-PROXY initialization: init all DMA channels of the instance
+* Parameter:
+*	(io)pdm - DMA-PROXY instance parameters
 * Return value:
 *	0  Success. All DMA channels were initialized
 *	-1 Error. Can not init one or more DMA channels
 *******************************************************************************/
-static int dmInitAllCh(void)
+static int dmInitAllCh(DM_PARM_t *pdm)
 {	
 	uint32_t ch_idx;
 	DM_CHAN_t *pch;
 	int rc;
 
 	// Init channels cycle
-	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++){
+	for(ch_idx = 0; ch_idx < pdm -> ch_num; ch_idx++){
 		// Set the pointer to the DMA-PROXY channel parameters
-		pch = &dm_parm.ch[ch_idx];
+		pch = &(pdm -> ch[ch_idx]);
 	
 		// Init the channel
 		rc = dmInitCh(pch);
@@ -512,8 +1448,6 @@ static int dmInitAllCh(void)
 * Requests DMA channel from DMA Engine
 * Allocates memory for DMA operations in the kernel space
 * Creates character device in the /dev folder
-* Used variable:
-*	(io)dm_parm - DMA-PROXY parameters
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 * Return value:
@@ -528,10 +1462,20 @@ static int dmInitCh(DM_CHAN_t *pch)
 	rc = dmInitChReq(pch);
 	if(rc < 0) return -1;				// Can not allocate DMA channel
 
+	// Create the real-time completion worker (optional)
+	dmInitChRt(pch);
+
 	// Allocate memory for DMA operations in the kernel space
 	rc = dmInitChMem(pch);
 	if(rc < 0) return -1;				// Can not allocate memory
 
+	// Allocate buffer metadata pages
+	rc = dmInitChMeta(pch);
+	if(rc < 0) return -1;				// Can not allocate memory
+
+	// Create debugfs statistics files (optional)
+	dmInitChDbg(pch);
+
 	// Create character device
 	return dmInitChDev(pch);
 }
@@ -539,8 +1483,6 @@ static int dmInitCh(DM_CHAN_t *pch)
 /****************************** dmInitChReq(pch) ******************************
 * DMA-PROXY channel initialization:
 *	Request DMA channel from DMA Engine
-* Used variable:
-*	(io)dm_parm - DMA-PROXY parameters
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 * Return value:
@@ -550,18 +1492,14 @@ static int dmInitCh(DM_CHAN_t *pch)
 static int dmInitChReq(DM_CHAN_t *pch)
 {
 	struct device *dev;
-	uint32_t ch_idx;
 	const char	*chan_name;
 	struct dma_chan *dma_chan;
 
 	// Set the pointer to the device structure of DMA-PROXY
-	dev = dm_parm.dev;
-
-	// Get DMA-PROXY channel index
-	ch_idx = pch -> ch_idx;
+	dev = pch -> dev;
 
 	// Set the pointer to the channel name
-	chan_name = dm_ch_name[ch_idx];
+	chan_name = pch -> name;
 
 	// Request DMA channel from DMA Engine
 	dma_chan = dma_request_slave_channel(dev,chan_name);
@@ -579,12 +1517,103 @@ static int dmInitChReq(DM_CHAN_t *pch)
 	return 0;
 }
 
+/****************************** dmInitChRt(pch) *******************************
+* DMA-PROXY channel initialization:
+*	Create the real-time completion worker of the channel (if "por,rt-cpus"
+*	is set): SCHED_FIFO kthread worker bound to the CPU. The interrupt of
+*	the DMA channel is bound to the same CPU, such that DMA engine tasklet
+*	(the callback) and the worker run there.
+* The worker is optional: if it can not be created, the pending buffers are
+*	started by the system workqueue
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmInitChRt(DM_CHAN_t *pch)
+{
+	struct kthread_worker *worker;
+	struct sched_param param;
+	int rc;
+
+	// The worker is not requested
+	if(pch -> rt_cpu == DM_RT_OFF) return;
+
+	// Create the worker bound to the CPU
+	worker = kthread_create_worker_on_cpu(pch -> rt_cpu, 0, "dm-%s",
+		pch -> name);
+	if(IS_ERR(worker)) {
+		dev_warn(pch -> dev, "%s: can not create completion worker\n",
+			pch -> name);
+		return;
+	}
+
+	// Run the worker with the real-time priority
+	param.sched_priority = pch -> rt_prio;
+	rc = sched_setscheduler_nocheck(worker -> task, SCHED_FIFO, &param);
+	if(rc != 0)
+		dev_warn(pch -> dev, "%s: can not set completion worker priority\n",
+			pch -> name);
+	pch -> rt_worker = worker;
+
+	// Bind the interrupt of the channel to the CPU
+	dmInitChRtIrq(pch);
+
+	// Report the worker (and the interrupt if it was bound)
+	if(pch -> rt_irq != 0)
+		dev_info(pch -> dev, "%s: completion worker on CPU%u, priority %u, "
+			"irq %u\n", pch -> name, pch -> rt_cpu, pch -> rt_prio,
+			pch -> rt_irq);
+	else
+		dev_info(pch -> dev, "%s: completion worker on CPU%u, priority %u\n",
+			pch -> name, pch -> rt_cpu, pch -> rt_prio);
+}
+
+/***************************** dmInitChRtIrq(pch) *****************************
+* DMA-PROXY channel initialization:
+*	Bind the interrupt of DMA channel to the CPU of the completion worker
+* dmaengine does not export the interrupt of the channel: it is taken from
+*	the channel node of AXI DMA controller (S2MM channel for receive, MM2S
+*	for transmit). Other DMA controllers are skipped.
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmInitChRtIrq(DM_CHAN_t *pch)
+{
+	struct device_node *np, *child;
+	const char *compat;
+	unsigned int irq;
+	int rc;
+
+	// Set the pointer to DMA controller node
+	np = pch -> dma_chan -> device -> dev -> of_node;
+	if(np == NULL) return;
+
+	// Find the interrupt of the channel node with the transfer direction
+	compat = (pch -> dir == _DM_DIR_RX) ? "xlnx,axi-dma-s2mm-channel" :
+		"xlnx,axi-dma-mm2s-channel";
+	irq = 0;
+	for_each_child_of_node(np, child) {
+		if(of_device_is_compatible(child, compat)) {
+			irq = irq_of_parse_and_map(child, 0);
+			of_node_put(child);
+			break;
+		}
+	}
+	if(irq == 0) return;				// No channel interrupt
+
+	// Bind the interrupt to the CPU (the hint is cleared on release)
+	rc = irq_set_affinity_hint(irq, cpumask_of(pch -> rt_cpu));
+	if(rc != 0) {
+		dev_warn(pch -> dev, "%s: can not set irq %u affinity\n",
+			pch -> name, irq);
+		return;
+	}
+	pch -> rt_irq = irq;
+}
+
 /****************************** dmInitChMem(pch) ******************************
 * DMA-PROXY channel initialization:
 *	Allocate memory for DMA operations in the kernel space
-* Used variable:
-*	(io)dm_parm - DMA-PROXY parameters
-*	(i)dm_ch_trsz - DMA channel transaction sizes array
+* The memory is allocated according to the channel buffer memory mode
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 * Return value:
@@ -592,70 +1621,272 @@ static int dmInitChReq(DM_CHAN_t *pch)
 *	-1 Error. Can not allocate memory
 *******************************************************************************/
 static int dmInitChMem(DM_CHAN_t *pch)
+{
+	// Allocate cacheable memory in cached memory mode
+	if(pch -> mem_mode == _DM_MEM_CACHED)
+		return dmInitChMemCached(pch);
+
+	// Allocate coherent memory
+	return dmInitChMemCoh(pch);
+}
+
+/**************************** dmInitChMemCoh(pch) *****************************
+* DMA-PROXY channel initialization:
+*	Allocate coherent memory for DMA operations in the kernel space
+* One memory area is allocated for all buffers of the channel buffer queue
+* The buffers are placed in the area one after another with page aligned
+*	stride, such that user can map all of them with one mmap() call
+* The capture ring is sliced into as many buffer slots as it holds
+*	(limited by the number of slots)
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0  Success. The memory was allocated
+*	-1 Error. Can not allocate memory
+*******************************************************************************/
+static int dmInitChMemCoh(DM_CHAN_t *pch)
 {
 	struct device *dev;
-	uint32_t ch_idx;
 	uint32_t trsz;
+	uint32_t mem_sz;
 	dma_addr_t *dma_handle;
 	uint8_t *dma_buffer;
 
 	// Set the pointer to the DMA-PROXY device structure
-	dev = dm_parm.dev;
+	dev = pch -> dev;
 
-	// Get DMA-PROXY channel index
-	ch_idx = pch -> ch_idx;
+	// Get the size of one DMA transaction (b)
+	trsz = pch -> trsz;
 
-	// Get the size of the memory to allocate (b)
-	trsz = dm_ch_trsz[ch_idx];
+	// Slice the capture ring into buffer slots
+	if(pch -> ring_sz != 0) {
+		pch -> buf_num = pch -> ring_sz / _DM_BUF_STRIDE(trsz);
+		if(pch -> buf_num > pch -> slot_max) pch -> buf_num = pch -> slot_max;
+		if(pch -> buf_num == 0) return -1;		// The ring is less than one slot
+	}
+
+	// Calculate the size of the memory to allocate for all buffers (b)
+	mem_sz = pch -> buf_num * _DM_BUF_STRIDE(trsz);
 
 	// Set the pointer to the DMA buffer physical address (aka DMA handle)
 	dma_handle = &(pch -> dma_buffer_phadd);
 
 	// Allocate coherent memory for DMA-PROXY channel in kernel space
 	dma_buffer = (uint8_t *)
-		dmam_alloc_coherent(dev, trsz, dma_handle, GFP_KERNEL);
-	if(dma_buffer == NULL) return -1;				// Can not allocate memory
+		dmam_alloc_coherent(dev, mem_sz, dma_handle, GFP_KERNEL);
+	if(dma_buffer == NULL) {
+		dev_err(dev, "%s: can not allocate %u bytes of DMA memory\n",
+			pch -> name, mem_sz);
+
+		// Can not allocate memory
+		return -1;
+	}
 
 	// Set the pointer to the allocated memory in "DMA channel parameters" structure
 	pch -> dma_buffer = dma_buffer;
 
+	// Store allocated memory size and buffers stride
+	pch -> dma_mem_sz = mem_sz;
+	pch -> buf_stride = _DM_BUF_STRIDE(trsz);
+
+	// Split allocated memory between the buffers of the queue
+	dmInitChMemBufs(pch);
+
 	// The memory was allocated successfully
 	return 0;
 }
 
-/****************************** dmInitChDev(pch) ******************************
+/**************************** dmInitChMemBufs(pch) ****************************
 * DMA-PROXY channel initialization:
-*	Create character device in /dev folder for user ioctl requests
-* Allocates character device major and minor numbers
-* Inits character device data structure
-* Creates character device
+*	Split allocated DMA memory between the buffers of the channel buffer queue
 * Parameter:
-*	(i)pch - pointer to the DMA-PROXY channel parameters structure
-* Return value:
-*	-1 Error. Character device was not created
-*	0  Success. Character device was created
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
 *******************************************************************************/
-static int dmInitChDev(DM_CHAN_t *pch)
+static void dmInitChMemBufs(DM_CHAN_t *pch)
 {
-	int rc;
+	DM_BUF_t *pbuf;
+	uint32_t buf_idx;
+	uint32_t offs;
 
-	// Allocate character device major and minor numbers
-	rc = dmInitChDevRegion(pch);
-	if(rc < 0) return rc;				// Can not allocate major+minor numbers
+	// Set buffer memory pointers cycle
+	for(buf_idx = 0; buf_idx < pch -> buf_num; buf_idx++) {
+		// Set the pointer to the buffer parameters
+		pbuf = &(pch -> buf[buf_idx]);
 
-	// Init character device data structure, add character device to the kernel
-	rc = dmInitChDevCdev(pch);
-	if(rc < 0) return rc;				// Can not add character device to the kernel
+		// Calculate buffer offset in the allocated memory (b)
+		offs = buf_idx * pch -> buf_stride;
 
-	// Create character device
-	return dmInitChDevCrDev(pch);
+		// Set buffer kernel space pointer and physical address
+		pbuf -> dma_buffer = pch -> dma_buffer + offs;
+		pbuf -> dma_buffer_phadd = pch -> dma_buffer_phadd + offs;
+	}
+}
+
+/*************************** dmInitChMemCached(pch) ***************************
+* DMA-PROXY channel initialization:
+*	Allocate cacheable memory for DMA operations in the kernel space
+* Each buffer of the channel buffer queue is allocated separately
+*	(physically contiguous pages) and mapped for streaming DMA.
+* User space sees the buffers with the same page aligned stride as in
+*	coherent memory mode, the mapping is cacheable
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0  Success. The memory was allocated
+*	-1 Error. Can not allocate memory
+*******************************************************************************/
+static int dmInitChMemCached(DM_CHAN_t *pch)
+{
+	uint32_t trsz;
+	uint32_t order;
+	uint32_t buf_idx;
+	int rc;
+
+	// Get the size of one DMA transaction (b)
+	trsz = pch -> trsz;
+
+	// Set buffers stride, calculate the order of pages block for one buffer
+	pch -> buf_stride = _DM_BUF_STRIDE(trsz);
+	order = get_order(pch -> buf_stride);
+
+	// Allocate buffers cycle
+	for(buf_idx = 0; buf_idx < pch -> buf_num; buf_idx++) {
+		// Allocate and map one buffer
+		rc = dmInitChMemCachedBuf(&(pch -> buf[buf_idx]), order);
+		if(rc < 0) {
+			// Can not allocate memory, free already allocated buffers
+			dmFreeChMemCached(pch);
+			return -1;
+		}
+	}
+
+	// Store the size of the memory seen by user (b)
+	pch -> dma_mem_sz = pch -> buf_num * _DM_BUF_STRIDE(trsz);
+
+	// The memory was allocated successfully
+	return 0;
+}
+
+/********************** dmInitChMemCachedBuf(pbuf,order) **********************
+* DMA-PROXY channel initialization:
+*	Allocate and map one buffer in cached memory mode
+* The buffer is owned by DMA device after the mapping
+* Parameters:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(i)order - order of pages block to allocate
+* Return value:
+*	0  Success. The buffer was allocated and mapped
+*	-1 Error. Can not allocate or map the buffer
+*******************************************************************************/
+static int dmInitChMemCachedBuf(DM_BUF_t *pbuf, uint32_t order)
+{
+	DM_CHAN_t *pch;
+	struct device *dev;
+	struct page *pages;
+	uint8_t *dma_buffer;
+	dma_addr_t dma_handle;
+
+	// Set the pointers to the channel parameters and DMA-PROXY device structure
+	pch = pbuf -> pch;
+	dev = pch -> dev;
+
+	// Allocate physically contiguous cleared pages (compound page: the pages
+	// of the buffer can be referenced separately by splice)
+	pages = alloc_pages(GFP_KERNEL | __GFP_ZERO | __GFP_COMP, order);
+	if(pages == NULL) return -1;			// Can not allocate memory
+
+	// Get kernel space address of the pages
+	dma_buffer = page_address(pages);
+
+	// Map the buffer for streaming DMA (in the channel direction)
+	dma_handle = dma_map_single(dev, dma_buffer,
+		PAGE_SIZE << order, pch -> dma_dir);
+	if(dma_mapping_error(dev, dma_handle)) {
+		// Can not map the buffer
+		__free_pages(pages, order);
+		return -1;
+	}
+
+	// Store buffer memory parameters
+	pbuf -> pages = pages;
+	pbuf -> dma_buffer = dma_buffer;
+	pbuf -> dma_buffer_phadd = dma_handle;
+
+	// The buffer is owned by DMA device
+	pbuf -> cpu_owned = 0;
+
+	// The buffer was allocated and mapped successfully
+	return 0;
+}
+
+/***************************** dmInitChMeta(pch) ******************************
+* DMA-PROXY channel initialization:
+*	Allocate buffer metadata pages (completion time, sequence number and
+*	result of each buffer slot). The pages are mapped to user space read
+*	only next to the buffers, they do not depend on the buffer memory mode
+*	and geometry.
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0  Success. The pages were allocated
+*	-1 Error. Can not allocate memory
+*******************************************************************************/
+static int dmInitChMeta(DM_CHAN_t *pch)
+{
+	uint32_t meta_sz;
+	unsigned long page;
+
+	// Calculate the size of the metadata of all slots (whole pages)
+	meta_sz = PAGE_ALIGN(pch -> slot_max * sizeof(_DM_META_t));
+
+	// Allocate zeroed memory pages
+	page = __get_free_pages(GFP_KERNEL | __GFP_ZERO, get_order(meta_sz));
+	if(page == 0) {
+		dev_err(pch -> dev, "Can not allocate metadata pages\n");
+
+		// Can not allocate memory
+		return -1;
+	}
+
+	// Set the pointer to the metadata pages and their size
+	pch -> meta = (_DM_META_t *)page;
+	pch -> meta_sz = meta_sz;
+
+	// The pages were allocated successfully
+	return 0;
+}
+
+/****************************** dmInitChDev(pch) ******************************
+* DMA-PROXY channel initialization:
+*	Create character device in /dev folder for user ioctl requests
+* Allocates character device major and minor numbers
+* Inits character device data structure
+* Creates character device
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	-1 Error. Character device was not created
+*	0  Success. Character device was created
+*******************************************************************************/
+static int dmInitChDev(DM_CHAN_t *pch)
+{
+	int rc;
+
+	// Allocate character device major and minor numbers
+	rc = dmInitChDevRegion(pch);
+	if(rc < 0) return rc;				// Can not allocate major+minor numbers
+
+	// Init character device data structure, add character device to the kernel
+	rc = dmInitChDevCdev(pch);
+	if(rc < 0) return rc;				// Can not add character device to the kernel
+
+	// Create character device
+	return dmInitChDevCrDev(pch);
 }
 
 /*************************** dmInitChDevRegion(pch) ***************************
 * DMA-PROXY channel character device initialization:
 *	Allocate character device major and minor numbers
-* Used variable:
-*	(o)dm_parm - DMA-PROXY parameters
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 * Return value:
@@ -686,7 +1917,6 @@ static int dmInitChDevRegion(DM_CHAN_t *pch)
 *	Init character device data structure, add character device to the kernel
 * Used variables:
 *	(i)dm_cdev_fops - character device file operations structure
-*	(io)dm_parm - DMA-PROXY parameters
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 * Return value:
@@ -728,7 +1958,6 @@ static int dmInitChDevCdev(DM_CHAN_t *pch)
 *	Create character device
 * Used variables:
 *	(i)module_parm - module parameters
-*	(io)dm_parm - DMA-PROXY parameters
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 * Return value:
@@ -740,7 +1969,6 @@ static int dmInitChDevCrDev(DM_CHAN_t *pch)
 	struct class *pclass;
 	struct device *char_dev;
 	dev_t node;
-	uint32_t ch_idx;
 	const char	*chan_name;
 
 	// Set the pointer to the module class
@@ -749,11 +1977,8 @@ static int dmInitChDevCrDev(DM_CHAN_t *pch)
 	// Get character device 32-bit major+minor number
 	node = pch -> cdev_node;
 
-	// Get DMA-PROXY channel index
-	ch_idx = pch -> ch_idx;
-
 	// Set the pointer to the channel name
-	chan_name = dm_ch_name[ch_idx];
+	chan_name = pch -> name;
 
 	// Create character device
 	char_dev = device_create(pclass, NULL, node, NULL, chan_name);
@@ -766,24 +1991,53 @@ static int dmInitChDevCrDev(DM_CHAN_t *pch)
 	return 0;
 }
 
+/****************************** dmInitChDbg(pch) ******************************
+* DMA-PROXY channel initialization:
+*	Create debugfs directory of the channel with statistics files
+*	"stats" - transfer counters and latency histograms (read)
+*	"reset" - any write clears the statistics
+* Debugfs is optional: errors are ignored
+* Used variable:
+*	(i)module_parm - module parameters
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmInitChDbg(DM_CHAN_t *pch)
+{
+	struct dentry *dir;
+
+	// The module directory was not created: no statistics files
+	if(module_parm.dbg_dir == NULL) return;
+
+	// Create the channel directory (named as the channel)
+	dir = debugfs_create_dir(pch -> name, module_parm.dbg_dir);
+	if(IS_ERR_OR_NULL(dir)) return;
+	pch -> dbg_dir = dir;
+
+	// Create statistics files, the channel parameters are their private data
+	debugfs_create_file("stats", S_IRUGO, dir, pch, &dm_dbg_stats_fops);
+	debugfs_create_file("reset", S_IWUSR, dir, pch, &dm_dbg_reset_fops);
+}
+
 /**************************** dmCdevOpen(ino,file) ****************************
 * Character device file operations:
 * 	Open function for the character device
-* Only one user can have access to the device. This is checked here.
-* Sets up the data pointer to the DMA-PROXY channel parameters
-*	(such that the ioctl function can access the parameters structure later)
+* Any number of users can open the device. Each opened file gets its own
+*	reader parameters: the read position in the data stream.
+* Sets up the data pointer to the reader parameters
+*	(such that the ioctl function can access the channel parameters later)
 * Parameters:
 *	(i)ino   - opened file parameters structure
 *	(o)file - opened file state structure
 * Return value:
 *	0 		Success. The file was opened
-*	-EBUSY  Error. The file is busy. It was already opened.
+*	-ENOMEM Error. Can not allocate the reader parameters
 *******************************************************************************/
 static int dmCdevOpen(struct inode *ino, struct file *file)
 {
 	struct cdev	*pcdev;
 	DM_CHAN_t *pch;
-	uint32_t cdev_opened;
+	DM_RDR_t *prdr;
 	
 	// Set the pointer to the kernel character device structure (for the opened device)
 	pcdev = ino -> i_cdev;
@@ -791,18 +2045,18 @@ static int dmCdevOpen(struct inode *ino, struct file *file)
 	// Set the pointer to the DMA-PROXY channel parameters (for the opened device)
 	pch = container_of(pcdev, DM_CHAN_t, cdev);
 
-	// Read the flag: character device was opened / not opened
-	cdev_opened = pch -> cdev_opened;
+	// Allocate the reader parameters of the file
+	prdr = kzalloc(sizeof(DM_RDR_t), GFP_KERNEL);
+	if(prdr == NULL) return -ENOMEM;
 
-	// If device was already opened - the file is busy
-	if(cdev_opened) return -EBUSY;
+	// The file does not read the data stream yet
+	prdr -> pch = pch;
+	INIT_LIST_HEAD(&(prdr -> list));
+	mutex_init(&(prdr -> rd_mutex));
 
-	// Open the device
-	pch -> cdev_opened = 1;
-
-	// Set up the data pointer to the DMA-PROXY channel parameters structure 
+	// Set up the data pointer to the reader parameters structure 
 	// in the opened file state structure
-	file -> private_data = pch;
+	file -> private_data = prdr;
 
 	// The file was opened successfully
 	return 0;
@@ -812,6 +2066,10 @@ static int dmCdevOpen(struct inode *ino, struct file *file)
 * Character device file operations:
 *	Release function for the character device
 * The function is called when character device is closed
+* Streaming is stopped if the file used the buffer queue ioctl requests or
+*	if it was the last reader, all buffers are returned to user. The
+*	recorder started by the file is stopped. The data written by the file
+*	is transmitted first (the wait is limited by the channel timeout).
 * Parameters:
 *	(i)ino  - opened file parameters structure
 *	(o)file - opened file state structure
@@ -820,27 +2078,51 @@ static int dmCdevOpen(struct inode *ino, struct file *file)
 *******************************************************************************/
 static int dmCdevRelease(struct inode *ino, struct file *file)
 {
-	struct cdev	*pcdev;
+	DM_RDR_t *prdr;
 	DM_CHAN_t *pch;
-	uint32_t cdev_opened;
+	uint8_t stop;
+
+	// Set the pointers to the reader and DMA-PROXY channel parameters
+	prdr = file -> private_data;
+	pch = prdr -> pch;
+
+	// The file did not use the buffer queue
+	if(!(prdr -> reading) && pch -> ctl_rdr != prdr) goto release_exit;
+
+	// Serialize with the start of streaming by read
+	mutex_lock(&(pch -> ioctl_mutex));
+
+	// Remove the file from the readers list, stop after the last reader
+	stop = 0;
+	if(prdr -> reading) {
+		mutex_lock(&(pch -> fan_mutex));
+		list_del(&(prdr -> list));
+		pch -> rdr_cnt--;
+		stop = (pch -> rdr_cnt == 0);
+		mutex_unlock(&(pch -> fan_mutex));
+	}
 
-	// Set the pointer to the kernel character device structure
-	pcdev = ino -> i_cdev;
+	// Release the buffer being read
+	if(prdr -> rd_buf != NULL) dmRdrNext(prdr);
 
-	// Set the pointer to the DMA-PROXY channel parameters
-	pch = container_of(pcdev, DM_CHAN_t, cdev);
+	// Stop the recorder started by the file, transmit the written data
+	if(pch -> ctl_rdr == prdr) dmChRecStop(pch);
+	if(pch -> ctl_rdr == prdr && pch -> wr_strm) dmChWrDrain(pch);
 
-	// Read the flag: character device was opened / not opened
-	cdev_opened = pch -> cdev_opened;
+	// Abort transfers on DMA channel, return all buffers of the buffer
+	// queue to user
+	if(stop || pch -> ctl_rdr == prdr) dmChStrmOff(pch);
 
-	// If the device was opened - abort transfers on DMA channel
-	if(cdev_opened) dmChTerm(pch);
+	// The buffer queue can be used by other file
+	if(pch -> ctl_rdr == prdr) pch -> ctl_rdr = NULL;
 
-	// Clear "device opened" flag	
-	pch -> cdev_opened = 0;
+	// Release ioctl mutex
+	mutex_unlock(&(pch -> ioctl_mutex));
 
-	// Clear closed file private data pointer
+release_exit:
+	// Clear closed file private data pointer, free the reader parameters
 	file -> private_data = NULL;
+	kfree(prdr);
 	
 	// Character device file was successfully closed
 	return 0;	
@@ -849,44 +2131,151 @@ static int dmCdevRelease(struct inode *ino, struct file *file)
 /************************* dmCdevIoctl(file,cmd,arg) **************************
 * Character device file operations:
 *	Ioctl call processing for the character device.
-* Executes DMA channel data receive operation.
+* Executes DMA channel data receive operation or buffer queue request.
+* Buffer dequeue, batch and "collect result" requests are executed without
+*	the ioctl mutex: they can block until DMA transaction is finished,
+*	other requests must not wait for them. If the file was opened with
+*	O_NONBLOCK, these requests return -EAGAIN instead of blocking.
+* Abort request is executed without the mutex too: it must stop the
+*	transfers waited by the blocked request which holds the mutex.
 * This function can block.
 * Parameters:
 *	(i)file - opened file state structure
 *	(i)cmd  - ioctl request code
-*	(o)arg - pointer to the user space transaction result buffer
+*	(io)arg - pointer to the user space request/result buffer
 * Return value:
-*	0 Success. DMA data receive transaction was executed
+*	0 Success. The request was executed
 *	-ENOTTY Error. Bad ioctl call (incorrect request)
 *	-EPERM  Error. Character device file was not opened by user
-*	-EFAULT Error. Can not copy transaction result code to user
+*	-EBUSY  Error. The buffer queue is used by other file, by readers,
+*			by the recorder thread or by write requests
+*	<0 Other error code (see request functions)
 *******************************************************************************/
 static long dmCdevIoctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+	DM_RDR_t *prdr;
 	DM_CHAN_t *pch;
+	int nonblock;
+	long rc;
+
+	// Set the pointer to the reader parameters
+	prdr = file -> private_data;
 
-	// Check ioctl command code
-	if(cmd != _DM_IOCTL_TRAN_RC)
-		return -ENOTTY;					// Incorrect request command code
+	// Check that the file was opened
+	if(prdr == NULL) return -EPERM;		// The file was not opened
 
 	// Set the pointer to the DMA-PROXY channel parameters
-	pch = file -> private_data;
+	pch = prdr -> pch;
 
-	// Check that the file was opened
-	if(pch == NULL) return -EPERM;		// The file was not opened
+	// Read the flag: non-blocking access is requested (1)
+	nonblock = ((file -> f_flags & O_NONBLOCK) != 0);
 
-	// Perform transfer on DMA channel (data receive)
-	dmChTransfer(pch);
+	// Reader information request is available for any file
+	if(cmd == _DM_IOCTL_RD_INFO)
+		return dmRdrIoctlInfo(prdr, arg);
+
+	// The buffer queue and transaction requests use the buffer queue: only
+	// one file can use them, while no file reads the data stream.
+	// Configuration, abort and statistics requests do not claim the queue.
+	if(dmCdevIoctlQueue(cmd, arg)) {
+		rc = dmChCtlClaim(prdr);
+		if(rc < 0) return rc;
+	}
+
+	// While the recorder thread or write requests own the buffer queue, only
+	// channel information, abort, coalescing, overrun and recorder requests
+	// are available. The owners are set under the mutex (WRITE_ONCE), they
+	// are read without it: the blocking requests must not wait for it.
+	if((READ_ONCE(pch -> rec.task) != NULL || READ_ONCE(pch -> wr_strm)) &&
+			cmd != _DM_IOCTL_INFO && cmd != _DM_IOCTL_ABORT &&
+			cmd != _DM_IOCTL_COAL && cmd != _DM_IOCTL_OVR &&
+			cmd != _DM_IOCTL_REC)
+		return -EBUSY;
+
+	// Buffer dequeue request can block, it is executed without the mutex
+	if(cmd == _DM_IOCTL_DQBUF)
+		return dmChIoctlDqbuf(pch, arg, nonblock);
+
+	// Batch request can block, it takes the mutex to queue the buffers only
+	if(cmd == _DM_IOCTL_BATCH)
+		return dmChIoctlBatch(pch, arg, nonblock);
+
+	// "Collect result" request can block, it is executed without the mutex
+	if(cmd == _DM_IOCTL_TRAN_RES)
+		return dmChIoctlTranRes(pch, arg, nonblock);
+
+	// Abort request stops blocked requests, it is executed without the mutex
+	if(cmd == _DM_IOCTL_ABORT) {
+		dmChAbort(pch, _DM_TRAN_RES_ABORTED);
+		return 0;
+	}
+
+	// Serialize other requests
+	mutex_lock(&(pch -> ioctl_mutex));
+
+	// Execute the request
+	rc = dmChIoctlCtrl(pch, cmd, arg);
 
-	// Copy DMA transaction result code to the user space app
-	return dmChResToUser(pch,arg);
+	// Release ioctl mutex
+	mutex_unlock(&(pch -> ioctl_mutex));
+
+	// Return request success/error code
+	return rc;
+}
+
+/************************ dmCdevIoctlQueue(cmd,arg) ***************************
+* Check if the ioctl request uses the buffer queue of the channel: the file
+*	must claim the queue (see dmChCtlClaim)
+* The buffer queue, transaction, CPU access and export requests and
+*	the recorder start use the queue. The information, configuration
+*	(timeout, coalescing, overrun policy, geometry, memory mode), abort
+*	and recorder stop/statistics requests are available for any file.
+* Parameters:
+*	(i)cmd - ioctl request code
+*	(i)arg - pointer to the user space request buffer
+* Return value:
+*	1 The request uses the buffer queue
+*	0 The request does not claim the queue
+*******************************************************************************/
+static int dmCdevIoctlQueue(unsigned int cmd, unsigned long arg)
+{
+	uint32_t rec_cmd;
+
+	switch(cmd) {
+	case _DM_IOCTL_QBUF:
+	case _DM_IOCTL_DQBUF:
+	case _DM_IOCTL_BATCH:
+	case _DM_IOCTL_STRM_ON:
+	case _DM_IOCTL_STRM_OFF:
+	case _DM_IOCTL_TRAN_RC:
+	case _DM_IOCTL_TRAN_ST:
+	case _DM_IOCTL_TRAN_RES:
+	case _DM_IOCTL_TRAN_USR:
+	case _DM_IOCTL_CPU_BEG:
+	case _DM_IOCTL_CPU_END:
+	case _DM_IOCTL_EXPBUF:
+		// Buffer queue and transaction requests
+		return 1;
+
+	case _DM_IOCTL_REC:
+		// The recorder thread owns the queue of the file which started it
+		// (the command is checked again by the request)
+		if(get_user(rec_cmd, &(((_DM_REC_t __user *)arg) -> cmd)) != 0)
+			return 1;
+		return (rec_cmd == _DM_REC_START);
+
+	default:
+		// Information, configuration, abort and statistics requests
+		return 0;
+	}
 }
 
 /**************************** dmCdevMmap(file,vma) ****************************
 * Character device file operations:
 * 	Map the memory for DMA operations to into user space
-* Used variable:
-*	(i)dm_parm - DMA-PROXY parameters
+* The whole memory of the channel buffer queue can be mapped at once,
+*	or one buffer at offset _DM_BUF_OFFS(trsz,buf_idx).
+*	The metadata pages are mapped at the offset next to the buffers.
 * Parameters:
 *	(i)file - opened file state structure
 *	(i)vma - user space virtual memory area parameters structure
@@ -901,430 +2290,5010 @@ static int dmCdevMmap(struct file *file, struct vm_area_struct *vma)
 	struct device *dev;
 	uint8_t *dma_buffer;
 	dma_addr_t dma_handle;
-	unsigned long vm_start;
-	unsigned long vm_end;
-	uint32_t trsz;
+	uint32_t mem_sz;
+	int rc;
+
+	// Check that the file was opened
+	if(file -> private_data == NULL) return -EPERM;	// The file was not opened
 
 	// Set the pointer to the DMA-PROXY channel parameters
-	pch = file -> private_data;
+	pch = ((DM_RDR_t *)(file -> private_data)) -> pch;
 
 	// Set the pointer to the DMA-PROXY device structure
-	dev = dm_parm.dev;
+	dev = pch -> dev;
 
-	// Check that the file was opened
-	if(pch == NULL) return -EPERM;		// The file was not opened
+	// Serialize with memory mode change
+	mutex_lock(&(pch -> ioctl_mutex));
 
-	// Set the pointer to the DMA channel allocated buffer (in the kernel space)
+	// Set the pointer to the DMA channel allocated memory (in the kernel space)
 	dma_buffer = pch -> dma_buffer;
 
-	// Get DMA buffer physical address (aka DMA handle)
+	// Get DMA memory physical address (aka DMA handle)
 	dma_handle = pch -> dma_buffer_phadd;
 
-	// Read start and end addresses in the user space virtual memory
-	vm_start = vma -> vm_start;
-	vm_end = vma -> vm_end;
+	// Get the size of the allocated memory (b)
+	mem_sz = pch -> dma_mem_sz;
+
+	if(mem_sz == 0)
+		// The memory is not allocated
+		rc = -ENOMEM;
+	else if((vma -> vm_pgoff << PAGE_SHIFT) == mem_sz)
+		// Map buffer metadata pages (next to the buffers)
+		rc = dmCdevMmapMeta(pch, vma);
+	else if(pch -> mem_mode == _DM_MEM_CACHED)
+		// Map cacheable buffers of DMA-PROXY channel to user space
+		rc = dmCdevMmapCached(pch, vma);
+	else
+		// Map coherent memory used by DMA-PROXY channel from kernel to user space
+		// (the offset in the memory is taken from vma, the range is checked there)
+		rc = dma_mmap_coherent(dev,vma,dma_buffer,dma_handle,mem_sz);
+
+	// Count the mapping: the memory can not be reallocated while it is mapped
+	if(rc == 0) {
+		vma -> vm_ops = &dm_vm_ops;
+		vma -> vm_private_data = pch;
+		atomic_inc(&(pch -> map_cnt));
+		pch -> map_space = vma -> vm_file -> f_mapping;
+	}
 
-	// Calculate the size of the memory to map (b)
-	trsz = vm_end - vm_start;
+	// Release ioctl mutex
+	mutex_unlock(&(pch -> ioctl_mutex));
 
-	// Map coherent memory used by DMA-PROXY channel from kernel to user space
-	return dma_mmap_coherent(dev,vma,dma_buffer,dma_handle,trsz);
+	// Return success/error code
+	return rc;
 }
 
-/***************************** dmChTransfer(pch) ******************************
-* Perform transfer on DMA channel
-* Starts DMA transfer
-* Waits until DMA transfer is finished
-* The status result of DMA transfer is stored in channel parameters
-* Parameter:
+/************************* dmCdevMmapCached(pch,vma) **************************
+* Map cacheable buffers of DMA-PROXY channel to user space
+* The buffers are allocated separately, each buffer which intersects
+*	the requested area is mapped at its fixed offset
+* Parameters:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)vma - user space virtual memory area parameters structure
+* Return value:
+*	0  Success. The memory was mapped
+*	-EINVAL Error. The requested area is out of the channel memory
+*	<0 Other error code (from remap_pfn_range)
 *******************************************************************************/
-static void dmChTransfer(DM_CHAN_t *pch)
+static int dmCdevMmapCached(DM_CHAN_t *pch, struct vm_area_struct *vma)
 {
+	unsigned long offs;
+	unsigned long size;
+	unsigned long uaddr;
+	unsigned long len;
+	unsigned long buf_offs;
+	unsigned long pfn;
+	uint32_t buf_idx;
+	uint32_t stride;
 	int rc;
 
-	// Start transfer on DMA channel
-	rc = dmChTrStart(pch);
+	// Get buffers stride (b)
+	stride = pch -> buf_stride;
 
-	// Check that the transfer was started
-	if(rc == 0)
-		// The transfer was started
-		// Wait until the transfer is finished 
-		// (function stores DMA transaction result code in channel parameters)
-		dmChTrWait(pch);
-	else
-		// Can not start DMA transfer
-		// Store DMA transaction result code (for user) - error
-		dmChTrStResCode(pch, _DM_TRAN_RES_ERROR);
+	// Get the requested offset and size of the area (b)
+	offs = vma -> vm_pgoff << PAGE_SHIFT;
+	size = vma -> vm_end - vma -> vm_start;
+
+	// Check that the requested area is inside the channel memory
+	if(offs + size > pch -> dma_mem_sz) return -EINVAL;
+
+	// Map buffers cycle
+	uaddr = vma -> vm_start;
+	while(size > 0) {
+		// Get the index of the buffer and the offset in it
+		buf_idx = offs / stride;
+		buf_offs = offs % stride;
+
+		// Calculate the size of the buffer part to map
+		len = min(size, stride - buf_offs);
+
+		// Get page frame number of the buffer part
+		pfn = page_to_pfn(pch -> buf[buf_idx].pages) + (buf_offs >> PAGE_SHIFT);
+
+		// Map the buffer part (cacheable, default page protection)
+		rc = remap_pfn_range(vma, uaddr, pfn, len, vma -> vm_page_prot);
+		if(rc != 0) return rc;			// Can not map the buffer
+
+		// Next buffer
+		uaddr += len;
+		offs += len;
+		size -= len;
+	}
+
+	// The memory was mapped successfully
+	return 0;
 }
 
-/**************************** dmChTrCallBack(cmp) *****************************
-* Callback function for "transfer finished" event
-* Indicates that the DMA transfer is complete to another thread of control
+/************************** dmCdevMmapMeta(pch,vma) ***************************
+* Map buffer metadata pages of DMA-PROXY channel to user space (read only)
+* Parameters:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)vma - user space virtual memory area parameters structure
+* Return value:
+*	0  Success. The pages were mapped
+*	-EINVAL Error. The requested area is not the metadata area
+*	-EPERM  Error. Write access to the pages is requested
+*	<0 Other error code (from remap_pfn_range)
+*******************************************************************************/
+static int dmCdevMmapMeta(DM_CHAN_t *pch, struct vm_area_struct *vma)
+{
+	unsigned long pfn;
+
+	// Only the whole metadata area can be mapped
+	if(vma -> vm_end - vma -> vm_start != pch -> meta_sz) return -EINVAL;
+
+	// The pages are written by the driver only
+	if(vma -> vm_flags & VM_WRITE) return -EPERM;
+	vma -> vm_flags &= ~VM_MAYWRITE;
+
+	// Get page frame number of the first metadata page
+	pfn = virt_to_phys(pch -> meta) >> PAGE_SHIFT;
+
+	// Map the pages (cacheable, default page protection)
+	return remap_pfn_range(vma, vma -> vm_start, pfn, pch -> meta_sz,
+		vma -> vm_page_prot);
+}
+
+/**************************** dmCdevVmOpen(vma) *******************************
+* User space mapping operations:
+*	The mapping was copied (fork) or split - count it
 * Parameter:
-*	(o)cmp - DMA transaction complete indicator
+*	(i)vma - user space virtual memory area parameters structure
 *******************************************************************************/
-static void dmChTrCallBack(void *cmp)
+static void dmCdevVmOpen(struct vm_area_struct *vma)
 {
-	complete(cmp);
+	DM_CHAN_t *pch;
+
+	// Set the pointer to the DMA-PROXY channel parameters
+	pch = vma -> vm_private_data;
+
+	// Count the mapping
+	atomic_inc(&(pch -> map_cnt));
 }
 
-/****************************** dmChTrStart(pch) ******************************
-* Start transfer on DMA channel
-* Inits DMA transaction
-* Inits callback function for "transfer finished" event
-* Submits DMA transaction to the DMA engine
-* Initiates DMA transfer
+/**************************** dmCdevVmClose(vma) ******************************
+* User space mapping operations:
+*	The mapping was removed - uncount it
 * Parameter:
-*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)vma - user space virtual memory area parameters structure
+*******************************************************************************/
+static void dmCdevVmClose(struct vm_area_struct *vma)
+{
+	DM_CHAN_t *pch;
+
+	// Set the pointer to the DMA-PROXY channel parameters
+	pch = vma -> vm_private_data;
+
+	// Uncount the mapping
+	dmChMapPut(pch);
+}
+
+/****************************** dmChMapPut(pch) *******************************
+* Release one reference of the channel memory (user space mapping, exported
+*	dma-buf, pipe buffer). After the last reference the memory can be
+*	reallocated or freed (the waiting channel release is woken up).
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChMapPut(DM_CHAN_t *pch)
+{
+	// Uncount the reference, wake up the release after the last one
+	if(atomic_dec_and_test(&(pch -> map_cnt)))
+		wake_up(&(pch -> wq));
+}
+
+/**************************** dmCdevPoll(file,wait) ***************************
+* Character device file operations:
+*	Poll function for the character device
+* For the file using the buffer queue ioctl requests: checks if the buffer
+*	can be dequeued or the result of the started transaction can be
+*	collected without blocking. For the reader: checks if there is the
+*	buffer to read (the file which did not read yet can start streaming).
+*	For the transmit channel: checks if the data can be written or the
+*	buffer can be dequeued without blocking.
+* Parameters:
+*	(i)file - opened file state structure
+*	(i)wait - poll table structure
 * Return value:
-*	0  Success. The transfer was started
-*	-1 Error. Can not start DMA transfer
+*	Poll event mask:
+*	POLLIN|POLLRDNORM - there is a finished DMA transaction
+*	POLLOUT|POLLWRNORM - there is a free buffer (transmit channel)
+*	POLLERR - the file was not opened
+*	0 - no finished DMA transactions
+*******************************************************************************/
+static unsigned int dmCdevPoll(struct file *file, poll_table *wait)
+{
+	DM_RDR_t *prdr;
+	DM_CHAN_t *pch;
+	unsigned int mask;
+
+	// Set the pointer to the reader parameters
+	prdr = file -> private_data;
+
+	// Check that the file was opened
+	if(prdr == NULL) return POLLERR;		// The file was not opened
+
+	// Set the pointer to the DMA-PROXY channel parameters
+	pch = prdr -> pch;
+
+	// Add "DMA transaction finished" wait queue to the poll table
+	poll_wait(file, &(pch -> wq), wait);
+
+	// Make poll event mask
+	mask = 0;
+	if(pch -> dir == _DM_DIR_TX) {
+		// The transmit channel has the free buffer (the file which did not
+		// write yet can start streaming)
+		if(pch -> ctl_rdr != prdr || !(pch -> wr_strm) || dmChBufDone(pch) ||
+				pch -> wr_buf != NULL || pch -> wr_next < pch -> buf_num)
+			mask |= POLLOUT | POLLWRNORM;
+	}
+	else if(pch -> ctl_rdr == prdr) {
+		// The file uses the buffer queue
+		if(dmChBufDone(pch)) mask |= POLLIN | POLLRDNORM;
+	}
+	else if(!(prdr -> reading) || dmRdrAvail(prdr))
+		// The reader has the buffer to read (or read starts streaming)
+		mask |= POLLIN | POLLRDNORM;
+
+	// Return poll event mask
+	return mask;
+}
+
+/*********************** dmCdevRead(file,buf,count,ppos) **********************
+* Character device file operations:
+*	Read the received data as a byte stream
+* The first read starts streaming on the idle buffer queue: all buffers are
+*	queued. Each opened file reads the finished buffers from its own position
+*	in the fan-out ring, in the completion order (trsz - residue bytes of
+*	each buffer). The buffer is queued again when all readers have read it.
+*	The slow reader does not stop DMA: if DMA has not enough buffers, the
+*	oldest buffers are queued again, the readers which have not read them
+*	lose them (the lost buffers are counted and skipped).
+* The read can stop in the middle of the buffer, the next read continues
+*	from this position. The read blocks until at least one byte is received
+*	(if non-blocking access is not requested), then returns the data
+*	available without blocking.
+* Parameters:
+*	(i)file - opened file state structure
+*	(o)buf - user space buffer to read the data to
+*	(i)count - number of bytes to read
+*	(io)ppos - file position
+* Return value:
+*	>0 Number of bytes read
+*	-EPERM  Error. Character device file was not opened by user
+*	-EBUSY  Error. The buffer queue is used by ioctl requests
+*	-EFAULT Error. Can not copy the data to user
+*	<0 Other error code (see dmRdrBuf)
 *******************************************************************************/
-static int dmChTrStart(DM_CHAN_t *pch)
+static ssize_t dmCdevRead(struct file *file, char __user *buf, size_t count,
+	loff_t *ppos)
 {
+	DM_RDR_t *prdr;
+	DM_BUF_t *pbuf;
+	unsigned long error_count;
+	size_t copied;
+	size_t len;
+	int nonblock;
 	int rc;
 
-	// Init DMA single entry transaction
-	rc = dmChTrIniSing(pch);
-	if(rc < 0) return rc;				// Can not init single entry transaction
+	// Set the pointer to the reader parameters
+	prdr = file -> private_data;
+
+	// Check that the file was opened
+	if(prdr == NULL) return -EPERM;		// The file was not opened
+
+	// Read the flag: non-blocking access is requested (1)
+	nonblock = ((file -> f_flags & O_NONBLOCK) != 0);
+
+	// Serialize read and splice requests of the file
+	if(mutex_lock_interruptible(&(prdr -> rd_mutex))) return -ERESTARTSYS;
+
+	// Read cycle (until the user buffer is filled)
+	copied = 0;
+	rc = 0;
+	while(copied < count) {
+		// Get the buffer to read, do not block if some data was read
+		rc = dmRdrBuf(prdr, nonblock || copied != 0);
+		if(rc < 0) break;
+		pbuf = prdr -> rd_buf;
+
+		// Copy the data of the buffer to user
+		len = min_t(size_t, count - copied, prdr -> rd_len - prdr -> rd_offs);
+		error_count = copy_to_user(buf + copied,
+			pbuf -> dma_buffer + prdr -> rd_offs, len);
+		if(error_count != 0) {
+			rc = -EFAULT;		// Failed to copy data to user
+			break;
+		}
+		copied += len;
+		prdr -> rd_offs += len;
+
+		// The buffer was read: go to the next buffer
+		if(prdr -> rd_offs == prdr -> rd_len) dmRdrNext(prdr);
+	}
+
+	// Release read mutex
+	mutex_unlock(&(prdr -> rd_mutex));
+
+	// Return the number of bytes read or error code (nothing was read)
+	if(copied == 0) return rc;
+	*ppos += copied;
+	return copied;
+}
+
+/**************** dmCdevSpliceRead(file,ppos,pipe,len,flags) ******************
+* Character device file operations:
+*	Splice the received data into the pipe
+* The pages of the buffer are put into the pipe without copying (the data
+*	stream is the same as for read). The buffer can be queued again when
+*	all its data was spliced and all pipe buffers with its pages are
+*	released: the consumer of the pipe must not keep the page references
+*	after that.
+* Only the buffers of cached memory mode are spliced: their pages are
+*	allocated by the page allocator. The pages of coherent memory (remapped
+*	by DMA API) can not be referenced by the pipe, read() is used instead.
+* One splice request takes the data of one buffer (up to the free space
+*	in the pipe), sendfile() repeats the request.
+* Parameters:
+*	(i)file - opened file state structure
+*	(io)ppos - file position
+*	(io)pipe - the pipe to splice the data to (locked by the caller)
+*	(i)len - maximum number of bytes to splice
+*	(i)flags - splice flags
+* Return value:
+*	>0 Number of bytes spliced
+*	-EPERM  Error. Character device file was not opened by user
+*	-EINVAL Error. The memory of the channel is not cached
+*	-EBUSY  Error. The buffer queue is used by ioctl requests
+*	<0 Other error code (see dmRdrBuf and splice_to_pipe)
+*******************************************************************************/
+static ssize_t dmCdevSpliceRead(struct file *file, loff_t *ppos,
+	struct pipe_inode_info *pipe, size_t len, unsigned int flags)
+{
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages = 0,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		.ops = &dm_pipe_buf_ops,
+		.spd_release = dmPipeSpdRelease
+	};
+	DM_RDR_t *prdr;
+	DM_BUF_t *pbuf;
+	uint32_t page_max;
+	uint32_t offs;
+	uint32_t n;
+	int nonblock;
+	ssize_t rc;
+
+	// Set the pointer to the reader parameters
+	prdr = file -> private_data;
+
+	// Check that the file was opened
+	if(prdr == NULL) return -EPERM;		// The file was not opened
+
+	// Only the pages of cached memory can be put into the pipe
+	if(prdr -> pch -> mem_mode != _DM_MEM_CACHED) return -EINVAL;
+
+	// Read the flag: non-blocking access is requested (1)
+	nonblock = ((file -> f_flags & O_NONBLOCK) != 0) ||
+		((flags & SPLICE_F_NONBLOCK) != 0);
+
+	// Serialize read and splice requests of the file
+	if(mutex_lock_interruptible(&(prdr -> rd_mutex))) return -ERESTARTSYS;
+
+	// Get the buffer to read
+	rc = dmRdrBuf(prdr, nonblock);
+	if(rc < 0) {
+		mutex_unlock(&(prdr -> rd_mutex));
+		return rc;
+	}
+	pbuf = prdr -> rd_buf;
+
+	// Splice not more pages than the free space in the pipe
+	page_max = min_t(uint32_t, PIPE_DEF_BUFFERS,
+		pipe -> buffers - pipe -> nrbufs);
+
+	// Take the pages of the buffer from the read position
+	while(len != 0 && spd.nr_pages < page_max &&
+			prdr -> rd_offs < prdr -> rd_len) {
+		// Part of the page with the data
+		offs = prdr -> rd_offs & ~PAGE_MASK;
+		n = min3((size_t)(PAGE_SIZE - offs), len,
+			(size_t)(prdr -> rd_len - prdr -> rd_offs));
+
+		// Put the page into splice descriptor, reference the buffer
+		pages[spd.nr_pages] = dmChBufPage(pbuf, prdr -> rd_offs);
+		partial[spd.nr_pages].offset = offs;
+		partial[spd.nr_pages].len = n;
+		partial[spd.nr_pages].private = (unsigned long)pbuf;
+		dmPipeRefGet(pbuf, pages[spd.nr_pages]);
+		spd.nr_pages++;
+
+		// Move the read position
+		prdr -> rd_offs += n;
+		len -= n;
+	}
+
+	// All data of the buffer was taken: go to the next buffer
+	if(prdr -> rd_offs == prdr -> rd_len) dmRdrNext(prdr);
+
+	// Release read mutex
+	mutex_unlock(&(prdr -> rd_mutex));
+
+	// Put the pages into the pipe (not spliced pages are released)
+	rc = splice_to_pipe(pipe, &spd);
+	if(rc > 0) *ppos += rc;
+
+	// Return the number of bytes spliced or error code
+	return rc;
+}
+
+/********************** dmCdevWrite(file,buf,count,ppos) **********************
+* Character device file operations:
+*	Write the data to transmit as a byte stream (transmit channel)
+* The first write starts streaming on the idle buffer queue, the file owns
+*	the buffer queue until it is closed. The data fills the buffers, the
+*	full buffer is queued (transmitted in the write order). The buffers
+*	are reused when their transfers are finished.
+* The write blocks until there is the free buffer (if non-blocking access
+*	is not requested), then writes the data which fits without blocking.
+* Parameters:
+*	(i)file - opened file state structure
+*	(i)buf - user space buffer with the data to write
+*	(i)count - number of bytes to write
+*	(io)ppos - file position
+* Return value:
+*	>0 Number of bytes written
+*	-EPERM  Error. Character device file was not opened by user
+*	-EINVAL Error. The channel receives data
+*	-EBUSY  Error. The buffer queue is used by other file or by ioctl requests
+*	-EFAULT Error. Can not copy the data from user
+*	<0 Other error code (see dmChWrBuf)
+*******************************************************************************/
+static ssize_t dmCdevWrite(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	DM_RDR_t *prdr;
+	DM_CHAN_t *pch;
+	unsigned long error_count;
+	size_t copied;
+	size_t len;
+	int nonblock;
+	int rc;
+
+	// Set the pointer to the reader parameters
+	prdr = file -> private_data;
+
+	// Check that the file was opened
+	if(prdr == NULL) return -EPERM;		// The file was not opened
+
+	// Set the pointer to the DMA-PROXY channel parameters
+	pch = prdr -> pch;
+
+	// Read the flag: non-blocking access is requested (1)
+	nonblock = ((file -> f_flags & O_NONBLOCK) != 0);
+
+	// Serialize write requests of the file
+	if(mutex_lock_interruptible(&(prdr -> rd_mutex))) return -ERESTARTSYS;
+
+	// Start streaming for write if required
+	rc = dmChWrStart(prdr);
+
+	// Write cycle (until all user data is written)
+	copied = 0;
+	while(rc == 0 && copied < count) {
+		// Get the buffer to fill, do not block if some data was written
+		rc = dmChWrBuf(pch, nonblock || copied != 0);
+		if(rc < 0) break;
+
+		// Copy the data from user into the buffer
+		len = min_t(size_t, count - copied, pch -> trsz - pch -> wr_len);
+		error_count = copy_from_user(pch -> wr_buf -> dma_buffer +
+			pch -> wr_len, buf + copied, len);
+		if(error_count != 0) {
+			rc = -EFAULT;		// Failed to copy data from user
+			break;
+		}
+		copied += len;
+		pch -> wr_len += len;
+
+		// The buffer is full: queue it
+		if(pch -> wr_len == pch -> trsz) dmChWrQueue(pch);
+	}
+
+	// Release write mutex
+	mutex_unlock(&(prdr -> rd_mutex));
+
+	// Return the number of bytes written or error code (nothing was written)
+	if(copied == 0) return rc;
+	*ppos += copied;
+	return copied;
+}
+
+/******************** dmCdevFsync(file,start,end,datasync) ********************
+* Character device file operations:
+*	Transmit the written data (transmit channel)
+* The partially filled buffer is queued, the function waits until all
+*	queued buffers are transmitted (limited by the channel timeout)
+* Parameters:
+*	(i)file - opened file state structure
+*	(i)start - not used
+*	(i)end - not used
+*	(i)datasync - not used
+* Return value:
+*	0 Success. All written data was transmitted
+*	-EINVAL Error. The file does not write the data stream
+*	<0 Other error code (see dmChWrDrain)
+*******************************************************************************/
+static int dmCdevFsync(struct file *file, loff_t start, loff_t end,
+	int datasync)
+{
+	DM_RDR_t *prdr;
+	DM_CHAN_t *pch;
+	int rc;
+
+	// Set the pointers to the reader and DMA-PROXY channel parameters
+	prdr = file -> private_data;
+	if(prdr == NULL) return -EINVAL;	// The file was not opened
+	pch = prdr -> pch;
+
+	// Only the file writing the data stream can transmit it
+	if(pch -> ctl_rdr != prdr || !(pch -> wr_strm)) return -EINVAL;
+
+	// Serialize with write requests of the file
+	if(mutex_lock_interruptible(&(prdr -> rd_mutex))) return -ERESTARTSYS;
+
+	// Transmit the written data
+	rc = dmChWrDrain(pch);
+
+	// Release write mutex
+	mutex_unlock(&(prdr -> rd_mutex));
+
+	// Return success/error code
+	return rc;
+}
+
+/***************************** dmChWrStart(prdr) ******************************
+* Start streaming for write requests (if it was not started yet)
+* The file claims the buffer queue, the buffer queue must be idle.
+*	Streaming is started with no queued buffers: the buffers are queued
+*	when they are filled.
+* Parameter:
+*	(i)prdr - pointer to the reader parameters structure of the file
+* Return value:
+*	0 Success. Streaming for write is on
+*	-EINVAL Error. The channel receives data
+*	-EBUSY Error. The buffer queue is used by other file, by readers or
+*			by ioctl requests, or the memory is not allocated
+*******************************************************************************/
+static int dmChWrStart(DM_RDR_t *prdr)
+{
+	DM_CHAN_t *pch;
+	int rc;
+
+	// Set the pointer to the channel parameters
+	pch = prdr -> pch;
+
+	// Only the transmit channel can be written
+	if(pch -> dir != _DM_DIR_TX) return -EINVAL;
+
+	// Claim the buffer queue for the file
+	rc = dmChCtlClaim(prdr);
+	if(rc < 0) return rc;
+
+	// Streaming for write is already on
+	if(READ_ONCE(pch -> wr_strm)) return 0;
+
+	// Serialize with ioctl requests
+	mutex_lock(&(pch -> ioctl_mutex));
+
+	// The buffer queue must be idle, the memory must be allocated
+	rc = 0;
+	if(!dmChQueueIdle(pch) || pch -> dma_mem_sz == 0)
+		rc = -EBUSY;
+	else {
+		// No buffers were filled yet, start streaming
+		pch -> wr_buf = NULL;
+		pch -> wr_len = 0;
+		pch -> wr_next = 0;
+		WRITE_ONCE(pch -> wr_strm, 1);
+		dmChStrmOn(pch);
+	}
+
+	// Release ioctl mutex
+	mutex_unlock(&(pch -> ioctl_mutex));
+
+	// Return success/error code
+	return rc;
+}
+
+/************************** dmChWrBuf(pch,nonblock) ***************************
+* Get the buffer to fill: the buffer being filled, the buffer never filled
+*	yet or the oldest transmitted buffer (waits until its transfer is
+*	finished, the failed transfers are counted in the channel statistics)
+* Must be called with the write mutex of the file locked
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)nonblock - flag: non-blocking access is requested (1)
+* Return value:
+*	0 Success. The buffer to fill is pch -> wr_buf
+*	<0 Error code (see dmChBufWaitPop)
+*******************************************************************************/
+static int dmChWrBuf(DM_CHAN_t *pch, int nonblock)
+{
+	DM_BUF_t *pbuf;
+	int rc;
+
+	// Continue to fill the current buffer
+	if(pch -> wr_buf != NULL) return 0;
+
+	// Take the buffer never filled yet or the transmitted buffer
+	if(pch -> wr_next < pch -> buf_num)
+		pbuf = &(pch -> buf[pch -> wr_next++]);
+	else {
+		rc = dmChBufWaitPop(pch, nonblock, &pbuf);
+		if(rc < 0) return rc;			// No free buffers
+	}
+
+	// The buffer is filled by CPU (cached memory mode)
+	dmChBufSyncCpu(pbuf);
+
+	// Fill the buffer from the beginning
+	pch -> wr_buf = pbuf;
+	pch -> wr_len = 0;
+
+	// The buffer to fill was taken successfully
+	return 0;
+}
+
+/****************************** dmChWrQueue(pch) ******************************
+* Queue the buffer being filled (if it has the data)
+* The buffer which can not be started is finished with error result code,
+*	it is reused by the next write
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChWrQueue(DM_CHAN_t *pch)
+{
+	DM_BUF_t *pbuf;
+	uint32_t len;
+
+	// Take the buffer being filled
+	pbuf = pch -> wr_buf;
+	len = pch -> wr_len;
+	if(pbuf == NULL || len == 0) return;
+	pch -> wr_buf = NULL;
+	pch -> wr_len = 0;
+
+	// Queue the filled part of the buffer
+	dmChBufQueue(pch, pbuf -> buf_idx, len);
+}
+
+/****************************** dmChWrDrain(pch) ******************************
+* Transmit the written data: queue the partially filled buffer, wait until
+*	all queued buffers are transmitted
+* The wait is limited by the channel timeout (the transfers are not stopped)
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 Success. All queued buffers were transmitted
+*	-ETIMEDOUT Error. The buffers were not transmitted within the timeout
+*	-ERESTARTSYS Error. The wait was interrupted by a signal
+*******************************************************************************/
+static int dmChWrDrain(DM_CHAN_t *pch)
+{
+	long rc;
+
+	// Queue the partially filled buffer
+	dmChWrQueue(pch);
+
+	// Wait until DMA has no buffers or streaming is off
+	rc = wait_event_interruptible_timeout(pch -> wq,
+			dmChQueueDmaCnt(pch) == 0 || !(pch -> streaming),
+			dmChTrWaitTmo(pch));
+	if(rc < 0) return rc;				// The wait was interrupted
+	if(rc == 0) return -ETIMEDOUT;		// The data was not transmitted
+
+	// All written data was transmitted
+	return 0;
+}
+
+/****************************** dmRdrStart(prdr) ******************************
+* Start reading of the data stream by the file
+* Streaming for read is started if required, the file is added to the
+*	readers list: it reads the buffers finished after this moment
+* Parameter:
+*	(io)prdr - pointer to the reader parameters structure
+* Return value:
+*	0 Success. The file reads the data stream
+*	-EBUSY Error. The buffer queue is used by ioctl requests
+*			or the memory is not allocated
+*******************************************************************************/
+static int dmRdrStart(DM_RDR_t *prdr)
+{
+	DM_CHAN_t *pch;
+	int rc;
+
+	// Set the pointer to the channel parameters
+	pch = prdr -> pch;
+
+	// The file already reads the data stream
+	if(prdr -> reading && pch -> rd_strm) return 0;
+
+	// Serialize with ioctl requests and release of other readers
+	mutex_lock(&(pch -> ioctl_mutex));
+
+	// Start streaming for read if required
+	rc = 0;
+	if(!(pch -> rd_strm)) rc = dmChRdStart(pch);
+
+	// Add the file to the readers list
+	if(rc == 0 && !(prdr -> reading)) {
+		mutex_lock(&(pch -> fan_mutex));
+		list_add_tail(&(prdr -> list), &(pch -> rdr_list));
+		pch -> rdr_cnt++;
+		prdr -> seq = pch -> fan_head;
+		prdr -> reading = 1;
+		mutex_unlock(&(pch -> fan_mutex));
+	}
+
+	// Release ioctl mutex
+	mutex_unlock(&(pch -> ioctl_mutex));
+
+	// Return success/error code
+	return rc;
+}
+
+/****************************** dmChRdStart(pch) ******************************
+* Start streaming for read requests
+* The buffer queue must be idle and must not be used by ioctl requests:
+*	the fan-out ring is cleared, all buffers are queued (except the
+*	buffers still referenced by pipes, they are queued when released) and
+*	streaming is started.
+* Must be called with the ioctl mutex locked
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 Success. Streaming for read is on
+*	-EBUSY Error. The buffer queue is used by ioctl requests
+*			or the memory is not allocated
+*	-EINVAL Error. The channel transmits data
+*******************************************************************************/
+static int dmChRdStart(DM_CHAN_t *pch)
+{
+	DM_BUF_t *pbuf;
+	uint32_t buf_idx;
+
+	// Only the received data can be read
+	if(pch -> dir != _DM_DIR_RX) return -EINVAL;
+
+	// The buffer queue must be idle, the memory must be allocated
+	if(!dmChQueueIdle(pch) || pch -> dma_mem_sz == 0) return -EBUSY;
+
+	// The buffer queue must not be used by ioctl requests
+	// (the flag is checked by ioctl requests after they claim the queue)
+	if(pch -> ctl_rdr != NULL) return -EBUSY;
+	pch -> rd_strm = 1;
+	smp_mb();
+	if(pch -> ctl_rdr != NULL) {
+		pch -> rd_strm = 0;
+		return -EBUSY;
+	}
+
+	// Clear the fan-out ring, DMA keeps the submission window
+	// (but not more than half of the buffers)
+	mutex_lock(&(pch -> fan_mutex));
+	pch -> fan_tail = pch -> fan_head;
+	pch -> fan_rd = 0;
+	pch -> fan_lowat = max_t(uint32_t, 1,
+		min_t(uint32_t, pch -> act_max, pch -> buf_num / 2));
+
+	// Queue all buffers, the buffers referenced by pipes are queued
+	// when the last reference is released
+	for(buf_idx = 0; buf_idx < pch -> buf_num; buf_idx++) {
+		pbuf = &(pch -> buf[buf_idx]);
+		if(atomic_read(&(pbuf -> rd_ref)) == 0)
+			dmChBufQueue(pch, buf_idx, pch -> trsz);
+		else
+			pbuf -> rd_requeue = 1;
+	}
+	mutex_unlock(&(pch -> fan_mutex));
+
+	// Start streaming (the buffer which can not be started is finished
+	// with error result code, it is not delivered to readers)
+	dmChStrmOn(pch);
+
+	// Streaming for read was started successfully
+	return 0;
+}
+
+/************************* dmRdrBuf(prdr,nonblock) ****************************
+* Get the buffer to read: the buffer being read or the next buffer of
+*	the fan-out ring (the reader starts to read the data stream if required)
+* The buffers reused by DMA before the reader has read them are counted
+*	as lost and skipped. If the channel timeout expires, the transfers are
+*	not stopped (other readers use them), the timeout is reported.
+* Must be called with the read mutex of the reader locked
+* Parameters:
+*	(io)prdr - pointer to the reader parameters structure
+*	(i)nonblock - flag: non-blocking access is requested (1)
+* Return value:
+*	0 Success. The buffer to read is prdr -> rd_buf
+*	-EBUSY Error. The buffer queue is used by ioctl requests
+*	-EAGAIN Error. Non-blocking access, no buffers to read
+*	-ETIMEDOUT Error. No buffers within the channel timeout
+*	-EINVAL Error. Streaming is off
+*	-ERESTARTSYS Error. The wait was interrupted by a signal
+*******************************************************************************/
+static int dmRdrBuf(DM_RDR_t *prdr, int nonblock)
+{
+	DM_CHAN_t *pch;
+	DM_FAN_t *pfan;
+	DM_BUF_t *pbuf;
+	long rc;
+
+	// Set the pointer to the channel parameters
+	pch = prdr -> pch;
+
+	// Continue to read the current buffer
+	if(prdr -> rd_buf != NULL) return 0;
+
+	// Start reading of the data stream if required
+	rc = dmRdrStart(prdr);
+	if(rc < 0) return rc;
+
+	// Wait for the buffer to read cycle
+	for(;;) {
+		// Wait until there is the buffer to read or streaming is off
+		if(nonblock)
+			rc = (dmRdrAvail(prdr) || !(pch -> rd_strm)) ? 1 : -EAGAIN;
+		else
+			rc = wait_event_interruptible_timeout(pch -> wq,
+					dmRdrAvail(prdr) || !(pch -> rd_strm),
+					dmChTrWaitTmo(pch));
+		if(rc < 0) return rc;			// No buffers or the wait was interrupted
+		if(rc == 0) return -ETIMEDOUT;	// No buffers within the timeout
+
+		// Lock the fan-out ring
+		mutex_lock(&(pch -> fan_mutex));
+
+		// Streaming is off
+		if(!(pch -> rd_strm)) {
+			mutex_unlock(&(pch -> fan_mutex));
+			return -EINVAL;
+		}
+
+		// Skip the buffers reused by DMA, count them as lost
+		if((int32_t)(prdr -> seq - pch -> fan_tail) < 0) {
+			prdr -> lost += pch -> fan_tail - prdr -> seq;
+			prdr -> seq = pch -> fan_tail;
+		}
+
+		// There is the buffer to read
+		if(prdr -> seq != pch -> fan_head) break;
+
+		// All buffers were reused, wait again
+		mutex_unlock(&(pch -> fan_mutex));
+	}
+
+	// Take the buffer from the fan-out ring, reference it by the read
+	// position (the buffer is not reused, the memory is not reallocated)
+	pfan = &(pch -> fan[dmChFanSlot(pch, prdr -> seq)]);
+	pbuf = &(pch -> buf[pfan -> buf_idx]);
+	atomic_inc(&(pch -> map_cnt));
+	atomic_inc(&(pbuf -> rd_ref));
+
+	// Read the buffer from the beginning
+	prdr -> rd_buf = pbuf;
+	prdr -> rd_offs = 0;
+	prdr -> rd_len = pfan -> len;
+
+	// Unlock the fan-out ring
+	mutex_unlock(&(pch -> fan_mutex));
+
+	// The buffer to read was taken successfully
+	return 0;
+}
+
+/****************************** dmRdrAvail(prdr) ******************************
+* Check that there is the buffer to read for the reader
+* Parameter:
+*	(i)prdr - pointer to the reader parameters structure
+* Return value:
+*	1 There is the buffer to read (or the lost buffers to skip)
+*	0 All finished buffers were read
+*******************************************************************************/
+static int dmRdrAvail(DM_RDR_t *prdr)
+{
+	// Compare the read position with the fan-out ring head
+	return (READ_ONCE(prdr -> pch -> fan_head) != prdr -> seq);
+}
+
+/****************************** dmRdrNext(prdr) *******************************
+* Finish reading of the current buffer: move the read position to the next
+*	buffer, release the read position reference of the buffer
+*	(the buffer is reused when all readers have read it)
+* Parameter:
+*	(io)prdr - pointer to the reader parameters structure
+*******************************************************************************/
+static void dmRdrNext(DM_RDR_t *prdr)
+{
+	DM_BUF_t *pbuf;
+
+	// Take the buffer being read
+	pbuf = prdr -> rd_buf;
+	prdr -> rd_buf = NULL;
+	prdr -> rd_offs = 0;
+	prdr -> rd_len = 0;
+
+	// Move the read position (under the fan-out ring mutex: the positions
+	// are used to find the buffers read by all readers)
+	mutex_lock(&(pbuf -> pch -> fan_mutex));
+	prdr -> seq++;
+	prdr -> frames++;
+	mutex_unlock(&(pbuf -> pch -> fan_mutex));
+
+	// Release the read position reference
+	dmChRdPut(pbuf);
+}
+
+/******************************* dmChRdPut(pbuf) ******************************
+* Release read reference of the buffer
+* The buffers of the fan-out ring read by all readers are queued again.
+*	The buffer of stopped streaming is queued after the last reference
+*	(only if streaming for read was started again).
+* Parameter:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*******************************************************************************/
+static void dmChRdPut(DM_BUF_t *pbuf)
+{
+	DM_CHAN_t *pch;
+	int last;
+
+	// Set the pointer to the channel parameters
+	pch = pbuf -> pch;
+
+	// Release the reference
+	last = atomic_dec_and_test(&(pbuf -> rd_ref));
+
+	// Lock the fan-out ring
+	mutex_lock(&(pch -> fan_mutex));
+
+	// Queue the buffer of stopped streaming
+	if(last && pbuf -> rd_requeue) {
+		pbuf -> rd_requeue = 0;
+		if(pch -> rd_strm) dmChBufQueue(pch, pbuf -> buf_idx, pch -> trsz);
+	}
+
+	// Queue the buffers read by all readers
+	dmChFanRecycle(pch);
+
+	// Unlock the fan-out ring
+	mutex_unlock(&(pch -> fan_mutex));
+
+	// The memory can be reallocated after the last reference
+	dmChMapPut(pch);
+}
+
+/***************************** dmChFanPump(pch) *******************************
+* Move the finished buffers into the fan-out ring, queue the buffers read by
+*	all readers (and the oldest buffers if DMA has not enough buffers)
+* Called by the work scheduled by the callback while streaming for read is on
+* The buffer finished with error result code is queued again, it is not
+*	delivered to readers (the error is counted in the channel statistics)
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChFanPump(DM_CHAN_t *pch)
+{
+	DM_BUF_t *pbuf;
+	DM_FAN_t *pfan;
+
+	// Lock the fan-out ring
+	mutex_lock(&(pch -> fan_mutex));
+
+	// Take the finished buffers cycle (while streaming for read is on)
+	while(pch -> rd_strm && (pbuf = dmChBufPop(pch)) != NULL) {
+		// DMA transaction failed: queue the buffer again
+		if(pbuf -> res_code != _DM_TRAN_RES_SUCCESS) {
+			dmChBufQueue(pch, pbuf -> buf_idx, pch -> trsz);
+			continue;
+		}
+
+		// Synchronize the buffer for CPU (cached memory mode)
+		dmChBufSyncCpu(pbuf);
+
+		// Put the buffer into the fan-out ring
+		pfan = &(pch -> fan[dmChFanSlot(pch, pch -> fan_head)]);
+		pfan -> buf_idx = pbuf -> buf_idx;
+		pfan -> len = pch -> trsz - pbuf -> residue;
+		pch -> fan_head++;
+	}
+
+	// Queue the buffers read by all readers, the oldest buffers if required
+	dmChFanRecycle(pch);
+
+	// Unlock the fan-out ring
+	mutex_unlock(&(pch -> fan_mutex));
+
+	// Wake up the readers
+	wake_up_interruptible(&(pch -> wq));
+}
+
+/**************************** dmChFanRecycle(pch) *****************************
+* Queue the oldest buffers of the fan-out ring again (in the ring order):
+*	the buffers read by all readers, and the buffers not read yet if DMA
+*	has less than the minimum number of buffers (the slow readers lose them)
+* The buffer referenced by the reader or by the pipe is not queued (it stops
+*	the cycle: the ring keeps the buffers in the sequence order)
+* Must be called with the fan-out ring mutex locked
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChFanRecycle(DM_CHAN_t *pch)
+{
+	DM_RDR_t *prdr;
+	DM_FAN_t *pfan;
+	DM_BUF_t *pbuf;
+	uint32_t min_seq;
+
+	// Nothing to do if streaming for read is off
+	if(!(pch -> rd_strm)) return;
+
+	// Find the read position of the slowest reader
+	min_seq = pch -> fan_head;
+	list_for_each_entry(prdr, &(pch -> rdr_list), list)
+		if((int32_t)(prdr -> seq - min_seq) < 0) min_seq = prdr -> seq;
+
+	// Queue the oldest buffers cycle
+	while(pch -> fan_tail != pch -> fan_head) {
+		// Set the pointer to the oldest buffer of the ring
+		pfan = &(pch -> fan[pch -> fan_rd]);
+		pbuf = &(pch -> buf[pfan -> buf_idx]);
+
+		// The buffer is read now or referenced by the pipe
+		if(atomic_read(&(pbuf -> rd_ref)) != 0) break;
+
+		// The buffer was not read by all readers, DMA has enough buffers
+		if((int32_t)(pch -> fan_tail - min_seq) >= 0 &&
+				dmChQueueDmaCnt(pch) >= pch -> fan_lowat) break;
+
+		// Remove the buffer from the ring, queue it
+		pch -> fan_tail++;
+		pch -> fan_rd = (pch -> fan_rd + 1) % pch -> buf_num;
+		dmChBufQueue(pch, pfan -> buf_idx, pch -> trsz);
+	}
+}
+
+
+/*************************** dmChFanSlot(pch,seq) *****************************
+* Get the fan-out ring slot of the buffer by its sequence number
+* The slot is counted from the slot of the oldest kept buffer: the sequence
+*	numbers wrap at 2^32, the slots wrap at buf_num (not a power of two)
+* Must be called with the fan-out ring mutex locked
+* Parameters:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)seq - sequence number (fan_tail..fan_head)
+* Return value:
+*	Slot index in the fan-out ring
+*******************************************************************************/
+static uint32_t dmChFanSlot(DM_CHAN_t *pch, uint32_t seq)
+{
+	// Distance from the oldest kept buffer (less than buf_num)
+	return (pch -> fan_rd + (seq - pch -> fan_tail)) % pch -> buf_num;
+}
+
+/**************************** dmChQueueDmaCnt(pch) ****************************
+* Get the number of buffers owned by DMA (queued and active)
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	Number of the buffers owned by DMA
+*******************************************************************************/
+static uint32_t dmChQueueDmaCnt(DM_CHAN_t *pch)
+{
+	unsigned long flags;
+	uint32_t cnt;
+
+	// Read the numbers of pending and active buffers with the queue locked
+	spin_lock_irqsave(&(pch -> lock), flags);
+	cnt = pch -> pend_cnt + pch -> act_cnt;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Return the number of buffers owned by DMA
+	return cnt;
+}
+
+/***************************** dmChCtlClaim(prdr) *****************************
+* Claim the buffer queue for ioctl requests of the file
+* The first file which uses the buffer queue ioctl requests owns the queue
+*	until it is closed. The queue can not be claimed while streaming for
+*	read is on (the flag is checked after the claim: streaming for read
+*	checks the owner after the flag is set).
+* Parameter:
+*	(i)prdr - pointer to the reader parameters structure of the file
+* Return value:
+*	0 Success. The file owns the buffer queue
+*	-EBUSY Error. The buffer queue is used by other file or by readers
+*******************************************************************************/
+static int dmChCtlClaim(DM_RDR_t *prdr)
+{
+	DM_CHAN_t *pch;
+	DM_RDR_t *prev;
+
+	// Set the pointer to the channel parameters
+	pch = prdr -> pch;
+
+	// Claim the buffer queue
+	prev = cmpxchg(&(pch -> ctl_rdr), NULL, prdr);
+	if(prev != NULL && prev != prdr) return -EBUSY;	// Used by other file
+	smp_mb();
+
+	// The buffer queue is used by readers: release the claim
+	if(pch -> rd_strm) {
+		if(prev == NULL) pch -> ctl_rdr = NULL;
+		return -EBUSY;
+	}
+
+	// The file owns the buffer queue
+	return 0;
+}
+
+/************************** dmRdrIoctlInfo(prdr,arg) **************************
+* Ioctl request: get reader information
+* Parameters:
+*	(i)prdr - pointer to the reader parameters structure
+*	(o)arg - pointer to the user space reader information structure
+*			 (_DM_RD_INFO_t)
+* Return value:
+*	0 Success. The information was copied to user
+*	-EFAULT Error. Can not copy the information to user
+*******************************************************************************/
+static int dmRdrIoctlInfo(DM_RDR_t *prdr, unsigned long arg)
+{
+	DM_CHAN_t *pch;
+	_DM_RD_INFO_t info;
+	unsigned long error_count;
+	uint32_t seq;
+
+	// Set the pointer to the channel parameters
+	pch = prdr -> pch;
+
+	// Lock the fan-out ring
+	mutex_lock(&(pch -> fan_mutex));
+
+	// Fill reader information structure (the buffers reused by DMA and not
+	// skipped yet are counted as lost)
+	memset(&info, 0, sizeof(_DM_RD_INFO_t));
+	info.frames = prdr -> frames;
+	info.lost = prdr -> lost;
+	if(prdr -> reading && pch -> rd_strm) {
+		seq = prdr -> seq;
+		if((int32_t)(seq - pch -> fan_tail) < 0) {
+			info.lost += pch -> fan_tail - seq;
+			seq = pch -> fan_tail;
+		}
+		info.lag = pch -> fan_head - seq;
+	}
+	info.readers = pch -> rdr_cnt;
+
+	// Unlock the fan-out ring
+	mutex_unlock(&(pch -> fan_mutex));
+
+	// Copy reader information to user
+	error_count = copy_to_user((void *)arg, &info, sizeof(_DM_RD_INFO_t));
+	if(error_count != 0)
+		return -EFAULT;	// Failed to copy data to user
+
+	// The information was copied successfully
+	return 0;
+}
+
+/************************** dmChBufPage(pbuf,offs) ****************************
+* Get the page of the buffer memory (cached memory mode: the pages are
+*	allocated by the page allocator)
+* Parameters:
+*	(i)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(i)offs - offset in the buffer (b)
+* Return value:
+*	Pointer to the page structure
+*******************************************************************************/
+static struct page *dmChBufPage(DM_BUF_t *pbuf, uint32_t offs)
+{
+	uint8_t *addr;
+
+	// Kernel space address of the data
+	addr = pbuf -> dma_buffer + offs;
+
+	// Get the page of the address
+	return virt_to_page(addr);
+}
+
+/************************* dmPipeRefGet(pbuf,page) ****************************
+* Reference the buffer page by the pipe buffer
+* The page, the buffer (it is not queued again), the memory of the channel
+*	(it is not reallocated) and the module are referenced
+* Parameters:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(io)page - the page of the buffer
+*******************************************************************************/
+static void dmPipeRefGet(DM_BUF_t *pbuf, struct page *page)
+{
+	// Reference the page
+	get_page(page);
+
+	// Reference the buffer and the memory of the channel
+	atomic_inc(&(pbuf -> pch -> map_cnt));
+	atomic_inc(&(pbuf -> rd_ref));
+
+	// The pipe buffer operations are in the module
+	__module_get(THIS_MODULE);
+}
+
+/************************* dmPipeRefPut(pbuf,page) ****************************
+* Release the buffer page reference of the pipe buffer
+* Parameters:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(io)page - the page of the buffer
+*******************************************************************************/
+static void dmPipeRefPut(DM_BUF_t *pbuf, struct page *page)
+{
+	// Release the page
+	put_page(page);
+
+	// Release the buffer (it is queued again after the last reference)
+	dmChRdPut(pbuf);
+
+	// Release the module
+	module_put(THIS_MODULE);
+}
+
+/************************** dmPipeBufGet(pipe,buf) ****************************
+* Pipe buffer operations: get additional reference (tee)
+* Parameters:
+*	(i)pipe - the pipe
+*	(io)buf - the pipe buffer
+*******************************************************************************/
+static void dmPipeBufGet(struct pipe_inode_info *pipe, struct pipe_buffer *buf)
+{
+	// Reference the buffer page
+	dmPipeRefGet((DM_BUF_t *)buf -> private, buf -> page);
+}
+
+/************************ dmPipeBufRelease(pipe,buf) **************************
+* Pipe buffer operations: release the pipe buffer (the data was consumed)
+* Parameters:
+*	(i)pipe - the pipe
+*	(io)buf - the pipe buffer
+*******************************************************************************/
+static void dmPipeBufRelease(struct pipe_inode_info *pipe,
+	struct pipe_buffer *buf)
+{
+	// Release the buffer page reference
+	dmPipeRefPut((DM_BUF_t *)buf -> private, buf -> page);
+}
+
+/************************* dmPipeBufSteal(pipe,buf) ***************************
+* Pipe buffer operations: steal the page of the pipe buffer
+* The pages of DMA buffers can not be stolen
+* Parameters:
+*	(i)pipe - the pipe
+*	(i)buf - the pipe buffer
+* Return value:
+*	1 The page can not be stolen
+*******************************************************************************/
+static int dmPipeBufSteal(struct pipe_inode_info *pipe,
+	struct pipe_buffer *buf)
+{
+	return 1;
+}
+
+/************************** dmPipeSpdRelease(spd,i) ***************************
+* Splice descriptor page release function
+* Called for the pages which were not put into the pipe
+* Parameters:
+*	(i)spd - splice descriptor
+*	(i)i - page index in the descriptor
+*******************************************************************************/
+static void dmPipeSpdRelease(struct splice_pipe_desc *spd, unsigned int i)
+{
+	// Release the buffer page reference
+	dmPipeRefPut((DM_BUF_t *)spd -> partial[i].private, spd -> pages[i]);
+}
+
+/************************* dmChIoctlCtrl(pch,cmd,arg) *************************
+* Execute ioctl request (except buffer dequeue request)
+* The function is called with the channel ioctl mutex locked
+* Parameters:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)cmd - ioctl request code
+*	(io)arg - pointer to the user space request/result buffer
+* Return value:
+*	0 Success. The request was executed
+*	-ENOTTY Error. Bad ioctl call (incorrect request)
+*	<0 Other error code (see request functions)
+*******************************************************************************/
+static long dmChIoctlCtrl(DM_CHAN_t *pch, unsigned int cmd, unsigned long arg)
+{
+	switch(cmd) {
+	case _DM_IOCTL_TRAN_RC:
+		// Perform single transfer on DMA channel (data receive)
+		return dmChIoctlTranRc(pch, arg);
+
+	case _DM_IOCTL_TRAN_ST:
+		// Start single transfer on DMA channel, do not wait
+		return dmChIoctlTranSt(pch);
+
+	case _DM_IOCTL_QBUF:
+		// Queue the buffer for DMA data receiving
+		return dmChIoctlQbuf(pch, arg);
+
+	case _DM_IOCTL_STRM_ON:
+		// Start streaming on the buffer queue
+		return dmChStrmOn(pch);
+
+	case _DM_IOCTL_STRM_OFF:
+		// Stop streaming, return all buffers to user
+		dmChStrmOff(pch);
+		return 0;
+
+	case _DM_IOCTL_INFO:
+		// Get DMA channel information
+		return dmChIoctlInfo(pch, arg);
+
+	case _DM_IOCTL_MEM_MODE:
+		// Set buffer memory mode
+		return dmChIoctlMemMode(pch, arg);
+
+	case _DM_IOCTL_CPU_BEG:
+		// Begin CPU access to the buffer
+		return dmChIoctlCpuAcc(pch, arg, 1);
+
+	case _DM_IOCTL_CPU_END:
+		// End CPU access to the buffer
+		return dmChIoctlCpuAcc(pch, arg, 0);
+
+	case _DM_IOCTL_TRAN_USR:
+		// Perform single transfer into user buffer (data receive)
+		return dmChIoctlTranUsr(pch, arg);
+
+	case _DM_IOCTL_GEOM:
+		// Set transfer geometry (resize the buffers)
+		return dmChIoctlGeom(pch, arg);
+
+	case _DM_IOCTL_TIMEOUT:
+		// Set DMA transaction timeout
+		return dmChIoctlTimeout(pch, arg);
+
+	case _DM_IOCTL_EXPBUF:
+		// Export the buffer as dma-buf
+		return dmChIoctlExpbuf(pch, arg);
+
+	case _DM_IOCTL_COAL:
+		// Set interrupt coalescing parameters
+		return dmChIoctlCoal(pch, arg);
+
+	case _DM_IOCTL_OVR:
+		// Set/get overrun policy
+		return dmChIoctlOvr(pch, arg);
+
+	case _DM_IOCTL_REC:
+		// In-kernel recorder control
+		return dmChIoctlRec(pch, arg);
+
+	default:
+		// Incorrect request command code
+		return -ENOTTY;
+	}
+}
+
+/************************** dmChIoctlTranRc(pch,arg) **************************
+* Ioctl request: perform single transfer on DMA channel (data receive)
+* The data is received into the first buffer of the buffer queue
+* This function can block (interruptible, limited by the channel timeout).
+* Parameters:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(o)arg - pointer to the user space transaction result buffer
+* Return value:
+*	0 Success. DMA data receive transaction was executed (see result code)
+*	-EBUSY  Error. Streaming is on or the first buffer is queued
+*	-EINTR  Error. The wait was interrupted, the transfer was aborted
+*	-EFAULT Error. Can not copy transaction result code to user
+*******************************************************************************/
+static int dmChIoctlTranRc(DM_CHAN_t *pch, unsigned long arg)
+{
+	DM_BUF_t *pbuf;
+	int rc;
+
+	// Set the pointer to the first buffer of the queue
+	pbuf = &(pch -> buf[0]);
+
+	// Single transfer is not possible while the buffer queue is used
+	// or "start transfer" request is not collected yet
+	if(pch -> streaming || pbuf -> state != DM_BUF_ST_USER)
+		return -EBUSY;
+
+	// Perform transfer on DMA channel (data receive)
+	rc = dmChTransfer(pch);
+	if(rc < 0) return rc;				// The wait was interrupted
+
+	// Single transfer user does not bracket buffer access: sync it for CPU
+	dmChBufSyncCpu(pbuf);
+
+	// Copy DMA transaction result code and residue to the user space app
+	return dmChResToUser(pbuf, arg);
+}
+
+/**************************** dmChIoctlTranSt(pch) ****************************
+* Ioctl request: start single transfer on DMA channel (data receive)
+* The data is received into the first buffer of the buffer queue
+* The function does not wait until the transfer is finished,
+*	the result is collected by "collect result" request
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 Success. DMA data receive transaction was started
+*	-EBUSY Error. Streaming is on or the first buffer is queued/active
+*	-EIO   Error. Can not start DMA transfer
+*******************************************************************************/
+static int dmChIoctlTranSt(DM_CHAN_t *pch)
+{
+	DM_BUF_t *pbuf;
+	int rc;
+
+	// Set the pointer to the first buffer of the queue
+	pbuf = &(pch -> buf[0]);
+
+	// Single transfer is not possible while the buffer queue is used
+	if(pch -> streaming || pbuf -> state != DM_BUF_ST_USER)
+		return -EBUSY;
+
+	// Start transfer on DMA channel (the whole buffer)
+	pbuf -> len = pch -> trsz;
+	rc = dmChBufStart(pbuf, 1);
+	if(rc < 0) return -EIO;				// Can not start DMA transfer
+
+	// DMA data receive transaction was started successfully
+	return 0;
+}
+
+/********************* dmChIoctlTranRes(pch,arg,nonblock) *********************
+* Ioctl request: collect the result of single transfer on DMA channel
+* Waits until the transfer started by "start transfer" request is finished
+* If the channel timeout expires, the transfer is stopped with timeout
+*	result code
+* This function can block (if non-blocking access is not requested)
+* Parameters:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(o)arg - pointer to the user space transaction result buffer
+*	(i)nonblock - flag: non-blocking access is requested (1)
+* Return value:
+*	0 Success. DMA transaction result code was copied to user
+*	-EINVAL Error. Streaming is on or the transfer was not started
+*	-EAGAIN Error. Non-blocking access, the transfer is not finished yet
+*	-ERESTARTSYS Error. The wait was interrupted by a signal
+*	-EFAULT Error. Can not copy transaction result code to user
+*******************************************************************************/
+static int dmChIoctlTranRes(DM_CHAN_t *pch, unsigned long arg, int nonblock)
+{
+	DM_BUF_t *pbuf;
+	long rc;
+
+	// Set the pointer to the first buffer of the queue
+	pbuf = &(pch -> buf[0]);
+
+	// The result can be collected only for started single transfer
+	if(pch -> streaming || pbuf -> state == DM_BUF_ST_USER ||
+			pbuf -> state == DM_BUF_ST_QUEUED)
+		return -EINVAL;
+
+	// Check the transfer without blocking if requested
+	if(nonblock && !dmChBufDone(pch)) return -EAGAIN;
+
+	// Wait until the transfer is finished or the buffer is returned to user
+	rc = wait_event_interruptible_timeout(pch -> wq,
+			dmChBufDone(pch) || pbuf -> state != DM_BUF_ST_ACTIVE,
+			dmChTrWaitTmo(pch));
+	if(rc < 0) return rc;				// The wait was interrupted
+
+	// Timeout: stop the transfer, it is finished with timeout result code
+	if(rc == 0) dmChAbort(pch, _DM_TRAN_RES_TIMEOUT);
+
+	// Take the finished buffer from the done FIFO
+	pbuf = dmChBufPop(pch);
+	if(pbuf == NULL) return -EINVAL;	// Streaming was stopped
+
+	// Single transfer user does not bracket buffer access: sync it for CPU
+	dmChBufSyncCpu(pbuf);
+
+	// Copy DMA transaction result code and residue to the user space app
+	return dmChResToUser(pbuf, arg);
+}
+
+/*************************** dmChIoctlQbuf(pch,arg) ***************************
+* Ioctl request: queue the buffer for DMA data receiving/transmitting
+* The buffer of the transmit channel can be filled partially
+* Parameters:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)arg - pointer to the user space buffer structure (_DM_BUF_t)
+* Return value:
+*	0 Success. The buffer was queued
+*	-EFAULT Error. Can not copy buffer structure from user
+*	-EINVAL Error. The length to transmit exceeds the buffer size
+*	<0 Other error code (see dmChBufQueue)
+*******************************************************************************/
+static int dmChIoctlQbuf(DM_CHAN_t *pch, unsigned long arg)
+{
+	_DM_BUF_t ubuf;
+	unsigned long error_count;
+	uint32_t len;
+
+	// Copy buffer structure from user
+	error_count = copy_from_user(&ubuf, (void *)arg, sizeof(_DM_BUF_t));
+	if(error_count != 0)
+		return -EFAULT;		// Failed to copy data from user
+
+	// The whole buffer is received, the transmitted length is set by user
+	len = pch -> trsz;
+	if(pch -> dir == _DM_DIR_TX && ubuf.len != 0) {
+		if(ubuf.len > pch -> trsz) return -EINVAL;
+		len = ubuf.len;
+	}
+
+	// Queue the buffer
+	return dmChBufQueue(pch, ubuf.buf_idx, len);
+}
+
+/********************** dmChIoctlDqbuf(pch,arg,nonblock) **********************
+* Ioctl request: dequeue the buffer with received data
+* Waits until DMA transaction into the oldest active buffer is finished
+* If the channel timeout expires, the active transfers are stopped with
+*	timeout result code (streaming stays on, the buffers can be queued again)
+* This function can block (if non-blocking access is not requested)
+* Parameters:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(o)arg - pointer to the user space buffer structure (_DM_BUF_t)
+*	(i)nonblock - flag: non-blocking access is requested (1)
+* Return value:
+*	0 Success. The buffer was dequeued
+*	-EINVAL Error. Streaming is off
+*	-EAGAIN Error. Non-blocking access, no finished buffers
+*	-ETIMEDOUT Error. Timeout, there were no active transfers to stop
+*	-ECANCELED Error. Abort request, there were no active transfers to stop
+*	-ERESTARTSYS Error. The wait was interrupted by a signal
+*	-EFAULT Error. Can not copy buffer structure to user
+*******************************************************************************/
+static int dmChIoctlDqbuf(DM_CHAN_t *pch, unsigned long arg, int nonblock)
+{
+	DM_BUF_t *pbuf;
+	int rc;
+
+	// Wait for the finished buffer, take it from the done FIFO
+	rc = dmChBufWaitPop(pch, nonblock, &pbuf);
+	if(rc < 0) return rc;
+
+	// Copy buffer index and DMA transaction result code to user
+	return dmChBufToUser(pbuf, arg);
+}
+
+/********************** dmChIoctlBatch(pch,arg,nonblock) **********************
+* Ioctl request: queue and dequeue the buffers in one call
+* The listed buffers are queued, then the finished buffers are dequeued
+*	(see _DM_BATCH_t). One request replaces up to 2 * _DM_BATCH_MAX queue,
+*	dequeue and CPU access requests: the small frames of high rate channels
+*	are served with one system call per batch.
+* The request structure is copied from user in two parts (the header and the
+*	buffers to queue), the results are copied to user at once
+* This function can block (if non-blocking access is not requested)
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)arg - pointer to the user space batch request structure (_DM_BATCH_t)
+*	(i)nonblock - flag: non-blocking access is requested (1)
+* Return value:
+*	0 Success. The buffers were queued, "done" buffers were dequeued
+*	-ENOMEM Error. Can not allocate the request structure
+*	-EFAULT Error. Can not copy the request structure from/to user
+*	-EINVAL Error. Bad number of buffers
+*	<0 Other error code (see dmChBufQueue, dmChBufWaitPop): no buffers
+*		were dequeued ("queued" buffers were queued)
+*******************************************************************************/
+static int dmChIoctlBatch(DM_CHAN_t *pch, unsigned long arg, int nonblock)
+{
+	_DM_BATCH_t *pbat;
+	_DM_BATCH_t __user *ubat;
+	unsigned long error_count;
+	size_t hdr_sz;
+	int rc;
+
+	// Set the pointer to the user space request structure, its header size
+	ubat = (_DM_BATCH_t __user *)arg;
+	hdr_sz = offsetof(_DM_BATCH_t, ent);
+
+	// Allocate the request structure (too large for the kernel stack)
+	pbat = kmalloc(sizeof(_DM_BATCH_t), GFP_KERNEL);
+	if(pbat == NULL) return -ENOMEM;
+
+	// Copy the header from user, check the number of buffers
+	rc = -EFAULT;
+	error_count = copy_from_user(pbat, ubat, hdr_sz);
+	if(error_count != 0) goto BATCH_END;
+	rc = -EINVAL;
+	if(pbat -> qcount > _DM_BATCH_MAX || pbat -> count > _DM_BATCH_MAX)
+		goto BATCH_END;
+
+	// Copy the buffers to queue from user
+	rc = -EFAULT;
+	error_count = copy_from_user(pbat -> ent, ubat -> ent,
+		pbat -> qcount * sizeof(_DM_BATCH_ENT_t));
+	if(error_count != 0) goto BATCH_END;
+
+	// Queue the buffers, dequeue the finished buffers
+	pbat -> done = 0;
+	rc = dmChBatchQueue(pch, pbat);
+	if(rc == 0) rc = dmChBatchDequeue(pch, pbat, nonblock);
+
+	// Copy the header and the dequeued buffers to user
+	error_count = copy_to_user(ubat, pbat,
+		hdr_sz + pbat -> done * sizeof(_DM_BATCH_ENT_t));
+	if(error_count != 0) rc = -EFAULT;
+
+BATCH_END:
+	// Free the request structure
+	kfree(pbat);
+	return rc;
+}
+
+/************************** dmChBatchQueue(pch,pbat) **************************
+* Batch request: queue the buffers
+* The buffers are queued under the ioctl mutex (as queue requests are),
+*	the queueing stops at the first error
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)pbat - batch request structure (the number of queued buffers is set)
+* Return value:
+*	0 Success. All buffers were queued
+*	-EINVAL Error. Bad buffer (see dmChBufQueue) or transmit length
+*	<0 Other error code (see dmChBufQueue)
+*******************************************************************************/
+static int dmChBatchQueue(DM_CHAN_t *pch, _DM_BATCH_t *pbat)
+{
+	_DM_BATCH_ENT_t *pent;
+	uint32_t len;
+	int rc;
+
+	// Serialize with other requests of the buffer queue
+	mutex_lock(&(pch -> ioctl_mutex));
+
+	// Queue the buffers in the list order
+	rc = 0;
+	for(pbat -> queued = 0; pbat -> queued < pbat -> qcount; pbat -> queued++) {
+		pent = &(pbat -> ent[pbat -> queued]);
+
+		// The whole buffer is received, the transmitted length is set by user
+		len = pch -> trsz;
+		if(pch -> dir == _DM_DIR_TX && pent -> len != 0) {
+			rc = -EINVAL;
+			if(pent -> len > pch -> trsz) break;
+			len = pent -> len;
+		}
+
+		// Queue the buffer
+		rc = dmChBufQueue(pch, pent -> buf_idx, len);
+		if(rc < 0) break;
+	}
+
+	// Release ioctl mutex
+	mutex_unlock(&(pch -> ioctl_mutex));
+
+	return rc;
+}
+
+/******************** dmChBatchDequeue(pch,pbat,nonblock) *********************
+* Batch request: dequeue the finished buffers
+* Waits for "wait" buffers (as dequeue request), takes the other finished
+*	buffers without waiting, up to "count" buffers. The buffers are
+*	synchronized for CPU access, their results are stored in the entries.
+* The buffers dequeued before an error are kept in the result (success)
+* This function can block (if non-blocking access is not requested)
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)pbat - batch request structure (the dequeued buffers are set)
+*	(i)nonblock - flag: non-blocking access is requested (1)
+* Return value:
+*	0 Success. "done" buffers were dequeued
+*	<0 Error code (see dmChBufWaitPop), no buffers were dequeued
+*******************************************************************************/
+static int dmChBatchDequeue(DM_CHAN_t *pch, _DM_BATCH_t *pbat, int nonblock)
+{
+	_DM_BATCH_ENT_t *pent;
+	_DM_META_t *pmeta;
+	DM_BUF_t *pbuf;
+	uint32_t wait;
+	int rc;
+
+	// Number of buffers to wait for
+	wait = min(pbat -> wait, pbat -> count);
+
+	// Dequeue the buffers (the oldest first)
+	while(pbat -> done < pbat -> count) {
+		if(pbat -> done < wait) {
+			// Wait for the finished buffer
+			rc = dmChBufWaitPop(pch, nonblock, &pbuf);
+			if(rc < 0) return (pbat -> done != 0) ? 0 : rc;
+		} else {
+			// Take the finished buffer without waiting
+			pbuf = dmChBufPop(pch);
+			if(pbuf == NULL) break;
+		}
+
+		// The buffer is read by CPU (invalidates cache in cached memory mode)
+		dmChBufSyncCpu(pbuf);
+
+		// Store the result of the buffer
+		pent = &(pbat -> ent[pbat -> done++]);
+		pmeta = &(pch -> meta[pbuf -> buf_idx]);
+		pent -> buf_idx = pbuf -> buf_idx;
+		pent -> res_code = pbuf -> res_code;
+		pent -> len = pch -> trsz - pbuf -> residue;
+		pent -> seq = pmeta -> seq;
+		pent -> ts_ns = pmeta -> ts_ns;
+	}
+
+	// The buffers were dequeued
+	return 0;
+}
+
+/*************************** dmChIoctlInfo(pch,arg) ***************************
+* Ioctl request: get DMA channel information
+* Parameters:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(o)arg - pointer to the user space information structure (_DM_CH_INFO_t)
+* Return value:
+*	0 Success. The information was copied to user
+*	-EFAULT Error. Can not copy the information to user
+*******************************************************************************/
+static int dmChIoctlInfo(DM_CHAN_t *pch, unsigned long arg)
+{
+	_DM_CH_INFO_t info;
+	unsigned long error_count;
+
+	// Fill DMA channel information structure
+	info.trsz = pch -> trsz;
+	info.frame_sz = pch -> frame_sz;
+	info.frames = pch -> frames;
+	info.buf_num = pch -> buf_num;
+	info.dir = pch -> dir;
+	info.buf_stride = pch -> buf_stride;
+	info.area_sz = pch -> dma_mem_sz;
+	info.mem_mode = pch -> mem_mode;
+	info.timeout_ms = pch -> timeout_ms;
+	info.meta_offs = pch -> dma_mem_sz;
+	info.meta_sz = pch -> meta_sz;
+	info.ring_sz = pch -> ring_sz;
+	info.inflight = pch -> act_max;
+	info.coal_cnt = pch -> coal_cnt;
+	info.coal_us = pch -> coal_us;
+	info.ovr_policy = pch -> ovr_policy;
+	info.rt_cpu = (pch -> rt_worker != NULL) ? (int32_t)pch -> rt_cpu : -1;
+	info.rt_prio = (pch -> rt_worker != NULL) ? pch -> rt_prio : 0;
+
+	// Copy the information to user
+	error_count = copy_to_user((void *)arg, &info, sizeof(_DM_CH_INFO_t));
+	if(error_count != 0)
+		return -EFAULT;	// Failed to copy data to user
+
+	// The information was successfully copied to user space
+	return 0;
+}
+
+/************************** dmChIoctlMemMode(pch,arg) *************************
+* Ioctl request: set buffer memory mode
+* The memory of the channel is reallocated in the new mode
+* The mode can be changed only when streaming is off, all buffers are
+*	owned by user and the memory is not mapped to user space.
+* If the memory can not be allocated in the new mode, the old mode is restored
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)arg - pointer to the user space memory mode value (uint32_t)
+* Return value:
+*	0 Success. The memory mode was set
+*	-EFAULT Error. Can not copy memory mode from user
+*	-EINVAL Error. Bad memory mode (the ring supports coherent mode only)
+*	-EBUSY  Error. Streaming is on, buffers are used or mapped
+*	-ENOMEM Error. Can not allocate memory in the new mode
+*	-ENODEV Error. Can not allocate memory, the old memory is lost
+*******************************************************************************/
+static int dmChIoctlMemMode(DM_CHAN_t *pch, unsigned long arg)
+{
+	uint32_t mode;
+	unsigned long error_count;
+
+	// Copy memory mode from user
+	error_count = copy_from_user(&mode, (void *)arg, sizeof(uint32_t));
+	if(error_count != 0)
+		return -EFAULT;		// Failed to copy data from user
+
+	// Check memory mode value
+	if(mode != _DM_MEM_COHERENT && mode != _DM_MEM_CACHED) return -EINVAL;
+
+	// The capture ring is allocated in coherent memory only
+	if(pch -> ring_sz != 0 && mode != _DM_MEM_COHERENT) return -EINVAL;
+
+	// Nothing to do if the mode is not changed
+	if(mode == pch -> mem_mode && pch -> dma_mem_sz != 0) return 0;
+
+	// Reallocate the memory in the new mode
+	return dmChMemRealloc(pch, mode, pch -> frames);
+}
+
+/*************************** dmChIoctlGeom(pch,arg) ***************************
+* Ioctl request: set DMA channel transfer geometry
+* One DMA transaction receives the requested number of stream frames,
+*	the buffers are resized to hold the transaction.
+* The geometry can be changed only when streaming is off, all buffers are
+*	owned by user and the memory is not mapped to user space.
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)arg - pointer to the user space geometry structure (_DM_CH_GEOM_t)
+* Return value:
+*	0 Success. The geometry was set
+*	-EFAULT Error. Can not copy geometry structure from/to user
+*	-EINVAL Error. Bad number of frames
+*	-EBUSY  Error. Streaming is on, buffers are used or mapped
+*	-ENOMEM Error. Can not allocate memory for the new geometry
+*	-ENODEV Error. Can not allocate memory, the old memory is lost
+*******************************************************************************/
+static int dmChIoctlGeom(DM_CHAN_t *pch, unsigned long arg)
+{
+	_DM_CH_GEOM_t geom;
+	unsigned long error_count;
+	int rc;
+
+	// Copy geometry structure from user
+	error_count = copy_from_user(&geom, (void *)arg, sizeof(_DM_CH_GEOM_t));
+	if(error_count != 0)
+		return -EFAULT;		// Failed to copy data from user
+
+	// Check the number of frames
+	if(geom.frames == 0 || geom.frames > _DM_FRAMES_MAX) return -EINVAL;
+
+	// Reallocate the memory for the new geometry (if it is changed)
+	if(geom.frames != pch -> frames || pch -> dma_mem_sz == 0) {
+		rc = dmChMemRealloc(pch, pch -> mem_mode, geom.frames);
+		if(rc < 0) return rc;			// The geometry was not set
+	}
+
+	// Return the resulting geometry to user
+	geom.frame_sz = pch -> frame_sz;
+	geom.trsz = pch -> trsz;
+	error_count = copy_to_user((void *)arg, &geom, sizeof(_DM_CH_GEOM_t));
+	if(error_count != 0)
+		return -EFAULT;	// Failed to copy data to user
+
+	// The geometry was set successfully
+	return 0;
+}
+
+/************************* dmChIoctlTimeout(pch,arg) **************************
+* Ioctl request: set DMA transaction timeout
+* The timeout limits the wait of blocking requests (single transfer,
+*	collect result, buffer dequeue, user buffer transfer). When it expires,
+*	the active transfers are stopped with timeout result code.
+* Parameters:
+*	(o)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)arg - pointer to the user space timeout value (ms) (uint32_t)
+*			 (0 - no timeout)
+* Return value:
+*	0 Success. The timeout was set
+*	-EFAULT Error. Can not copy the timeout from user
+*******************************************************************************/
+static int dmChIoctlTimeout(DM_CHAN_t *pch, unsigned long arg)
+{
+	uint32_t timeout_ms;
+	unsigned long error_count;
+
+	// Copy the timeout from user
+	error_count = copy_from_user(&timeout_ms, (void *)arg, sizeof(uint32_t));
+	if(error_count != 0)
+		return -EFAULT;		// Failed to copy data from user
+
+	// Set the timeout (used by the next blocking request)
+	pch -> timeout_ms = timeout_ms;
+
+	// The timeout was set successfully
+	return 0;
+}
+
+/*************************** dmChIoctlCoal(pch,arg) ***************************
+* Ioctl request: set interrupt coalescing parameters
+* The number of DMA transactions per interrupt is limited, the limited value
+*	is copied to user. The parameters are used by the next started batch.
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)arg - pointer to the user space coalescing parameters structure
+*			  (_DM_COAL_t)
+* Return value:
+*	0 Success. The parameters were set
+*	-EFAULT Error. Can not copy the parameters from/to user
+*******************************************************************************/
+static int dmChIoctlCoal(DM_CHAN_t *pch, unsigned long arg)
+{
+	_DM_COAL_t coal;
+	unsigned long error_count;
+
+	// Copy the parameters from user
+	error_count = copy_from_user(&coal, (void *)arg, sizeof(_DM_COAL_t));
+	if(error_count != 0)
+		return -EFAULT;		// Failed to copy data from user
+
+	// Set the parameters (under the start mutex: the batch uses them)
+	mutex_lock(&(pch -> kick_mutex));
+	pch -> coal_cnt = dmChCoalLimit(pch, coal.count);
+	pch -> coal_us = coal.timeout_us;
+	mutex_unlock(&(pch -> kick_mutex));
+
+	// Copy the limited parameters to user
+	coal.count = pch -> coal_cnt;
+	error_count = copy_to_user((void *)arg, &coal, sizeof(_DM_COAL_t));
+	if(error_count != 0)
+		return -EFAULT;	// Failed to copy data to user
+
+	// The parameters were set successfully
+	return 0;
+}
+
+/************************ dmChCoalLimit(pch,coal_cnt) *************************
+* Limit the number of DMA transactions per interrupt: the next batch must be
+*	submitted while the previous one is transferred, so the batch is not
+*	larger than the half of the submission window (and _DM_COAL_MAX)
+* Parameters:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)coal_cnt - requested number of DMA transactions per interrupt
+* Return value:
+*	Limited number of DMA transactions per interrupt (1.._DM_COAL_MAX)
+*******************************************************************************/
+static uint32_t dmChCoalLimit(DM_CHAN_t *pch, uint32_t coal_cnt)
+{
+	uint32_t coal_max;
+
+	// Maximum batch: half of the submission window
+	coal_max = min_t(uint32_t, pch -> act_max / 2, _DM_COAL_MAX);
+
+	// Limit the number of DMA transactions per interrupt
+	if(coal_cnt > coal_max) coal_cnt = coal_max;
+	if(coal_cnt == 0) coal_cnt = 1;
+	return coal_cnt;
+}
+
+/*************************** dmChIoctlOvr(pch,arg) ****************************
+* Ioctl request: set/get overrun policy of the channel
+* The policy can be changed while streaming: it is used by the next
+*	completion. The overrun counters are copied to user.
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)arg - pointer to the user space overrun policy structure (_DM_OVR_t)
+* Return value:
+*	0 Success. The policy was set, the counters were copied to user
+*	-EFAULT Error. Can not copy the structure from/to user
+*	-EINVAL Error. Bad overrun policy
+*******************************************************************************/
+static int dmChIoctlOvr(DM_CHAN_t *pch, unsigned long arg)
+{
+	_DM_OVR_t ovr;
+	unsigned long error_count;
+	unsigned long flags;
+
+	// Copy the structure from user
+	error_count = copy_from_user(&ovr, (void *)arg, sizeof(_DM_OVR_t));
+	if(error_count != 0)
+		return -EFAULT;		// Failed to copy data from user
+
+	// Check the policy to set
+	if(ovr.set && ovr.policy > _DM_OVR_DROP_NEWEST)
+		return -EINVAL;		// Bad overrun policy
+
+	// Set the policy and read the counters with the queue locked
+	spin_lock_irqsave(&(pch -> lock), flags);
+	if(ovr.set) pch -> ovr_policy = ovr.policy;
+	ovr.policy = pch -> ovr_policy;
+	ovr.drops = pch -> stat.drops;
+	ovr.stalls = pch -> stat.stalls;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Copy the structure to user
+	error_count = copy_to_user((void *)arg, &ovr, sizeof(_DM_OVR_t));
+	if(error_count != 0)
+		return -EFAULT;	// Failed to copy data to user
+
+	// The policy was set successfully
+	return 0;
+}
+
+/**************************** dmChIoctlRec(pch,arg) ***************************
+* Ioctl request: in-kernel recorder control
+* Starts/stops the recorder thread, the recorder counters are copied to user
+*	for any command
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)arg - pointer to the user space recorder structure (_DM_REC_t)
+* Return value:
+*	0 Success. The command was executed
+*	-EFAULT Error. Can not copy the recorder structure from/to user
+*	-EINVAL Error. Bad command
+*	<0 Other error code (see dmChRecStart)
+*******************************************************************************/
+static int dmChIoctlRec(DM_CHAN_t *pch, unsigned long arg)
+{
+	_DM_REC_t rec;
+	DM_REC_t *prec;
+	unsigned long error_count;
+	unsigned long flags;
+	int rc;
+
+	// Set the pointer to the recorder parameters
+	prec = &(pch -> rec);
+
+	// Copy the recorder structure from user
+	error_count = copy_from_user(&rec, (void *)arg, sizeof(_DM_REC_t));
+	if(error_count != 0)
+		return -EFAULT;		// Failed to copy data from user
+
+	// Execute the command
+	switch(rec.cmd) {
+	case _DM_REC_START:
+		// Start recording into the file
+		rc = dmChRecStart(pch, rec.fd);
+		if(rc < 0) return rc;			// Can not start recording
+		break;
+
+	case _DM_REC_STOP:
+		// Stop recording, the counters are kept until the next start
+		dmChRecStop(pch);
+		break;
+
+	case _DM_REC_STAT:
+		// Nothing to do, the counters are copied to user
+		break;
+
+	default:
+		// Bad command
+		return -EINVAL;
+	}
+
+	// Read the counters with the queue locked
+	spin_lock_irqsave(&(pch -> lock), flags);
+	rec.bytes = prec -> bytes;
+	rec.frames = prec -> frames;
+	rec.errors = prec -> errors;
+	rec.lost = prec -> lost;
+	rec.stalls = prec -> stalls;
+	rec.wr_err = prec -> wr_err;
+	rec.running = (prec -> task != NULL && prec -> running);
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Copy the recorder structure to user
+	error_count = copy_to_user((void *)arg, &rec, sizeof(_DM_REC_t));
+	if(error_count != 0)
+		return -EFAULT;	// Failed to copy data to user
+
+	// The command was executed successfully
+	return 0;
+}
+
+/**************************** dmChRecStart(pch,fd) ****************************
+* Start the in-kernel recorder
+* The buffer queue must be idle: all buffers are queued, streaming is started
+*	and the recorder thread is created. The thread writes the received
+*	buffers into the file and queues them again.
+* Must be called with the ioctl mutex locked
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)fd - file descriptor of the file to write to
+* Return value:
+*	0 Success. Recording was started
+*	-EBUSY Error. Recording is on, the buffer queue is used
+*			or the memory is not allocated
+*	-EINVAL Error. Not a receive channel, the file is not opened for
+*			writing or it is opened with O_DIRECT
+*	-EBADF Error. Bad file descriptor
+*	<0 Other error code (can not create the thread)
+*******************************************************************************/
+static int dmChRecStart(DM_CHAN_t *pch, int fd)
+{
+	DM_REC_t *prec;
+	struct file *file;
+	struct task_struct *task;
+	unsigned long flags;
+	uint32_t buf_idx;
+	loff_t pos;
+
+	// Set the pointer to the recorder parameters
+	prec = &(pch -> rec);
+
+	// Recording must be off, the buffer queue must be idle
+	if(prec -> task != NULL) return -EBUSY;
+	if(!dmChQueueIdle(pch) || pch -> dma_mem_sz == 0) return -EBUSY;
+
+	// Only the received data is recorded
+	if(pch -> dir != _DM_DIR_RX) return -EINVAL;
+
+	// Take the file reference: the file must be opened for writing,
+	// the buffers of kernel memory can not be written with O_DIRECT
+	file = fget(fd);
+	if(file == NULL) return -EBADF;
+	if(!(file -> f_mode & FMODE_WRITE) || (file -> f_flags & O_DIRECT)) {
+		fput(file);
+		return -EINVAL;
+	}
+
+	// Read the file offset (under its lock: the file can be written
+	// or seeked by other tasks)
+	mutex_lock(&(file -> f_pos_lock));
+	pos = file -> f_pos;
+	mutex_unlock(&(file -> f_pos_lock));
+
+	// Clear the counters, the file is written from its current offset
+	spin_lock_irqsave(&(pch -> lock), flags);
+	prec -> file = file;
+	prec -> pos = pos;
+	prec -> running = 1;
+	prec -> wr_err = 0;
+	prec -> bytes = 0;
+	prec -> frames = 0;
+	prec -> errors = 0;
+	prec -> lost = 0;
+	prec -> stalls = 0;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Queue all buffers, start streaming (the buffer which can not be
+	// started is finished with error, the thread queues it again)
+	for(buf_idx = 0; buf_idx < pch -> buf_num; buf_idx++)
+		dmChBufQueue(pch, buf_idx, pch -> trsz);
+	dmChStrmOn(pch);
+
+	// Create the recorder thread
+	task = kthread_run(dmChRecThread, pch, "dm-rec/%s", pch -> name);
+	if(IS_ERR(task)) {
+		// Can not create the thread, stop streaming
+		dmChStrmOff(pch);
+		prec -> running = 0;
+		prec -> file = NULL;
+		fput(file);
+		return PTR_ERR(task);
+	}
+	WRITE_ONCE(prec -> task, task);
+
+	// Recording was started successfully
+	return 0;
+}
+
+/****************************** dmChRecStop(pch) ******************************
+* Stop the in-kernel recorder (if it is on)
+* The recorder thread is stopped, streaming is stopped (all buffers are
+*	returned to user), the file offset is advanced past the written data
+*	and the file reference is released. The counters are kept until
+*	the next start.
+* Must be called with the ioctl mutex locked
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChRecStop(DM_CHAN_t *pch)
+{
+	DM_REC_t *prec;
+
+	// Set the pointer to the recorder parameters
+	prec = &(pch -> rec);
+
+	// Nothing to do if recording is off
+	if(prec -> task == NULL) return;
+
+	// Stop the recorder thread (it finishes the current write)
+	kthread_stop(prec -> task);
+	WRITE_ONCE(prec -> task, NULL);
+	prec -> running = 0;
+
+	// Stop streaming, return all buffers to user
+	dmChStrmOff(pch);
+
+	// Advance the file offset under its lock (the next write of the file
+	// follows the recorded data), release the file reference
+	mutex_lock(&(prec -> file -> f_pos_lock));
+	prec -> file -> f_pos = prec -> pos;
+	mutex_unlock(&(prec -> file -> f_pos_lock));
+	fput(prec -> file);
+	prec -> file = NULL;
+}
+
+/**************************** dmChRecThread(data) *****************************
+* Recorder thread function
+* Waits for the finished buffers, writes them into the file and queues them
+*	again. After a write error the thread stops writing (the buffer is
+*	not queued, streaming stops when DMA has no buffers) and waits
+*	until it is stopped.
+* Parameter:
+*	(io)data - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 Always
+*******************************************************************************/
+static int dmChRecThread(void *data)
+{
+	DM_CHAN_t *pch;
+	DM_REC_t *prec;
+	DM_BUF_t *pbuf;
+	unsigned long flags;
+	int rc;
+
+	// Set the pointers to the channel and recorder parameters
+	pch = data;
+	prec = &(pch -> rec);
+
+	// Write the buffers cycle (until the thread is stopped)
+	while(!kthread_should_stop()) {
+		// Wait for the finished buffer (kthread_stop wakes the thread up)
+		wait_event_interruptible(pch -> wq, kthread_should_stop() ||
+			(prec -> running && dmChBufDone(pch)));
+
+		// Take the finished buffer from the done FIFO
+		if(kthread_should_stop()) break;
+		pbuf = dmChBufPop(pch);
+		if(pbuf == NULL) continue;
+
+		// Write the buffer into the file
+		rc = dmChRecWrite(pch, pbuf);
+		if(rc < 0) {
+			// Write error: stop writing
+			spin_lock_irqsave(&(pch -> lock), flags);
+			prec -> wr_err = rc;
+			prec -> running = 0;
+			spin_unlock_irqrestore(&(pch -> lock), flags);
+			continue;
+		}
+
+		// Queue the buffer again
+		dmChBufQueue(pch, pbuf -> buf_idx, pch -> trsz);
+	}
+
+	// The thread was stopped
+	return 0;
+}
+
+/************************** dmChRecWrite(pch,pbuf) ****************************
+* Write the received data of the buffer into the recorder file
+* The failed DMA transaction is counted, its partial data is written.
+*	The buffers lost before the buffer (buffer metadata) are counted.
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)pbuf - pointer to the finished buffer parameters structure
+* Return value:
+*	0 Success. The data was written
+*	-EIO Error. The data was written partially
+*	<0 Other error code (from kernel_write)
+*******************************************************************************/
+static int dmChRecWrite(DM_CHAN_t *pch, DM_BUF_t *pbuf)
+{
+	DM_REC_t *prec;
+	_DM_META_t *pmeta;
+	unsigned long flags;
+	uint32_t len;
+	ssize_t sz;
+
+	// Set the pointers to the recorder parameters and the buffer metadata
+	prec = &(pch -> rec);
+	pmeta = &(pch -> meta[pbuf -> buf_idx]);
+
+	// Get the number of received bytes
+	len = pch -> trsz - pbuf -> residue;
+
+	// Count the failed DMA transaction and the data lost before the buffer
+	spin_lock_irqsave(&(pch -> lock), flags);
+	if(pbuf -> res_code != _DM_TRAN_RES_SUCCESS) prec -> errors++;
+	prec -> lost += pmeta -> lost;
+	if(pmeta -> flags & _DM_META_STALL) prec -> stalls++;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Nothing was received
+	if(len == 0) return 0;
+
+	// Synchronize the buffer for CPU (cached memory mode)
+	dmChBufSyncCpu(pbuf);
+
+	// Write the data into the file
+	sz = kernel_write(prec -> file, pbuf -> dma_buffer, len, &(prec -> pos));
+	if(sz < 0) return sz;				// Write error
+	if(sz != len) return -EIO;			// The data was written partially
+
+	// Count the written data
+	spin_lock_irqsave(&(pch -> lock), flags);
+	prec -> bytes += len;
+	prec -> frames++;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// The data was written successfully
+	return 0;
+}
+
+/********************** dmChMemRealloc(pch,mode,frames) ***********************
+* Reallocate the memory of the channel for new memory mode and geometry
+* The memory must not be used: streaming is off, all buffers are owned by
+*	user, the memory is not mapped to user space.
+* If the memory can not be allocated, the old mode and geometry are restored.
+*	If the old memory can not be allocated again, the channel has no
+*	memory: it is unusable until the memory is reallocated successfully.
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)mode - new memory mode (_DM_MEM_MODE_t)
+*	(i)frames - new number of frames per DMA transaction
+* Return value:
+*	0 Success. The memory was reallocated
+*	-EBUSY  Error. The memory is used
+*	-ENOMEM Error. Can not allocate the memory (the old memory is restored)
+*	-ENODEV Error. Can not allocate the memory, the old memory can not be
+*			restored: the channel has no memory
+*******************************************************************************/
+static int dmChMemRealloc(DM_CHAN_t *pch, uint32_t mode, uint32_t frames)
+{
+	uint32_t old_mode;
+	uint32_t old_frames;
+	int rc;
+
+	// Check that the memory is not used
+	if(!dmChQueueIdle(pch) || atomic_read(&(pch -> map_cnt)) != 0) return -EBUSY;
+
+	// Free the memory allocated for the old parameters
+	dmFreeChMem(pch);
+
+	// Store old parameters, set new parameters
+	old_mode = pch -> mem_mode;
+	old_frames = pch -> frames;
+	pch -> mem_mode = mode;
+	pch -> frames = frames;
+	pch -> trsz = pch -> frame_sz * frames;
+
+	// Allocate the memory for new parameters
+	rc = dmInitChMem(pch);
+	if(rc == 0) return 0;				// The memory was reallocated successfully
+
+	// Can not allocate the memory, restore old parameters
+	pch -> mem_mode = old_mode;
+	pch -> frames = old_frames;
+	pch -> trsz = pch -> frame_sz * old_frames;
+	rc = dmInitChMem(pch);
+	if(rc != 0) {
+		// Can not restore the old memory, the channel is unusable
+		dev_err(pch -> dev, "%s: can not restore the buffer memory (%d), "
+			"the channel has no memory\n", pch -> name, rc);
+		return -ENODEV;
+	}
+
+	// The memory was not reallocated
+	return -ENOMEM;
+}
+
+/*********************** dmChIoctlCpuAcc(pch,arg,begin) ***********************
+* Ioctl request: begin/end CPU access to the buffer
+* In cached memory mode the buffer is synchronized for CPU (begin) or for
+*	DMA device (end). In coherent memory mode no activity is performed.
+* The buffer which is queued again is synchronized for DMA device
+*	automatically, "end CPU access" request is optional.
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)arg - pointer to the user space buffer structure (_DM_BUF_t)
+*	(i)begin - 1: begin CPU access, 0: end CPU access
+* Return value:
+*	0 Success. The buffer was synchronized
+*	-EFAULT Error. Can not copy buffer structure from user
+*	-EINVAL Error. Bad buffer index
+*	-EBUSY  Error. The buffer is not owned by user
+*******************************************************************************/
+static int dmChIoctlCpuAcc(DM_CHAN_t *pch, unsigned long arg, int begin)
+{
+	_DM_BUF_t ubuf;
+	DM_BUF_t *pbuf;
+	unsigned long error_count;
+
+	// Copy buffer structure from user
+	error_count = copy_from_user(&ubuf, (void *)arg, sizeof(_DM_BUF_t));
+	if(error_count != 0)
+		return -EFAULT;		// Failed to copy data from user
+
+	// Check buffer index
+	if(ubuf.buf_idx >= pch -> buf_num) return -EINVAL;
+
+	// Set the pointer to the buffer parameters
+	pbuf = &(pch -> buf[ubuf.buf_idx]);
+
+	// Only the buffer owned by user can be accessed by CPU
+	if(pbuf -> state != DM_BUF_ST_USER) return -EBUSY;
+
+	// Synchronize the buffer
+	if(begin)
+		dmChBufSyncCpu(pbuf);
+	else
+		dmChBufSyncDev(pbuf);
+
+	// The buffer was synchronized successfully
+	return 0;
+}
+
+/***************************** dmChBufSyncCpu(pbuf) ***************************
+* Synchronize the buffer for CPU access (cached memory mode only)
+* Cache lines of the buffer are invalidated, such that CPU reads the data
+*	written by DMA device
+* Parameter:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*******************************************************************************/
+static void dmChBufSyncCpu(DM_BUF_t *pbuf)
+{
+	DM_CHAN_t *pch;
+
+	// Set the pointer to the channel parameters
+	pch = pbuf -> pch;
+
+	// Nothing to do in coherent memory mode or if already synchronized
+	if(pch -> mem_mode != _DM_MEM_CACHED || pbuf -> cpu_owned) return;
+
+	// Synchronize the buffer for CPU
+	dma_sync_single_for_cpu(pch -> dev, pbuf -> dma_buffer_phadd,
+		pch -> buf_stride, pch -> dma_dir);
+
+	// The buffer is owned by CPU
+	pbuf -> cpu_owned = 1;
+}
+
+/***************************** dmChBufSyncDev(pbuf) ***************************
+* Synchronize the buffer for DMA device access (cached memory mode only)
+* Parameter:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*******************************************************************************/
+static void dmChBufSyncDev(DM_BUF_t *pbuf)
+{
+	DM_CHAN_t *pch;
+
+	// Set the pointer to the channel parameters
+	pch = pbuf -> pch;
+
+	// Nothing to do in coherent memory mode or if already synchronized
+	if(pch -> mem_mode != _DM_MEM_CACHED || !(pbuf -> cpu_owned)) return;
+
+	// Synchronize the buffer for DMA device
+	dma_sync_single_for_device(pch -> dev, pbuf -> dma_buffer_phadd,
+		pch -> buf_stride, pch -> dma_dir);
+
+	// The buffer is owned by DMA device
+	pbuf -> cpu_owned = 0;
+}
+
+/************************** dmChIoctlExpbuf(pch,arg) **************************
+* Ioctl request: export the buffer as dma-buf file descriptor
+* The importers (other processes and drivers) access the buffer memory
+*	without copying. The memory of the channel can not be reallocated
+*	while the dma-buf exists (it is counted as the memory mapping), the
+*	channel release waits until it is released.
+* Only the buffer owned by user (dequeued) is exported. The importers must
+*	finish the access before the buffer is queued again: DMA overwrites
+*	the data of the queued buffer.
+* The descriptor is installed after it was copied to user: no descriptor
+*	is left behind if the copy fails.
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)arg - pointer to the user space exported buffer structure
+*			  (_DM_EXPBUF_t)
+* Return value:
+*	0 Success. The buffer was exported, the descriptor was copied to user
+*	-EFAULT Error. Can not copy exported buffer structure from/to user
+*	-EINVAL Error. Bad buffer index or descriptor flags
+*	-EBUSY  Error. The buffer is not owned by user (queued)
+*	<0 Other error code (dma-buf export or file descriptor allocation)
+*******************************************************************************/
+static int dmChIoctlExpbuf(DM_CHAN_t *pch, unsigned long arg)
+{
+	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+	_DM_EXPBUF_t ubuf;
+	struct dma_buf *dmabuf;
+	unsigned long error_count;
+	int fd;
+
+	// Copy exported buffer structure from user
+	error_count = copy_from_user(&ubuf, (void *)arg, sizeof(_DM_EXPBUF_t));
+	if(error_count != 0)
+		return -EFAULT;		// Failed to copy data from user
+
+	// Check buffer index (the memory must be allocated) and descriptor flags
+	if(ubuf.buf_idx >= pch -> buf_num || pch -> dma_mem_sz == 0) return -EINVAL;
+	if(ubuf.flags & ~(O_CLOEXEC | O_ACCMODE)) return -EINVAL;
+
+	// Only the buffer owned by user can be exported
+	if(pch -> buf[ubuf.buf_idx].state != DM_BUF_ST_USER) return -EBUSY;
+
+	// Export the buffer (whole pages of the buffer)
+	exp_info.ops = &dm_exp_ops;
+	exp_info.size = pch -> buf_stride;
+	exp_info.flags = ubuf.flags & O_ACCMODE;
+	exp_info.priv = &(pch -> buf[ubuf.buf_idx]);
+	dmabuf = dma_buf_export(&exp_info);
+	if(IS_ERR(dmabuf)) return PTR_ERR(dmabuf);
+
+	// The memory can not be reallocated while it is exported
+	atomic_inc(&(pch -> map_cnt));
+
+	// Reserve file descriptor of dma-buf
+	fd = get_unused_fd_flags(ubuf.flags & O_CLOEXEC);
+	if(fd < 0) {
+		// Can not allocate the descriptor, release dma-buf
+		dma_buf_put(dmabuf);
+		return fd;
+	}
+
+	// Copy the descriptor to user
+	ubuf.fd = fd;
+	error_count = copy_to_user((void *)arg, &ubuf, sizeof(_DM_EXPBUF_t));
+	if(error_count != 0) {
+		// Release the descriptor and dma-buf
+		put_unused_fd(fd);
+		dma_buf_put(dmabuf);
+		return -EFAULT;	// Failed to copy data to user
+	}
+
+	// Install the descriptor: dma-buf file reference is passed to it
+	fd_install(fd, dmabuf -> file);
+
+	// The buffer was exported successfully
+	return 0;
+}
+
+/************************* dmChIoctlTranUsr(pch,arg) **************************
+* Ioctl request: perform single transfer into user buffer (data receive)
+* The data is received directly into the user memory: the user buffer is
+*	pinned, mapped as a scatter-gather list and given to DMA engine.
+*	No channel buffer is used, the data is not copied.
+* The buffer queue must be idle (streaming is off, all buffers owned by user)
+* The address and the size of the user buffer must be multiples of the
+*	cache line size (dma_get_cache_alignment): the cache lines invalidated
+*	for DMA must not hold other user data, AXI DMA without the data
+*	realignment engine needs aligned start addresses
+* This function can block (interruptible).
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)arg - pointer to the user space transaction structure (_DM_USR_TRAN_t)
+* Return value:
+*	0 Success. DMA transaction was executed (see result code)
+*	-EFAULT Error. Can not copy transaction structure from/to user
+*	-EINVAL Error. Bad user buffer size or alignment
+*	-EBUSY  Error. The buffer queue is used
+*	<0 Other error code (see dmChUsrTransfer)
+*******************************************************************************/
+static int dmChIoctlTranUsr(DM_CHAN_t *pch, unsigned long arg)
+{
+	_DM_USR_TRAN_t utran;
+	unsigned long error_count;
+	int rc;
+
+	// Copy transaction structure from user
+	error_count = copy_from_user(&utran, (void *)arg, sizeof(_DM_USR_TRAN_t));
+	if(error_count != 0)
+		return -EFAULT;		// Failed to copy data from user
+
+	// The user buffer must hold exactly one DMA transaction
+	if(utran.len != pch -> trsz) return -EINVAL;
+
+	// The user buffer must occupy whole cache lines
+	if(!IS_ALIGNED(utran.uaddr, dma_get_cache_alignment()) ||
+			!IS_ALIGNED(utran.len, dma_get_cache_alignment()))
+		return -EINVAL;
+
+	// The channel must not be used by the buffer queue
+	if(!dmChQueueIdle(pch)) return -EBUSY;
+
+	// Perform the transfer into user buffer
+	rc = dmChUsrTransfer(pch, &utran);
+	if(rc < 0) return rc;				// The transfer failed
+
+	// Copy transaction structure (with result code) to user
+	error_count = copy_to_user((void *)arg, &utran, sizeof(_DM_USR_TRAN_t));
+	if(error_count != 0)
+		return -EFAULT;	// Failed to copy data to user
+
+	// DMA transaction was executed
+	return 0;
+}
+
+/*********************** dmChUsrTransfer(pch,utran) ***************************
+* Perform single transfer on DMA channel into user buffer
+* Pins and maps the user buffer, starts DMA transfer, waits until it is
+*	finished, releases the user buffer (the pages are marked dirty)
+* If the channel timeout expires, the transfer is stopped with timeout
+*	result code, the residue tells how much data was received
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(io)utran - user buffer transaction structure, result code is set here
+* Return value:
+*	0 Success. DMA transaction was executed (see result code)
+*	-EFAULT Error. Can not pin the user buffer
+*	-ENOMEM Error. Can not allocate or map scatter-gather table
+*	-EINTR  Error. The wait was interrupted, the transfer was aborted
+*******************************************************************************/
+static int dmChUsrTransfer(DM_CHAN_t *pch, _DM_USR_TRAN_t *utran)
+{
+	DM_USR_t *pusr;
+	enum dma_status status;
+	unsigned long flags;
+	long wait_rc;
+	int rc;
+
+	// Set the pointer to the user buffer transaction parameters
+	pusr = &(pch -> usr);
+
+	// Pin the user buffer, build scatter-gather table
+	rc = dmChUsrPin(pusr, (unsigned long)utran -> uaddr, utran -> len,
+		pch -> dma_dir == DMA_FROM_DEVICE);
+	if(rc < 0) goto USR_END;
+
+	// Map scatter-gather table for DMA
+	rc = dmChUsrMap(pch);
+	if(rc < 0) goto USR_END;
+
+	// Start DMA transfer into the user buffer
+	rc = dmChUsrStart(pch);
+	if(rc < 0) {
+		// Can not start DMA transfer: report DMA error to user
+		utran -> res_code = _DM_TRAN_RES_ERROR;
+		utran -> residue = utran -> len;
+		rc = 0;
+		goto USR_END;
+	}
+
+	// Wait for the DMA transaction to complete, or error
+	wait_rc = wait_event_interruptible_timeout(pch -> wq, dmChUsrDone(pch),
+		dmChTrWaitTmo(pch));
+	if(wait_rc < 0) {
+		// The wait was interrupted: abort the transfer before unpinning
+		dmChAbort(pch, _DM_TRAN_RES_ABORTED);
+		rc = -EINTR;
+		goto USR_END;
+	}
+
+	// Timeout: stop the transfer, it is finished with timeout result code
+	if(wait_rc == 0) dmChAbort(pch, _DM_TRAN_RES_TIMEOUT);
+
+	// Make the result code: the stopped transfer has it already,
+	// otherwise get DMA transaction status
+	if(pusr -> stopped) {
+		utran -> res_code = pusr -> res_code;
+		utran -> residue = pusr -> residue;
+	}
+	else {
+		status = dma_async_is_tx_complete(pch -> dma_chan, pusr -> cookie,
+			NULL, NULL);
+		utran -> res_code = (status == DMA_COMPLETE) ?
+			_DM_TRAN_RES_SUCCESS : _DM_TRAN_RES_ERROR;
+		utran -> residue = (status == DMA_COMPLETE) ? 0 : utran -> len;
+	}
+
+	// Return completion time and sequence number
+	utran -> ts_ns = ktime_to_ns(pusr -> t_done);
+	utran -> seq = pusr -> seq;
+
+	// Account the transfer in the channel statistics
+	spin_lock_irqsave(&(pch -> lock), flags);
+	dmChStatDone(pch, utran -> res_code, utran -> residue, pusr -> t_submit,
+		pusr -> t_done, !(pusr -> stopped));
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+USR_END:
+	// The transaction is not active any more (late callback is ignored)
+	spin_lock_irqsave(&(pch -> lock), flags);
+	pusr -> active = 0;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Unmap and unpin the user buffer
+	dmChUsrFree(pch);
+
+	// Return success/error code
+	return rc;
+}
+
+/******************* dmChUsrPin(pusr,uaddr,len,write) *************************
+* User buffer transaction initialization:
+*	Pin user buffer pages, build scatter-gather table of the buffer
+* Parameters:
+*	(io)pusr - pointer to the user buffer transaction parameters
+*	(i)uaddr - user buffer virtual address
+*	(i)len - user buffer size (b)
+*	(i)write - 1: DMA writes into the buffer (receive), 0: DMA reads it
+* Return value:
+*	0 Success. The buffer was pinned
+*	-EFAULT Error. Can not pin the user buffer
+*	-ENOMEM Error. Can not allocate memory
+*******************************************************************************/
+static int dmChUsrPin(DM_USR_t *pusr, unsigned long uaddr, uint32_t len,
+	int write)
+{
+	unsigned long offs;
+	uint32_t npages;
+	int pinned;
+	int rc;
+
+	// Calculate the offset in the first page and the number of pages
+	offs = offset_in_page(uaddr);
+	npages = (offs + len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+	// Allocate the array of page pointers
+	pusr -> pages = kmalloc_array(npages, sizeof(struct page *), GFP_KERNEL);
+	if(pusr -> pages == NULL) return -ENOMEM;
+
+	// Pin user pages
+	pinned = get_user_pages_fast(uaddr & PAGE_MASK, npages, write, pusr -> pages);
+	if(pinned > 0) pusr -> npages = pinned;
+	if(pinned != npages) return -EFAULT;	// Can not pin all pages
+
+	// Build scatter-gather table (neighbour pages are merged)
+	rc = sg_alloc_table_from_pages(&(pusr -> sgt), pusr -> pages, npages,
+		offs, len, GFP_KERNEL);
+	if(rc < 0) return -ENOMEM;			// Can not allocate sg table
+	pusr -> sgt_alloc = 1;
+
+	// The buffer was pinned successfully
+	return 0;
+}
+
+/****************************** dmChUsrMap(pch) *******************************
+* User buffer transaction initialization:
+*	Map scatter-gather table of the user buffer for DMA
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 Success. The table was mapped
+*	-ENOMEM Error. Can not map the table
+*******************************************************************************/
+static int dmChUsrMap(DM_CHAN_t *pch)
+{
+	DM_USR_t *pusr;
+	int nents;
+
+	// Set the pointer to the user buffer transaction parameters
+	pusr = &(pch -> usr);
+
+	// Map scatter-gather table (cache maintenance is done here)
+	nents = dma_map_sg(pch -> dev, pusr -> sgt.sgl, pusr -> sgt.orig_nents,
+		pch -> dma_dir);
+	if(nents <= 0) return -ENOMEM;		// Can not map the table
+
+	// Store the number of mapped entries
+	pusr -> nents = nents;
+
+	// The table was mapped successfully
+	return 0;
+}
+
+/****************************** dmChUsrStart(pch) *****************************
+* Start transfer on DMA channel into the mapped user buffer
+* Inits scatter-gather DMA transaction, submits it, initiates DMA transfer
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0  Success. The transfer was started
+*	-1 Error. Can not start DMA transfer
+*******************************************************************************/
+static int dmChUsrStart(DM_CHAN_t *pch)
+{
+	DM_USR_t *pusr;
+	struct dma_async_tx_descriptor *tran_desc;
+	dma_cookie_t cookie;
+
+	// Set the pointer to the user buffer transaction parameters
+	pusr = &(pch -> usr);
+
+	// Init DMA scatter-gather transaction
+	tran_desc = dmaengine_prep_slave_sg(pch -> dma_chan, pusr -> sgt.sgl,
+		pusr -> nents, pch -> tr_dir, DMA_CTRL_ACK | DMA_PREP_INTERRUPT);
+	if(tran_desc == NULL) return -1;	// Can not init sg transaction
+	pusr -> tran_desc = tran_desc;
+
+	// Init callback function, its parameter points to the channel parameters
+	tran_desc -> callback = dmChUsrCallBack;
+	tran_desc -> callback_param = pch;
+
+	// The transaction is active (the flags are set before the callback can be called)
+	pusr -> done = 0;
+	pusr -> stopped = 0;
+	pusr -> residue = pch -> trsz;
+	pusr -> active = 1;
+
+	// Set transfer submit time (latency statistics)
+	pusr -> t_submit = ktime_get();
+
+	// Submit the transaction to the DMA engine
+	cookie = dmaengine_submit(tran_desc);
+	if(dma_submit_error(cookie))
+		return -1;					// Can not submit DMA transaction to the DMA engine
+	pusr -> cookie = cookie;
+
+	// Start the DMA transaction
+	dmChTrIniIssuePend(pch);
+
+	// The transfer was started successfully
+	return 0;
+}
+
+/*************************** dmChUsrCallBack(parm) ****************************
+* Callback function for "user buffer transfer finished" event
+* The function is called by DMA engine (in the tasklet context)
+* Parameter:
+*	(io)parm - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChUsrCallBack(void *parm)
+{
+	DM_CHAN_t *pch;
+	unsigned long flags;
+
+	// Set the pointer to the channel parameters
+	pch = parm;
+
+	// Mark the active transaction finished, set finished time
+	spin_lock_irqsave(&(pch -> lock), flags);
+	if(pch -> usr.active && !(pch -> usr.done)) {
+		pch -> usr.t_done = ktime_get();
+		pch -> usr.seq = pch -> seq++;
+		pch -> usr.done = 1;
+	}
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Wake up the waiting thread
+	wake_up_interruptible(&(pch -> wq));
+}
+
+/****************************** dmChUsrDone(pch) ******************************
+* Check that the user buffer transaction is finished
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	1 The transaction is finished
+*	0 The transaction is active
+*******************************************************************************/
+static int dmChUsrDone(DM_CHAN_t *pch)
+{
+	unsigned long flags;
+	int done;
+
+	// Read "finished" flag under the lock
+	spin_lock_irqsave(&(pch -> lock), flags);
+	done = pch -> usr.done;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Return the flag
+	return done;
+}
+
+/****************************** dmChUsrFree(pch) ******************************
+* Free user buffer transaction resources
+* Unmaps scatter-gather table, frees it, unpins the pages (the pages
+*	written by DMA are marked dirty)
+* Only allocated resources are freed
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChUsrFree(DM_CHAN_t *pch)
+{
+	DM_USR_t *pusr;
+	uint32_t i;
+
+	// Set the pointer to the user buffer transaction parameters
+	pusr = &(pch -> usr);
+
+	// Unmap scatter-gather table (the data becomes visible to CPU)
+	if(pusr -> nents != 0)
+		dma_unmap_sg(pch -> dev, pusr -> sgt.sgl, pusr -> sgt.orig_nents,
+			pch -> dma_dir);
+	pusr -> nents = 0;
+
+	// Free scatter-gather table
+	if(pusr -> sgt_alloc) sg_free_table(&(pusr -> sgt));
+	pusr -> sgt_alloc = 0;
+
+	// Unpin pages, mark the pages written by DMA (receive channel) dirty
+	for(i = 0; i < pusr -> npages; i++) {
+		if(pch -> dma_dir == DMA_FROM_DEVICE)
+			set_page_dirty_lock(pusr -> pages[i]);
+		put_page(pusr -> pages[i]);
+	}
+	pusr -> npages = 0;
+
+	// Free the array of page pointers
+	kfree(pusr -> pages);
+	pusr -> pages = NULL;
+}
+
+/****************************** dmChStrmOn(pch) *******************************
+* Start streaming on the buffer queue
+* DMA transactions into the queued buffers are submitted to the DMA engine
+*	in the queue order, up to the maximum number of active buffers.
+* While streaming is on, the queued buffer is submitted as soon as there is
+*	a free place (a transaction is finished), such that DMA engine always
+*	has the next buffers while user space processes the dequeued one.
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 Success. Streaming was started
+*	-EBUSY Error. Streaming is already on
+*	-EIO   Error. Can not start DMA transfer (the buffer is finished with
+*		   error result code, streaming stays on)
+*******************************************************************************/
+static int dmChStrmOn(DM_CHAN_t *pch)
+{
+	unsigned long flags;
+
+	// Check that streaming is off
+	if(pch -> streaming) return -EBUSY;
+
+	// Set the flag: streaming is on, no overrun yet
+	spin_lock_irqsave(&(pch -> lock), flags);
+	pch -> streaming = 1;
+	pch -> ovr_stall = 0;
+	pch -> pop_valid = 0;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Start transfers into queued buffers
+	return dmChQueueKick(pch);
+}
+
+/****************************** dmChStrmOff(pch) ******************************
+* Stop streaming on the buffer queue
+* Aborts current transfers on DMA channel, returns all buffers to user,
+*	wakes up the waiting dequeue requests
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChStrmOff(DM_CHAN_t *pch)
+{
+	// Serialize with the start of pending buffers
+	mutex_lock(&(pch -> kick_mutex));
+
+	// Abort current transfers on DMA channel
+	dmChTerm(pch);
+
+	// Return all buffers to user, clear the done and pending FIFOs
+	dmChQueueReset(pch);
+
+	// Release the start mutex
+	mutex_unlock(&(pch -> kick_mutex));
+
+	// Wake up dequeue requests waiting for finished buffers
+	wake_up_interruptible(&(pch -> wq));
+}
+
+/**************************** dmChQueueReset(pch) *****************************
+* Return all buffers of the buffer queue to user, clear the done and
+*	pending FIFOs, clear "streaming is on" flag
+* No DMA transactions must be active when the function is called
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChQueueReset(DM_CHAN_t *pch)
+{
+	unsigned long flags;
+	uint32_t buf_idx;
+
+	// Lock the buffer queue
+	spin_lock_irqsave(&(pch -> lock), flags);
+
+	// Return all buffers to user
+	for(buf_idx = 0; buf_idx < pch -> buf_num; buf_idx++)
+		pch -> buf[buf_idx].state = DM_BUF_ST_USER;
+
+	// Clear the done FIFO
+	pch -> done_rd = 0;
+	pch -> done_cnt = 0;
+
+	// Clear the pending and active FIFOs
+	pch -> pend_rd = 0;
+	pch -> pend_cnt = 0;
+	pch -> act_rd = 0;
+	pch -> act_cnt = 0;
+
+	// Streaming is off (also the streaming started by read or write)
+	pch -> streaming = 0;
+	pch -> rd_strm = 0;
+	WRITE_ONCE(pch -> wr_strm, 0);
+	pch -> wr_buf = NULL;
+	pch -> wr_len = 0;
+
+	// The next dequeued sequence is not checked for the gap
+	pch -> pop_valid = 0;
+	pch -> ovr_stall = 0;
+
+	// Unlock the buffer queue
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+}
+
+/***************************** dmChQueueIdle(pch) *****************************
+* Check that the buffer queue is idle: streaming is off and
+*	all buffers are owned by user (no DMA transactions into the buffers)
+* Must be called under ioctl mutex
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	1 The buffer queue is idle
+*	0 The buffer queue is used
+*******************************************************************************/
+static int dmChQueueIdle(DM_CHAN_t *pch)
+{
+	uint32_t buf_idx;
+
+	// Streaming must be off
+	if(pch -> streaming) return 0;
+
+	// All buffers must be owned by user
+	for(buf_idx = 0; buf_idx < pch -> buf_num; buf_idx++)
+		if(pch -> buf[buf_idx].state != DM_BUF_ST_USER) return 0;
+
+	// The buffer queue is idle
+	return 1;
+}
+
+/*********************** dmChBufQueue(pch,buf_idx,len) ************************
+* Queue the buffer for DMA data receiving/transmitting
+* The buffer is put into the pending FIFO. If streaming is on, DMA transfer
+*	into the buffer is started as soon as there is a free place
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)buf_idx - index of the buffer to queue
+*	(i)len - number of bytes to transfer (1..trsz, trsz for receiving)
+* Return value:
+*	0 Success. The buffer was queued
+*	-EINVAL Error. Bad buffer index or the buffer is not owned by user
+*	-EIO    Error. Can not start DMA transfer (the buffer is finished
+*			with error result code)
+*******************************************************************************/
+static int dmChBufQueue(DM_CHAN_t *pch, uint32_t buf_idx, uint32_t len)
+{
+	DM_BUF_t *pbuf;
+	unsigned long flags;
+	uint32_t pend_wr;
+
+	// Check buffer index
+	if(buf_idx >= pch -> buf_num) return -EINVAL;
+
+	// Set the pointer to the buffer parameters
+	pbuf = &(pch -> buf[buf_idx]);
+
+	// Lock the buffer queue
+	spin_lock_irqsave(&(pch -> lock), flags);
+
+	// Only the buffer owned by user can be queued
+	if(pbuf -> state != DM_BUF_ST_USER) {
+		spin_unlock_irqrestore(&(pch -> lock), flags);
+		return -EINVAL;
+	}
+
+	// The buffer waits for streaming start or for a free place,
+	// put its index into the pending FIFO
+	pbuf -> len = len;
+	pbuf -> state = DM_BUF_ST_QUEUED;
+	pend_wr = (pch -> pend_rd + pch -> pend_cnt) % pch -> buf_num;
+	pch -> pend_fifo[pend_wr] = buf_idx;
+	pch -> pend_cnt++;
+
+	// Unlock the buffer queue
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Streaming is off - the buffer waits for streaming start
+	if(!(pch -> streaming)) return 0;
+
+	// Streaming is on - start DMA transfer if there is a free place
+	return dmChQueueKick(pch);
+}
+
+/***************************** dmChQueueKick(pch) *****************************
+* Start DMA transfers into the pending buffers (in the queue order) while
+*	streaming is on and the number of active buffers is below the maximum
+* The buffers are started in batches of coal_cnt transfers: only the last
+*	transfer of the batch interrupts (interrupt coalescing)
+* Called by ioctl requests and by the work scheduled by the callback
+*	(DMA transactions are not prepared in the callback context)
+* The buffer which can not be started is finished with error result code.
+*	The transfers of the batch started before it have no callback: they are
+*	finished by the poll (with the default period if the poll is off).
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 Success. The transfers were started (or there is no free place)
+*	-EIO Error. Can not start DMA transfer
+*******************************************************************************/
+static int dmChQueueKick(DM_CHAN_t *pch)
+{
+	DM_BUF_t *batch[_DM_COAL_MAX];
+	unsigned long flags;
+	uint32_t n, i;
+	int rc;
+
+	// Serialize the starts: the buffers are started in the queue order
+	mutex_lock(&(pch -> kick_mutex));
+
+	// Start the batches of pending buffers cycle
+	rc = 0;
+	do {
+		// Take the batch of pending buffers (interrupt coalescing)
+		n = 0;
+		while(n < pch -> coal_cnt && (batch[n] = dmChQueueNext(pch)) != NULL)
+			n++;
+
+		// Start DMA transfers into the buffers of the batch,
+		// only the last transfer interrupts and issues the batch
+		for(i = 0; i < n; i++) {
+			if(dmChBufStart(batch[i], i == n - 1) < 0) {
+				// Can not start DMA transfer: issue the started transfers
+				// (they are finished by the poll), finish the buffer and
+				// the rest of the batch with error
+				if(i != 0) {
+					spin_lock_irqsave(&(pch -> lock), flags);
+					pch -> coal_poll = 1;
+					spin_unlock_irqrestore(&(pch -> lock), flags);
+					dmChTrIniIssuePend(pch);
+					schedule_delayed_work(&(pch -> coal_work),
+						usecs_to_jiffies(dmChCoalPeriod(pch)));
+				}
+				for(; i < n; i++) dmChBufFail(batch[i]);
+				rc = -EIO;
+			}
+		}
+
+		// Poll the finished coalesced transfers (the stream can stop
+		// before the last transfer of the batch)
+		if(rc == 0 && n > 1 && pch -> coal_us != 0)
+			schedule_delayed_work(&(pch -> coal_work),
+				usecs_to_jiffies(pch -> coal_us));
+	} while(rc == 0 && n == pch -> coal_cnt);
+
+	// Release the start mutex
+	mutex_unlock(&(pch -> kick_mutex));
+
+	// Return success/error code
+	return rc;
+}
+
+/***************************** dmChQueueNext(pch) *****************************
+* Take the oldest buffer from the pending FIFO if streaming is on and the
+*	number of active buffers is below the maximum
+* Must be called with the start mutex locked (the taken buffer is started
+*	before the next one is taken)
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	Pointer to the buffer parameters structure
+*	NULL - no buffer can be started
+*******************************************************************************/
+static DM_BUF_t *dmChQueueNext(DM_CHAN_t *pch)
+{
+	unsigned long flags;
+	DM_BUF_t *pbuf;
+	uint32_t buf_idx;
+
+	// Lock the buffer queue
+	spin_lock_irqsave(&(pch -> lock), flags);
+
+	// Take the oldest pending buffer if there is a free place
+	pbuf = NULL;
+	if(pch -> streaming && pch -> pend_cnt != 0 &&
+			pch -> act_cnt < pch -> act_max) {
+		buf_idx = pch -> pend_fifo[pch -> pend_rd];
+		pch -> pend_rd = (pch -> pend_rd + 1) % pch -> buf_num;
+		pch -> pend_cnt--;
+		pbuf = &(pch -> buf[buf_idx]);
+	}
+
+	// Unlock the buffer queue
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Return the pointer to the buffer to start
+	return pbuf;
+}
+
+/***************************** dmChQueueSched(pch) ****************************
+* Schedule the start of the pending buffers (the delivery to readers) in the
+*	process context: by the real-time completion worker of the channel or
+*	by the system workqueue. The schedule time is kept for the latency
+*	histogram.
+* Can be called in the tasklet context
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChQueueSched(DM_CHAN_t *pch)
+{
+	unsigned long flags;
+
+	// Keep the time of the first schedule (the work runs once)
+	spin_lock_irqsave(&(pch -> lock), flags);
+	if(ktime_to_ns(pch -> t_kick) == 0) pch -> t_kick = ktime_get();
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Queue the work
+	if(pch -> rt_worker != NULL)
+		kthread_queue_work(pch -> rt_worker, &(pch -> rt_work));
+	else
+		schedule_work(&(pch -> kick_work));
+}
+
+/*************************** dmChQueueWork(work) ******************************
+* Work function (system workqueue): start the pending buffers after DMA
+*	transactions were finished (scheduled by "transfer finished" callback)
+* Parameter:
+*	(i)work - pointer to the work structure of the channel
+*******************************************************************************/
+static void dmChQueueWork(struct work_struct *work)
+{
+	// Start the pending buffers of the channel
+	dmChQueueRun(container_of(work, DM_CHAN_t, kick_work));
+}
+
+/************************** dmChQueueRtWork(work) *****************************
+* Work function (real-time completion worker): start the pending buffers
+*	after DMA transactions were finished
+* Parameter:
+*	(i)work - pointer to the kthread work structure of the channel
+*******************************************************************************/
+static void dmChQueueRtWork(struct kthread_work *work)
+{
+	// Start the pending buffers of the channel
+	dmChQueueRun(container_of(work, DM_CHAN_t, rt_work));
+}
+
+/****************************** dmChQueueRun(pch) *****************************
+* Start the pending buffers after DMA transactions were finished. While
+*	streaming for read is on, the finished buffers are delivered to
+*	readers first. The delay after the schedule is counted.
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChQueueRun(DM_CHAN_t *pch)
+{
+	unsigned long flags;
+
+	// Count the delay from the schedule
+	spin_lock_irqsave(&(pch -> lock), flags);
+	if(ktime_to_ns(pch -> t_kick) != 0) {
+		dmChStatHist(pch -> stat.hist_kick, pch -> t_kick, ktime_get());
+		pch -> t_kick = 0;
+	}
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Deliver the finished buffers to readers (streaming for read)
+	if(pch -> rd_strm) dmChFanPump(pch);
+
+	// Start the pending buffers (errors are reported in the buffers)
+	dmChQueueKick(pch);
+}
+
+/***************************** dmChCoalWork(work) *****************************
+* Work function: poll the finished coalesced transfers
+* The transfers of the batch do not interrupt (except the last one). If the
+*	stream stops in the middle of the batch, the finished transfers are
+*	found by this poll: the oldest active buffers completed by DMA engine
+*	are finished. The poll is repeated while there are active buffers.
+* Parameter:
+*	(i)work - pointer to the work structure of the channel
+*******************************************************************************/
+static void dmChCoalWork(struct work_struct *work)
+{
+	DM_CHAN_t *pch;
+	DM_BUF_t *pbuf;
+	unsigned long flags;
+	enum dma_status status;
+	uint32_t done;
+	int kick, again;
+
+	// Set the pointer to the DMA-PROXY channel parameters
+	pch = container_of(to_delayed_work(work), DM_CHAN_t, coal_work);
+
+	// Lock the buffer queue
+	spin_lock_irqsave(&(pch -> lock), flags);
+
+	// Finish the completed active buffers cycle (the oldest buffer first)
+	done = 0;
+	while((pbuf = dmChBufOldest(pch)) != NULL) {
+		status = dma_async_is_tx_complete(pch -> dma_chan, pbuf -> cookie,
+			NULL, NULL);
+		if(status != DMA_COMPLETE) break;
+
+		// The buffer is finished, put its index into the done FIFO
+		if(done == 0) pch -> batch_seq++;
+		dmChBufFinish(pbuf);
+		done++;
+	}
+
+	// Apply the overrun policy (the dropped buffers become pending)
+	if(done != 0) dmChOvrCheck(pch);
+
+	// Check if the pending buffers wait for the free place
+	// or the finished buffer is delivered to readers
+	kick = done != 0 && pch -> streaming &&
+		(pch -> pend_cnt != 0 || pch -> rd_strm);
+
+	// Poll again while there are active coalesced transfers
+	// (or the transfers without callback after a start error)
+	if(pch -> act_cnt == 0) pch -> coal_poll = 0;
+	again = pch -> act_cnt != 0 && (pch -> coal_poll ||
+		(pch -> coal_cnt > 1 && pch -> coal_us != 0));
+
+	// Unlock the buffer queue
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Start the pending buffers (deliver the buffers) in the process context
+	if(kick) dmChQueueSched(pch);
+
+	// Wake up the waiting requests
+	if(done != 0) wake_up_interruptible(&(pch -> wq));
+
+	// Schedule the next poll
+	if(again)
+		schedule_delayed_work(&(pch -> coal_work),
+			usecs_to_jiffies(dmChCoalPeriod(pch)));
+}
+
+
+/**************************** dmChCoalPeriod(pch) *****************************
+* Get the poll period of the coalesced transfers: the period of the channel
+*	or the default one if the poll is off (the transfers without callback
+*	after a start error are polled anyway)
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	Poll period (us)
+*******************************************************************************/
+static uint32_t dmChCoalPeriod(DM_CHAN_t *pch)
+{
+	// Return the poll period of the channel or the default one
+	return pch -> coal_us != 0 ? pch -> coal_us : DM_COAL_US;
+}
+
+/****************************** dmChOvrCheck(pch) *****************************
+* Apply the overrun policy after the buffers were finished
+* Only the buffer queue of the streaming receive channel is checked (not
+*	the streaming started by read: the fan-out ring reuses its buffers).
+* Drop policies: while less than two transfers are active or pending, the
+*	finished buffer not dequeued yet (the oldest or the newest one) is put
+*	into the pending FIFO, one finished buffer is kept for user. Its
+*	sequence number is skipped: the gap is reported by the next dequeue.
+* If DMA has no buffers left (any policy), the PL stream stalls: the stall
+*	is counted once and the next finished buffer is marked
+* Must be called with the buffer queue locked
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChOvrCheck(DM_CHAN_t *pch)
+{
+	DM_BUF_t *pbuf;
+	uint32_t reserve, buf_idx, pend_wr;
+
+	// Check that the policy is used
+	if(!(pch -> streaming) || pch -> rd_strm || pch -> dir != _DM_DIR_RX)
+		return;
+
+	// Number of transfers kept submitted (one if only one can be submitted)
+	reserve = min_t(uint32_t, pch -> act_max, 2);
+
+	// Drop the finished buffers while DMA has not enough buffers
+	while(pch -> ovr_policy != _DM_OVR_BLOCK && pch -> done_cnt > 1 &&
+			pch -> act_cnt + pch -> pend_cnt < reserve) {
+		// Take the oldest or the newest finished buffer from the done FIFO
+		if(pch -> ovr_policy == _DM_OVR_DROP_OLDEST) {
+			buf_idx = pch -> done_fifo[pch -> done_rd];
+			pch -> done_rd = (pch -> done_rd + 1) % pch -> buf_num;
+		}
+		else
+			buf_idx = pch -> done_fifo[(pch -> done_rd + pch -> done_cnt - 1) %
+				pch -> buf_num];
+		pch -> done_cnt--;
+
+		// Receive into the buffer again, put its index into the pending FIFO
+		pbuf = &(pch -> buf[buf_idx]);
+		pbuf -> len = pch -> trsz;
+		pbuf -> state = DM_BUF_ST_QUEUED;
+		pend_wr = (pch -> pend_rd + pch -> pend_cnt) % pch -> buf_num;
+		pch -> pend_fifo[pend_wr] = buf_idx;
+		pch -> pend_cnt++;
+		pch -> stat.drops++;
+	}
+
+	// DMA has no buffers: the stream stalls until the buffer is queued
+	if(pch -> act_cnt == 0 && pch -> pend_cnt == 0 && !(pch -> ovr_stall)) {
+		pch -> ovr_stall = 1;
+		pch -> stat.stalls++;
+	}
+}
+
+/*************************** dmChBufStart(pbuf,irq) ***************************
+* Start DMA transfer into the buffer
+* In cached memory mode the buffer is synchronized for DMA device first
+* The buffer becomes active (it is put into the active FIFO). If the transfer
+*	can not be started, the buffer is returned to user.
+* Parameters:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(i)irq - flag: the transfer interrupts and issues the submitted transfers
+*			 (1), the transfer is coalesced with the next one (0)
+* Return value:
+*	0  Success. The transfer was started
+*	-1 Error. Can not start DMA transfer
+*******************************************************************************/
+static int dmChBufStart(DM_BUF_t *pbuf, int irq)
+{
+	DM_CHAN_t *pch;
+	unsigned long flags;
+	int rc;
+
+	// Set the pointer to the channel parameters
+	pch = pbuf -> pch;
+
+	// Check that the buffer memory is allocated
+	if(pbuf -> dma_buffer == NULL) return -1;
+
+	// The buffer must be owned by DMA device before the transfer
+	dmChBufSyncDev(pbuf);
+
+	// Nothing is transferred yet, set the start order number
+	pbuf -> residue = pch -> trsz;
+	pbuf -> stopped = 0;
+	pbuf -> start_seq = pch -> start_cnt++;
+
+	// The buffer is active (the state is set before the callback can be called)
+	spin_lock_irqsave(&(pch -> lock), flags);
+	pbuf -> state = DM_BUF_ST_ACTIVE;
+	pch -> act_fifo[(pch -> act_rd + pch -> act_cnt) % pch -> buf_num] =
+		pbuf -> buf_idx;
+	pch -> act_cnt++;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Start transfer on DMA channel
+	rc = dmChTrStart(pbuf, irq);
+	if(rc < 0) {
+		// Can not start DMA transfer, return the buffer to user
+		// (remove it from the end of the active FIFO)
+		spin_lock_irqsave(&(pch -> lock), flags);
+		pbuf -> state = DM_BUF_ST_USER;
+		pch -> act_cnt--;
+		spin_unlock_irqrestore(&(pch -> lock), flags);
+	}
+
+	// Return success/error code
+	return rc;
+}
+
+/**************************** dmChBufFinish(pbuf) *****************************
+* Finish the buffer: set finished time, stamp buffer metadata, put the
+*	buffer index into the done FIFO. The active buffer frees its place
+*	for the pending buffers.
+* Must be called with the buffer queue locked
+* Parameter:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*******************************************************************************/
+static void dmChBufFinish(DM_BUF_t *pbuf)
+{
+	DM_CHAN_t *pch;
+	uint32_t done_wr;
+
+	// Set the pointer to the channel parameters
+	pch = pbuf -> pch;
+
+	// Set the finished time, stamp buffer metadata
+	pbuf -> t_done = ktime_get();
+	dmChMetaStamp(pbuf);
+
+	// The active buffer frees its place (the oldest active buffer is
+	// finished first: it is removed from the beginning of the active FIFO)
+	if(pbuf -> state == DM_BUF_ST_ACTIVE) {
+		pch -> act_rd = (pch -> act_rd + 1) % pch -> buf_num;
+		pch -> act_cnt--;
+	}
+
+	// The buffer is finished, put its index into the done FIFO
+	pbuf -> state = DM_BUF_ST_DONE;
+	done_wr = (pch -> done_rd + pch -> done_cnt) % pch -> buf_num;
+	pch -> done_fifo[done_wr] = pbuf -> buf_idx;
+	pch -> done_cnt++;
+}
+
+/***************************** dmChBufFail(pbuf) ******************************
+* Finish the buffer which can not be started with error result code
+*	(nothing is transferred), wake up the waiting requests
+* Parameter:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*******************************************************************************/
+static void dmChBufFail(DM_BUF_t *pbuf)
+{
+	DM_CHAN_t *pch;
+	unsigned long flags;
+
+	// Set the pointer to the channel parameters
+	pch = pbuf -> pch;
+
+	// Lock the buffer queue
+	spin_lock_irqsave(&(pch -> lock), flags);
+
+	// Set the result: the result is not requested from DMA engine at dequeue
+	pbuf -> res_code = _DM_TRAN_RES_ERROR;
+	pbuf -> residue = pch -> trsz;
+	pbuf -> stopped = 1;
+
+	// Finish the buffer
+	dmChBufFinish(pbuf);
+
+	// Unlock the buffer queue
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Wake up the waiting requests
+	wake_up_interruptible(&(pch -> wq));
+}
+
+/****************************** dmChBufDone(pch) ******************************
+* Check if there are finished buffers in the done FIFO
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 The done FIFO is empty
+*	1 There are finished buffers in the done FIFO
+*******************************************************************************/
+static int dmChBufDone(DM_CHAN_t *pch)
+{
+	unsigned long flags;
+	uint32_t done_cnt;
+
+	// Read the number of finished buffers with the buffer queue locked
+	spin_lock_irqsave(&(pch -> lock), flags);
+	done_cnt = pch -> done_cnt;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Return the check result
+	return (done_cnt != 0);
+}
+
+/****************************** dmChBufPop(pch) *******************************
+* Take the oldest finished buffer from the done FIFO
+* The buffer is returned to user, DMA transaction result code is stored
+*	in the buffer parameters (the buffers stopped by timeout or abort
+*	have the result code and residue already)
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	Pointer to the buffer parameters structure
+*	NULL - the done FIFO is empty
+*******************************************************************************/
+static DM_BUF_t *dmChBufPop(DM_CHAN_t *pch)
+{
+	unsigned long flags;
+	DM_BUF_t *pbuf;
+	uint32_t buf_idx;
+	enum dma_status status;
+
+	// Lock the buffer queue
+	spin_lock_irqsave(&(pch -> lock), flags);
+
+	// Check that the done FIFO is not empty
+	if(pch -> done_cnt == 0) {
+		spin_unlock_irqrestore(&(pch -> lock), flags);
+		return NULL;
+	}
+
+	// Read the index of the oldest finished buffer, remove it from the FIFO
+	buf_idx = pch -> done_fifo[pch -> done_rd];
+	pch -> done_rd = (pch -> done_rd + 1) % pch -> buf_num;
+	pch -> done_cnt--;
+
+	// Set the pointer to the buffer parameters
+	pbuf = &(pch -> buf[buf_idx]);
+
+	// Get the status of the DMA transaction
+	// (before the buffer is returned to user and can be queued again),
+	// set DMA transaction result code (for user)
+	if(!(pbuf -> stopped)) {
+		status = dmChTrWaitGetStat(pbuf);
+		dmChTrWaitRes(pbuf, status);
+	}
+
+	// The residue of the partially filled buffer (transmit channel) is
+	// counted from the whole buffer: trsz - residue bytes were transferred
+	if(pbuf -> len < pch -> trsz)
+		pbuf -> residue = min(pbuf -> residue, pbuf -> len) +
+			pch -> trsz - pbuf -> len;
+
+	// Store the result in buffer metadata
+	dmChMetaRes(pbuf);
+
+	// Account the transfer in the channel statistics
+	dmChStatDone(pch, pbuf -> res_code, pbuf -> residue, pbuf -> t_submit,
+		pbuf -> t_done, !(pbuf -> stopped));
+
+	// Return the buffer to user
+	pbuf -> state = DM_BUF_ST_USER;
+
+	// Unlock the buffer queue
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Return the pointer to the finished buffer
+	return pbuf;
+}
+
+/********************* dmChBufWaitPop(pch,nonblock,ppbuf) *********************
+* Wait until DMA transaction into the oldest active buffer is finished,
+*	take the buffer from the done FIFO
+* If the channel timeout expires, the active transfers are stopped with
+*	timeout result code (streaming stays on, the buffers can be queued again)
+* This function can block (if non-blocking access is not requested)
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)nonblock - flag: non-blocking access is requested (1)
+*	(o)ppbuf - pointer to the finished buffer parameters structure pointer
+* Return value:
+*	0 Success. The buffer was taken from the done FIFO
+*	-EINVAL Error. Streaming is off
+*	-EAGAIN Error. Non-blocking access, no finished buffers
+*	-ETIMEDOUT Error. Timeout, there were no active transfers to stop
+*	-ECANCELED Error. Abort request, there were no active transfers to stop
+*	-ERESTARTSYS Error. The wait was interrupted by a signal
+*******************************************************************************/
+static int dmChBufWaitPop(DM_CHAN_t *pch, int nonblock, DM_BUF_t **ppbuf)
+{
+	DM_BUF_t *pbuf;
+	uint32_t abort_cnt;
+	long rc;
+
+	// Check the queue without blocking if requested
+	if(nonblock && pch -> streaming && !dmChBufDone(pch)) return -EAGAIN;
+
+	// Read the number of abort requests (a new request finishes the wait)
+	abort_cnt = pch -> abort_cnt;
+
+	// Wait until DMA transaction into the buffer is finished, streaming is off
+	// or abort was requested
+	rc = wait_event_interruptible_timeout(pch -> wq,
+			dmChBufDone(pch) || !(pch -> streaming) ||
+			pch -> abort_cnt != abort_cnt,
+			dmChTrWaitTmo(pch));
+	if(rc < 0) return rc;				// The wait was interrupted
+
+	// Timeout: stop active transfers, they are finished with timeout result code
+	if(rc == 0) dmChAbort(pch, _DM_TRAN_RES_TIMEOUT);
+
+	// Take the finished buffer from the done FIFO
+	pbuf = dmChBufPop(pch);
+	if(pbuf == NULL) {
+		// No finished buffers
+		if(!(pch -> streaming)) return -EINVAL;		// Streaming is off
+		return (rc == 0) ? -ETIMEDOUT : -ECANCELED;	// Nothing was stopped
+	}
+
+	// The buffer was taken successfully
+	*ppbuf = pbuf;
+	return 0;
+}
+
+/***************************** dmChTransfer(pch) ******************************
+* Perform single transfer on DMA channel into the first buffer of the queue
+* Starts DMA transfer
+* Waits until DMA transfer is finished
+* The status result of DMA transfer is stored in buffer parameters
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 Success. The transfer is finished (see result code)
+*	-EINTR Error. The wait was interrupted, the transfer was aborted
+*******************************************************************************/
+static int dmChTransfer(DM_CHAN_t *pch)
+{
+	DM_BUF_t *pbuf;
+	int rc;
+
+	// Set the pointer to the first buffer of the queue
+	pbuf = &(pch -> buf[0]);
+
+	// Start transfer on DMA channel (the whole buffer)
+	pbuf -> len = pch -> trsz;
+	rc = dmChBufStart(pbuf, 1);
+
+	// Check that the transfer was started
+	if(rc == 0)
+		// The transfer was started
+		// Wait until the transfer is finished 
+		// (function stores DMA transaction result code in buffer parameters)
+		return dmChTrWait(pch);
+
+	// Can not start DMA transfer
+	// Store DMA transaction result code (for user) - error
+	pbuf -> res_code = _DM_TRAN_RES_ERROR;
+	pbuf -> residue = pch -> trsz;
+	return 0;
+}
+
+/**************************** dmChTrCallBack(parm) ****************************
+* Callback function for "transfer finished" event
+* The function is called by DMA engine (in the tasklet context)
+* Moves the buffer into the done FIFO, schedules the start of the pending
+*	buffers, wakes up the waiting thread
+* The coalesced transfers started before the buffer (they have no callback)
+*	are finished too: the transfers of the channel complete in start order
+* Parameter:
+*	(io)parm - pointer to the DMA-PROXY channel buffer parameters structure
+*******************************************************************************/
+static void dmChTrCallBack(void *parm)
+{
+	DM_BUF_t *pbuf, *pold;
+	DM_CHAN_t *pch;
+	unsigned long flags;
+	int kick;
+
+	// Set the pointers to the finished buffer and its channel parameters
+	pbuf = parm;
+	pch = pbuf -> pch;
+
+	// Lock the buffer queue
+	spin_lock_irqsave(&(pch -> lock), flags);
+
+	// Ignore the buffers returned to user by "stop streaming" request
+	if(pbuf -> state == DM_BUF_ST_ACTIVE) {
+		// One more completion event
+		pch -> batch_seq++;
+
+		// The buffers of the batch are finished (the oldest buffer first),
+		// put their indexes into the done FIFO
+		// (the buffer is always active: the check protects the queue)
+		do {
+			pold = dmChBufOldest(pch);
+			if(pold == NULL) break;
+			dmChBufFinish(pold);
+		} while(pold != pbuf);
+
+		// Apply the overrun policy (the dropped buffers become pending)
+		dmChOvrCheck(pch);
+	}
+
+	// Check if the pending buffers wait for the free place
+	// or the finished buffer is delivered to readers
+	kick = pch -> streaming && (pch -> pend_cnt != 0 || pch -> rd_strm);
+
+	// Unlock the buffer queue
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Start the pending buffers (deliver the buffer) in the process context
+	if(kick) dmChQueueSched(pch);
+
+	// Indicate that the DMA transfer is complete to another thread of control
+	wake_up_interruptible(&(pch -> wq));
+}
+
+/**************************** dmChMetaStamp(pbuf) *****************************
+* Stamp the metadata of the finished buffer: completion time, completion
+*	sequence number of the channel, the number of completion event and
+*	the stall flag (the stall before the buffer)
+* Must be called with the buffer queue locked
+* Parameter:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*				(t_done must be set)
+*******************************************************************************/
+static void dmChMetaStamp(DM_BUF_t *pbuf)
+{
+	DM_CHAN_t *pch;
+	_DM_META_t *pmeta;
+
+	// Set the pointers to the channel parameters and the buffer metadata
+	pch = pbuf -> pch;
+	pmeta = &(pch -> meta[pbuf -> buf_idx]);
+
+	// Set completion time and the next sequence number
+	pmeta -> ts_ns = ktime_to_ns(pbuf -> t_done);
+	pmeta -> seq = pch -> seq++;
+	pmeta -> batch = pch -> batch_seq;
+
+	// Mark the first buffer finished after the stall
+	pmeta -> flags = pch -> ovr_stall ? _DM_META_STALL : 0;
+	pmeta -> lost = 0;
+	pch -> ovr_stall = 0;
+}
+
+/***************************** dmChMetaRes(pbuf) ******************************
+* Store DMA transaction result code and residue in the buffer metadata
+* The dequeued buffers are checked for the sequence gap: the buffers dropped
+*	by the overrun policy before the buffer are counted in its metadata
+* Must be called with the buffer queue locked
+* Parameter:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*******************************************************************************/
+static void dmChMetaRes(DM_BUF_t *pbuf)
+{
+	DM_CHAN_t *pch;
+	_DM_META_t *pmeta;
+
+	// Set the pointers to the channel parameters and the buffer metadata
+	pch = pbuf -> pch;
+	pmeta = &(pch -> meta[pbuf -> buf_idx]);
+
+	// Store the result
+	pmeta -> res_code = pbuf -> res_code;
+	pmeta -> residue = pbuf -> residue;
+
+	// Count the dropped buffers (the gap of the dequeued sequence numbers)
+	pmeta -> lost = pch -> pop_valid ? pmeta -> seq - pch -> pop_seq : 0;
+	if(pmeta -> lost != 0) pmeta -> flags |= _DM_META_OVERRUN;
+	pch -> pop_seq = pmeta -> seq + 1;
+	pch -> pop_valid = 1;
+}
+
+/*************************** dmChTrStart(pbuf,irq) ****************************
+* Start transfer on DMA channel into the buffer
+* Inits DMA transaction (single entry or scatter-gather)
+* Inits callback function for "transfer finished" event
+* Submits DMA transaction to the DMA engine
+* Initiates DMA transfer
+* The coalesced transaction (not the last of the batch) does not interrupt,
+*	has no callback and is issued with the last transaction of the batch
+* Parameters:
+*	(i)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(i)irq - flag: the transaction interrupts and issues the batch (1)
+* Return value:
+*	0  Success. The transfer was started
+*	-1 Error. Can not start DMA transfer
+*******************************************************************************/
+static int dmChTrStart(DM_BUF_t *pbuf, int irq)
+{
+	unsigned long flags;
+	int rc;
+
+	// Set the flags: only the last transaction of the batch interrupts
+	flags = DMA_CTRL_ACK;
+	if(irq) flags |= DMA_PREP_INTERRUPT;
+
+	// Init DMA transaction: single entry for one frame,
+	// one sg entry per frame otherwise
+	if(pbuf -> pch -> frames == 1)
+		rc = dmChTrIniSing(pbuf, flags);
+	else
+		rc = dmChTrIniSg(pbuf, flags);
+	if(rc < 0) return rc;				// Can not init DMA transaction
+
+	// Init callback function (the last transaction of the batch)
+	if(irq) dmChTrIniCallBack(pbuf);
+
+	// Set transfer submit time (latency statistics)
+	pbuf -> t_submit = ktime_get();
+
+	// Submit DMA transaction to the DMA engine
+	rc = dmChTrIniSubmit(pbuf);
+	if(rc < 0) return rc;				// Can not submit DMA transaction
+
+	// Start the batch of DMA transactions submitted to the DMA engine
+	if(irq) dmChTrIniIssuePend(pbuf -> pch);
+
+	// The transfer was started successfully
+	return 0;
+}
+
+/************************* dmChTrIniSing(pbuf,flags) **************************
+* DMA transfer initialization:
+*	Init DMA single entry transaction
+* Parameters:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(i)flags - DMA transaction control flags
+* Return value:
+*	0  Success. DMA transaction was initialized
+*	-1 Error. Can not init single entry transaction
+*******************************************************************************/
+static int dmChTrIniSing(DM_BUF_t *pbuf, unsigned long flags)
+{
+	DM_CHAN_t *pch;
+	struct dma_chan *dma_chan;
+	dma_addr_t dma_handle;
+	uint32_t trsz;
+	struct dma_async_tx_descriptor *tran_desc;
+
+	// Set the pointer to the channel parameters
+	pch = pbuf -> pch;
+
+	// Get the pointer to the allocated DMA channel
+	dma_chan = pch -> dma_chan;
+
+	// Get DMA buffer physical address (aka DMA handle)
+	dma_handle = pbuf -> dma_buffer_phadd;
+
+	// Get the size of the transactin (b)
+	trsz = pbuf -> len;
+
+	// Init DMA single entry transaction
+	tran_desc = dmaengine_prep_slave_single(
+		dma_chan,dma_handle,trsz,pch -> tr_dir,flags);
+	if(tran_desc == NULL) return -1;		// Can not init single entry transaction
+
+	// Set the pointer to the async DMA transaction descriptor
+	pbuf -> tran_desc = tran_desc;
+
+	// DMA transaction was initialized successfully
+	return 0;
+}
+
+/***************************** dmChTrIniSg(pbuf) ******************************
+* DMA transfer initialization:
+*	Init DMA scatter-gather transaction: one entry per stream frame
+* Each frame gets its own descriptor, such that a frame terminated by the
+*	end of stream packet does not shift the next frames in the buffer
+* Parameters:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(i)flags - DMA transaction control flags
+* Return value:
+*	0  Success. DMA transaction was initialized
+*	-1 Error. Can not init scatter-gather transaction
+*******************************************************************************/
+static int dmChTrIniSg(DM_BUF_t *pbuf, unsigned long flags)
+{
+	DM_CHAN_t *pch;
+	struct scatterlist *sgl;
+	uint32_t frame_sz;
+	uint32_t frames;
+	uint32_t i;
+	struct dma_async_tx_descriptor *tran_desc;
+
+	// Set the pointer to the channel parameters
+	pch = pbuf -> pch;
+
+	// Get transfer geometry: the frames of the data to transfer
+	// (the last frame of the partially filled buffer is shorter)
+	frame_sz = pch -> frame_sz;
+	frames = DIV_ROUND_UP(pbuf -> len, frame_sz);
+
+	// Fill sg list of the (already mapped) buffer: one entry per frame
+	sgl = pbuf -> sgl;
+	sg_init_table(sgl, frames);
+	for(i = 0; i < frames; i++) {
+		sg_dma_address(&sgl[i]) = pbuf -> dma_buffer_phadd + i * frame_sz;
+		sg_dma_len(&sgl[i]) = min(frame_sz, pbuf -> len - i * frame_sz);
+	}
+
+	// Init DMA scatter-gather transaction
+	tran_desc = dmaengine_prep_slave_sg(pch -> dma_chan, sgl, frames,
+		pch -> tr_dir, flags);
+	if(tran_desc == NULL) return -1;		// Can not init sg transaction
+
+	// Set the pointer to the async DMA transaction descriptor
+	pbuf -> tran_desc = tran_desc;
+
+	// DMA transaction was initialized successfully
+	return 0;
+}
+
+/************************** dmChTrIniCallBack(pbuf) ***************************
+* DMA transfer initialization:
+*	Init callback function for "transfer finished" event
+* Parameter:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*******************************************************************************/
+static void dmChTrIniCallBack(DM_BUF_t *pbuf)
+{
+	struct dma_async_tx_descriptor *tran_desc;
+
+	// Get the pointer to the async DMA transaction descriptor
+	tran_desc = pbuf -> tran_desc;
+
+	// Set the routine to call after the operation is complete
+	tran_desc -> callback = dmChTrCallBack;
+
+	// Callback function parameter points to the buffer parameters
+	tran_desc -> callback_param = pbuf;
+}
+
+/*************************** dmChTrIniSubmit(pbuf) ****************************
+* DMA transfer initialization:
+*	Submit DMA transaction to the DMA engine
+* Parameter:
+*	(io)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+* Return value:
+*	0  Success. DMA transaction was submitted to the DMA engine
+*	-1 Error. Can not submit DMA transaction to the DMA engine
+*******************************************************************************/
+static int dmChTrIniSubmit(DM_BUF_t *pbuf)
+{
+	struct dma_async_tx_descriptor *tran_desc;
+	dma_cookie_t cookie;
+
+	// Get the pointer to the async DMA transaction descriptor
+	tran_desc = pbuf -> tran_desc;
+
+	// Submit the transaction to the DMA engine
+	cookie = dmaengine_submit(tran_desc);
+	if(dma_submit_error(cookie))
+		return -1;					// Can not submit DMA transaction to the DMA engine
+
+	// Store the cookie to track the status of this transaction
+	pbuf -> cookie = cookie;
+
+	// DMA transaction was successfuly submitted to the DMA engine
+	return 0;
+}
+
+/************************** dmChTrIniIssuePend(pch) ***************************
+* DMA transfer initialization:
+*	Start the DMA transaction which was submitted to the DMA engine
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChTrIniIssuePend(DM_CHAN_t *pch)
+{
+	struct dma_chan *dma_chan;
+	
+	// Set the pointer to the DMA Engine channel parameters
+	dma_chan = pch -> dma_chan;
+
+	// Start the DMA transaction
+	dma_async_issue_pending(dma_chan);
+}
+
+/****************************** dmChTrWait(pch) *******************************
+* Wait until single DMA transfer is finished
+* The status result of DMA transfer is stored in buffer parameters
+* If the channel timeout expires or the wait is interrupted, the transfer
+*	is stopped with timeout/aborted result code
+* This function can block
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 Success. The transfer is finished (see result code)
+*	-EINTR Error. The wait was interrupted, the transfer was aborted
+*******************************************************************************/
+static int dmChTrWait(DM_CHAN_t *pch)
+{
+	long rc;
+
+	// Wait for the DMA transaction to complete, or error
+	rc = wait_event_interruptible_timeout(pch -> wq, dmChBufDone(pch),
+		dmChTrWaitTmo(pch));
+
+	// Timeout or interrupted wait: stop the transfer
+	if(rc == 0) dmChAbort(pch, _DM_TRAN_RES_TIMEOUT);
+	if(rc < 0) dmChAbort(pch, _DM_TRAN_RES_ABORTED);
+
+	// Take the finished buffer, set DMA transaction result code (for user)
+	dmChBufPop(pch);
+
+	// Return success/error code
+	return (rc < 0) ? -EINTR : 0;
+}
+
+/***************************** dmChTrWaitTmo(pch) *****************************
+* Get DMA transaction timeout for the wait functions
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	Timeout (jiffies), MAX_SCHEDULE_TIMEOUT if the timeout is not set
+*******************************************************************************/
+static long dmChTrWaitTmo(DM_CHAN_t *pch)
+{
+	// Timeout is not set: wait forever
+	if(pch -> timeout_ms == 0) return MAX_SCHEDULE_TIMEOUT;
+
+	// Convert the timeout to jiffies
+	return msecs_to_jiffies(pch -> timeout_ms);
+}
+
+/************************** dmChTrWaitGetStat(pbuf) ***************************
+* Get the status of the DMA transaction
+* The function requests status from DMA Engine
+* Parameter:
+*	(i)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+* Return value:
+*	DMA transaction status
+*******************************************************************************/
+static enum dma_status dmChTrWaitGetStat(DM_BUF_t *pbuf)
+{
+	struct dma_chan *dma_chan;
+	dma_cookie_t cookie;
+
+	// Set the pointer to the DMA Engine channel parameters
+	dma_chan = pbuf -> pch -> dma_chan;
+
+	// Get the cookie to track the status of DMA transaction
+	cookie = pbuf -> cookie;
+
+	// Get DMA transaction status
+	return dma_async_is_tx_complete(dma_chan, cookie, NULL, NULL);
+}
+
+/************************* dmChTrWaitRes(pbuf,status) *************************
+* Set DMA transaction result code - for user
+* The function is called when DMA transaction was completed
+* Parameters:
+*	(o)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(i)status - DMA transaction status (from DMA engine)
+*******************************************************************************/
+static void dmChTrWaitRes(DM_BUF_t *pbuf, enum dma_status status)
+{
+	uint32_t res_code;
+
+	// Make DMA transaction result code 
+	if(status != DMA_COMPLETE)
+		res_code = _DM_TRAN_RES_ERROR;		// DMA transaction error
+	else
+		res_code = _DM_TRAN_RES_SUCCESS;	// Transaction was executed successfully
+
+	// Store DMA transaction result code, the failed transaction gives no data
+	pbuf -> res_code = res_code;
+	pbuf -> residue = (status == DMA_COMPLETE) ? 0 : pbuf -> pch -> trsz;
+}
+
+/************************** dmChResToUser(pbuf,arg) ***************************
+* Copy DMA transaction result code and residue to the user space app
+* Parameters:
+*	(i)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(o)arg - pointer to the user space transaction result buffer
+* Return value:
+*	0 Success. DMA transaction result code was copied to user space
+*	-EFAULT Error. Can not copy transaction result code to user
+*******************************************************************************/
+static int dmChResToUser(DM_BUF_t *pbuf, unsigned long arg)
+{
+	_DM_TRAN_RESULT_t res;
+	unsigned long error_count;
+
+	// Fill the result structure for user
+	res.res_code = pbuf -> res_code;
+	res.residue = pbuf -> residue;
+
+	// Copy result structure to user
+	error_count = copy_to_user((void *)arg, &res, sizeof(_DM_TRAN_RESULT_t));
+	if(error_count != 0)
+		return -EFAULT;	// Failed to copy data to user
+
+	// DMA transaction result code was successfully copied to user space
+	return 0;
+}
+
+/************************** dmChBufToUser(pbuf,arg) ***************************
+* Copy dequeued buffer index, DMA transaction result code and residue
+*	to the user space app
+* Parameters:
+*	(i)pbuf - pointer to the DMA-PROXY channel buffer parameters structure
+*	(o)arg - pointer to the user space buffer structure (_DM_BUF_t)
+* Return value:
+*	0 Success. The buffer structure was copied to user space
+*	-EFAULT Error. Can not copy the buffer structure to user
+*******************************************************************************/
+static int dmChBufToUser(DM_BUF_t *pbuf, unsigned long arg)
+{
+	_DM_BUF_t ubuf;
+	unsigned long error_count;
+
+	// Fill the buffer structure for user
+	ubuf.buf_idx = pbuf -> buf_idx;
+	ubuf.res_code = pbuf -> res_code;
+	ubuf.residue = pbuf -> residue;
+	ubuf.len = pbuf -> pch -> trsz - pbuf -> residue;
+
+	// Copy the buffer structure to user
+	error_count = copy_to_user((void *)arg, &ubuf, sizeof(_DM_BUF_t));
+	if(error_count != 0)
+		return -EFAULT;	// Failed to copy data to user
+
+	// The buffer structure was successfully copied to user space
+	return 0;
+}
+
+/******************************* dmChTerm(pch) ********************************
+* Abort current transfers on DMA channel
+* Waits until the running completion callback of the channel is finished:
+*	no callback can finish a buffer after the abort (the buffers can be
+*	queued again). Must be called without the buffer queue lock.
+* If the channel was not allocated, no activity is performed
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmChTerm(DM_CHAN_t *pch)
+{
+	struct dma_chan *dma_chan;
+
+	// Set the pointer to the DMA Engine channel parameters
+	dma_chan = pch -> dma_chan;
+
+	// Abort current transfers on the channel, wait for the callbacks
+	if(dma_chan != NULL)
+		dmaengine_terminate_sync(dma_chan);
+}
+
+/************************** dmChAbort(pch,res_code) ***************************
+* Stop all active transfers on DMA channel, finish them with the result code
+* The residues of the transfers are read before the channel is terminated.
+*	The stopped buffers are put into the done FIFO in the start order,
+*	the stopped user buffer transaction is marked finished.
+*	Waiting requests are woken up.
+* The function does not need the ioctl mutex: it can stop the transfer
+*	waited by the request which holds the mutex. It is serialized with
+*	the start of the pending buffers.
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)res_code - result code of the stopped transfers
+*				  (_DM_TRAN_RES_TIMEOUT or _DM_TRAN_RES_ABORTED)
+*******************************************************************************/
+static void dmChAbort(DM_CHAN_t *pch, uint32_t res_code)
+{
+	unsigned long flags;
+	DM_BUF_t *pbuf;
+
+	// Nothing to stop if DMA channel was not allocated
+	if(pch -> dma_chan == NULL) return;
+
+	// No pending buffers are started until the transfers are finished
+	mutex_lock(&(pch -> kick_mutex));
+
+	// Lock the buffer queue
+	spin_lock_irqsave(&(pch -> lock), flags);
+
+	// Read the residue of the oldest active buffer: DMA engine works on it,
+	// the younger buffers have received nothing
+	pbuf = dmChBufOldest(pch);
+	if(pbuf != NULL) pbuf -> residue = dmChAbortResidue(pch, pbuf -> cookie);
+
+	// Read the residue of the active user buffer transaction
+	if(pch -> usr.active && !(pch -> usr.done))
+		pch -> usr.residue = dmChAbortResidue(pch, pch -> usr.cookie);
+
+	// Unlock the buffer queue
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Terminate all transfers on DMA channel
+	dmChTerm(pch);
+
+	// Lock the buffer queue
+	spin_lock_irqsave(&(pch -> lock), flags);
+
+	// Finish the stopped transfers
+	dmChAbortBufs(pch, res_code);
+	dmChAbortUsr(pch, res_code);
+
+	// One more abort was executed (finishes the waits without active transfers)
+	pch -> abort_cnt++;
+
+	// Unlock the buffer queue
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Release the start mutex
+	mutex_unlock(&(pch -> kick_mutex));
+
+	// Wake up the waiting requests
+	wake_up_interruptible(&(pch -> wq));
+}
+
+/************************ dmChAbortBufs(pch,res_code) *************************
+* Finish the buffers stopped by dmChAbort: put them into the done FIFO
+*	in the start order. The buffers which were completed by DMA engine
+*	before the channel was terminated are finished successfully.
+*	While streaming is on, the pending buffers (they would be started
+*	next) are finished after the active ones, nothing is received into them.
+* Must be called with the buffer queue locked
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)res_code - result code of the stopped transfers
+*******************************************************************************/
+static void dmChAbortBufs(DM_CHAN_t *pch, uint32_t res_code)
+{
+	DM_BUF_t *pbuf;
+	enum dma_status status;
+	uint32_t buf_idx;
+
+	// Finish the active buffers cycle (the oldest buffer first)
+	while((pbuf = dmChBufOldest(pch)) != NULL) {
+		// Set the result code: the buffer can be completed before termination
+		status = dma_async_is_tx_complete(pch -> dma_chan, pbuf -> cookie,
+			NULL, NULL);
+		if(status == DMA_COMPLETE) {
+			pbuf -> res_code = _DM_TRAN_RES_SUCCESS;
+			pbuf -> residue = 0;
+		}
+		else
+			pbuf -> res_code = res_code;
+
+		// The result is set, it is not requested from DMA engine at dequeue
+		pbuf -> stopped = 1;
+
+		// The buffer is finished, put its index into the done FIFO
+		dmChBufFinish(pbuf);
+	}
+
+	// Finish the pending buffers cycle (only while streaming is on)
+	while(pch -> streaming && pch -> pend_cnt != 0) {
+		// Take the oldest pending buffer
+		buf_idx = pch -> pend_fifo[pch -> pend_rd];
+		pch -> pend_rd = (pch -> pend_rd + 1) % pch -> buf_num;
+		pch -> pend_cnt--;
+		pbuf = &(pch -> buf[buf_idx]);
+
+		// Nothing was received, the result is set
+		pbuf -> res_code = res_code;
+		pbuf -> residue = pch -> trsz;
+		pbuf -> stopped = 1;
+
+		// The buffer is finished, put its index into the done FIFO
+		dmChBufFinish(pbuf);
+	}
+}
+
+/************************* dmChAbortUsr(pch,res_code) *************************
+* Finish the user buffer transaction stopped by dmChAbort
+* Must be called with the buffer queue locked
+* Parameters:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)res_code - result code of the stopped transfer
+*******************************************************************************/
+static void dmChAbortUsr(DM_CHAN_t *pch, uint32_t res_code)
+{
+	DM_USR_t *pusr;
+	enum dma_status status;
+
+	// Set the pointer to the user buffer transaction parameters
+	pusr = &(pch -> usr);
+
+	// Only the active unfinished transaction is stopped
+	if(!(pusr -> active) || pusr -> done) return;
+
+	// Set the result code: the transfer can be completed before termination
+	status = dma_async_is_tx_complete(pch -> dma_chan, pusr -> cookie,
+		NULL, NULL);
+	if(status == DMA_COMPLETE) {
+		pusr -> res_code = _DM_TRAN_RES_SUCCESS;
+		pusr -> residue = 0;
+	}
+	else
+		pusr -> res_code = res_code;
+
+	// The transaction is finished, the result is set
+	pusr -> t_done = ktime_get();
+	pusr -> seq = pch -> seq++;
+	pusr -> stopped = 1;
+	pusr -> done = 1;
+}
+
+/**************************** dmChBufOldest(pch) ******************************
+* Get the oldest active buffer of the buffer queue (by start order):
+*	the first buffer of the active FIFO
+* Must be called with the buffer queue locked
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	Pointer to the buffer parameters structure
+*	NULL - there are no active buffers
+*******************************************************************************/
+static DM_BUF_t *dmChBufOldest(DM_CHAN_t *pch)
+{
+	// There are no active buffers
+	if(pch -> act_cnt == 0) return NULL;
+
+	// Return the pointer to the oldest active buffer
+	return &(pch -> buf[pch -> act_fifo[pch -> act_rd]]);
+}
+
+/********************** dmChAbortResidue(pch,cookie) **************************
+* Read the residue of the active DMA transaction from DMA engine
+* If DMA engine driver reports the residue only for whole transactions,
+*	nothing is considered received
+* Parameters:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)cookie - the cookie of DMA transaction
+* Return value:
+*	Number of bytes not transferred (0..trsz)
+*******************************************************************************/
+static uint32_t dmChAbortResidue(DM_CHAN_t *pch, dma_cookie_t cookie)
+{
+	struct dma_chan *dma_chan;
+	struct dma_tx_state state;
+	enum dma_status status;
 
-	// Init callback function
-	dmChTrIniCallBack(pch);
+	// Set the pointer to the DMA Engine channel parameters
+	dma_chan = pch -> dma_chan;
 
-	// Init DMA transaction complete indicator before using it
-	dmChTrIniCmp(pch);
+	// Get DMA transaction status and residue
+	state.residue = 0;
+	status = dmaengine_tx_status(dma_chan, cookie, &state);
 
-	// Submit DMA transaction to the DMA engine
-	rc = dmChTrIniSubmit(pch);
-	if(rc < 0) return rc;				// Can not submit DMA transaction
+	// The transaction is completed: all data was received
+	if(status == DMA_COMPLETE) return 0;
 
-	// Start the DMA transaction which was submitted to the DMA engine
-	dmChTrIniIssuePend(pch);
+	// The residue of the transaction in progress is not reported
+	if(dma_chan -> device -> residue_granularity ==
+			DMA_RESIDUE_GRANULARITY_DESCRIPTOR)
+		return pch -> trsz;
 
-	// The transfer was started successfully
-	return 0;
+	// Return the residue (limited by the transaction size)
+	return (state.residue < pch -> trsz) ? state.residue : pch -> trsz;
 }
 
-/***************************** dmChTrIniSing(pch) *****************************
-* DMA transfer initialization:
-*	Init DMA single entry transaction
-* Used variable:
-*	(i)dm_ch_trsz - DMA channel transaction sizes array
-* Parameter:
+/******** dmChStatDone(pch,res_code,residue,t_submit,t_done,lat) **************
+* Account the finished transfer in the channel statistics
+* The function is called when the result is taken by user request
+*	(the time of the call is the user wakeup time)
+* Must be called with the buffer queue locked
+* Parameters:
 *	(io)pch - pointer to the DMA-PROXY channel parameters structure
-* Return value:
-*	0  Success. DMA transaction was initialized
-*	-1 Error. Can not init single entry transaction
+*	(i)res_code - DMA transaction result code
+*	(i)residue - number of bytes not transferred
+*	(i)t_submit - transfer submit time
+*	(i)t_done - transfer finished (callback) time
+*	(i)lat - flag: the transfer was finished by DMA engine, the latency
+*			 histograms are updated (1)
 *******************************************************************************/
-static int dmChTrIniSing(DM_CHAN_t *pch)
+static void dmChStatDone(DM_CHAN_t *pch, uint32_t res_code, uint32_t residue,
+	ktime_t t_submit, ktime_t t_done, int lat)
 {
-	struct dma_chan *dma_chan;
-	dma_addr_t dma_handle;
-	uint32_t ch_idx;
-	uint32_t trsz;
-	struct dma_async_tx_descriptor *tran_desc;
+	DM_STAT_t *pstat;
 
-	// Get the pointer to the allocated DMA channel
-	dma_chan = pch -> dma_chan;
+	// Set the pointer to the channel statistics
+	pstat = &(pch -> stat);
 
-	// Get DMA buffer physical address (aka DMA handle)
-	dma_handle = pch -> dma_buffer_phadd;
+	// Count the transfer and the received bytes
+	pstat -> transfers++;
+	pstat -> bytes += pch -> trsz - residue;
 
-	// Get DMA-PROXY channel index
-	ch_idx = pch -> ch_idx;
+	// Count failed transfers by result code
+	if(res_code == _DM_TRAN_RES_ERROR) pstat -> errors++;
+	if(res_code == _DM_TRAN_RES_TIMEOUT) pstat -> timeouts++;
+	if(res_code == _DM_TRAN_RES_ABORTED) pstat -> aborts++;
 
-	// Get the size of the transactin (b)
-	trsz = dm_ch_trsz[ch_idx];
+	// The stopped transfers have no callback time
+	if(!lat) return;
 
-	// Init DMA single entry transaction
-	tran_desc = dmaengine_prep_slave_single(
-		dma_chan,dma_handle,trsz,DMA_DEV_TO_MEM,
-		DMA_CTRL_ACK | DMA_PREP_INTERRUPT);
-	if(tran_desc == NULL) return -1;		// Can not init single entry transaction
+	// Update latency histograms: submit -> callback -> user wakeup
+	dmChStatHist(pstat -> hist_irq, t_submit, t_done);
+	dmChStatHist(pstat -> hist_wake, t_done, ktime_get());
+}
 
-	// Set the pointer to the async DMA transaction descriptor
-	pch -> tran_desc = tran_desc;
+/******************** dmChStatHist(hist,t_from,t_to) **************************
+* Count the time interval in log2 latency histogram
+* Parameters:
+*	(io)hist - latency histogram (DM_HIST_BINS bins)
+*	(i)t_from - interval start time
+*	(i)t_to - interval end time
+*******************************************************************************/
+static void dmChStatHist(uint32_t *hist, ktime_t t_from, ktime_t t_to)
+{
+	s64 ns;
+	uint32_t bin;
 
-	// DMA transaction was initialized successfully
-	return 0;
+	// Get the interval (ns)
+	ns = ktime_to_ns(ktime_sub(t_to, t_from));
+
+	// Bin index: log2 of the interval, limited by the last bin
+	bin = (ns > 0) ? ilog2((u64)ns) : 0;
+	if(bin >= DM_HIST_BINS) bin = DM_HIST_BINS - 1;
+
+	// Count the interval
+	hist[bin]++;
 }
 
-/*************************** dmChTrIniCallBack(pch) ***************************
-* DMA transfer initialization:
-*	Init callback function for "transfer finished" event
-* Parameter:
-*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+/************************* dmDbgStatsOpen(ino,file) ***************************
+* Debugfs "stats" file operations: open function
+* Parameters:
+*	(i)ino  - debugfs file inode (private data - channel parameters)
+*	(io)file - opened file state structure
+* Return value:
+*	0  Success. The file was opened
+*	<0 Error code
 *******************************************************************************/
-static void dmChTrIniCallBack(DM_CHAN_t *pch)
+static int dmDbgStatsOpen(struct inode *ino, struct file *file)
 {
-	struct dma_async_tx_descriptor *tran_desc;
-	struct completion *pcmp;
+	// Show the statistics of the channel by seq_file interface
+	return single_open(file, dmDbgStatsShow, ino -> i_private);
+}
 
-	// Get the pointer to the async DMA transaction descriptor
-	tran_desc = pch -> tran_desc;
+/************************** dmDbgStatsShow(seq,v) *****************************
+* Debugfs "stats" file operations: print channel statistics
+* The statistics are copied under the lock and printed from the copy
+* Parameters:
+*	(io)seq - seq_file structure (private - channel parameters)
+*	(i)v - not used
+* Return value:
+*	0 Always
+*******************************************************************************/
+static int dmDbgStatsShow(struct seq_file *seq, void *v)
+{
+	DM_CHAN_t *pch;
+	DM_STAT_t stat;
+	DM_RDR_t *prdr;
+	unsigned long flags;
+
+	// Set the pointer to the channel parameters
+	pch = seq -> private;
+
+	// Copy the statistics
+	spin_lock_irqsave(&(pch -> lock), flags);
+	stat = pch -> stat;
+	spin_unlock_irqrestore(&(pch -> lock), flags);
+
+	// Print transfer counters
+	seq_printf(seq, "channel:   %s\n", pch -> name);
+	seq_printf(seq, "trsz:      %u\n", pch -> trsz);
+	seq_printf(seq, "transfers: %llu\n", stat.transfers);
+	seq_printf(seq, "bytes:     %llu\n", stat.bytes);
+	seq_printf(seq, "errors:    %llu\n", stat.errors);
+	seq_printf(seq, "timeouts:  %llu\n", stat.timeouts);
+	seq_printf(seq, "aborts:    %llu\n", stat.aborts);
+	seq_printf(seq, "batches:   %u (%u per interrupt)\n", pch -> batch_seq,
+		pch -> coal_cnt);
+	seq_printf(seq, "overrun:   %s drops %llu stalls %llu\n",
+		(pch -> ovr_policy == _DM_OVR_BLOCK) ? "block" :
+		(pch -> ovr_policy == _DM_OVR_DROP_OLDEST) ? "drop-oldest" : "drop-newest",
+		stat.drops, stat.stalls);
+	if(pch -> rt_worker != NULL && pch -> rt_irq != 0)
+		seq_printf(seq, "rt:        cpu %u prio %u irq %u\n", pch -> rt_cpu,
+			pch -> rt_prio, pch -> rt_irq);
+	else if(pch -> rt_worker != NULL)
+		seq_printf(seq, "rt:        cpu %u prio %u (irq not bound)\n",
+			pch -> rt_cpu, pch -> rt_prio);
+	else
+		seq_printf(seq, "rt:        off (system workqueue)\n");
+
+	// Print the recorder counters
+	if(READ_ONCE(pch -> rec.task) != NULL)
+		seq_printf(seq, "recorder:  bytes %llu frames %llu errors %llu wr_err %d\n",
+			pch -> rec.bytes, pch -> rec.frames, pch -> rec.errors,
+			pch -> rec.wr_err);
+
+	// Print readers (frames read, lost, received frames not read yet)
+	mutex_lock(&(pch -> fan_mutex));
+	seq_printf(seq, "readers:   %u\n", pch -> rdr_cnt);
+	list_for_each_entry(prdr, &(pch -> rdr_list), list)
+		seq_printf(seq, "  frames %llu lost %llu lag %u\n",
+			prdr -> frames, prdr -> lost, pch -> fan_head - prdr -> seq);
+	mutex_unlock(&(pch -> fan_mutex));
+
+	// Print latency histograms
+	dmDbgStatsHist(seq, "submit->irq", stat.hist_irq);
+	dmDbgStatsHist(seq, "irq->wakeup", stat.hist_wake);
+	dmDbgStatsHist(seq, "irq->restart", stat.hist_kick);
+
+	// The statistics were printed
+	return 0;
+}
 
-	// Get the pointer to DMA transaction complete indicator
-	pcmp = &(pch -> cmp);
+/******************** dmDbgStatsHist(seq,title,hist) **************************
+* Print log2 latency histogram: one line for each non-empty bin,
+*	"<lower bound ns> <count>"
+* Parameters:
+*	(io)seq - seq_file structure
+*	(i)title - histogram title
+*	(i)hist - latency histogram (DM_HIST_BINS bins)
+*******************************************************************************/
+static void dmDbgStatsHist(struct seq_file *seq, const char *title,
+	uint32_t *hist)
+{
+	uint32_t bin;
 
-	// Set the routine to call after the operation is complete
-	tran_desc -> callback = dmChTrCallBack;
+	// Print the title
+	seq_printf(seq, "%s latency (ns >= : count)\n", title);
 
-	// Callback function parameter points to DMA transaction complete indicator
-	tran_desc -> callback_param = pcmp;
+	// Print non-empty bins
+	for(bin = 0; bin < DM_HIST_BINS; bin++)
+		if(hist[bin] != 0)
+			seq_printf(seq, "  %12llu : %u\n", 1ULL << bin, hist[bin]);
 }
 
-/***************************** dmChTrIniCmp(pch) ******************************
-* DMA transfer initialization:
-*	Init DMA transaction complete indicator
-* Parameter:
-*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+/**************** dmDbgResetWrite(file,buf,count,ppos) ************************
+* Debugfs "reset" file operations: clear channel statistics
+* Any written data clears the statistics
+* Parameters:
+*	(i)file - opened file state structure (private data - channel parameters)
+*	(i)buf - user data (not used)
+*	(i)count - user data size
+*	(io)ppos - file position (not used)
+* Return value:
+*	count - all the data was accepted
 *******************************************************************************/
-static void dmChTrIniCmp(DM_CHAN_t *pch)
+static ssize_t dmDbgResetWrite(struct file *file, const char __user *buf,
+	size_t count, loff_t *ppos)
 {
-	struct completion *pcmp;
+	DM_CHAN_t *pch;
+	unsigned long flags;
+
+	// Set the pointer to the channel parameters
+	pch = file -> private_data;
 
-	// Set the pointer to DMA transaction complete indicator
-	pcmp = &(pch -> cmp);
+	// Clear the statistics
+	spin_lock_irqsave(&(pch -> lock), flags);
+	memset(&(pch -> stat), 0, sizeof(DM_STAT_t));
+	spin_unlock_irqrestore(&(pch -> lock), flags);
 
-	// Initialize the completion structure
-	init_completion(pcmp);
+	// All the data was accepted
+	return count;
 }
 
-/**************************** dmChTrIniSubmit(pch) ****************************
-* DMA transfer initialization:
-*	Submit DMA transaction to the DMA engine
-* Parameter:
-*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+/*********************** dmExpAttach(dmabuf,dev,attach) ***********************
+* Exported buffer (dma-buf) operations: attach the importer device
+* Creates scatter-gather table of the buffer for the importer
+* Parameters:
+*	(i)dmabuf - exported buffer
+*	(i)dev - importer device
+*	(io)attach - attachment of the importer
 * Return value:
-*	0  Success. DMA transaction was submitted to the DMA engine
-*	-1 Error. Can not submit DMA transaction to the DMA engine
+*	0 Success. The importer was attached
+*	<0 Error code. No memory
 *******************************************************************************/
-static int dmChTrIniSubmit(DM_CHAN_t *pch)
+static int dmExpAttach(struct dma_buf *dmabuf, struct device *dev,
+	struct dma_buf_attachment *attach)
 {
-	struct dma_async_tx_descriptor *tran_desc;
-	dma_cookie_t cookie;
+	DM_BUF_t *pbuf;
+	DM_CHAN_t *pch;
+	DM_EXP_ATT_t *patt;
+	int rc;
 
-	// Get the pointer to the async DMA transaction descriptor
-	tran_desc = pch -> tran_desc;
+	// Set the pointers to the exported buffer and its channel parameters
+	pbuf = dmabuf -> priv;
+	pch = pbuf -> pch;
 
-	// Submit the transaction to the DMA engine
-	cookie = dmaengine_submit(tran_desc);
-	if(dma_submit_error(cookie))
-		return -1;					// Can not submit DMA transaction to the DMA engine
+	// Allocate attachment parameters
+	patt = kzalloc(sizeof(DM_EXP_ATT_t), GFP_KERNEL);
+	if(patt == NULL) return -ENOMEM;
 
-	// Store the cookie to track the status of this transaction
-	pch -> cookie = cookie;
+	// Create scatter-gather table of the buffer memory
+	if(pch -> mem_mode == _DM_MEM_CACHED) {
+		// Physically contiguous pages of the buffer
+		rc = sg_alloc_table(&(patt -> sgt), 1, GFP_KERNEL);
+		if(rc == 0)
+			sg_set_page(patt -> sgt.sgl, pbuf -> pages, pch -> buf_stride, 0);
+	}
+	else
+		// Part of coherent memory
+		rc = dma_get_sgtable(pch -> dev, &(patt -> sgt), pbuf -> dma_buffer,
+			pbuf -> dma_buffer_phadd, pch -> buf_stride);
+	if(rc < 0) {
+		// Can not create the table
+		kfree(patt);
+		return rc;
+	}
 
-	// DMA transaction was successfuly submitted to the DMA engine
+	// The table is not mapped for the importer yet
+	patt -> dir = DMA_NONE;
+	attach -> priv = patt;
+
+	// The importer was attached successfully
 	return 0;
 }
 
-/************************** dmChTrIniIssuePend(pch) ***************************
-* DMA transfer initialization:
-*	Start the DMA transaction which was submitted to the DMA engine
-* Parameter:
-*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+/************************* dmExpDetach(dmabuf,attach) *************************
+* Exported buffer (dma-buf) operations: detach the importer device
+* Unmaps and frees scatter-gather table of the importer
+* Parameters:
+*	(i)dmabuf - exported buffer
+*	(io)attach - attachment of the importer
 *******************************************************************************/
-static void dmChTrIniIssuePend(DM_CHAN_t *pch)
+static void dmExpDetach(struct dma_buf *dmabuf,
+	struct dma_buf_attachment *attach)
 {
-	struct dma_chan *dma_chan;
-	
-	// Set the pointer to the DMA Engine channel parameters
-	dma_chan = pch -> dma_chan;
+	DM_EXP_ATT_t *patt;
 
-	// Start the DMA transaction
-	dma_async_issue_pending(dma_chan);
+	// Set the pointer to the attachment parameters
+	patt = attach -> priv;
+
+	// Unmap the table if it was mapped for the importer
+	if(patt -> dir != DMA_NONE)
+		dma_unmap_sg(attach -> dev, patt -> sgt.sgl, patt -> sgt.orig_nents,
+			patt -> dir);
+
+	// Free the table and attachment parameters
+	sg_free_table(&(patt -> sgt));
+	kfree(patt);
+	attach -> priv = NULL;
 }
 
-/****************************** dmChTrWait(pch) *******************************
-* Wait until DMA transfer is finished
-* The status result of DMA transfer is stored in channel parameters
-* This function can block
-* Parameter:
-*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+/**************************** dmExpMap(attach,dir) ****************************
+* Exported buffer (dma-buf) operations: map the buffer for importer device
+* The mapping is kept until the importer is detached (or mapped in the
+*	other direction)
+* Parameters:
+*	(io)attach - attachment of the importer
+*	(i)dir - mapping direction
+* Return value:
+*	Pointer to the mapped scatter-gather table
+*	ERR_PTR(-ENOMEM) - can not map the table
 *******************************************************************************/
-static void dmChTrWait(DM_CHAN_t *pch)
+static struct sg_table *dmExpMap(struct dma_buf_attachment *attach,
+	enum dma_data_direction dir)
 {
-	enum dma_status status;
+	DM_EXP_ATT_t *patt;
+	int nents;
+
+	// Set the pointer to the attachment parameters
+	patt = attach -> priv;
+
+	// The table is already mapped in this direction
+	if(patt -> dir == dir) return &(patt -> sgt);
+
+	// Unmap the table mapped in the other direction
+	if(patt -> dir != DMA_NONE)
+		dma_unmap_sg(attach -> dev, patt -> sgt.sgl, patt -> sgt.orig_nents,
+			patt -> dir);
+	patt -> dir = DMA_NONE;
+
+	// Map the table for the importer device
+	nents = dma_map_sg(attach -> dev, patt -> sgt.sgl, patt -> sgt.orig_nents,
+		dir);
+	if(nents == 0) return ERR_PTR(-ENOMEM);		// Can not map the table
+	patt -> sgt.nents = nents;
+	patt -> dir = dir;
+
+	// Return the pointer to the mapped table
+	return &(patt -> sgt);
+}
 
-	// Wait for the DMA transaction to complete, or error
-	dmChTrWaitCmp(pch);
+/************************* dmExpUnmap(attach,sgt,dir) *************************
+* Exported buffer (dma-buf) operations: unmap the buffer for importer device
+* No activity: the mapping is kept until the importer is detached
+* Parameters:
+*	(i)attach - attachment of the importer
+*	(i)sgt - mapped scatter-gather table
+*	(i)dir - mapping direction
+*******************************************************************************/
+static void dmExpUnmap(struct dma_buf_attachment *attach,
+	struct sg_table *sgt, enum dma_data_direction dir)
+{
+}
 
-	// Get the status of the DMA transaction
-	status = dmChTrWaitGetStat(pch);
+/**************************** dmExpRelease(dmabuf) ****************************
+* Exported buffer (dma-buf) operations: release the exported buffer
+* The function is called when the last reference to dma-buf is dropped
+* Parameter:
+*	(i)dmabuf - exported buffer
+*******************************************************************************/
+static void dmExpRelease(struct dma_buf *dmabuf)
+{
+	DM_BUF_t *pbuf;
+
+	// Set the pointer to the exported buffer parameters
+	pbuf = dmabuf -> priv;
 
-	// Set DMA transaction result code (for user)
-	dmChTrWaitRes(pch, status);
+	// Uncount the export: the memory can be reallocated or freed
+	dmChMapPut(pbuf -> pch);
 }
 
-/***************************** dmChTrWaitCmp(pch) *****************************
-* Wait for the DMA transaction to complete or error
-* This function can block
-* Parameter:
-*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+/************************** dmExpCpuBeg(dmabuf,dir) ***************************
+* Exported buffer (dma-buf) operations: begin CPU access to the buffer
+* In cached memory mode the buffer is synchronized for CPU
+* Parameters:
+*	(i)dmabuf - exported buffer
+*	(i)dir - access direction
+* Return value:
+*	0 Success. The buffer was synchronized
 *******************************************************************************/
-static void dmChTrWaitCmp(DM_CHAN_t *pch)
+static int dmExpCpuBeg(struct dma_buf *dmabuf, enum dma_data_direction dir)
 {
-	struct completion *pcmp;
+	DM_BUF_t *pbuf;
+	DM_CHAN_t *pch;
 
-	// Set the pointer to DMA transaction complete indicator
-	pcmp = &(pch -> cmp);
+	// Set the pointers to the exported buffer and its channel parameters
+	pbuf = dmabuf -> priv;
+	pch = pbuf -> pch;
 
-	// Wait for the transaction to complete or error
-	wait_for_completion(pcmp);
+	// Synchronize the buffer for CPU (cached memory mode only)
+	if(pch -> mem_mode == _DM_MEM_CACHED)
+		dma_sync_single_for_cpu(pch -> dev, pbuf -> dma_buffer_phadd,
+			pch -> buf_stride, pch -> dma_dir);
+
+	// The buffer was synchronized successfully
+	return 0;
 }
 
-/*************************** dmChTrWaitGetStat(pch) ***************************
-* Get the status of the DMA transaction
-* The function requests status from DMA Engine
-* Parameter:
-*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+/************************** dmExpCpuEnd(dmabuf,dir) ***************************
+* Exported buffer (dma-buf) operations: end CPU access to the buffer
+* In cached memory mode the buffer is synchronized for DMA device
+* Parameters:
+*	(i)dmabuf - exported buffer
+*	(i)dir - access direction
 * Return value:
-*	DMA transaction status
+*	0 Success. The buffer was synchronized
 *******************************************************************************/
-static enum dma_status dmChTrWaitGetStat(DM_CHAN_t *pch)
+static int dmExpCpuEnd(struct dma_buf *dmabuf, enum dma_data_direction dir)
 {
-	struct dma_chan *dma_chan;
-	dma_cookie_t cookie;
+	DM_BUF_t *pbuf;
+	DM_CHAN_t *pch;
 
-	// Set the pointer to the DMA Engine channel parameters
-	dma_chan = pch -> dma_chan;
+	// Set the pointers to the exported buffer and its channel parameters
+	pbuf = dmabuf -> priv;
+	pch = pbuf -> pch;
 
-	// Get the cookie to track the status of DMA transaction
-	cookie = pch -> cookie;
+	// Synchronize the buffer for DMA device (cached memory mode only)
+	if(pch -> mem_mode == _DM_MEM_CACHED)
+		dma_sync_single_for_device(pch -> dev, pbuf -> dma_buffer_phadd,
+			pch -> buf_stride, pch -> dma_dir);
 
-	// Get DMA transaction status
-	return dma_async_is_tx_complete(dma_chan, cookie, NULL, NULL);
+	// The buffer was synchronized successfully
+	return 0;
 }
 
-/************************* dmChTrWaitRes(pch,status) **************************
-* Set DMA transaction result code - for user
-* The function is called when DMA transaction was completed
+/************************* dmExpKmap(dmabuf,page_num) *************************
+* Exported buffer (dma-buf) operations: map the page of the buffer into
+*	kernel space (the buffer is always mapped, also in atomic context)
 * Parameters:
-*	(o)pch - pointer to the DMA-PROXY channel parameters structure
-*	(i)status - DMA transaction status (from DMA engine)
+*	(i)dmabuf - exported buffer
+*	(i)page_num - page number in the buffer
+* Return value:
+*	Kernel space address of the page
 *******************************************************************************/
-static void dmChTrWaitRes(DM_CHAN_t *pch, enum dma_status status)
+static void *dmExpKmap(struct dma_buf *dmabuf, unsigned long page_num)
 {
-	uint32_t res_code;
+	DM_BUF_t *pbuf;
 
-	// Make DMA transaction result code 
-	if(status != DMA_COMPLETE)
-		res_code = _DM_TRAN_RES_ERROR;		// DMA transaction error
-	else
-		res_code = _DM_TRAN_RES_SUCCESS;	// Transaction was executed successfully
+	// Set the pointer to the exported buffer parameters
+	pbuf = dmabuf -> priv;
 
-	// Store DMA transaction result code
-	dmChTrStResCode(pch,res_code);
+	// Return the address of the page
+	return pbuf -> dma_buffer + page_num * PAGE_SIZE;
 }
 
-/*********************** dmChTrStResCode(pch,res_code) ************************
-* Store DMA transaction result code in channel parameters structure
+/********************* dmExpKunmap(dmabuf,page_num,vaddr) *********************
+* Exported buffer (dma-buf) operations: unmap the page of the buffer from
+*	kernel space (no activity, the buffer is always mapped)
 * Parameters:
-*	(i)pch - pointer to the DMA-PROXY channel parameters structure
-*	(i)res_code - result code to store
+*	(i)dmabuf - exported buffer
+*	(i)page_num - page number in the buffer
+*	(i)vaddr - kernel space address of the page
 *******************************************************************************/
-static void dmChTrStResCode(DM_CHAN_t *pch, uint32_t res_code)
+static void dmExpKunmap(struct dma_buf *dmabuf, unsigned long page_num,
+	void *vaddr)
 {
-	pch -> res_code = res_code;
 }
 
-/*************************** dmChResToUser(pch,arg) ***************************
-* Copy DMA transaction result code to the user space app
+/*************************** dmExpMmap(dmabuf,vma) ****************************
+* Exported buffer (dma-buf) operations: map the buffer into user space
+* The offset and the size of the area are checked by dma-buf core
 * Parameters:
-*	(i)pch - pointer to the DMA-PROXY channel parameters structure
-*	(o)arg - pointer to the user space transaction result buffer
+*	(i)dmabuf - exported buffer
+*	(io)vma - user space virtual memory area parameters structure
 * Return value:
-*	0 Success. DMA transaction result code was copied to user space
-*	-EFAULT Error. Can not copy transaction result code to user
+*	0  Success. The buffer was mapped
+*	<0 Error code (from the mapping function)
 *******************************************************************************/
-static int dmChResToUser(DM_CHAN_t *pch, unsigned long arg)
+static int dmExpMmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
 {
-	uint32_t res_code;
-	unsigned long error_count;
+	DM_BUF_t *pbuf;
+	DM_CHAN_t *pch;
+	unsigned long pfn;
 
-	// Get DMA transaction result code
-	res_code = pch -> res_code;
+	// Set the pointers to the exported buffer and its channel parameters
+	pbuf = dmabuf -> priv;
+	pch = pbuf -> pch;
 
-	// Copy result code to user
-	error_count = copy_to_user((void *)arg, &res_code, sizeof(uint32_t));
-	if(error_count != 0)
-		return -EFAULT;	// Failed to copy data to user
+	// Map coherent memory of the buffer
+	if(pch -> mem_mode != _DM_MEM_CACHED)
+		return dma_mmap_coherent(pch -> dev, vma, pbuf -> dma_buffer,
+			pbuf -> dma_buffer_phadd, pch -> buf_stride);
 
-	// DMA transaction result code was successfully copied to user space
-	return 0;
+	// Map cacheable pages of the buffer (default page protection)
+	pfn = page_to_pfn(pbuf -> pages) + vma -> vm_pgoff;
+	return remap_pfn_range(vma, vma -> vm_start, pfn,
+		vma -> vm_end - vma -> vm_start, vma -> vm_page_prot);
 }
 
-/******************************* dmChTerm(pch) ********************************
-* Abort current transfers on DMA channel
-* If the channel was not allocated, no activity is performed
-* Used variable:
-*	(i)dm_parm - DMA-PROXY parameters
+/***************************** dmExpVmap(dmabuf) ******************************
+* Exported buffer (dma-buf) operations: map the buffer into kernel space
 * Parameter:
-*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*	(i)dmabuf - exported buffer
+* Return value:
+*	Kernel space address of the buffer (the buffer is always mapped)
 *******************************************************************************/
-static void dmChTerm(DM_CHAN_t *pch)
+static void *dmExpVmap(struct dma_buf *dmabuf)
 {
-	struct dma_chan *dma_chan;
+	DM_BUF_t *pbuf;
 
-	// Set the pointer to the DMA Engine channel parameters
-	dma_chan = pch -> dma_chan;
+	// Set the pointer to the exported buffer parameters
+	pbuf = dmabuf -> priv;
 
-	// Abort current transfers on the channel
-	if(dma_chan != NULL)
-		dma_chan -> device -> device_terminate_all(dma_chan);
+	// Return the address of the buffer
+	return pbuf -> dma_buffer;
 }
 
-/******************************** dmFreeAll() *********************************
-* Free all resources associated with DMA-PROXY
+/******************************* dmFreeAll(pdm) *******************************
+* Free all resources associated with DMA-PROXY instance
 * The function is called from DMA-PROXY remove function
 * It is also called from DMA-PROXY probe function in case of errors
-* Used variable:
-*	(io)dm_parm - DMA-PROXY parameters
+* Parameter:
+*	(io)pdm - DMA-PROXY instance parameters
 *******************************************************************************/
-static void dmFreeAll(void)
+static void dmFreeAll(DM_PARM_t *pdm)
 {
 	uint32_t ch_idx;
 	DM_CHAN_t *pch;
+	int keep;
 
 	// Free channel resources cycle
-	for(ch_idx = 0; ch_idx < _DM_CH_NUM; ch_idx++) {
+	keep = 0;
+	for(ch_idx = 0; ch_idx < pdm -> ch_num; ch_idx++) {
 		// Set the pointer to the DMA-PROXY channel parameters
-		pch = &dm_parm.ch[ch_idx];
+		pch = &(pdm -> ch[ch_idx]);
 
 		// Free resources of the current channel
-		dmFreeCh(pch);
+		if(dmFreeCh(pch) != 0) keep = 1;
 	}
+
+	// The channel parameters are used by the memory kept by user space
+	if(keep) devm_remove_action(pdm -> dev, dmFreeDevKv, pdm -> ch);
 }
 
 /******************************* dmFreeCh(pch) ********************************
 * Free all resources associated with one DMA channel
-* Used variable:
-*	(io)dm_parm - DMA-PROXY parameters
+* The memory referenced by user space (mappings, dma-bufs, pipe buffers)
+*	is waited for DM_FREE_WAIT_MS at most. Then the mappings of the device
+*	file are revoked and the memory is not freed (leaked): the release
+*	can not be blocked by user space. The channel parameters are kept too:
+*	the last users release their references there.
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
+* Return value:
+*	0 The resources were freed
+*	1 The memory and the parameters are kept (used by user space)
 *******************************************************************************/
-static void dmFreeCh(DM_CHAN_t *pch)
+static int dmFreeCh(DM_CHAN_t *pch)
 {
-	// Abort current transfers on DMA channel
-	dmChTerm(pch);
+	int keep;
+
+	// Remove statistics files (they access the channel parameters)
+	dmFreeChDbg(pch);
+
+	// Stop the recorder and streaming: abort current transfers,
+	// pending buffers are not started
+	dmChRecStop(pch);
+	dmChStrmOff(pch);
+	cancel_work_sync(&(pch -> kick_work));
+	cancel_delayed_work_sync(&(pch -> coal_work));
+
+	// Destroy the real-time completion worker
+	dmFreeChRt(pch);
 
 	// Free all resources associated with character device
 	dmFreeChDev(pch);
 
-	// Free the memory allocated for DMA operations
-	dmFreeChMem(pch);
+	// Wait until the memory is not referenced: user space mappings,
+	// exported dma-bufs and pipe buffers (the module can not be unloaded
+	// while they exist, the device can be unbound)
+	keep = 0;
+	if(!wait_event_timeout(pch -> wq, atomic_read(&(pch -> map_cnt)) == 0,
+			msecs_to_jiffies(DM_FREE_WAIT_MS))) {
+		// User space keeps the memory: revoke the mappings of the device
+		// file (the access faults), the memory is left allocated for
+		// the importers and pipes (the release is not blocked)
+		WARN(1, "%s: %d users keep the memory, it is not freed\n",
+			pch -> name, atomic_read(&(pch -> map_cnt)));
+		if(pch -> map_space != NULL)
+			unmap_mapping_range(pch -> map_space, 0, 0, 1);
+		dmFreeChKeep(pch);
+		keep = 1;
+	}
+	else {
+		// Free the memory allocated for DMA operations
+		dmFreeChMem(pch);
+
+		// Free buffer metadata pages
+		dmFreeChMeta(pch);
+	}
 
 	// Release allocated DMA channel
 	dmFreeChRelease(pch);
+
+	// Return the flag: the memory is kept
+	return keep;
+}
+
+/****************************** dmFreeChDbg(pch) ******************************
+* Remove debugfs directory of the channel with statistics files
+* The directory is removed only if it was created
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmFreeChDbg(DM_CHAN_t *pch)
+{
+	// Remove the directory if it was created
+	if(pch -> dbg_dir != NULL)
+		debugfs_remove_recursive(pch -> dbg_dir);
+
+	// Clear the pointer to the directory
+	pch -> dbg_dir = NULL;
 }
 
 /****************************** dmFreeChDev(pch) ******************************
 * Free all resources associated with character device
 * Used variables:
 *	(i)module_parm - module parameters
-*	(io)dm_parm - DMA-PROXY parameters
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 *******************************************************************************/
@@ -1344,7 +7313,6 @@ static void dmFreeChDev(DM_CHAN_t *pch)
 * Destroy character device
 * Used variables:
 *	(i)module_parm - module parameters
-*	(io)dm_parm - DMA-PROXY parameters
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 *******************************************************************************/
@@ -1372,8 +7340,6 @@ static void dmFreeChDevDest(DM_CHAN_t *pch)
 
 /**************************** dmFreeChDevCdev(pch) ****************************
 * Remove character device from kernel
-* Used variable:
-*	(io)dm_parm - DMA-PROXY parameters
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 *******************************************************************************/
@@ -1398,8 +7364,6 @@ static void dmFreeChDevCdev(DM_CHAN_t *pch)
 /*************************** dmFreeChDevRegion(pch) ***************************
 * Unregister character device region
 * (Free allocated character device major and minor numbers)
-* Used variable:
-*	(io)dm_parm - DMA-PROXY parameters
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 *******************************************************************************/
@@ -1423,28 +7387,28 @@ static void dmFreeChDevRegion(DM_CHAN_t *pch)
 
 /****************************** dmFreeChMem(pch) ******************************
 * Free the memory allocated for DMA operations
-* Used variable:
-*	(io)dm_parm - DMA-PROXY parameters
-*	(i)dm_ch_trsz - DMA channel transaction sizes array
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 *******************************************************************************/
 static void dmFreeChMem(DM_CHAN_t *pch)
 {
 	struct device *dev;
-	uint32_t ch_idx;
-	uint32_t trsz;
+	uint32_t mem_sz;
 	dma_addr_t dma_handle;
 	uint8_t *dma_buffer;
+	uint32_t buf_idx;
 
-	// Set the pointer to the DMA-PROXY device structure
-	dev = dm_parm.dev;
+	// Free separately allocated buffers in cached memory mode
+	if(pch -> mem_mode == _DM_MEM_CACHED) {
+		dmFreeChMemCached(pch);
+		return;
+	}
 
-	// Get DMA-PROXY channel index
-	ch_idx = pch -> ch_idx;
+	// Set the pointer to the DMA-PROXY device structure
+	dev = pch -> dev;
 
 	// Get the size of the allocated memory (b)
-	trsz = dm_ch_trsz[ch_idx];
+	mem_sz = pch -> dma_mem_sz;
 
 	// Get DMA buffer physical address (aka DMA handle)
 	dma_handle = pch -> dma_buffer_phadd;
@@ -1454,16 +7418,90 @@ static void dmFreeChMem(DM_CHAN_t *pch)
 
 	// Free allocated coherent memory 
 	if(dma_buffer != NULL)
-		dmam_free_coherent(dev,trsz,dma_buffer, dma_handle);
+		dmam_free_coherent(dev,mem_sz,dma_buffer, dma_handle);
 
-	// Clear DMA buffer memory pointer
+	// Clear DMA memory pointers
 	pch -> dma_buffer = NULL;
+	pch -> dma_mem_sz = 0;
+	for(buf_idx = 0; buf_idx < pch -> buf_num; buf_idx++)
+		pch -> buf[buf_idx].dma_buffer = NULL;
+}
+
+/*************************** dmFreeChMemCached(pch) ***************************
+* Free the memory allocated for DMA operations in cached memory mode
+* Each allocated buffer is unmapped and freed
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmFreeChMemCached(DM_CHAN_t *pch)
+{
+	DM_BUF_t *pbuf;
+	uint32_t buf_idx;
+	uint32_t order;
+
+	// Calculate the order of pages block of one buffer
+	order = get_order(pch -> buf_stride);
+
+	// Free buffers cycle
+	for(buf_idx = 0; buf_idx < pch -> buf_num; buf_idx++) {
+		// Set the pointer to the buffer parameters
+		pbuf = &(pch -> buf[buf_idx]);
+
+		// Skip the buffers which were not allocated
+		if(pbuf -> pages == NULL) continue;
+
+		// Unmap and free the buffer
+		dma_unmap_single(pch -> dev, pbuf -> dma_buffer_phadd,
+			PAGE_SIZE << order, pch -> dma_dir);
+		__free_pages(pbuf -> pages, order);
+
+		// Clear buffer memory pointers
+		pbuf -> pages = NULL;
+		pbuf -> dma_buffer = NULL;
+		pbuf -> cpu_owned = 0;
+	}
+
+	// The memory is not allocated
+	pch -> dma_mem_sz = 0;
+}
+
+/***************************** dmFreeChMeta(pch) ******************************
+* Free buffer metadata pages
+* The pages are freed only if they were allocated
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmFreeChMeta(DM_CHAN_t *pch)
+{
+	// Free the pages if they were allocated
+	if(pch -> meta != NULL)
+		free_pages((unsigned long)pch -> meta, get_order(pch -> meta_sz));
+
+	// Clear the pointer to the pages
+	pch -> meta = NULL;
+}
+
+/****************************** dmFreeChRt(pch) *******************************
+* Destroy the real-time completion worker, clear the interrupt affinity hint
+* Parameter:
+*	(io)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmFreeChRt(DM_CHAN_t *pch)
+{
+	// Clear the affinity hint (the interrupt keeps its affinity)
+	if(pch -> rt_irq != 0) irq_set_affinity_hint(pch -> rt_irq, NULL);
+	pch -> rt_irq = 0;
+
+	// Destroy the worker (the queued work is finished first)
+	if(pch -> rt_worker != NULL) {
+		kthread_cancel_work_sync(&(pch -> rt_work));
+		kthread_destroy_worker(pch -> rt_worker);
+	}
+	pch -> rt_worker = NULL;
 }
 
 /**************************** dmFreeChRelease(pch) ****************************
 * Release allocated DMA channel
-* Used variable:
-*	(io)dm_parm - DMA-PROXY parameters
 * Parameter:
 *	(i)pch - pointer to the DMA-PROXY channel parameters structure
 *******************************************************************************/
@@ -1482,6 +7520,49 @@ static void dmFreeChRelease(DM_CHAN_t *pch)
 	pch -> dma_chan = NULL;
 }
 
+
+/***************************** dmFreeChKeep(pch) ******************************
+* Keep the buffer parameters and FIFOs of the channel after the device
+*	release: the memory of the channel is still used by user space, the
+*	last users release their references there (the memory is leaked)
+* Parameter:
+*	(i)pch - pointer to the DMA-PROXY channel parameters structure
+*******************************************************************************/
+static void dmFreeChKeep(DM_CHAN_t *pch)
+{
+	// Cancel the device managed free of the channel arrays
+	devm_remove_action(pch -> dev, dmFreeDevKv, pch -> buf);
+	devm_remove_action(pch -> dev, dmFreeDevKv, pch -> done_fifo);
+	devm_remove_action(pch -> dev, dmFreeDevKv, pch -> pend_fifo);
+	devm_remove_action(pch -> dev, dmFreeDevKv, pch -> act_fifo);
+	devm_remove_action(pch -> dev, dmFreeDevKv, pch -> fan);
+}
+
+/***************************** dmFreeDevRmem(data) ****************************
+* Release the reserved memory region assigned to DMA-PROXY device
+* Device managed action: it is called when the device is released,
+*	after the coherent memory allocated from the region was freed
+* Parameter:
+*	(i)data - pointer to the DMA-PROXY device structure
+*******************************************************************************/
+static void dmFreeDevRmem(void *data)
+{
+	// Release the region
+	of_reserved_mem_device_release((struct device *)data);
+}
+
+/****************************** dmFreeDevKv(data) *****************************
+* Free the memory allocated by kvzalloc (channel parameters and arrays)
+* Device managed action: it is called when the device is released
+* Parameter:
+*	(i)data - pointer to the memory to free
+*******************************************************************************/
+static void dmFreeDevKv(void *data)
+{
+	// Free the memory
+	kvfree(data);
+}
+
 /******************************************************************************
 * A module must use the "module_init" "module_exit" macros from linux/init.h,
 *	which identify the initialization function at insertion time, 
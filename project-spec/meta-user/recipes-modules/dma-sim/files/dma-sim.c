@@ -0,0 +1,1190 @@
+/*================================ ZYNQBOARD ==================================
+*	PROJECT:	ZYNQ3 v1:	 "ZynqBoard software (Xilinx Zynq-7000, Linux) "
+*	FILE:		dma-sim.c
+*	CONTENTS:	Kernel module. Synthetic DMA Engine provider (DMA-SIM).
+*				Replaces the PL DMA channels (axi_dma_0, axi_dma_sc36) for
+*				dma-mod and dma-uapp load tests without the ZynqBoard: the
+*				receive transfers are filled with synthetic 48x48 pixel frames
+*				at the programmed GTU rate, errors and stalls can be injected
+*	VERSION:	01.01  16.10.2026
+*	AUTHOR:		Andrey Poroshin
+*	UPDATES :
+*	1) 01.01   16 October 2026 - Initial version
+ ============================================================================== */
+
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/of.h>
+#include <linux/of_dma.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/highmem.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/scatterlist.h>
+
+// Standard module information
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Poroshin Andrey");
+MODULE_DESCRIPTION("dma-sim - synthetic dma engine provider for dma-mod tests");
+
+/******************************************************************************
+*	Internal definitions
+*******************************************************************************/
+// This module name
+#define DRIVER_NAME	"dma-sim"
+
+// Synthetic frame geometry: 48x48 pixels, 128 GTUs per frame (default)
+#define DS_PIX_NUM			(48 * 48)
+#define DS_FRAME_GTUS		128
+
+// Default GTU rate (GTU/s): 2.5 us GTU
+#define DS_GTU_RATE			400000
+
+// Minimum frame period (ns): limits the timer interrupt rate
+#define DS_PERIOD_MIN_NS	10000
+
+// Number of remembered failed transfers (status requests after completion)
+#define DS_ERR_HIST			16
+
+// Synthetic data patterns
+typedef enum DS_PAT_e {
+	DS_PAT_NONE,					// The buffers are not written (timing only)
+	DS_PAT_RAMP,					// Cell = frame number + GTU + pixel index
+	DS_PAT_NOISE					// Cell = random background (0..7 counts)
+} DS_PAT_t;
+
+/******************************************************************************
+*	Internal structures
+*******************************************************************************/
+// DMA-SIM transfer segment (one scatterlist entry)
+typedef struct DS_SEG_s {
+	dma_addr_t addr;				// Segment DMA address
+	uint32_t len;					// Segment length (b)
+} DS_SEG_t;
+
+// DMA-SIM transfer descriptor (one frame)
+typedef struct DS_DESC_s {
+	struct dma_async_tx_descriptor txd;	// Async DMA transaction descriptor
+	struct list_head node;			// Channel list node (pending/active/done)
+	enum dma_transfer_direction dir;	// Transfer direction
+	uint32_t len;					// Transfer length (b)
+	uint64_t frame_no;				// Number of the frame given to the transfer
+	uint8_t err;					// Flag: the transfer fails (injected error) (1)
+	uint32_t seg_num;				// Number of segments
+	DS_SEG_t seg[];					// Segments
+} DS_DESC_t;
+
+// Synthetic cell generator state (filled bytes of one frame)
+typedef struct DS_GEN_s {
+	DS_PAT_t pat;					// Data pattern
+	uint32_t cell_sz;				// Cell size (b)
+	uint32_t byte;					// Byte index in the cell
+	uint32_t pix;					// Pixel index in the GTU
+	uint32_t gtu;					// GTU index in the frame
+	uint32_t val;					// Current cell value
+	uint32_t rnd;					// Random generator state (xorshift32)
+	uint64_t frame_no;				// Frame number
+} DS_GEN_t;
+
+// DMA-SIM channel parameters
+typedef struct DS_CHAN_s {
+	struct dma_chan chan;			// DMA Engine channel
+	struct DS_DEV_s *pds;			// Pointer to the device the channel belongs to
+
+	// Frame timing (DT parameters)
+	uint32_t gtu_rate;				// GTU rate (GTU/s)
+	uint32_t frame_gtus;			// Number of GTUs per frame
+
+	// Transfer lists (submitted -> issued -> finished, waits for callback)
+	spinlock_t lock;				// Lists and counters access lock
+	struct list_head pending;		// Submitted transfers
+	struct list_head active;		// Issued transfers
+	struct list_head done;			// Finished transfers (callback in tasklet)
+
+	// Frame clock
+	struct hrtimer timer;			// Frame timer (the PL frame output)
+	uint8_t running;				// Flag: the frame timer runs (1)
+	struct tasklet_struct tasklet;	// Transfer completion tasklet
+
+	// Failed transfer cookies (DMA_ERROR status after completion)
+	dma_cookie_t err_cookie[DS_ERR_HIST];
+	uint32_t err_idx;				// Next entry of the failed cookie list
+
+	// Statistics
+	uint64_t frame_no;				// Number of frames output by the clock
+	uint64_t frames;				// Number of finished transfers
+	uint64_t errors;				// Number of injected errors
+	uint64_t stalls;				// Number of injected stalls
+	uint64_t lost;					// Number of frames lost (no issued transfers)
+} DS_CHAN_t;
+
+// DMA-SIM device parameters (one DT node - one channel, as AXI DMA S2MM)
+typedef struct DS_DEV_s {
+	struct device *dev;				// Pointer to the platform device structure
+	struct dma_device ddev;			// DMA Engine device
+	DS_CHAN_t ch;					// The channel of the device
+	uint8_t of_registered;			// Flag: the OF DMA controller was registered (1)
+} DS_DEV_t;
+
+/******************************************************************************
+*	Internal functions
+*******************************************************************************/
+// Module init/exit functions
+static int __init moduleInit(void);
+static void __exit moduleExit(void);
+
+// Platform driver functions
+static int dsProbe(struct platform_device *pdev);
+static int dsRemove(struct platform_device *pdev);
+
+// Device initialization functions
+static void dsInitParm(struct platform_device *pdev, DS_DEV_t *pds);
+static void dsInitCh(DS_DEV_t *pds);
+static int dsInitDev(DS_DEV_t *pds);
+static void dsFreeDev(DS_DEV_t *pds);
+
+// DMA Engine provider functions
+static int dsChAlloc(struct dma_chan *chan);
+static void dsChFree(struct dma_chan *chan);
+static struct dma_async_tx_descriptor *dsChPrepSg(struct dma_chan *chan,
+	struct scatterlist *sgl, unsigned int sg_len,
+	enum dma_transfer_direction dir, unsigned long flags, void *context);
+static dma_cookie_t dsChSubmit(struct dma_async_tx_descriptor *txd);
+static void dsChIssue(struct dma_chan *chan);
+static enum dma_status dsChStatus(struct dma_chan *chan, dma_cookie_t cookie,
+	struct dma_tx_state *txstate);
+static int dsChConfig(struct dma_chan *chan, struct dma_slave_config *cfg);
+static int dsChTerminate(struct dma_chan *chan);
+static void dsChSync(struct dma_chan *chan);
+
+// Frame clock and completion functions
+static ktime_t dsChPeriod(DS_CHAN_t *pchan);
+static enum hrtimer_restart dsChTimer(struct hrtimer *timer);
+static void dsChTasklet(unsigned long data);
+static void dsChDone(DS_CHAN_t *pchan, DS_DESC_t *pdesc);
+static uint32_t dsChDescLen(DS_CHAN_t *pchan, dma_cookie_t cookie);
+static int dsChErrFind(DS_CHAN_t *pchan, dma_cookie_t cookie);
+
+// Synthetic data functions
+static void dsChFill(DS_CHAN_t *pchan, DS_DESC_t *pdesc);
+static void dsGenFill(DS_GEN_t *pgen, uint8_t *p, uint32_t len);
+static uint32_t dsGenRun(DS_GEN_t *pgen, uint8_t *p, uint32_t len);
+static uint32_t dsGenCell(DS_GEN_t *pgen);
+
+/******************************************************************************
+*	Internal data
+*******************************************************************************/
+// List of platform driver compatible devices
+static struct of_device_id plat_of_match[] = {
+	{ .compatible = "por,dma-sim", },
+	{ /* end of list */ },
+};
+MODULE_DEVICE_TABLE(of, plat_of_match);		// Make the list global for the kernel
+
+// DMA-SIM platform driver structure
+static struct platform_driver plat_drv = {
+	.driver = {
+		.name = DRIVER_NAME,
+		.owner = THIS_MODULE,
+		.of_match_table	= plat_of_match,
+	},
+	.probe  = dsProbe,
+	.remove = dsRemove,
+};
+
+// Synthetic data pattern (module parameter, can be changed at run time)
+static uint pattern = DS_PAT_RAMP;
+module_param(pattern, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(pattern, "Data pattern: 0 - none, 1 - ramp (default), 2 - noise");
+
+// GTU rate of all channels (module parameter, 0 - DT "por,gtu-rate")
+static uint gtu_rate = 0;
+module_param(gtu_rate, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(gtu_rate, "GTU rate (GTU/s) of all channels, 0 - DT value (default)");
+
+// Error injection: every N-th transfer fails (module parameter, 0 - off)
+static uint err_every = 0;
+module_param(err_every, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(err_every, "Fail every N-th transfer, 0 - no errors (default)");
+
+// Stall injection: the frame clock stops for stall_ms after every N-th frame
+static uint stall_every = 0;
+module_param(stall_every, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(stall_every, "Stall after every N-th frame, 0 - no stalls (default)");
+
+static uint stall_ms = 100;
+module_param(stall_ms, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(stall_ms, "Stall duration (ms), 100 by default");
+
+// Ramp table: two periods of byte values 0..255 (the ramp of 1-byte cells
+// is copied from it)
+static uint8_t ds_ramp[2 * 256];
+
+/******************************************************************************
+*	Module functions
+*******************************************************************************/
+/******************************** moduleInit() ********************************
+* Module initialization function
+* Registers the platform driver, the DMA-SIM devices are probed from DT
+* Return value:
+*	0  - Success. The platform driver was registered
+*	<0 - Error code
+*******************************************************************************/
+static int __init moduleInit(void)
+{
+	uint32_t i;
+
+	printk(KERN_INFO "Poroshin: init %s \n", DRIVER_NAME);
+
+	// Fill the ramp table
+	for(i = 0; i < sizeof(ds_ramp); i++)
+		ds_ramp[i] = (uint8_t)i;
+
+	// Register platform driver for DMA-SIM devices
+	return platform_driver_register(&plat_drv);
+}
+
+/******************************** moduleExit() ********************************
+* Module exit function
+* It is called when the module is removed from kernel.
+*******************************************************************************/
+static void __exit moduleExit(void)
+{
+	// Unregister platform driver (all DMA-SIM devices are removed)
+	platform_driver_unregister(&plat_drv);
+
+	printk(KERN_INFO "Poroshin: exit %s \n", DRIVER_NAME);
+}
+
+/******************************* dsProbe(pdev) ********************************
+* DMA-SIM device probe function.
+* The function is called when compatible with this driver platform device
+*	(DMA-SIM) was found
+* Each DMA-SIM device provides one slave channel to the DMA Engine and
+*	registers itself as the OF DMA controller of its DT node (the node
+*	replaces the AXI DMA node, the "dmas" phandles of dma-mod are unchanged)
+* Parameter:
+*	(i)pdev - structure of the detected platform device
+* Return value:
+*	0  - Success. The channel was registered in DMA Engine
+*	<0 - Error code
+*******************************************************************************/
+static int dsProbe(struct platform_device *pdev)
+{
+	DS_DEV_t *pds;
+	int rc;
+
+	// Allocate DMA-SIM device parameters (freed with the device)
+	pds = devm_kzalloc(&pdev->dev, sizeof(DS_DEV_t), GFP_KERNEL);
+	if(pds == NULL) return -ENOMEM;
+
+	// The buffers of dma-mod are addressed directly (no IOMMU)
+	rc = dma_set_mask_and_coherent(&pdev->dev, DMA_BIT_MASK(32));
+	if(rc != 0) return rc;
+
+	// Init device parameters (frame timing is read from DT)
+	dsInitParm(pdev, pds);
+
+	// Store device parameters in the device (for remove function)
+	platform_set_drvdata(pdev, pds);
+
+	// Init the channel
+	dsInitCh(pds);
+
+	// Register the channel in DMA Engine
+	rc = dsInitDev(pds);
+	if(rc != 0) {
+		// Free the registered resources
+		dsFreeDev(pds);
+		return rc;
+	}
+
+	dev_info(pds -> dev, "%u GTU/s, %u GTU frames \n", pds -> ch.gtu_rate,
+		pds -> ch.frame_gtus);
+
+	// Success. The channel was registered
+	return 0;
+}
+
+/******************************* dsRemove(pdev) *******************************
+* DMA-SIM device remove function
+* The function is called when compatible platform device (DMA-SIM)
+*	was removed (or the driver module was removed from kernel)
+* Parameter:
+*	(i)pdev - structure of the platform device to remove
+* Return value:
+*	0  - The device was removed successfully
+*******************************************************************************/
+static int dsRemove(struct platform_device *pdev)
+{
+	DS_DEV_t *pds;
+
+	// Get DMA-SIM device parameters
+	pds = platform_get_drvdata(pdev);
+
+	// Unregister the channel, stop the frame clock
+	dsFreeDev(pds);
+
+	// The device was removed successfully
+	return 0;
+}
+
+/**************************** dsInitParm(pdev,pds) ****************************
+* DMA-SIM initialization: init device parameters
+* The frame timing is read from the DT node of the device:
+*	"por,gtu-rate" - GTU rate (GTU/s), 400000 by default
+*	"por,frame-gtus" - number of GTUs per frame (transfer), 128 by default
+* Parameters:
+*	(i)pdev - structure of the platform device - DMA-SIM
+*	(o)pds - DMA-SIM device parameters
+*******************************************************************************/
+static void dsInitParm(struct platform_device *pdev, DS_DEV_t *pds)
+{
+	struct device_node *np;
+	DS_CHAN_t *pchan;
+
+	// Set device structure pointer in DMA-SIM parameters
+	pds -> dev = &pdev->dev;
+	np = pds -> dev -> of_node;
+	pchan = &(pds -> ch);
+
+	// Read the GTU rate (the default is used if not set in DT)
+	if(of_property_read_u32(np, "por,gtu-rate", &(pchan -> gtu_rate)) != 0 ||
+		pchan -> gtu_rate == 0)
+		pchan -> gtu_rate = DS_GTU_RATE;
+
+	// Read the number of GTUs per frame (the default is used if not set in DT)
+	if(of_property_read_u32(np, "por,frame-gtus", &(pchan -> frame_gtus)) != 0 ||
+		pchan -> frame_gtus == 0)
+		pchan -> frame_gtus = DS_FRAME_GTUS;
+}
+
+/******************************** dsInitCh(pds) *******************************
+* DMA-SIM initialization: init the channel
+* Inits transfer lists, frame clock timer and completion tasklet
+* Parameter:
+*	(io)pds - DMA-SIM device parameters
+*******************************************************************************/
+static void dsInitCh(DS_DEV_t *pds)
+{
+	DS_CHAN_t *pchan;
+
+	// Set the pointer to the channel parameters
+	pchan = &(pds -> ch);
+	pchan -> pds = pds;
+
+	// Init transfer lists
+	spin_lock_init(&(pchan -> lock));
+	INIT_LIST_HEAD(&(pchan -> pending));
+	INIT_LIST_HEAD(&(pchan -> active));
+	INIT_LIST_HEAD(&(pchan -> done));
+
+	// Init frame clock timer (started when the transfers are issued)
+	hrtimer_init(&(pchan -> timer), CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	pchan -> timer.function = dsChTimer;
+	pchan -> running = 0;
+
+	// Init completion tasklet (the callbacks are called in softirq context)
+	tasklet_init(&(pchan -> tasklet), dsChTasklet, (unsigned long)pchan);
+}
+
+/******************************* dsInitDev(pds) *******************************
+* DMA-SIM initialization: register the channel in DMA Engine
+* The device provides slave transfers in both directions: receive (the
+*	synthetic frames are written into the buffers) and transmit (the
+*	buffers are consumed at the frame rate)
+* Parameter:
+*	(io)pds - DMA-SIM device parameters
+* Return value:
+*	0  - Success. The device was registered
+*	<0 - Error code
+*******************************************************************************/
+static int dsInitDev(DS_DEV_t *pds)
+{
+	struct dma_device *ddev;
+	DS_CHAN_t *pchan;
+	int rc;
+
+	// Set the pointers to DMA Engine device and the channel
+	ddev = &(pds -> ddev);
+	pchan = &(pds -> ch);
+
+	// Slave transfers only, the channel is requested by name (private)
+	dma_cap_zero(ddev -> cap_mask);
+	dma_cap_set(DMA_SLAVE, ddev -> cap_mask);
+	dma_cap_set(DMA_PRIVATE, ddev -> cap_mask);
+	ddev -> dev = pds -> dev;
+	ddev -> directions = BIT(DMA_DEV_TO_MEM) | BIT(DMA_MEM_TO_DEV);
+	ddev -> src_addr_widths = BIT(DMA_SLAVE_BUSWIDTH_8_BYTES);
+	ddev -> dst_addr_widths = BIT(DMA_SLAVE_BUSWIDTH_8_BYTES);
+	ddev -> residue_granularity = DMA_RESIDUE_GRANULARITY_DESCRIPTOR;
+
+	// Provider functions
+	ddev -> device_alloc_chan_resources = dsChAlloc;
+	ddev -> device_free_chan_resources = dsChFree;
+	ddev -> device_prep_slave_sg = dsChPrepSg;
+	ddev -> device_issue_pending = dsChIssue;
+	ddev -> device_tx_status = dsChStatus;
+	ddev -> device_config = dsChConfig;
+	ddev -> device_terminate_all = dsChTerminate;
+	ddev -> device_synchronize = dsChSync;
+
+	// Add the channel to the device
+	INIT_LIST_HEAD(&(ddev -> channels));
+	pchan -> chan.device = ddev;
+	list_add_tail(&(pchan -> chan.device_node), &(ddev -> channels));
+
+	// Register the device in DMA Engine
+	rc = dma_async_device_register(ddev);
+	if(rc != 0) return rc;
+
+	// Register OF DMA controller: "dmas = <&node 0>" gives the channel
+	rc = of_dma_controller_register(pds -> dev -> of_node,
+		of_dma_xlate_by_chan_id, ddev);
+	if(rc != 0) {
+		dma_async_device_unregister(ddev);
+		return rc;
+	}
+	pds -> of_registered = 1;
+
+	// The device was registered successfully
+	return 0;
+}
+
+/******************************* dsFreeDev(pds) *******************************
+* Free DMA-SIM device resources
+* Unregisters OF DMA controller and DMA Engine device, stops the frame clock
+* Parameter:
+*	(io)pds - DMA-SIM device parameters
+*******************************************************************************/
+static void dsFreeDev(DS_DEV_t *pds)
+{
+	// Unregister the device if it was registered
+	if(pds -> of_registered) {
+		of_dma_controller_free(pds -> dev -> of_node);
+		dma_async_device_unregister(&(pds -> ddev));
+		pds -> of_registered = 0;
+	}
+
+	// Stop the frame clock and the completions (the channel is not used)
+	hrtimer_cancel(&(pds -> ch.timer));
+	tasklet_kill(&(pds -> ch.tasklet));
+}
+
+/****************************** dsChAlloc(chan) *******************************
+* DMA Engine provider: allocate channel resources
+* The function is called when the channel is requested by a client
+* The descriptors are allocated per transfer, the cookies and statistics
+*	are reset
+* Parameter:
+*	(i)chan - DMA Engine channel
+* Return value:
+*	0 - Success. The channel is ready
+*******************************************************************************/
+static int dsChAlloc(struct dma_chan *chan)
+{
+	DS_CHAN_t *pchan;
+	unsigned long flags;
+
+	// Get the channel parameters
+	pchan = container_of(chan, DS_CHAN_t, chan);
+
+	// Reset the cookies and the statistics
+	spin_lock_irqsave(&(pchan -> lock), flags);
+	chan -> cookie = DMA_MIN_COOKIE;
+	chan -> completed_cookie = DMA_MIN_COOKIE;
+	memset(pchan -> err_cookie, 0, sizeof(pchan -> err_cookie));
+	pchan -> err_idx = 0;
+	pchan -> frame_no = 0;
+	pchan -> frames = 0;
+	pchan -> errors = 0;
+	pchan -> stalls = 0;
+	pchan -> lost = 0;
+	spin_unlock_irqrestore(&(pchan -> lock), flags);
+
+	// The channel is ready
+	return 0;
+}
+
+/******************************* dsChFree(chan) *******************************
+* DMA Engine provider: free channel resources
+* The function is called when the channel is released by the client
+* Stops the frame clock, frees all transfers, prints the channel statistics
+* Parameter:
+*	(i)chan - DMA Engine channel
+*******************************************************************************/
+static void dsChFree(struct dma_chan *chan)
+{
+	DS_CHAN_t *pchan;
+
+	// Get the channel parameters
+	pchan = container_of(chan, DS_CHAN_t, chan);
+
+	// Stop the channel, wait for the running callbacks
+	dsChTerminate(chan);
+	dsChSync(chan);
+
+	dev_info(pchan -> pds -> dev,
+		"frames %llu, transfers %llu, errors %llu, stalls %llu, lost %llu \n",
+		pchan -> frame_no, pchan -> frames, pchan -> errors, pchan -> stalls,
+		pchan -> lost);
+}
+
+/*************** dsChPrepSg(chan,sgl,sg_len,dir,flags,context) ****************
+* DMA Engine provider: prepare slave scatter-gather transfer
+* One transfer gets one synthetic frame. The scatterlist is copied into the
+*	descriptor (the client may reuse it after submit)
+* Parameters:
+*	(i)chan - DMA Engine channel
+*	(i)sgl - transfer scatterlist (DMA mapped)
+*	(i)sg_len - number of scatterlist entries
+*	(i)dir - transfer direction
+*	(i)flags - transfer flags
+*	(i)context - transfer context (not used)
+* Return value:
+*	Pointer to the transfer descriptor or NULL (bad direction, no memory)
+*******************************************************************************/
+static struct dma_async_tx_descriptor *dsChPrepSg(struct dma_chan *chan,
+	struct scatterlist *sgl, unsigned int sg_len,
+	enum dma_transfer_direction dir, unsigned long flags, void *context)
+{
+	DS_DESC_t *pdesc;
+	struct scatterlist *sg;
+	unsigned int i;
+
+	// Slave transfers only
+	if(sg_len == 0 || (dir != DMA_DEV_TO_MEM && dir != DMA_MEM_TO_DEV))
+		return NULL;
+
+	// Allocate the descriptor (the function can be called in atomic context)
+	pdesc = kzalloc(sizeof(DS_DESC_t) + sg_len * sizeof(DS_SEG_t), GFP_NOWAIT);
+	if(pdesc == NULL) return NULL;
+
+	// Copy the segments, count the transfer length
+	for_each_sg(sgl, sg, sg_len, i) {
+		pdesc -> seg[i].addr = sg_dma_address(sg);
+		pdesc -> seg[i].len = sg_dma_len(sg);
+		pdesc -> len += sg_dma_len(sg);
+	}
+	pdesc -> seg_num = sg_len;
+	pdesc -> dir = dir;
+
+	// Init async transaction descriptor
+	dma_async_tx_descriptor_init(&(pdesc -> txd), chan);
+	pdesc -> txd.tx_submit = dsChSubmit;
+	pdesc -> txd.flags = flags;
+	INIT_LIST_HEAD(&(pdesc -> node));
+
+	// The transfer was prepared
+	return &(pdesc -> txd);
+}
+
+/****************************** dsChSubmit(txd) *******************************
+* DMA Engine provider: submit the transfer
+* The transfer gets the next cookie and waits for issue (pending list)
+* Parameter:
+*	(i)txd - async transaction descriptor
+* Return value:
+*	Transfer cookie
+*******************************************************************************/
+static dma_cookie_t dsChSubmit(struct dma_async_tx_descriptor *txd)
+{
+	DS_CHAN_t *pchan;
+	DS_DESC_t *pdesc;
+	dma_cookie_t cookie;
+	unsigned long flags;
+
+	// Get the channel and the transfer descriptor
+	pchan = container_of(txd -> chan, DS_CHAN_t, chan);
+	pdesc = container_of(txd, DS_DESC_t, txd);
+
+	spin_lock_irqsave(&(pchan -> lock), flags);
+
+	// Assign the next cookie (the positive cookies wrap around)
+	cookie = pchan -> chan.cookie + 1;
+	if(cookie < DMA_MIN_COOKIE) cookie = DMA_MIN_COOKIE;
+	pchan -> chan.cookie = cookie;
+	txd -> cookie = cookie;
+
+	// The transfer waits for issue
+	list_add_tail(&(pdesc -> node), &(pchan -> pending));
+
+	spin_unlock_irqrestore(&(pchan -> lock), flags);
+
+	return cookie;
+}
+
+/******************************* dsChIssue(chan) ******************************
+* DMA Engine provider: issue pending transfers
+* The submitted transfers are given to the frame clock. The clock is started
+*	by the first issue and runs until the channel is terminated: the frames
+*	output while no transfer is issued are lost (as the PL frames are)
+* Parameter:
+*	(i)chan - DMA Engine channel
+*******************************************************************************/
+static void dsChIssue(struct dma_chan *chan)
+{
+	DS_CHAN_t *pchan;
+	unsigned long flags;
+	uint8_t start;
+
+	// Get the channel parameters
+	pchan = container_of(chan, DS_CHAN_t, chan);
+
+	spin_lock_irqsave(&(pchan -> lock), flags);
+
+	// Issue the pending transfers
+	list_splice_tail_init(&(pchan -> pending), &(pchan -> active));
+
+	// Start the frame clock if it is stopped
+	start = !(pchan -> running);
+	pchan -> running = 1;
+
+	spin_unlock_irqrestore(&(pchan -> lock), flags);
+
+	// The first frame is output after one frame period
+	if(start)
+		hrtimer_start(&(pchan -> timer), dsChPeriod(pchan), HRTIMER_MODE_REL);
+}
+
+/********************** dsChStatus(chan,cookie,txstate) ***********************
+* DMA Engine provider: get the transfer status
+* The finished transfer has DMA_ERROR status if the error was injected
+*	(the last failed transfers are remembered). The unfinished transfer has
+*	the whole length as residue (the frames are written at once)
+* Parameters:
+*	(i)chan - DMA Engine channel
+*	(i)cookie - transfer cookie
+*	(o)txstate - transfer state (can be NULL)
+* Return value:
+*	Transfer status: DMA_COMPLETE, DMA_ERROR or DMA_IN_PROGRESS
+*******************************************************************************/
+static enum dma_status dsChStatus(struct dma_chan *chan, dma_cookie_t cookie,
+	struct dma_tx_state *txstate)
+{
+	DS_CHAN_t *pchan;
+	enum dma_status status;
+	dma_cookie_t last, used;
+	uint32_t residue;
+	unsigned long flags;
+
+	// Get the channel parameters
+	pchan = container_of(chan, DS_CHAN_t, chan);
+
+	spin_lock_irqsave(&(pchan -> lock), flags);
+
+	// Get the cookie status
+	last = chan -> completed_cookie;
+	used = chan -> cookie;
+	status = dma_async_is_complete(cookie, last, used);
+
+	// The failed transfer (injected error)
+	if(status == DMA_COMPLETE && dsChErrFind(pchan, cookie))
+		status = DMA_ERROR;
+
+	// The unfinished transfer was not written
+	residue = (status == DMA_IN_PROGRESS) ? dsChDescLen(pchan, cookie) : 0;
+
+	spin_unlock_irqrestore(&(pchan -> lock), flags);
+
+	// Fill the transfer state
+	dma_set_tx_state(txstate, last, used, residue);
+
+	return status;
+}
+
+/*************************** dsChConfig(chan,cfg) *****************************
+* DMA Engine provider: slave channel configuration
+* The synthetic channel has no device side parameters, any configuration
+*	is accepted
+* Parameters:
+*	(i)chan - DMA Engine channel
+*	(i)cfg - slave configuration
+* Return value:
+*	0 - The configuration was accepted
+*******************************************************************************/
+static int dsChConfig(struct dma_chan *chan, struct dma_slave_config *cfg)
+{
+	return 0;
+}
+
+/**************************** dsChTerminate(chan) *****************************
+* DMA Engine provider: terminate all transfers
+* Stops the frame clock, frees all submitted and unfinished transfers (their
+*	callbacks are not called). The callbacks of the transfers finished
+*	before can still be running (see dsChSync)
+* Parameter:
+*	(i)chan - DMA Engine channel
+* Return value:
+*	0 - The transfers were terminated
+*******************************************************************************/
+static int dsChTerminate(struct dma_chan *chan)
+{
+	DS_CHAN_t *pchan;
+	DS_DESC_t *pdesc, *ptmp;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	// Get the channel parameters
+	pchan = container_of(chan, DS_CHAN_t, chan);
+
+	// Stop the frame clock (the running clock function is waited for)
+	spin_lock_irqsave(&(pchan -> lock), flags);
+	pchan -> running = 0;
+	spin_unlock_irqrestore(&(pchan -> lock), flags);
+	hrtimer_cancel(&(pchan -> timer));
+
+	// Take all transfers from the channel lists
+	spin_lock_irqsave(&(pchan -> lock), flags);
+	list_splice_tail_init(&(pchan -> pending), &list);
+	list_splice_tail_init(&(pchan -> active), &list);
+	list_splice_tail_init(&(pchan -> done), &list);
+	spin_unlock_irqrestore(&(pchan -> lock), flags);
+
+	// Free the transfers
+	list_for_each_entry_safe(pdesc, ptmp, &list, node) {
+		list_del(&(pdesc -> node));
+		kfree(pdesc);
+	}
+
+	// The transfers were terminated
+	return 0;
+}
+
+/******************************* dsChSync(chan) *******************************
+* DMA Engine provider: synchronize the termination
+* Waits until the running completion callbacks are finished
+* Parameter:
+*	(i)chan - DMA Engine channel
+*******************************************************************************/
+static void dsChSync(struct dma_chan *chan)
+{
+	DS_CHAN_t *pchan;
+
+	// Get the channel parameters
+	pchan = container_of(chan, DS_CHAN_t, chan);
+
+	// Wait for the completion tasklet
+	tasklet_kill(&(pchan -> tasklet));
+}
+
+/****************************** dsChPeriod(pchan) *****************************
+* Get the frame period of the channel
+* The period is the frame length (GTUs) divided by the GTU rate: DT rate or
+*	"gtu_rate" module parameter (if set). The period is not shorter than
+*	DS_PERIOD_MIN_NS
+* Used variable:
+*	(i)gtu_rate - GTU rate of all channels (module parameter)
+* Parameter:
+*	(i)pchan - DMA-SIM channel parameters
+* Return value:
+*	Frame period
+*******************************************************************************/
+static ktime_t dsChPeriod(DS_CHAN_t *pchan)
+{
+	uint32_t rate;
+	uint64_t ns;
+
+	// The module parameter overrides the DT rate
+	rate = READ_ONCE(gtu_rate);
+	if(rate == 0) rate = pchan -> gtu_rate;
+
+	// Frame period (ns)
+	ns = div_u64((uint64_t)(pchan -> frame_gtus) * NSEC_PER_SEC, rate);
+	if(ns < DS_PERIOD_MIN_NS) ns = DS_PERIOD_MIN_NS;
+
+	return ns_to_ktime(ns);
+}
+
+/***************************** dsChTimer(timer) *******************************
+* Frame clock function (hrtimer, hard interrupt context)
+* Each call outputs one frame: the oldest issued transfer is finished by the
+*	completion tasklet (the data is written there), the frame is lost if
+*	no transfer is issued. Every "err_every" transfer fails, the clock is
+*	stopped for "stall_ms" after every "stall_every" frame
+* Used variables:
+*	(i)err_every, stall_every, stall_ms - injection module parameters
+* Parameter:
+*	(i)timer - frame clock timer of the channel
+* Return value:
+*	HRTIMER_RESTART while the channel runs, HRTIMER_NORESTART if terminated
+*******************************************************************************/
+static enum hrtimer_restart dsChTimer(struct hrtimer *timer)
+{
+	DS_CHAN_t *pchan;
+	DS_DESC_t *pdesc;
+	ktime_t period;
+	uint32_t every;
+	uint8_t running;
+
+	// Get the channel parameters
+	pchan = container_of(timer, DS_CHAN_t, timer);
+
+	// Next frame period
+	period = dsChPeriod(pchan);
+
+	spin_lock(&(pchan -> lock));
+
+	// One more frame was output
+	pchan -> frame_no++;
+
+	// Give the frame to the oldest issued transfer (or lose it)
+	pdesc = list_first_entry_or_null(&(pchan -> active), DS_DESC_t, node);
+	if(pdesc != NULL) {
+		pdesc -> frame_no = pchan -> frame_no;
+		pchan -> frames++;
+
+		// Inject the transfer error
+		every = READ_ONCE(err_every);
+		if(every != 0 && (pchan -> frames % every) == 0) {
+			pdesc -> err = 1;
+			pchan -> errors++;
+		}
+
+		// The transfer is finished by the completion tasklet
+		list_move_tail(&(pdesc -> node), &(pchan -> done));
+		tasklet_schedule(&(pchan -> tasklet));
+	} else
+		pchan -> lost++;
+
+	// Inject the stall (no frames are output)
+	every = READ_ONCE(stall_every);
+	if(every != 0 && (pchan -> frame_no % every) == 0) {
+		period = ktime_add(period, ms_to_ktime(READ_ONCE(stall_ms)));
+		pchan -> stalls++;
+	}
+
+	// The clock runs until the channel is terminated
+	running = pchan -> running;
+
+	spin_unlock(&(pchan -> lock));
+
+	// Stop the clock or wait for the next frame
+	if(!running) return HRTIMER_NORESTART;
+	hrtimer_forward_now(timer, period);
+	return HRTIMER_RESTART;
+}
+
+/***************************** dsChTasklet(data) ******************************
+* Completion tasklet
+* Finishes the transfers given the frames by the clock (in order): writes
+*	the synthetic data (receive transfers), completes the cookie and calls
+*	the client callback
+* Parameter:
+*	(i)data - DMA-SIM channel parameters
+*******************************************************************************/
+static void dsChTasklet(unsigned long data)
+{
+	DS_CHAN_t *pchan;
+	DS_DESC_t *pdesc, *ptmp;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	// Get the channel parameters
+	pchan = (DS_CHAN_t *)data;
+
+	// Take the finished transfers
+	spin_lock_irqsave(&(pchan -> lock), flags);
+	list_splice_tail_init(&(pchan -> done), &list);
+	spin_unlock_irqrestore(&(pchan -> lock), flags);
+
+	// Finish the transfers
+	list_for_each_entry_safe(pdesc, ptmp, &list, node) {
+		list_del(&(pdesc -> node));
+		dsChDone(pchan, pdesc);
+		kfree(pdesc);
+	}
+}
+
+/************************** dsChDone(pchan,pdesc) *****************************
+* Finish the transfer
+* The receive transfer gets the synthetic frame (the failed one gets no
+*	data). The cookie is completed before the callback is called (the client
+*	reads the status in the callback)
+* Parameters:
+*	(io)pchan - DMA-SIM channel parameters
+*	(i)pdesc - the finished transfer
+*******************************************************************************/
+static void dsChDone(DS_CHAN_t *pchan, DS_DESC_t *pdesc)
+{
+	struct dma_async_tx_descriptor *txd;
+	struct dmaengine_result res;
+	unsigned long flags;
+
+	// Set the pointer to the async transaction descriptor
+	txd = &(pdesc -> txd);
+
+	// Write the synthetic frame
+	if(!(pdesc -> err) && pdesc -> dir == DMA_DEV_TO_MEM)
+		dsChFill(pchan, pdesc);
+
+	// Complete the cookie, remember the failed transfer
+	spin_lock_irqsave(&(pchan -> lock), flags);
+	pchan -> chan.completed_cookie = txd -> cookie;
+	if(pdesc -> err) {
+		pchan -> err_cookie[pchan -> err_idx] = txd -> cookie;
+		pchan -> err_idx = (pchan -> err_idx + 1) % DS_ERR_HIST;
+	}
+	spin_unlock_irqrestore(&(pchan -> lock), flags);
+
+	// Call the client callback (result or plain one)
+	if(txd -> callback_result != NULL) {
+		res.result = pdesc -> err ? ((pdesc -> dir == DMA_DEV_TO_MEM) ?
+			DMA_TRANS_WRITE_FAILED : DMA_TRANS_READ_FAILED) : DMA_TRANS_NOERROR;
+		res.residue = pdesc -> err ? pdesc -> len : 0;
+		txd -> callback_result(txd -> callback_param, &res);
+	} else if(txd -> callback != NULL)
+		txd -> callback(txd -> callback_param);
+}
+
+/************************* dsChDescLen(pchan,cookie) **************************
+* Get the length of the unfinished transfer
+* The function is called with the channel lock held
+* Parameters:
+*	(i)pchan - DMA-SIM channel parameters
+*	(i)cookie - transfer cookie
+* Return value:
+*	Transfer length (b), 0 if the transfer is not in the channel lists
+*******************************************************************************/
+static uint32_t dsChDescLen(DS_CHAN_t *pchan, dma_cookie_t cookie)
+{
+	DS_DESC_t *pdesc;
+
+	// Issued transfers
+	list_for_each_entry(pdesc, &(pchan -> active), node)
+		if(pdesc -> txd.cookie == cookie) return pdesc -> len;
+
+	// Submitted transfers
+	list_for_each_entry(pdesc, &(pchan -> pending), node)
+		if(pdesc -> txd.cookie == cookie) return pdesc -> len;
+
+	// Finished transfers (the callback is not called yet)
+	list_for_each_entry(pdesc, &(pchan -> done), node)
+		if(pdesc -> txd.cookie == cookie) return pdesc -> len;
+
+	// The transfer is not found
+	return 0;
+}
+
+/************************* dsChErrFind(pchan,cookie) **************************
+* Check if the finished transfer failed (injected error)
+* The function is called with the channel lock held
+* Parameters:
+*	(i)pchan - DMA-SIM channel parameters
+*	(i)cookie - transfer cookie
+* Return value:
+*	1 - The transfer failed
+*	0 - The transfer succeeded (or it is too old to be remembered)
+*******************************************************************************/
+static int dsChErrFind(DS_CHAN_t *pchan, dma_cookie_t cookie)
+{
+	uint32_t i;
+
+	// Search the failed cookie list
+	for(i = 0; i < DS_ERR_HIST; i++)
+		if(pchan -> err_cookie[i] == cookie) return 1;
+
+	// The transfer succeeded
+	return 0;
+}
+
+/************************** dsChFill(pchan,pdesc) *****************************
+* Write the synthetic frame into the receive transfer buffer
+* The frame is GTU-major: GTUs of 48x48 pixel cells, the cell size is the
+*	transfer length divided by the number of frame cells (at least 1 byte).
+*	The buffer pages are mapped by their DMA addresses (no IOMMU: DMA
+*	address is the physical one), the written page is flushed from the
+*	data cache (the client synchronizes its buffer by DMA API with its
+*	own device: coherent and cached buffers of dma-mod)
+* Used variable:
+*	(i)pattern - data pattern (module parameter)
+* Parameters:
+*	(i)pchan - DMA-SIM channel parameters
+*	(i)pdesc - the receive transfer
+*******************************************************************************/
+static void dsChFill(DS_CHAN_t *pchan, DS_DESC_t *pdesc)
+{
+	DS_GEN_t gen;
+	struct page *page;
+	dma_addr_t addr;
+	uint32_t len, off, n, i;
+	uint8_t *va;
+
+	// Timing only: the buffers are not written
+	gen.pat = READ_ONCE(pattern);
+	if(gen.pat == DS_PAT_NONE) return;
+
+	// Init the cell generator
+	gen.cell_sz = pdesc -> len / (DS_PIX_NUM * pchan -> frame_gtus);
+	if(gen.cell_sz == 0) gen.cell_sz = 1;
+	gen.byte = 0;
+	gen.pix = 0;
+	gen.gtu = 0;
+	gen.val = 0;
+	gen.frame_no = pdesc -> frame_no;
+	gen.rnd = (uint32_t)(pdesc -> frame_no) * 2654435761u | 1;
+
+	// Write the segments page by page
+	for(i = 0; i < pdesc -> seg_num; i++) {
+		addr = pdesc -> seg[i].addr;
+		len = pdesc -> seg[i].len;
+		while(len != 0) {
+			// The page is not the system memory
+			if(!pfn_valid(PHYS_PFN(addr))) return;
+
+			// Map the page, write the cells
+			page = pfn_to_page(PHYS_PFN(addr));
+			off = offset_in_page(addr);
+			n = min_t(uint32_t, len, PAGE_SIZE - off);
+			va = kmap_atomic(page);
+			dsGenFill(&gen, va + off, n);
+			kunmap_atomic(va);
+			flush_dcache_page(page);
+
+			// Next page
+			addr += n;
+			len -= n;
+		}
+	}
+}
+
+/************************** dsGenFill(pgen,p,len) *****************************
+* Write the synthetic cells (little endian) into the buffer
+* The generator state is kept between the pages of the frame
+* The whole cells of 1, 2 and 4 bytes are written by runs (the fill runs in
+*	the tasklet: the frame of 294912 cells must not stall softirqs), the
+*	other cells and the cells split by the page boundary byte by byte
+* Parameters:
+*	(io)pgen - cell generator state
+*	(o)p - pointer to the buffer
+*	(i)len - buffer length (b)
+*******************************************************************************/
+static void dsGenFill(DS_GEN_t *pgen, uint8_t *p, uint32_t len)
+{
+	uint8_t *pend;
+	uint32_t n;
+
+	// Write the bytes
+	for(pend = p + len; p < pend; p++) {
+		// Whole cells up to the end of the GTU
+		if(pgen -> byte == 0) {
+			n = dsGenRun(pgen, p, pend - p);
+			p += n;
+			if(p == pend) break;
+		}
+
+		// The next cell
+		if(pgen -> byte == 0) pgen -> val = dsGenCell(pgen);
+
+		// Cell byte
+		*p = (uint8_t)(pgen -> val >> (8 * (pgen -> byte & 3)));
+
+		// Next byte, next pixel, next GTU
+		if(++(pgen -> byte) < pgen -> cell_sz) continue;
+		pgen -> byte = 0;
+		if(++(pgen -> pix) < DS_PIX_NUM) continue;
+		pgen -> pix = 0;
+		pgen -> gtu++;
+	}
+}
+
+
+/*************************** dsGenRun(pgen,p,len) *****************************
+* Write the whole synthetic cells of 1, 2 or 4 bytes (little endian) into
+*	the buffer up to the end of the GTU
+* The ramp of 1-byte cells is copied from the ramp table, the other cells
+*	are written cell by cell
+* Used variable:
+*	(i)ds_ramp - ramp table
+* Parameters:
+*	(io)pgen - cell generator state (the byte index in the cell is 0)
+*	(o)p - pointer to the buffer
+*	(i)len - buffer length (b)
+* Return value:
+*	Number of bytes written (0 - other cell size or no whole cell)
+*******************************************************************************/
+static uint32_t dsGenRun(DS_GEN_t *pgen, uint8_t *p, uint32_t len)
+{
+	uint32_t cells, base, i, n;
+	uint32_t val;
+
+	// Only 1, 2 and 4 byte cells are written by runs
+	if(pgen -> cell_sz != 1 && pgen -> cell_sz != 2 && pgen -> cell_sz != 4)
+		return 0;
+
+	// Number of whole cells up to the end of the GTU
+	cells = min_t(uint32_t, len / pgen -> cell_sz, DS_PIX_NUM - pgen -> pix);
+	if(cells == 0) return 0;
+
+	// Ramp of 1-byte cells: copy the ramp table (256 cells at most per copy)
+	if(pgen -> pat != DS_PAT_NOISE && pgen -> cell_sz == 1) {
+		base = (uint32_t)(pgen -> frame_no) + pgen -> gtu + pgen -> pix;
+		for(i = 0; i < cells; i += n) {
+			n = min_t(uint32_t, cells - i, 256);
+			memcpy(p + i, ds_ramp + ((base + i) & 0xFF), n);
+		}
+		pgen -> pix += cells;
+	}
+	else {
+		// Write the cells one by one
+		for(i = 0; i < cells; i++) {
+			val = dsGenCell(pgen);
+			p[0] = (uint8_t)val;
+			if(pgen -> cell_sz >= 2) p[1] = (uint8_t)(val >> 8);
+			if(pgen -> cell_sz == 4) {
+				p[2] = (uint8_t)(val >> 16);
+				p[3] = (uint8_t)(val >> 24);
+			}
+			p += pgen -> cell_sz;
+			pgen -> pix++;
+		}
+	}
+
+	// Next GTU
+	if(pgen -> pix == DS_PIX_NUM) {
+		pgen -> pix = 0;
+		pgen -> gtu++;
+	}
+
+	// Return the number of bytes written
+	return cells * pgen -> cell_sz;
+}
+
+/****************************** dsGenCell(pgen) *******************************
+* Get the value of the next synthetic cell
+* Parameter:
+*	(io)pgen - cell generator state
+* Return value:
+*	Cell value: frame number + GTU + pixel index (ramp) or random background
+*	counts 0..7 (noise)
+*******************************************************************************/
+static uint32_t dsGenCell(DS_GEN_t *pgen)
+{
+	uint32_t x;
+
+	// Ramp: the lost and reordered frames are seen in the data
+	if(pgen -> pat != DS_PAT_NOISE)
+		return (uint32_t)(pgen -> frame_no) + pgen -> gtu + pgen -> pix;
+
+	// Noise: xorshift32 random background
+	x = pgen -> rnd;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	pgen -> rnd = x;
+	return x >> 29;
+}
+
+/******************************************************************************
+* A module must use the "module_init" "module_exit" macros from linux/init.h,
+* which identify the initialization function at insertion time,
+* the cleanup function for the module removal
+*******************************************************************************/
+module_init(moduleInit);
+module_exit(moduleExit);